@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <cstdint>
+#include <cstdio>
+
+#include <time.h>
+
+
+namespace logport{
+
+
+    /**
+     * Wall and CPU time of a benchmark run (CPU is the whole process: every thread, user and system).
+     *
+     *   BenchmarkTimer timer;
+     *   ...
+     *   timer.stop();
+     *   timer.report( "line_splitter 100B", bytes, lines );
+     */
+    class BenchmarkTimer{
+
+        public:
+            BenchmarkTimer(){
+                this->start();
+            }
+
+            void start(){
+                this->wall_start = now_ns( CLOCK_MONOTONIC );
+                this->cpu_start = now_ns( CLOCK_PROCESS_CPUTIME_ID );
+                this->wall_ns = this->cpu_ns = 0;
+            }
+
+            void stop(){
+                this->wall_ns = now_ns( CLOCK_MONOTONIC ) - this->wall_start;
+                this->cpu_ns = now_ns( CLOCK_PROCESS_CPUTIME_ID ) - this->cpu_start;
+            }
+
+            int64_t getWallNs() const{ return this->wall_ns; }
+            int64_t getCpuNs() const{ return this->cpu_ns; }
+
+            //one line: throughput, CPU per GB and CPU per item (eg. lines or messages)
+            void report( const string& name, uint64_t bytes, uint64_t items, const string& extra = "" ) const{
+
+                const double wall_seconds = double( this->wall_ns ) / 1e9;
+                const double cpu_seconds = double( this->cpu_ns ) / 1e9;
+                const double gigabytes = double( bytes ) / ( 1024.0 * 1024.0 * 1024.0 );
+
+                printf( "%-40s %10.1f MB/s  %8.3f cpu-s/GB  %8.1f cpu-ns/item  %s\n",
+                    name.c_str(),
+                    wall_seconds > 0 ? double(bytes) / (1024.0 * 1024.0) / wall_seconds : 0.0,
+                    gigabytes > 0 ? cpu_seconds / gigabytes : 0.0,
+                    items > 0 ? double(this->cpu_ns) / double(items) : 0.0,
+                    extra.c_str()
+                );
+
+            }
+
+        protected:
+            static int64_t now_ns( clockid_t clock ){
+                struct timespec now;
+                clock_gettime( clock, &now );
+                return int64_t( now.tv_sec ) * 1000000000 + now.tv_nsec;
+            }
+
+            int64_t wall_start;
+            int64_t cpu_start;
+            int64_t wall_ns = 0;
+            int64_t cpu_ns = 0;
+
+    };
+
+
+}
@@ -0,0 +1,158 @@
+/**
+ * Frames batches of encoded log messages into HTTP request bodies, the work HttpProducer::flush() does per batch:
+ *
+ *   json_dump:     parse every message with nlohmann::json (merging the metadata into each record) and dump()
+ *                  the whole batch (before HttpBatchWriter)
+ *   batch_writer:  HttpBatchWriter (appends the messages as they are, splicing in the pre-rendered metadata)
+ *
+ * Messages are logport envelopes (see JsonEnvelopeEncoder): plain text lines, and JSON lines embedded as "log_obj".
+ * Both bodies of the first batch are parsed and compared, so the two are known to send the same thing.
+ *
+ * Usage: build/http_batch_bench [MESSAGES] [BATCH_SIZE] (defaults: 1000000 messages, 1000 per batch)
+ */
+
+#include "HttpBatchWriter.h"
+#include "JsonEnvelopeEncoder.h"
+#include "Benchmark.h"
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <cstdlib>
+
+using namespace logport;
+
+
+//the fields "logport set http.producer.metadata" would add to every record
+#define BENCH_METADATA "{\"env\":\"prod\",\"region\":\"us-east-1\"}"
+
+
+static vector<string> make_messages( size_t count ){
+
+    JsonEnvelopeEncoder encoder( "web-01.example.com", "/var/log/app/app.log", "prd123", "application" );
+
+    vector<string> messages( count );
+    string line;
+
+    for( size_t x = 0; x < count; x++ ){
+
+        //every fourth line is structured
+        if( x % 4 == 3 ){
+            line = "{\"level\":\"info\",\"msg\":\"request served\",\"status\":200,\"path\":\"/api/v1/items/" + std::to_string( x ) + "\",\"duration_ms\":12.5}";
+        }else{
+            line = "2026-10-17 12:00:00.123 INFO  [worker-" + std::to_string( x % 16 ) + "] GET /api/v1/items/" + std::to_string( x ) + " took 12ms \"ok\"";
+        }
+
+        encoder.encode( line, messages[x] );
+
+    }
+
+    return messages;
+
+}
+
+
+
+//the body flush() built before HttpBatchWriter
+static string dump_batch( const vector<string>& messages, size_t begin, size_t end, HttpBatchWriter::Framing framing, const json& metadata ){
+
+    json batch_json = json::object();
+    json messages_json = json::array();
+
+    if( framing == HttpBatchWriter::Framing::RECORDS ){
+        for( size_t x = begin; x < end; x++ ){
+            json record = json::object();
+            json temp_object = json::parse( messages[x] );
+            for( const auto& [key, value] : metadata.items() ){
+                temp_object[key] = value;
+            }
+            record["value"] = temp_object;
+            messages_json.push_back( std::move(record) );
+        }
+        batch_json["records"] = messages_json;
+    }else{
+        for( size_t x = begin; x < end; x++ ){
+            messages_json.push_back( json::parse(messages[x]) );
+        }
+        batch_json["messages"] = messages_json;
+        batch_json["count"] = end - begin;
+    }
+
+    return batch_json.dump();
+
+}
+
+
+
+static string write_batch( const vector<string>& messages, size_t begin, size_t end, HttpBatchWriter& batch_writer ){
+
+    for( size_t x = begin; x < end; x++ ){
+        batch_writer.append( messages[x] );
+    }
+
+    return batch_writer.finish().body;
+
+}
+
+
+
+int main( int argc, char** argv ){
+
+    const size_t message_count = argc > 1 ? size_t( atol(argv[1]) ) : 1000000;
+    const size_t batch_size = argc > 2 ? std::max<size_t>( size_t(atol(argv[2])), 1 ) : 1000;
+
+    const vector<string> messages = make_messages( message_count );
+
+    uint64_t message_bytes = 0;
+    for( const string& message : messages ){
+        message_bytes += message.size();
+    }
+
+    const json metadata = json::parse( BENCH_METADATA );
+    string metadata_fields;
+    for( const auto& [key, value] : metadata.items() ){
+        metadata_fields += "," + json(key).dump() + ":" + value.dump();
+    }
+
+    const HttpBatchWriter::Framing framings[] = { HttpBatchWriter::Framing::MESSAGES, HttpBatchWriter::Framing::RECORDS };
+
+    for( HttpBatchWriter::Framing framing : framings ){
+
+        const string suffix = framing == HttpBatchWriter::Framing::RECORDS ? " records+metadata" : " messages";
+
+        HttpBatchWriter batch_writer( framing, framing == HttpBatchWriter::Framing::RECORDS ? metadata_fields : "" );
+
+        //the same requests either way
+        const size_t first_end = std::min( batch_size, message_count );
+        if( json::parse(dump_batch(messages, 0, first_end, framing, metadata)) != json::parse(write_batch(messages, 0, first_end, batch_writer)) ){
+            fprintf( stderr, "http_batch_bench: the bodies differ\n" );
+            return 1;
+        }
+
+        uint64_t dump_bytes = 0;
+        BenchmarkTimer dump_timer;
+        for( size_t begin = 0; begin < message_count; begin += batch_size ){
+            dump_bytes += dump_batch( messages, begin, std::min(begin + batch_size, message_count), framing, metadata ).size();
+        }
+        dump_timer.stop();
+        dump_timer.report( "json_dump" + suffix, message_bytes, message_count, std::to_string(dump_bytes) + " body bytes" );
+
+        uint64_t writer_bytes = 0;
+        BenchmarkTimer writer_timer;
+        for( size_t begin = 0; begin < message_count; begin += batch_size ){
+            writer_bytes += write_batch( messages, begin, std::min(begin + batch_size, message_count), batch_writer ).size();
+        }
+        writer_timer.stop();
+        writer_timer.report( "batch_writer" + suffix, message_bytes, message_count, std::to_string(writer_bytes) + " body bytes" );
+
+    }
+
+    return 0;
+
+}
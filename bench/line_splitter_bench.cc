@@ -0,0 +1,163 @@
+/**
+ * Splits a buffer of log lines into lines, 64KB read chunk by chunk, the way FileTailer does.
+ *
+ *   copy_loop:      the per-byte scan that copied every line into its own string (before LineSplitter)
+ *   line_splitter:  LineSplitter (SIMD newline scan, spans into the chunk)
+ *
+ * Usage: build/line_splitter_bench [MEGABYTES] (default 512)
+ */
+
+#include "LineSplitter.h"
+#include "Benchmark.h"
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
+
+using namespace logport;
+
+
+#define BENCH_READ_CHUNK_SIZE 64 * 1024
+
+
+//every line is line_length bytes (the last one of them the newline) of printable text
+static string make_lines( size_t total_bytes, size_t line_length ){
+
+    string data;
+    data.reserve( total_bytes );
+
+    uint32_t seed = 12345;
+
+    while( data.size() + line_length <= total_bytes ){
+        for( size_t x = 0; x + 1 < line_length; x++ ){
+            seed = seed * 1103515245 + 12345;
+            data.push_back( char(' ' + (seed >> 16) % 94) );
+        }
+        data.push_back( '\n' );
+    }
+
+    return data;
+
+}
+
+
+
+//the loop FileTailer replaced (see InotifyWatcher before LineSplitter); consumes each line so it isn't optimized away
+static uint64_t split_copy_loop( const string& data, uint64_t& checksum ){
+
+    uint64_t lines = 0;
+    string previous_log_partial;
+
+    for( size_t chunk_offset = 0; chunk_offset < data.size(); chunk_offset += BENCH_READ_CHUNK_SIZE ){
+
+        string log_chunk( data.data() + chunk_offset, std::min<size_t>(BENCH_READ_CHUNK_SIZE, data.size() - chunk_offset) );
+
+        if( previous_log_partial.size() ){
+            log_chunk = previous_log_partial + log_chunk;
+            previous_log_partial.clear();
+        }
+
+        string::iterator current_message_begin_it = log_chunk.begin();
+        string::iterator current_message_end_it = log_chunk.begin();
+
+        while( current_message_end_it != log_chunk.end() ){
+
+            if( *current_message_end_it == '\n' ){
+
+                string sent_message;
+                sent_message.reserve( log_chunk.size() );
+
+                if( current_message_end_it != current_message_begin_it ){
+                    std::copy( current_message_begin_it, current_message_end_it, std::back_inserter(sent_message) );
+                }
+
+                if( sent_message.size() > 0 ){
+                    checksum += sent_message.size() + uint8_t( sent_message[0] );
+                    lines++;
+                }
+
+                current_message_end_it++;
+                current_message_begin_it = current_message_end_it;
+
+            }else{
+
+                current_message_end_it++;
+
+            }
+
+        }
+
+        if( current_message_begin_it != log_chunk.end() ){
+            previous_log_partial.assign( current_message_begin_it, log_chunk.end() );
+        }
+
+    }
+
+    return lines;
+
+}
+
+
+
+static uint64_t split_line_splitter( const string& data, uint64_t& checksum ){
+
+    uint64_t lines = 0;
+    LineSplitter line_splitter;
+    vector<LineSpan> spans;
+
+    for( size_t chunk_offset = 0; chunk_offset < data.size(); chunk_offset += BENCH_READ_CHUNK_SIZE ){
+
+        spans.clear();
+        line_splitter.split( data.data() + chunk_offset, std::min<size_t>(BENCH_READ_CHUNK_SIZE, data.size() - chunk_offset), spans );
+
+        for( const LineSpan& span : spans ){
+            checksum += span.text.size() + uint8_t( span.text[0] );
+        }
+        lines += spans.size();
+
+    }
+
+    return lines;
+
+}
+
+
+
+int main( int argc, char** argv ){
+
+    const size_t megabytes = argc > 1 ? size_t( atol(argv[1]) ) : 512;
+    const size_t line_lengths[] = { 100, 4096 };
+
+    for( size_t line_length : line_lengths ){
+
+        const string data = make_lines( megabytes * 1024 * 1024, line_length );
+        const string suffix = " " + std::to_string( line_length ) + "B lines";
+
+        uint64_t copy_checksum = 0;
+        BenchmarkTimer copy_timer;
+        const uint64_t copy_lines = split_copy_loop( data, copy_checksum );
+        copy_timer.stop();
+        copy_timer.report( "copy_loop" + suffix, data.size(), copy_lines );
+
+        uint64_t splitter_checksum = 0;
+        BenchmarkTimer splitter_timer;
+        const uint64_t splitter_lines = split_line_splitter( data, splitter_checksum );
+        splitter_timer.stop();
+        splitter_timer.report( "line_splitter" + suffix, data.size(), splitter_lines );
+
+        if( copy_lines != splitter_lines || copy_checksum != splitter_checksum ){
+            fprintf( stderr, "line_splitter_bench: results differ (%lu lines vs %lu)\n", (unsigned long)copy_lines, (unsigned long)splitter_lines );
+            return 1;
+        }
+
+    }
+
+    return 0;
+
+}
@@ -12,6 +12,9 @@ using std::string;
 #include <vector>
 using std::vector;
 
+#include <map>
+using std::map;
+
 #include <iostream>
 #include <iomanip>
 
@@ -30,6 +33,13 @@ namespace logport{
 	//gets the absolute path (resolves symlinks too)
 	string get_real_filepath( const string& relative_filepath );
 
+	//eg. "/var/log/syslog" => "/var/log" and "syslog"
+	string get_parent_directory( const string& filepath );
+	string get_file_name( const string& filepath );
+
+	//contains a fnmatch() wildcard ('*', '?' or '[')
+	bool is_glob_pattern( const string& file_name );
+
 	string get_executable_filepath( const string& relative_filepath );
 
 
@@ -56,6 +66,8 @@ namespace logport{
 
 	vector<string> proc_stat_values( pid_t pid );
 
+	double proc_stat_get_cpu_time_seconds( pid_t pid );  //user + system; 0 if it can't be read
+
 
 	// computer identification
 
@@ -75,6 +87,9 @@ namespace logport{
     long int string_to_long( string input );
     unsigned long int string_to_ulong( string input );
 
+    //returns default_value if the setting is missing or not a number
+    int64_t get_setting_int64( const map<string,string>& settings, const string& key, int64_t default_value );
+
 
 }
 
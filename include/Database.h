@@ -10,6 +10,9 @@ using std::vector;
 #include <map>
 using std::map;
 
+#include <memory>
+#include <utility>
+
 #include <sys/types.h>
 
 
@@ -20,13 +23,25 @@ namespace logport{
 	class Watch;
 	class PreparedStatement;
 
+	/*
+		One connection to the logport database (WAL journal, synchronous=NORMAL).
+
+		Open one per process (or per thread) and keep it: statements prepared through getCachedStatement() are
+		kept for the life of the connection. A connection must not be used across fork().
+
+		Lock contention is waited out by sqlite's busy handler (up to DATABASE_BUSY_TIMEOUT_MS).
+	*/
 	class Database{
 
 	    public:
 	    	Database();
 	    	~Database();
 
+	    	Database( const Database& ) = delete;
+	    	Database& operator=( const Database& ) = delete;
+
 	    	void createDatabase();
+	    	void upgradeDatabase();  //adds the columns of newer versions to a database created by an older one
 
 	    	vector<Watch> getWatches();
 	    	Watch getWatchByPid( pid_t pid );
@@ -37,9 +52,26 @@ namespace logport{
 
 	    	void execute( const string& command );
 
+	    	//prepared once per connection; reset and unbound, ready to use (reset it again when done reading)
+	    	PreparedStatement& getCachedStatement( const string& statement_sql );
+
+	    	//offsets are queued (the latest per watch wins) and written together in one transaction by commitOffsets()
+	    	void queueOffset( int64_t watch_id, int64_t file_offset );
+	    	void queueFileOffset( int64_t watch_id, const string& filepath, int64_t file_offset );  //a file found by a pattern watch
+	    	void commitOffsets();  //throws on failure; the offsets stay queued for the next commit
+
+	    	//the offset and fingerprint of each file found by a pattern watch, by watch id and file path
+	    	void loadWatchFile( Watch& watch );  //0 if the file hasn't been seen before
+	    	void saveWatchFile( const Watch& watch );
+	    	void forgetWatchFile( int64_t watch_id, const string& filepath );
+
 	    private:
 	    	sqlite3 *db;
 
+	    	map<string, std::unique_ptr<PreparedStatement>> statement_cache;
+	    	map<int64_t, int64_t> queued_offsets;  //watch id => file offset
+	    	map<std::pair<int64_t, string>, int64_t> queued_file_offsets;  //( watch id, file path ) => file offset
+
 	    friend class PreparedStatement;
 
 	};
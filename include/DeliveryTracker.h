@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <deque>
+#include <mutex>
+#include <memory>
+
+
+namespace logport{
+
+    class DeliveryTracker;
+    class Spool;
+
+
+    /**
+     * Travels with a produced message (eg. as the rdkafka msg_opaque) and is handed back through
+     * DeliveryTracker::acknowledge() once the message has been delivered or durably recorded in the spool (see Spool).
+     */
+    struct DeliveryTicket{
+        DeliveryTracker* tracker;
+        int64_t end_offset;     //file offset just past this message's line; -1 if the message has no file position
+        uint32_t pending;       //acknowledgements still outstanding (a producer may raise this before the message is sent, eg. one per target)
+        int64_t replay_position = -1;  //spool position just past this message's record, if it's being replayed (see Spool::read())
+    };
+
+
+
+    /**
+     * Tracks the highest contiguous byte offset whose messages have all been acknowledged.
+     *
+     * Tickets are issued in file order. Acknowledgements may arrive in any order and from any thread; the
+     * acknowledged offset only advances past a ticket once every ticket before it has been acknowledged too.
+     *
+     * Replayed spool records are tracked alongside the file's lines (in the order they were read) and advance
+     * the acknowledged replay position the same way, so the spool's cursor is only saved past delivered records.
+     *
+     * The tracker must outlive every producer that may still hold its tickets.
+     */
+    class DeliveryTracker{
+
+        public:
+            DeliveryTracker( int64_t acknowledged_offset = 0 );
+
+            DeliveryTicket* track( int64_t end_offset );
+            DeliveryTicket* trackReplay( int64_t replay_position );  //a replayed spool record; has no file position
+
+            static void acknowledge( DeliveryTicket* ticket );  //no-op for nullptr
+
+            //sets how many acknowledgements a ticket needs (eg. one per target); call before the message is handed on
+            static void require( DeliveryTicket* ticket, uint32_t acknowledgements );
+
+            int64_t getAcknowledgedOffset() const;
+            int64_t getAcknowledgedReplayPosition() const;  //-1 until a replayed record has been acknowledged
+            size_t getPendingCount() const;
+
+            //restarts tracking at offset (eg. after seeking); tickets still in flight no longer move the acknowledged offset (but still move the replay position)
+            void reset( int64_t acknowledged_offset );
+
+            //when set, producers record this tracker's failed messages in the spool instead of in their own undelivered log
+            void setSpool( std::shared_ptr<Spool> spool );
+            std::shared_ptr<Spool> getSpool() const;
+
+        protected:
+            void acknowledgeTicket( DeliveryTicket* ticket );
+            void requireTicket( DeliveryTicket* ticket, uint32_t acknowledgements );
+            void advance();  //called with the mutex held after a ticket's last acknowledgement
+
+            mutable std::mutex mutex;
+
+            std::deque<DeliveryTicket> tickets;  //references into a deque remain valid while elements are only added to the back and removed from the front
+            size_t pending_count = 0;
+            int64_t acknowledged_offset = 0;
+            int64_t acknowledged_replay_position = -1;
+
+            std::shared_ptr<Spool> spool;
+
+    };
+
+}
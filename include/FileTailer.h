@@ -0,0 +1,183 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "LineSplitter.h"
+#include "DeliveryTracker.h"
+#include "MessageBatch.h"
+#include "Spool.h"
+#include "SpoolReplayer.h"
+#include "MultilineAggregator.h"
+#include "RotatedBacklog.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+namespace logport{
+
+    class Database;
+    class Watch;
+    class LogPort;
+    class Producer;
+    class LinePipeline;
+
+
+    /**
+     * Tails one watched file: resumes at the saved offset, splits what it reads into lines, produces them and
+     * checkpoints the acknowledged offset. Messages that fail are recorded in the watch's spool (see Spool), which is
+     * replayed a bounded amount at a time alongside the live file (see SpoolReplayer), unless someone else replays it.
+     *
+     * A file that's far behind (eg. after an outage) is read in large sequential reads, with the kernel's readahead
+     * and without keeping the backlog in the page cache, until it's near the end; then it goes back to tailing.
+     *
+     * A tailer doesn't own an inotify instance. Whoever drives it (InotifyWatcher for a single file per process or
+     * MultiFileWatcher for many files per process) forwards the file's events through handleInotifyEvent() and calls
+     * service() when there's something to read.
+     */
+    class FileTailer{
+
+        public:
+            FileTailer( Producer& producer, Watch& watch, LogPort* logport, DeliveryTracker& delivery_tracker, const map<string,string>& settings );
+            ~FileTailer();
+
+            //with "watch.pipeline.encoder.threads" set, lines are encoded and produced on other threads (see LinePipeline); call before open()
+            void startPipeline();  //throws on failure
+
+            void open( Database& db );  //throws on failure; seeks to the saved offset and opens the spool (registered with the delivery tracker)
+            void close();
+            void reopen( Database& db );  //throws on failure; starts over at the beginning of a new file at the same path (eg. after logrotate)
+
+            void handleInotifyEvent( uint32_t mask );  //safe to call from another thread
+
+            /**
+             * Reads (a bounded amount of) whatever is pending and produces every complete line.
+             * Leaves hasPendingReads() true if there might be more to read.
+             * @throws on failure
+             */
+            void service( Database& db );
+
+            //false when the spool is shared and replayed by whoever drives this tailer (eg. PatternWatcher); call before open()
+            void setSpoolReplay( bool spool_replay ){ this->spool_replay = spool_replay; }
+
+            bool hasPendingReads() const;  //includes spool replay that's ready to run
+            bool hasPendingRecord() const;  //a multiline record is waiting for its next line (or its flush timeout)
+            bool isFinished() const;  //the file was rotated, everything up to its end has been produced and there's a new file at its path
+
+            //how long whoever drives this tailer may wait for events before calling service() again (0 if hasPendingReads())
+            int getWaitTimeoutMs( int idle_timeout_ms ) const;
+
+            //queues the acknowledged offset (and saves the spool cursor) if the checkpoint interval or byte threshold has been reached (or if forced)
+            //the caller writes the queued offsets with db.commitOffsets()
+            void checkpoint( Database& db, bool force = false );
+
+            //saves the read position (excluding any partial line) and the spool cursor when shutting down
+            void saveShutdownOffset( Database& db );
+
+            string filterLogLine( std::string_view unfiltered_log_line ) const;
+
+            Watch& getWatch(){ return this->watch; }
+            int64_t getReadPosition() const{ return this->read_position; }
+
+        protected:
+            void readFile( Database& db );
+            int64_t beginRead( Database& db );  //-1 if there's nothing to read now; otherwise the bytes known to be waiting (may be 0)
+            bool completeRead( Database& db, const char* data, ssize_t bytes_read );  //false at the end of the file (or on a read error)
+            void openSpool();
+            void migrateUndeliveredLog( Spool& new_spool, const string& undelivered_log_filepath );  //moves a flat undelivered log (from older versions) into the spool
+            void migrateUndeliveredFile( Spool& new_spool, const string& migrating_filepath );  //resumes at the offset saved next to it
+            bool isBlocked() const;  //the spool is full and its policy is to stop reading the watched file
+            int64_t checkTruncation( Database& db );  //starts over at the beginning if the file shrank below the read position (eg. copytruncate); returns the file size
+            bool isCatchingUp( int64_t file_size );  //enters catch-up mode if the file is more than "watch.catchup.threshold.bytes" behind
+            void readBacklog( int64_t file_size );  //one large read while catching up; back to regular reads once it's near the end
+            void readRotatedBacklog( Database& db );  //a bounded amount of the rotated file; moves on to the watched file at its end
+            void finishRotatedBacklog( Database& db );  //the watched file is read from the beginning from here on (with its own fingerprint)
+            void produceChunk( const char* data, size_t length );  //produces every complete line of what was read at the read position
+            void saveFileIdentity( Database& db, const struct stat64& file_status );  //saves the fingerprint of the open file along with watch.file_offset
+            bool isReplacementReady();  //after a rotation: a new file is at the path and the writer has (probably) moved on to it
+            void produceLine( std::string_view line, int64_t end_offset );
+            void addLineToBatch( std::string_view line, int64_t end_offset );
+            void flushPartialLine();  //and the pending multiline record
+            void addRecord( std::string_view record, int64_t end_offset );  //to the pipeline, or to the batch of the current read
+            void drainPipeline();  //throws if the producer failed
+            void reportLongLines();  //writes the truncated/split line count to the metrics log when it has changed (at most every LONG_LINE_METRIC_INTERVAL_MS)
+
+            Producer& producer;
+            Watch& watch;
+            LogPort* logport;
+            DeliveryTracker& delivery_tracker;
+
+            map<string,string> settings;
+
+            string watched_file;
+            string undelivered_log;
+
+            int watched_file_fd = -1;
+
+            int64_t read_position = 0;  //offset in the watched file just past the last byte read
+
+            //shared with the delivery tracker (and kept across reopen())
+            std::shared_ptr<Spool> spool;
+            bool blocked = false;
+
+            bool spool_replay = true;
+            std::unique_ptr<SpoolReplayer> replayer;  //nullptr unless this tailer replays its spool
+
+            LineSplitter line_splitter;
+            vector<LineSpan> lines;
+            uint64_t reported_long_lines = 0;
+            std::chrono::steady_clock::time_point last_long_line_report_time;
+            string filtered_line;  //reused for every produced message
+            MessageBatch batch;    //the lines of one read; reused
+
+            std::unique_ptr<MultilineAggregator> multiline;  //nullptr unless enabled
+            MultilineRecord multiline_record;
+            int64_t multiline_flush_ms;
+            std::chrono::steady_clock::time_point multiline_append_time;  //last time lines were added to the pending record
+
+            std::unique_ptr<LinePipeline> pipeline;  //nullptr unless enabled
+
+            bool startup = true;
+            bool finished = false;
+            std::atomic<bool> try_read{ false };
+            std::atomic<bool> log_being_rotated{ false };
+
+            //rotation handover
+            bool rotation_noticed = false;
+            bool replacement_seen = false;  //a new (empty) file is at the path
+            int64_t rotate_wait_ms;
+            std::chrono::steady_clock::time_point last_data_time;  //last read from the rotated file
+
+            //the file the saved offset belongs to, found rotated (eg. "app.log.1.gz") when the watch started; nullptr once it has been read
+            std::unique_ptr<RotatedBacklog> rotated_backlog;
+            bool recover_rotated;
+
+            //catch-up mode
+            bool catching_up = false;
+            int64_t catch_up_threshold_bytes;
+            int64_t catch_up_read_bytes;
+            int64_t catch_up_start_position = 0;
+            std::chrono::steady_clock::time_point catch_up_start_time;
+
+            int64_t checkpoint_interval_ms;
+            int64_t checkpoint_bytes;
+            int64_t last_checkpoint_offset = 0;
+            std::chrono::steady_clock::time_point last_checkpoint_time;
+
+    };
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include "DeliveryTracker.h"
+
+
+namespace logport{
+
+
+    /**
+     * A framed HTTP batch body and the delivery tickets of its messages, in order.
+     *
+     * The batch is encoded (and compressed) once and shared by every target it's sent to.
+     */
+    struct HttpBatch{
+
+        //where a message sits in the body; metadata_length bytes of metadata were spliced in at offset + metadata_offset
+        struct MessageSpan{
+            size_t offset;
+            size_t length;          //of the message itself
+            size_t metadata_offset;
+            size_t metadata_length;
+        };
+
+        string body;
+        string compressed_body;  //gzip of body (see compress()); empty if it's sent as it is
+        vector<DeliveryTicket*> tickets;
+        vector<MessageSpan> spans;
+
+        bool undelivered_recorded = false;  //fanned out: the first target to give up on it records it (see HttpProducer::deliver())
+
+        size_t getMessageCount() const{ return this->tickets.size(); }
+
+        //fills compressed_body (for "Content-Encoding: gzip"); false (and compressed_body empty) if zlib fails
+        bool compress( int level = -1 );  //-1: zlib's default level
+
+        //the message as it was appended (eg. to record it as undelivered); buffer holds it if metadata has to be cut out
+        std::string_view getMessage( size_t index, string& buffer ) const;
+
+    };
+
+
+
+    /**
+     * Builds an HTTP batch body by appending already-encoded JSON messages, without parsing them again.
+     *
+     *   RECORDS:   {"records":[{"value":<message>},{"value":<message>}]}    (application/vnd.kafka.json.v2+json)
+     *   MESSAGES:  {"messages":[<message>,<message>],"count":2}
+     *
+     * With RECORDS, the metadata fields (pre-rendered once as ',"key":value,...') are spliced in before the closing
+     * brace of each message that is a JSON object. A message that already has one of those keys ends up with it twice;
+     * the metadata comes last, so it wins with the usual last-one-wins parsers (as it did when records were merged key by key).
+     */
+    class HttpBatchWriter{
+
+        public:
+            enum struct Framing{
+                RECORDS,
+                MESSAGES
+            };
+
+            HttpBatchWriter( Framing framing = Framing::MESSAGES, const string& metadata_fields = "" );
+
+            void append( std::string_view message, DeliveryTicket* ticket = nullptr );
+
+            size_t getMessageCount() const{ return this->batch.getMessageCount(); }
+            bool empty() const{ return this->batch.tickets.empty(); }
+
+            //the size of the body finish() would return if a message of message_bytes were appended first (0: as it is now);
+            //never under, and only over by the metadata for a message that isn't an object
+            size_t predictBodySize( size_t message_bytes = 0 ) const;
+
+            //closes the framing and hands the batch over; the writer starts a new one
+            HttpBatch finish();
+
+        protected:
+            Framing framing;
+            string metadata_fields;  //eg. ',"env":"prod","region":"us-east-1"'
+
+            HttpBatch batch;
+
+    };
+
+}
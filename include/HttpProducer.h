@@ -15,6 +15,7 @@ using std::vector;
 #include "UrlList.h"
 
 #include "Producer.h"
+#include "HttpBatchWriter.h"
 #include <cstdint>
 
 #include "httplib.hpp"
@@ -22,6 +23,8 @@ using std::vector;
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "thread_pool.hpp"
 
 #include "json.hpp"
@@ -47,6 +50,39 @@ namespace logport{
                 KAFKA_JSON_V2_JSON
             };
 
+            //which targets a batch is sent to (http.producer.dispatch)
+            enum struct DispatchMode{
+                FANOUT,         //every target
+                ROUND_ROBIN,    //one target, in turns
+                LEAST_INFLIGHT, //one target, the one with the fewest requests outstanding (then the fastest)
+                FAILOVER        //one target, the first healthy one in the list
+            };
+
+            //httplib serializes the requests of a client, so each request in flight to a target has a client of its own
+            struct HttpClient{
+                http_client_ptr client;
+                https_client_ptr https_client;
+            };
+
+            struct HttpTargetStats{
+                uint64_t batches_delivered = 0;
+                uint64_t messages_delivered = 0;
+                uint64_t batches_undelivered = 0;   //rejected, or out of retries; recorded in the spool or undelivered log
+                uint64_t messages_undelivered = 0;
+                uint64_t retries = 0;
+                uint64_t latency_batches = 0;       //batches completed since the last report (delivered or not)
+                int64_t latency_total_ms = 0;       //from the hand-off of each batch to its completion, retries included
+                int64_t latency_max_ms = 0;
+                int last_status = 0;                //of the last response; 0 if there wasn't one (eg. a timeout)
+                size_t in_flight = 0;
+                double latency_ewma_ms = 0.0;       //of each request (attempt), smoothed
+                double error_rate = 0.0;            //share of recent requests without a usable response, smoothed
+                uint64_t ejections = 0;             //times the circuit breaker opened
+                bool ejected = false;
+
+                string toJson() const;
+            };
+
             // this is used as kind of a pre-computed set so that these values don't need to be computed on each message
             struct HttpConnection{
                 homer6::Url url;
@@ -56,12 +92,18 @@ namespace logport{
                 string format_str;
                 bool compress = true;
                 bool secure = false;
-                http_client_ptr client;
-                https_client_ptr https_client;
+                string description;                 //scheme, host, port and path; for logs and metrics (no credentials or query)
+                vector<HttpClient> clients;         //one per request that may be in flight
+                vector<size_t> idle_clients;        //indexes into clients
                 httplib::Headers request_headers_template;
                 settings_map settings;
-                vector<string> messages;
-                json metadata;
+                HttpTargetStats stats;
+
+                //circuit breaker (see recordAttempt()); an ejected target takes no batches until ejected_until, then a single probe
+                uint32_t consecutive_failures = 0;
+                bool ejected = false;
+                bool probing = false;
+                std::chrono::steady_clock::time_point ejected_until;
             };
 
             using http_connection_list = std::vector<HttpConnection>;
@@ -73,23 +115,72 @@ namespace logport{
             HttpProducer( const map<string,string>& settings, LogPort* logport, const string& undelivered_log, const string& targets_list );
             virtual ~HttpProducer() override;
 
-            virtual void produce( const string& message ) override;
+            virtual void produce( const string& message, DeliveryTicket* ticket = nullptr ) override;
+            virtual void produceBatch( MessageBatch& batch ) override;  //takes the lock once per target for the whole batch
             virtual void openUndeliveredLog() override;  //must be called before the first message is produced
             virtual void poll( int timeout_ms = 0 ) override;
 
 
-            virtual void flush( HttpConnection* connection );
+            //sends the batch to every target in the background; blocks while a target already has max.in.flight requests outstanding
+            virtual void flush();
 
         protected:
+            //posts the batch (with retries) until it's delivered, rejected or out of time, then acknowledges its tickets
+            void deliver( HttpConnection* connection, size_t client_index, HttpBatch& batch, std::chrono::steady_clock::time_point cut_time );
+            void addTargetMetrics();
+
+            //with model_mutex held; a target with an idle client that may take a batch now (see DispatchMode), or nullptr
+            //last_resort: if every target is ejected, any of them with an idle client
+            HttpConnection* selectTarget( const HttpConnection* excluded, bool last_resort );
+
+            //with model_mutex held; scores the target's health and opens or closes its circuit breaker
+            void recordAttempt( HttpConnection* connection, bool failed, int64_t latency_ms );
+
+            //with fanout, a message is acknowledged once every target has delivered (or given up on) it; a batch that fails on
+            //any target is spooled once and replayed to every target, so the targets that took it get it again (at least once)
+            uint32_t getRequiredAcknowledgements() const{
+                return this->dispatch == DispatchMode::FANOUT ? static_cast<uint32_t>( this->connections.size() ) : 1;
+            }
+
+            //with model_mutex held; false (and should_flush) if the message has to wait for the current batch to be sent first
+            bool appendMessage( std::string_view message, DeliveryTicket* ticket, bool& should_flush );
+
+            void runLinger();  //sends batches whose linger.ms has passed
+
             string targets_list;
             uint32_t batch_size = 1;
+            size_t batch_max_bytes = 1048576;
+            bool compress = true;
+            int64_t linger_ms = 1000;
 
             homer6::UrlList targets_url_list;
 
             http_connection_list connections;
 
+            //every target takes the same format and metadata, so a batch is encoded and compressed once for all of them
+            HttpBatchWriter batch_writer;
+            std::chrono::steady_clock::time_point linger_deadline;  //when the batch in batch_writer is sent even if it isn't full
+
+            int64_t message_timeout_ms = 5000;
+            int64_t max_retries = 2147483647;
+            int64_t retry_backoff_ms = 100;
+            int64_t retry_backoff_max_ms = 1000;
+            int64_t stats_interval_ms = 60000;
+            std::atomic<int64_t> next_stats_ms{ 0 };
+
+            DispatchMode dispatch = DispatchMode::FANOUT;
+            size_t next_target = 0;  //round_robin
+            int64_t breaker_failures = 5;
+            int64_t breaker_latency_ms = 2000;
+            int64_t breaker_open_ms = 10000;
+
             thread_pool pool{20};
             std::mutex model_mutex;
+            std::condition_variable client_released;  //with model_mutex; a request completed and its client is idle
+
+            std::thread linger_thread;
+            std::condition_variable linger_changed;  //with model_mutex; a batch was started, or the producer is shutting down
+            bool linger_stopping = false;
 
     };
 
@@ -4,10 +4,14 @@
 #include <string>
 using std::string;
 
+#include <string_view>
+
 #include <vector>
 using std::vector;
 
 #include "Producer.h"
+#include "DeliveryTracker.h"
+#include "FileTailer.h"
 
 #include <fstream>
 
@@ -21,12 +25,12 @@ namespace logport{
     class InotifyWatcher{
 
         public:
-            InotifyWatcher( Database& db, Producer &producer, Watch& watch, LogPort* logport );
+            InotifyWatcher( Database& db, Producer &producer, Watch& watch, LogPort* logport, DeliveryTracker& delivery_tracker );
             ~InotifyWatcher();
 
             void startWatching(); //throws on failure
 
-            string filterLogLine( const string& unfiltered_log_line ) const;
+            string filterLogLine( std::string_view unfiltered_log_line ) const;
 
             string escapeToJsonString( const string& unescaped_string ) const;
 
@@ -37,19 +41,23 @@ namespace logport{
             bool run;
 
         protected:
-            string watched_file;
+            void commitOffsets();  //writes the offset queued by the tailer's checkpoint; failures are logged (and retried next time)
+            void followReplacement();  //throws on failure; switches to the new file at the watched path after a rotation
 
-            string undelivered_log;
-            int undelivered_log_fd;
+            string watched_file;
+            string watched_file_name;  //eg. "syslog"
 
             Producer& producer;
 
             int inotify_fd;
             int inotify_watch_descriptor;
+            int directory_watch_descriptor;  //IN_CREATE/IN_MOVED_TO in the watched file's directory
 
             Watch& watch;
             LogPort* logport;
 
+            FileTailer tailer;
+
     };
 
 }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+
+namespace logport{
+
+    /**
+     * Wraps a log line in logport's JSON envelope without building a JSON document.
+     *
+     * The constant fields of a watch are escaped and rendered once, when the encoder is constructed; encoding a line
+     * only writes the timestamp and the line itself. For a valid UTF-8 line sent as "log", the output is byte-compatible
+     * with what nlohmann::json's dump() produced for the same envelope (keys in sorted order, the same escaping):
+     *
+     *   {"@timestamp":"1556352653.816769123","host":"...","log":"hello world","log_type":"...","prd":"...","source":"..."}
+     *
+     * Lines starting with '{' or '[' that are valid JSON are embedded verbatim as "log_obj" (after a validating scan,
+     * not a parse); anything else is escaped into "log". Two cases differ from dump():
+     *
+     *   - "log_obj" keeps the line's own key order and whitespace; dump() re-serialized it with sorted keys and no whitespace
+     *   - invalid UTF-8 is replaced with U+FFFD; dump() threw (and the line was lost)
+     */
+    class JsonEnvelopeEncoder{
+
+        public:
+            JsonEnvelopeEncoder();
+            JsonEnvelopeEncoder( const string& hostname, const string& source, const string& product_code, const string& log_type );
+
+            //replaces the contents of output (reusing its capacity) with the envelope for log_line; output is empty if log_line is
+            void encode( std::string_view log_line, string& output ) const;
+
+            //appends the JSON string escaping of text (without the surrounding quotes)
+            static void appendEscaped( std::string_view text, string& output );
+
+            //true if text is exactly one JSON value (RFC 8259), optionally surrounded by whitespace
+            static bool isValidJson( std::string_view text );
+
+        protected:
+            string header;   //the fields rendered between the timestamp and the log (eg. ,"host":"my.hostname.com")
+            string trailer;  //the fields rendered after the log, and the closing brace
+
+    };
+
+}
@@ -6,8 +6,15 @@ using std::string;
 #include <map>
 using std::map;
 
+#include <memory>
+#include <atomic>
+
+#include <vector>
+using std::vector;
+
 #include <librdkafka/rdkafka.h>
 #include "Producer.h"
+#include "PayloadPool.h"
 
 namespace logport{
 
@@ -16,7 +23,12 @@ namespace logport{
 
     /*
         Produces messages to kafka.
-        You can only safely have one KafkaProducer instantiated (per process) due to the static variables.
+        One producer (and its rdkafka instance) can be shared by several watches that send to the same brokers and topic.
+
+        Delivery reports are signalled through the producer's event descriptor (see Producer::getEventFd()).
+
+        Payloads are copied into pooled blocks (see PayloadPool) that rdkafka sends from directly; each block is returned
+        to the pool by its delivery report.
     */
     class KafkaProducer : public Producer{
 
@@ -24,19 +36,37 @@ namespace logport{
             KafkaProducer( const map<string,string>& settings, LogPort* logport, const string& undelivered_log, const string& brokers_list, const string& topic );
             virtual ~KafkaProducer() override;
 
-            virtual void produce( const string& message ) override;
+            virtual void produce( const string& message, DeliveryTicket* ticket = nullptr ) override;
+            virtual void produceBatch( MessageBatch& batch ) override;  //rd_kafka_produce_batch; takes the batch's payload blocks
             virtual void openUndeliveredLog() override;  //must be called before the first message is produced
             virtual void poll( int timeout_ms = 0 ) override;
+            virtual void handleEvents() override;  //serves the delivery reports that are ready
+
+            void handleDeliveryReport( const rd_kafka_message_t *rkmessage );  //called from rd_kafka_poll()
+
+            virtual PayloadPool* getPayloadPool() override{
+                return this->payload_pool.get();
+            }
+
+            PayloadPoolStats getPayloadPoolStats() const;
 
         protected:
+            void addPayloadPoolMetric();
+            void recordFailedDeliveries();  //records the failed delivery reports served on this thread in one go
+
             string brokers_list;
             string topic;
 
             rd_kafka_t *rk;             /* Producer instance handle */
             rd_kafka_topic_t *rkt;      /* Topic object */
+            rd_kafka_queue_t *main_queue = nullptr;  /* Delivery reports; signals the event descriptor when it becomes non-empty */
             
             char errstr[512];           /* librdkafka API error reporting buffer */
 
+            std::unique_ptr<PayloadPool> payload_pool;
+            int64_t payload_pool_stats_interval_ms;
+            std::atomic<int64_t> next_payload_pool_stats_ms{ 0 };
+
     };
 
 }
@@ -1,15 +1,25 @@
 #ifndef LOGPORT_LEVEL_TRIGGERED_EPOLL_WATCHER_H
 #define LOGPORT_LEVEL_TRIGGERED_EPOLL_WATCHER_H
 
+#include <vector>
+using std::vector;
+
 namespace logport{
 
 	class LevelTriggeredEpollWatcher{
 
 	    public:
+	        LevelTriggeredEpollWatcher();  //watches nothing until add() is called
 	        LevelTriggeredEpollWatcher( int watching_file_descriptor );
 	        ~LevelTriggeredEpollWatcher();
 
-	        bool watch( int timeout_ms = 1000 ); //throws on failure
+	        void add( int file_descriptor ); //throws on failure
+	        void remove( int file_descriptor );
+
+	        bool watch( int timeout_ms = 1000 ); //throws on failure; true if the constructor's file descriptor is ready
+
+	        //throws on failure; fills ready_file_descriptors with every watched descriptor that is ready to read
+	        int watch( int timeout_ms, vector<int>& ready_file_descriptors );
 
 	    protected:
 	        int watching_file_descriptor;
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdint>
+
+#include "SpscRing.h"
+#include "MessageBatch.h"
+
+
+namespace logport{
+
+    class Producer;
+    class Watch;
+    class LogPort;
+    class DeliveryTracker;
+
+
+    struct LinePipelineStageStats{
+        string stage;                           //"encode" (reader to encoder) or "produce" (encoder to producer)
+        size_t ring = 0;                        //one ring per encoder thread
+        size_t capacity_bytes = 0;
+        size_t depth_bytes = 0;
+        size_t depth_bytes_high_water_mark = 0;
+        uint64_t full_waits = 0;                //times the writer had to wait for room
+    };
+
+
+    struct LinePipelineStats{
+        uint64_t lines_read = 0;
+        uint64_t lines_encoded = 0;
+        uint64_t lines_produced = 0;
+        uint64_t batches_produced = 0;
+        uint64_t lines_bypassed = 0;            //too long for the rings; encoded and produced on the reader thread
+        vector<LinePipelineStageStats> stages;
+
+        string toJson() const;
+    };
+
+
+
+    /**
+     * Moves line encoding and producing off the thread that reads the watched file (see FileTailer).
+     *
+     *   reader thread --(ring)--> encoder thread(s) --(ring)--> producer thread
+     *
+     * The reader pushes the lines of each read as one chunk. Chunks are dealt to the encoder threads in turn, each
+     * through its own single-producer/single-consumer ring, and the producer thread takes them back in the same turn,
+     * so lines are produced in file order (one batch per chunk) and delivery tickets are issued in file order.
+     *
+     * The rings are bounded in bytes. When the producer blocks (eg. librdkafka's queue is full), the rings fill up
+     * and push() waits, so backpressure still reaches the reader deterministically, with a bounded amount buffered.
+     *
+     * A producer failure is rethrown to the reader by the next push(), endChunk() or drain().
+     *
+     * Enable with "logport set watch.pipeline.encoder.threads 1" (the default, 0, reads, encodes and produces on one thread).
+     */
+    class LinePipeline{
+
+        public:
+            LinePipeline( Producer& producer, const Watch& watch, DeliveryTracker& delivery_tracker, LogPort* logport, size_t encoder_threads, size_t ring_bytes, int64_t stats_interval_ms );
+            ~LinePipeline();  //stops without draining; lines still in the rings were never tracked, so they're read again after a restart
+
+            LinePipeline( const LinePipeline& ) = delete;
+            LinePipeline& operator=( const LinePipeline& ) = delete;
+
+            //reader thread
+            void push( std::string_view line, int64_t end_offset );  //blocks while the ring is full; throws if the producer failed
+            void endChunk();  //the lines pushed since the last chunk are produced together
+            void drain();  //returns once everything pushed has been handed to the producer (eg. before the delivery tracker is reset)
+
+            LinePipelineStats getStats() const;
+
+        protected:
+            struct Encoder{
+                std::unique_ptr<SpscRing> input;   //lines from the reader
+                std::unique_ptr<SpscRing> output;  //encoded messages for the producer thread
+                std::thread thread;
+                std::atomic<uint64_t> input_full_waits{ 0 };
+                std::atomic<uint64_t> output_full_waits{ 0 };
+            };
+
+            void runEncoder( Encoder& encoder );
+            void runProducer();
+
+            //waits until another stage notifies (or briefly); returns false once the pipeline is stopping
+            //seen_progress is read before looking at the ring, so progress made in between isn't missed
+            bool waitForProgress( uint64_t seen_progress );
+            void notifyProgress();  //after a stage has made room or published something; never while idle, so idle stages don't wake each other
+
+            void throwIfFailed();
+            void bypass( std::string_view line, int64_t end_offset );  //a line too long for the rings
+
+            Producer& producer;
+            const Watch& watch;
+            DeliveryTracker& delivery_tracker;
+            LogPort* logport;
+
+            size_t max_line_bytes;
+            int64_t stats_interval_ms;
+
+            vector<std::unique_ptr<Encoder>> encoders;
+            size_t next_input = 0;         //reader thread: the encoder that gets the current chunk
+            bool chunk_open = false;       //reader thread: lines were pushed since the last endChunk()
+            bool reader_notify_pending = false;  //reader thread: lines were pushed since the last notification
+            uint64_t chunks_pushed = 0;    //reader thread
+            std::atomic<uint64_t> chunks_produced{ 0 };
+
+            std::atomic<uint64_t> lines_read{ 0 };
+            std::atomic<uint64_t> lines_encoded{ 0 };
+            std::atomic<uint64_t> lines_produced{ 0 };
+            std::atomic<uint64_t> batches_produced{ 0 };
+            std::atomic<uint64_t> lines_bypassed{ 0 };
+
+            std::atomic<bool> stopping{ false };
+            std::atomic<bool> failed{ false };
+            std::exception_ptr failure;  //set by the producer thread before failed
+
+            //only taken by a stage that has to wait; the rings themselves are lock-free
+            std::mutex wait_mutex;
+            std::condition_variable wait_condition;
+            std::atomic<int> waiting{ 0 };
+            std::atomic<uint64_t> progress{ 0 };
+
+            std::thread producer_thread;
+
+    };
+
+}
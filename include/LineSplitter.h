@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include <deque>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace logport{
+
+
+    /**
+     * Finds the first newline character in [begin, end).
+     * Uses AVX2 or SSE2 (probed once at runtime) and falls back to a scalar scan on other platforms.
+     *
+     * @returns a pointer to the newline or end if there isn't one
+     */
+    const char* find_newline( const char* begin, const char* end );
+
+
+    struct LineSpan{
+        std::string_view text;  //the line without its trailing newline
+        int64_t begin;          //where the line starts, relative to the current chunk (negative if it started in an earlier chunk)
+        size_t end;             //bytes of the current chunk consumed up to (and including) this line's newline
+    };
+
+
+    enum class LongLinePolicy{
+        TRUNCATE,   //the first max_line_bytes are kept (followed by LONG_LINE_TRUNCATED_MARKER); the rest of the line is dropped
+        SPLIT       //the line is produced as consecutive fragments of at most max_line_bytes each
+    };
+
+    #define LONG_LINE_TRUNCATED_MARKER "...[truncated]"
+
+
+    /**
+     * Splits read chunks into complete lines without copying them.
+     *
+     * Line spans point straight into the chunk that was passed in. The only exception is the first line of a
+     * chunk when a partial line was carried over from the previous chunk; that line is assembled into an
+     * internal buffer. Spans remain valid until the next call to split() or clear().
+     *
+     * Empty lines (consecutive newlines) are dropped.
+     *
+     * With a maximum line length, the carried-over partial line never grows past it (eg. binary junk without
+     * newlines); longer lines are truncated (and marked) or split into fragments, depending on the policy.
+     * Truncated lines are assembled into internal buffers, too.
+     */
+    class LineSplitter{
+
+        public:
+            void split( const char* data, size_t length, vector<LineSpan>& lines );
+
+            void setMaxLineBytes( size_t max_line_bytes, LongLinePolicy policy );  //0 is unlimited (the default)
+
+            const string& getPartial() const{ return this->partial; }
+            size_t getPartialSize() const{ return this->partial.size(); }
+            size_t getPartialSourceBytes() const{ return this->partial_source_bytes; }  //bytes read since the partial line started (more than its size once truncated)
+
+            uint64_t getLongLineCount() const{ return this->long_lines; }  //lines truncated or split so far
+
+            void clear();
+
+        protected:
+            string& nextTruncatedLine();
+            void countLongLine();
+
+            string partial;     //incomplete trailing line carried over from the previous chunk
+            string assembled;   //partial + head of the current chunk (reused between calls to avoid allocations)
+            size_t partial_source_bytes = 0;
+
+            size_t max_line_bytes = 0;
+            LongLinePolicy long_line_policy = LongLinePolicy::TRUNCATE;
+            bool discarding = false;  //the partial line was truncated; the rest of it is dropped up to its newline
+            uint64_t long_lines = 0;
+            bool long_line_counted = false;  //the current (unfinished) line has been counted
+
+            std::deque<string> truncated_lines;  //a deque, so earlier buffers (and spans into them) stay put while it grows
+            size_t truncated_lines_used = 0;
+
+    };
+
+
+}
@@ -64,7 +64,12 @@ namespace logport{
 
 
 	        int runFromCommandLine( int argc, char **argv );
-	        void registerSignalHandlers();
+	        void registerSignalHandlers();  //throws on failure; also creates the event descriptor (see getEventFd())
+
+	        //readable once a signal has changed run, reload_required or watches_paused, so a main loop can wait on it (eg. in its epoll set)
+	        int getEventFd() const{ return this->event_fd; }
+	        void signalEvent();  //async-signal-safe
+	        void clearEvent();
 
 	        void addWatch( const Watch& watch );
 	        void listWatches();
@@ -99,9 +104,10 @@ namespace logport{
 	    	void installLogrotate();
 
 	    	void startWatches();  //main loop (blocks)
+	    	void startConsolidatedWatches();  //main loop for "watch.mode consolidated" (blocks)
 
 
-	    	//this will wait for 60 seconds; but, it'll check to see if there's an event every second
+	    	//waits for the given seconds, or until the service is stopped or a reload is required (see getEventFd())
 	    	void waitUnlessEvent( int seconds );
 
 
@@ -113,6 +119,7 @@ namespace logport{
 	    	Database *db;
 	    	Inspector* inspector;
 	    	Observer* observer;
+	    	int event_fd;
 
 	    public:
 	     	bool run;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include "DeliveryTracker.h"
+#include "PayloadPool.h"
+
+
+namespace logport{
+
+    /**
+     * Messages that are produced together (eg. every complete line of one read), each with its delivery ticket.
+     *
+     * The payloads are stored back to back in one buffer; clear() keeps the capacity so a batch can be reused
+     * without allocating.
+     *
+     * A message can also be added as a payload block from the producer's pool (see Producer::getPayloadPool()), so
+     * the producer can send it with takeBlock() instead of copying it out of the batch. Blocks that aren't taken are
+     * released by clear().
+     */
+    class MessageBatch{
+
+        public:
+            MessageBatch() = default;
+            ~MessageBatch();
+
+            MessageBatch( const MessageBatch& ) = delete;
+            MessageBatch& operator=( const MessageBatch& ) = delete;
+
+            void add( std::string_view message, DeliveryTicket* ticket );
+            void add( PayloadBlock* block );  //the batch owns the block (and its ticket) until it's taken or cleared
+            void clear();
+
+            size_t size() const{ return this->tickets.size(); }
+            bool empty() const{ return this->tickets.empty(); }
+
+            std::string_view getMessage( size_t index ) const;
+            DeliveryTicket* getTicket( size_t index ) const{ return this->tickets[index]; }
+
+            PayloadBlock* takeBlock( size_t index );  //nullptr if the message was copied in (or its block was already taken)
+
+        protected:
+            string payloads;
+            vector<size_t> payload_ends;  //offset in payloads just past each message (empty in payloads if it's a block)
+            vector<DeliveryTicket*> tickets;
+            vector<PayloadBlock*> blocks;  //nullptr for messages copied into payloads
+
+    };
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "Watch.h"
+#include "Producer.h"
+#include "DeliveryTracker.h"
+#include "FileTailer.h"
+#include "LevelTriggeredEpollWatcher.h"
+
+
+namespace logport{
+
+    class LogPort;
+    class Database;
+
+
+    /**
+     * Consolidated mode: tails many watches in one process instead of forking a process per watch.
+     *
+     * One inotify instance watches every file and one epoll loop (on the calling thread) dispatches its events.
+     * Watches are sharded across a small, fixed pool of worker threads that read, produce and checkpoint.
+     * Watches that send to the same brokers (and topic) share one producer.
+     *
+     * The process is held to the RSS and CPU limits WatchSupervisor applies to each watch process (all of the watches
+     * together, "watch.consolidated.max.rss.kb" and "watch.consolidated.max.cpu.seconds"); going past one restarts the
+     * watches in place: startWatching() returns and the caller creates a new MultiFileWatcher.
+     *
+     * Enable with "logport set watch.mode consolidated" (the default, "process", forks a process per watch).
+     */
+    class MultiFileWatcher{
+
+        public:
+            MultiFileWatcher( LogPort* logport, const vector<Watch>& watches, const map<string,string>& settings );
+            ~MultiFileWatcher();
+
+            void startWatching();  //blocks until the logport service stops or a reload is required; throws on failure
+
+        protected:
+
+            struct WatchState{
+                Watch watch;
+                Producer* producer = nullptr;
+                std::unique_ptr<DeliveryTracker> delivery_tracker;
+                std::unique_ptr<FileTailer> tailer;
+                string file_name;  //eg. "syslog"; matched against its directory's events
+                int watch_descriptor = -1;
+                int directory_watch_descriptor = -1;
+                size_t worker_index = 0;
+                bool active = false;   //the file is open and being tailed
+                std::chrono::steady_clock::time_point next_activation_attempt;
+            };
+
+            struct Worker{
+                std::thread thread;
+                std::mutex mutex;
+                std::condition_variable condition;
+                bool signaled = false;
+                vector<WatchState*> watch_states;
+            };
+
+            Producer& getProducer( const Watch& watch );
+
+            void runWorker( Worker& worker );
+            void signalWorker( size_t worker_index );
+
+            void activate( WatchState& watch_state, Database& db );  //throws on failure
+            void deactivate( WatchState& watch_state );
+            bool rewatch( WatchState& watch_state );  //follows the path to the new file after a rotation
+
+            void readInotifyEvents();
+            void checkResources();  //on the timerfd; sets restart_required if a limit was exceeded
+
+
+            LogPort* logport;
+            map<string,string> settings;
+
+            std::atomic<bool> run{ true };
+
+            int inotify_fd = -1;
+            int timer_fd = -1;  //the periodic resource check
+
+            int64_t max_rss_kb;
+            int64_t max_cpu_time_seconds;
+            double start_cpu_time_seconds = 0;  //the process's CPU time when watching started
+            bool restart_required = false;
+
+            //trackers and tailers must outlive the producers (delivery reports are served until a producer is flushed)
+            vector<std::unique_ptr<WatchState>> watch_states;
+
+            std::mutex watch_descriptors_mutex;
+            map<int, WatchState*> watch_states_by_descriptor;
+            map<int, vector<WatchState*>> watch_states_by_directory_descriptor;  //watches are notified when a file is created at their path
+
+            vector<std::unique_ptr<Producer>> producers;
+            map<string, Producer*> producers_by_key;  //eg. "KAFKA|broker1:9092,broker2:9092|my_topic"
+
+            vector<std::unique_ptr<Worker>> workers;
+
+    };
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace logport{
+
+
+    /**
+     * A fixed-length pattern matched against the beginning of a line, one byte at a time (no backtracking, no std::regex).
+     *
+     *   \d  a digit            \s  a space or tab        \w  a letter, digit or underscore
+     *   .   any byte           [abc] [0-9] [^ ]  a set    \x  x itself (eg. \[ or \.)
+     *
+     * Every other byte matches itself. eg. "\d\d\d\d-\d\d-\d\d" matches lines that start with an ISO date.
+     */
+    class LinePattern{
+
+        public:
+            LinePattern() = default;
+            explicit LinePattern( const string& pattern );  //throws if the pattern is malformed (eg. an unterminated set)
+
+            bool matches( std::string_view line ) const;
+            bool empty() const{ return this->positions.empty(); }
+
+        protected:
+            vector<std::bitset<256>> positions;  //the bytes accepted at each position
+
+    };
+
+
+    struct MultilineRecord{
+        std::string_view text;  //the lines joined by newlines; valid until the next call to add() or flush()
+        int64_t end_offset;     //just past the newline of the record's last line (or -1 if unknown)
+    };
+
+
+    /**
+     * Joins continuation lines (eg. the lines of a stack trace) onto the line that started their record, so each
+     * record is produced as one message.
+     *
+     * A line continues the current record if it's indented (starts with a space or tab) or, when there's a start
+     * pattern, if it doesn't match the start pattern. Any other line starts a new record, which completes the
+     * previous one. A record that would grow past max_record_bytes is completed early; the line starts a new one.
+     *
+     * The pending record is only known to be complete once the next record starts, so the caller flushes it when
+     * no line has been added for a while (see FileTailer::service()).
+     */
+    class MultilineAggregator{
+
+        public:
+            MultilineAggregator( const LinePattern& start_pattern, size_t max_record_bytes );
+
+            //true if the line completed the previous record (returned in completed)
+            bool add( std::string_view line, int64_t begin_offset, int64_t end_offset, MultilineRecord& completed );
+            bool flush( MultilineRecord& completed );  //completes the pending record, if there is one
+
+            bool hasPending() const{ return this->pending_lines > 0; }
+            int64_t getPendingBeginOffset() const{ return this->pending_begin_offset; }  //where the pending record starts in the file (or -1 if unknown)
+
+            void clear();
+
+        protected:
+            bool isContinuation( std::string_view line ) const;
+
+            LinePattern start_pattern;
+            size_t max_record_bytes;
+
+            string pending;     //the record being assembled
+            string completed;   //the last completed record (reused between calls to avoid allocations)
+            size_t pending_lines = 0;
+            int64_t pending_begin_offset = -1;
+            int64_t pending_end_offset = -1;
+
+    };
+
+
+}
@@ -5,6 +5,7 @@
 using std::string;
 
 #include <fstream>
+#include <mutex>
 
 
 namespace logport{
@@ -19,6 +20,8 @@ namespace logport{
 		handles all elements of observability (metrics, events, tracing, telemetry, and 
 		logging). We call this collection METTL, after the first letters of this set.
 
+		One observer may be shared by several threads (eg. consolidated watches).
+
 	*/
 	class Observer{
 
@@ -38,6 +41,8 @@ namespace logport{
 	    	std::ofstream traces_file;
 	    	std::ofstream telemetry_file;
 	     	std::ofstream log_file;
+
+	     	std::mutex mutex;
 	     	
 	};
 
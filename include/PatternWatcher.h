@@ -0,0 +1,123 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "Watch.h"
+#include "Producer.h"
+#include "DeliveryTracker.h"
+#include "FileTailer.h"
+#include "Spool.h"
+#include "SpoolReplayer.h"
+
+
+namespace logport{
+
+    class Database;
+    class LogPort;
+
+
+    /**
+     * Runs a pattern watch (eg. "logport watch '/var/log/app/app-*.log'"): tails every file in one directory whose name
+     * matches the pattern, including the ones created after it starts.
+     *
+     * A single inotify watch on the directory reports every matching file's creations, modifications, deletions and
+     * renames, so there's no inotify watch (or process) per file. Each file gets a FileTailer while it's active; its
+     * offset and fingerprint are kept in the watch_files table.
+     *
+     *   - a file is opened when it's found (or modified again after it was retired)
+     *   - a file that has been quiet for "watch.pattern.idle.ms" is retired (closed) once its messages are acknowledged
+     *   - a file that's deleted (or renamed to a name that doesn't match) is drained and retired
+     *   - a file renamed to another matching name carries on from where it was
+     *   - at most "watch.pattern.max.open.files" are open at once; the others wait their turn
+     *
+     * Every file shares the watch's producer and spool. The spool is replayed by the pattern watch itself (one rate
+     * limit and one tracker for the whole watch), not by the files' tailers.
+     */
+    class PatternWatcher{
+
+        public:
+            PatternWatcher( Database& db, Watch& watch, LogPort* logport, const map<string,string>& settings );  //throws on failure
+            ~PatternWatcher();
+
+            PatternWatcher( const PatternWatcher& ) = delete;
+            PatternWatcher& operator=( const PatternWatcher& ) = delete;
+
+            void startWatching();  //main loop (blocks) until stop() is called; throws on failure
+
+            void stop(){ this->run = false; }  //safe to call from a signal handler or another thread
+
+            std::atomic<bool> run{ true };
+
+        protected:
+            typedef std::chrono::steady_clock::time_point TimePoint;
+
+            struct WatchedFile{
+                Watch watch;  //a copy of the pattern watch, for this file
+                std::unique_ptr<DeliveryTracker> delivery_tracker;  //outlives its tailer until every message it produced is acknowledged
+                std::unique_ptr<FileTailer> tailer;
+                int64_t last_read_position = 0;
+                TimePoint last_activity_time;
+                bool detached = false;  //deleted or renamed away; drained, but no longer checkpointed (its path may be reused)
+                bool deleted = false;
+            };
+
+            void scanDirectory();
+            void readInotifyEvents();
+
+            void discover( const string& file_name );  //opens the file, or queues it if too many are open
+            void open( const string& file_name );
+            void detach( const string& file_name, bool deleted );
+            bool reattach( const string& old_file_name, const string& new_file_name );  //a detached file was renamed to another matching name
+            void serviceFiles();
+            void serviceReplay();
+            void retireFiles();
+            bool canRetire( const WatchedFile& watched_file, TimePoint now ) const;
+            void retire( WatchedFile& watched_file );
+
+            int getWaitTimeoutMs() const;
+            size_t getOpenFileCount() const;
+            void commitOffsets();
+
+            Database& db;
+            Watch& watch;
+            LogPort* logport;
+            map<string,string> settings;
+
+            string directory;
+            string pattern;  //eg. "*.log"
+
+            int64_t idle_ms;
+            int64_t rotate_wait_ms;
+            size_t max_open_files;
+
+            int inotify_fd = -1;
+            int directory_watch_descriptor = -1;
+
+            //shared by every file's tracker; failed messages from any file are replayed through replay_tracker
+            std::shared_ptr<Spool> spool;
+            std::unique_ptr<DeliveryTracker> replay_tracker;
+            std::unique_ptr<SpoolReplayer> replayer;
+
+            map<string, std::unique_ptr<WatchedFile>> watched_files;  //by file name
+            vector<std::unique_ptr<WatchedFile>> detached_files;
+            std::deque<string> queued_file_names;  //found while max_open_files were open
+
+            //declared last so it's destroyed first; delivery reports are served to the trackers above until it's flushed
+            std::unique_ptr<Producer> producer;
+
+    };
+
+}
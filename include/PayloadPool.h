@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <mutex>
+
+#include "DeliveryTracker.h"
+
+
+namespace logport{
+
+    class PayloadPool;
+
+
+    /**
+     * A message payload owned by a PayloadPool. The payload bytes follow this header.
+     *
+     * A block travels with its message (eg. as the rdkafka msg_opaque) until the delivery report, when it's handed back
+     * with PayloadPool::release().
+     */
+    struct PayloadBlock{
+
+        PayloadPool* pool;
+        DeliveryTicket* ticket;     //the message's delivery ticket; may be nullptr
+        PayloadBlock* next_free;    //free list link (pooled blocks only)
+        uint32_t capacity;          //payload bytes available after the header
+        uint32_t length;            //payload bytes in use
+        bool pooled;                //false for overflow blocks (allocated for one message and freed on release)
+
+        char* data(){ return reinterpret_cast<char*>( this + 1 ); }
+
+    };
+
+
+
+    struct PayloadPoolStats{
+        size_t block_bytes = 0;             //payload capacity of a pooled block
+        size_t max_blocks = 0;              //pooled blocks are never allocated past this; larger demand overflows
+        size_t allocated_blocks = 0;        //pooled blocks allocated so far (in slabs)
+        size_t blocks_in_use = 0;
+        size_t blocks_in_use_high_water_mark = 0;
+        size_t overflow_blocks_in_use = 0;
+        size_t overflow_blocks_in_use_high_water_mark = 0;
+        size_t bytes_in_use = 0;            //payload bytes held by messages (pooled and overflow)
+        size_t bytes_in_use_high_water_mark = 0;
+        uint64_t overflow_allocations = 0;  //messages that didn't fit a pooled block (too large, or the pool was exhausted)
+
+        string toJson() const;
+    };
+
+
+
+    /**
+     * Fixed-size payload blocks for messages that are handed to a producer without a copy.
+     *
+     * Pooled blocks are carved from slabs that are allocated as they're needed (up to max_blocks) and are recycled
+     * through a free list; they're only returned to the system when the pool is destroyed. Payloads larger than a
+     * block, or acquired while every pooled block is in use, get an overflow block of their own.
+     *
+     * acquire() and release() may be called from different threads.
+     */
+    class PayloadPool{
+
+        public:
+            PayloadPool( size_t block_bytes = 1024, size_t max_blocks = 32768, size_t blocks_per_slab = 256 );
+            ~PayloadPool();
+
+            PayloadPool( const PayloadPool& ) = delete;
+            PayloadPool& operator=( const PayloadPool& ) = delete;
+
+            //returns a block holding a copy of payload; throws std::bad_alloc on failure
+            PayloadBlock* acquire( const char* payload, size_t length, DeliveryTicket* ticket = nullptr );
+
+            static void release( PayloadBlock* block );  //no-op for nullptr
+
+            PayloadPoolStats getStats() const;
+
+        protected:
+            void releaseBlock( PayloadBlock* block );
+            bool allocateSlab();  //called with the mutex held; false if the pool is at max_blocks
+
+            const size_t block_bytes;
+            const size_t block_stride;  //header + payload, rounded up to keep headers aligned
+            const size_t max_blocks;
+            const size_t blocks_per_slab;
+
+            mutable std::mutex mutex;
+
+            vector<char*> slabs;
+            PayloadBlock* free_list = nullptr;
+
+            PayloadPoolStats stats;
+
+    };
+
+}
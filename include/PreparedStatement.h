@@ -16,7 +16,7 @@ namespace logport{
 	class PreparedStatement{
 
 	    public:
-	    	PreparedStatement( const Database& database, const string& statement_sql );  //eg. http://www.sqlite.org/c3ref/bind_blob.html
+	    	PreparedStatement( const Database& database, const string& statement_sql, unsigned int prepare_flags = 0 );  //eg. http://www.sqlite.org/c3ref/bind_blob.html
 	    	~PreparedStatement();
 
 	    	// The leftmost SQL parameter has an offset of 0
@@ -49,6 +49,8 @@ namespace logport{
 	    	int last_step_result;
 	    	int column_count;
 
+	    friend class Database;
+
 	};
 
 }
@@ -6,6 +6,17 @@ using std::map;
 #include <string>
 using std::string;
 
+#include <mutex>
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+
+#include "DeliveryTracker.h"
+#include "MessageBatch.h"
+
 
 namespace logport {
 
@@ -44,11 +55,25 @@ namespace logport {
              * @blocks on queue full (logport does not have buffers so as to provide tight coupling with inotify, which deterministically applies backpressure)
              *
              * @param message unescaped (raw) message
+             * @param ticket acknowledged (see DeliveryTracker) once the message is delivered or recorded in the undelivered log; may be nullptr
              */
-            virtual void produce( const string &message ) = 0;
+            virtual void produce( const string &message, DeliveryTicket* ticket = nullptr ) = 0;
+
 
+            /**
+             * Produce several raw messages at once (eg. every complete line of one read), in order.
+             *
+             * Same guarantees as produce() for each message. The default implementation calls produce() for each one.
+             * Payload blocks in the batch may be taken (see MessageBatch::takeBlock()); clear the batch before reusing it.
+             *
+             * @throws on failure
+             */
+            virtual void produceBatch( MessageBatch& batch );
 
-            //void produceBatch() rd_kafka_produce_batch  TODO:implement
+            //the pool this producer sends payload blocks from, so a batch can be filled with them (see MessageBatch); may be nullptr
+            virtual PayloadPool* getPayloadPool(){
+                return nullptr;
+            }
 
             //TODO: implement rd_kafka_set_logger
 
@@ -56,11 +81,39 @@ namespace logport {
 
             virtual void poll( int timeout_ms = 0 ) = 0;  //called intermittently on another thread
 
+            /**
+             * A descriptor that becomes readable when this producer has completion work to serve (eg. delivery reports),
+             * so a watcher can wait on it in the same epoll set as its inotify descriptor instead of polling on a timer.
+             * Call handleEvents() when it's readable.
+             */
+            int getEventFd() const{
+                return this->event_read_fd;
+            }
+
+            virtual void handleEvents();  //clears the event descriptor; overrides then serve whatever is ready
+
             virtual ProducerType getType() const{
                 return this->type;
             }
 
         protected:
+            struct UndeliveredMessage{
+                std::string_view payload;
+                DeliveryTicket* ticket;
+            };
+
+            /**
+             * Appends a failed message to the spool of the ticket's tracker, if it has one, or else (with a newline) to
+             * this producer's undelivered log. Safe to call from delivery report or worker threads.
+             */
+            void recordUndelivered( const void* payload, size_t length, DeliveryTicket* ticket );
+
+            //same as above for several messages; consecutive messages bound for the same spool are appended together
+            void recordUndelivered( const vector<UndeliveredMessage>& messages );
+
+            void signalEvent();  //makes the event descriptor readable; safe to call from any thread
+            void clearEvent();
+
             ProducerType type = ProducerType::KAFKA;
             map<string, string> settings;
             LogPort *logport;
@@ -68,6 +121,11 @@ namespace logport {
             int undelivered_log_fd = -1;
             string undelivered_log;
             bool undelivered_log_open = false;
+            std::mutex undelivered_log_mutex;
+
+            //a non-blocking pipe; the write end is also handed to rdkafka (see KafkaProducer)
+            int event_read_fd = -1;
+            int event_write_fd = -1;
 
     };
 
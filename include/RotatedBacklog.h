@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <memory>
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include <zlib.h>
+
+
+namespace logport{
+
+    class Watch;
+
+
+    /**
+     * The unshipped rest of a watched file that was rotated away (and possibly compressed) while it wasn't being
+     * watched, eg. "/var/log/app.log.1.gz" when logrotate ran with "compress" while logport was down.
+     *
+     * Siblings of the watched path ("app.log.1", "app.log-20240101.gz", ...) are identified by the saved fingerprint
+     * (the crc32 of the head of the file, which survives renaming and compression), and are read through zlib, which
+     * passes uncompressed files through unchanged. Offsets are those of the uncompressed stream, so the saved offset
+     * of the rotated file is where reading resumes.
+     */
+    class RotatedBacklog{
+
+        public:
+            //the sibling of watch.watched_filepath that holds the file the saved fingerprint belongs to; nullptr if there isn't one
+            static std::unique_ptr<RotatedBacklog> find( const Watch& watch );
+
+            RotatedBacklog( const string& filepath, int64_t offset );  //throws if it can't be opened or skipped to offset
+            ~RotatedBacklog();
+
+            RotatedBacklog( const RotatedBacklog& ) = delete;
+            RotatedBacklog& operator=( const RotatedBacklog& ) = delete;
+
+            ssize_t read( char* buffer, size_t length );  //0 at the end of the (uncompressed) file; throws on a read or decompression error
+
+            const string& getFilepath() const{ return this->filepath; }
+            int64_t getOffset() const{ return this->offset; }  //in the uncompressed stream
+
+        protected:
+            string filepath;
+            gzFile file = nullptr;
+            int64_t offset = 0;
+
+    };
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+using std::string;
+
+#include <string_view>
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include <sys/uio.h>
+
+#include "MessageBatch.h"
+
+
+namespace logport{
+
+    class DeliveryTracker;
+
+
+    /**
+     * Disk-backed queue of undelivered messages (replaces the flat "_undelivered" log).
+     *
+     * Messages are appended as records to fixed-size segment files in one directory (eg. "/var/log/syslog_undelivered.spool/"):
+     *
+     *   [uint32 payload length][uint32 crc32 of the payload][payload]
+     *
+     * Appends are batched into writev() calls. A single reader consumes records from a cursor. Each record read is tracked
+     * with its position in the spool (see DeliveryTracker::trackReplay()), and the cursor that's persisted in its own file
+     * is the position up to which every replayed record has been acknowledged, so an interrupted replay resumes without
+     * losing the records that were still in flight. Segments are deleted once their records have been acknowledged.
+     * Appending and reading may happen at the same time, from different threads.
+     *
+     * The spool is capped at "watch.spool.max.bytes". With the "drop_oldest" policy (the default), the oldest segments
+     * are deleted to make room; with "block", isFull() tells the tailer to stop reading its file until replay catches up.
+     */
+    class Spool{
+
+        public:
+            enum struct FullPolicy{
+                DROP_OLDEST,
+                BLOCK
+            };
+
+            Spool( const string& directory, const map<string,string>& settings );  //throws on failure
+            ~Spool();
+
+            Spool( const Spool& ) = delete;
+            Spool& operator=( const Spool& ) = delete;
+
+            //appends each payload as one record; false (and logged) on failure
+            bool append( const void* payload, size_t length );
+            bool append( const std::string_view* payloads, size_t count );
+
+            /**
+             * Reads whole records from the cursor (at least one, if there is one, even if it's larger than max_bytes) and adds
+             * them to batch, each with a replay ticket from delivery_tracker. Advances the cursor. Returns the payload bytes read.
+             *
+             * A spool is replayed through one tracker only (the first one that reads it); throws if it's given another one.
+             */
+            size_t read( MessageBatch& batch, size_t max_bytes, DeliveryTracker& delivery_tracker );
+
+            //persists the acknowledged replay position of the tracker the spool is replayed through (see read()) if it moved
+            //and deletes the segments that have been read and acknowledged; ignores any other tracker
+            void saveCursor( const DeliveryTracker& delivery_tracker );
+
+            bool hasUnread() const;
+            bool isFull() const;  //only with the BLOCK policy
+            uint64_t getSize() const;  //bytes in the segment files
+            FullPolicy getFullPolicy() const{ return this->full_policy; }
+
+            std::chrono::steady_clock::time_point getLastAppendTime() const;
+
+            const string& getDirectory() const{ return this->directory; }
+
+            static string getDirectoryFor( const string& undelivered_log_filepath );  //eg. "/var/log/syslog_undelivered.spool"
+            static uint64_t getDiskUsage( const string& directory );  //0 if it doesn't exist
+
+        protected:
+            struct Segment{
+                uint64_t sequence;
+                uint64_t size;
+            };
+
+            //called with the mutex held
+            bool openWriteSegment();
+            void closeWriteSegment();
+            bool writeRecords( size_t first_record, size_t count, const std::string_view* payloads );
+            void makeRoom( uint64_t record_bytes );
+            bool dropOldestSegment();  //false if only the segment being written is left
+            void removeReadSegment();  //the oldest unread segment is deleted (eg. dropped to make room)
+            void finishReadSegment();  //the oldest unread segment has been read to its end; kept until its records have been acknowledged
+            static int64_t getPosition( uint64_t sequence, uint64_t offset );
+            bool hasUnreadLocked() const;
+            string getSegmentPath( uint64_t sequence ) const;
+
+            string directory;
+            string cursor_path;
+
+            uint64_t segment_bytes;
+            uint64_t max_bytes;
+            FullPolicy full_policy;
+
+            mutable std::mutex mutex;
+
+            std::deque<Segment> segments;   //oldest first; the last one is being written
+            std::deque<Segment> read_segments;  //read to their ends, but not acknowledged yet; oldest first
+            uint64_t read_segments_bytes = 0;
+            uint64_t total_bytes = 0;       //includes read_segments
+
+            int write_fd = -1;
+
+            //the read cursor
+            uint64_t read_sequence = 0;
+            uint64_t read_offset = 0;
+            int read_fd = -1;
+            uint64_t read_fd_sequence = 0;
+            uint64_t saved_read_sequence = 0;
+            uint64_t saved_read_offset = 0;
+
+            //every record read is tracked by this one, so its acknowledged position is the only one the cursor may be saved at
+            const DeliveryTracker* replay_tracker = nullptr;
+
+            string read_buffer;
+
+            vector<uint32_t> record_headers;  //reused by every append
+            vector<struct iovec> iovecs;
+
+            std::atomic<int64_t> last_append_time_ns{ 0 };
+
+    };
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <map>
+using std::map;
+
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include "DeliveryTracker.h"
+#include "MessageBatch.h"
+#include "Spool.h"
+
+
+namespace logport{
+
+    class Producer;
+
+
+    /**
+     * Replays a spool through a producer, a bounded amount at a time, and saves its cursor at the acknowledged position.
+     *
+     * A spool has exactly one replayer: every replayed record is tracked by its delivery tracker, so the cursor it saves
+     * never passes a record that's still in flight. A FileTailer replays its own watch's spool; a pattern watch replays
+     * the spool its files share (see PatternWatcher), and its files' tailers don't.
+     *
+     * Replay is paced by a token bucket ("watch.spool.replay.bytes.per.second"), waits "watch.spool.replay.backoff.ms"
+     * after a message is spooled (eg. while the brokers are down) and, while the live file is behind, runs at most every
+     * "watch.spool.replay.yield.ms".
+     */
+    class SpoolReplayer{
+
+        public:
+            SpoolReplayer( std::shared_ptr<Spool> spool, Producer& producer, DeliveryTracker& delivery_tracker, const map<string,string>& settings, const string& description );
+
+            SpoolReplayer( const SpoolReplayer& ) = delete;
+            SpoolReplayer& operator=( const SpoolReplayer& ) = delete;
+
+            int64_t getDelayMs() const;  //0 when replay may run now; -1 when there's nothing to replay
+
+            //replays a batch if it's time to; live_reading: the live file has more to read, so replay yields to it
+            void service( bool live_reading );
+
+            //saves the cursor at most every "watch.checkpoint.interval.ms" (unless forced)
+            void saveCursor( bool force = false );
+
+            Spool& getSpool(){ return *this->spool; }
+
+        protected:
+            std::shared_ptr<Spool> spool;
+            Producer& producer;
+            DeliveryTracker& delivery_tracker;
+            string description;  //eg. the watched file; for logs
+
+            int64_t bytes_per_second;
+            int64_t backoff_ms;
+            int64_t yield_ms;
+            int64_t cursor_interval_ms;
+
+            double tokens = 0;
+            std::chrono::steady_clock::time_point tokens_time;
+            std::chrono::steady_clock::time_point last_replay_time;
+            std::chrono::steady_clock::time_point last_cursor_save_time;
+
+            MessageBatch batch;  //reused
+
+    };
+
+}
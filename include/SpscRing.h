@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string_view>
+
+#include <atomic>
+#include <memory>
+
+
+namespace logport{
+
+
+    /**
+     * A bounded, lock-free ring of variable-length records for exactly one writing thread and one reading thread.
+     *
+     * The capacity is in bytes, so the depth of the ring bounds the memory it holds no matter how long its records
+     * are. Records are stored contiguously (a record that doesn't fit before the end of the buffer starts over at
+     * the beginning), so the reader gets each one as a single span without a copy.
+     *
+     * Writer:  char* record = ring.reserve( length );  (nullptr while full)  ...fill it...  ring.commit();
+     * Reader:  std::string_view record;  if( ring.peek(record) ){ ...use it...  ring.release(); }
+     *
+     * Neither side blocks; whoever drives the ring decides how to wait.
+     */
+    class SpscRing{
+
+        public:
+            explicit SpscRing( size_t capacity_bytes );  //rounded up to a power of two (at least 4 KiB)
+
+            SpscRing( const SpscRing& ) = delete;
+            SpscRing& operator=( const SpscRing& ) = delete;
+
+            //writer: room for a record of length bytes, or nullptr until the reader releases enough
+            //a record of up to getMaxRecordBytes() always fits once the ring is empty
+            char* reserve( size_t length );
+            void commit();  //publishes the record returned by the last reserve()
+
+            //reader: the oldest record; valid until release()
+            bool peek( std::string_view& record );
+            void release();
+
+            size_t getCapacity() const{ return this->capacity; }
+            size_t getMaxRecordBytes() const;
+            size_t getUsedBytes() const;  //approximate when called from a third thread
+            size_t getUsedBytesHighWaterMark() const{ return this->used_bytes_high_water_mark.load( std::memory_order_relaxed ); }
+
+        protected:
+            static size_t getRecordBytes( size_t length );  //header + payload, rounded up to keep headers aligned
+
+            const size_t capacity;
+            const size_t mask;
+            std::unique_ptr<char[]> buffer;
+
+            //written by the writer only
+            alignas(64) std::atomic<size_t> head{ 0 };  //total bytes ever committed (including padding)
+            size_t reserved_head = 0;  //head once the reserved record is committed
+            size_t cached_tail = 0;
+            std::atomic<size_t> used_bytes_high_water_mark{ 0 };
+
+            //written by the reader only
+            alignas(64) std::atomic<size_t> tail{ 0 };  //total bytes ever released (including padding)
+            size_t peeked_tail = 0;  //tail once the peeked record is released
+            size_t cached_head = 0;
+
+    };
+
+}
@@ -4,6 +4,8 @@
 #include <string>
 using std::string;
 
+#include <string_view>
+
 #include <vector>
 using std::vector;
 
@@ -14,6 +16,7 @@ using std::vector;
 
 #include "Producer.h"
 #include "UrlList.h"
+#include "JsonEnvelopeEncoder.h"
 
 namespace logport{
 
@@ -72,20 +75,45 @@ namespace logport{
 	        int64_t file_offset;
 	        int64_t last_undelivered_size;
 
+            //fingerprint of the file that file_offset belongs to; 0 inode if unknown (eg. saved by an older version)
+            uint64_t file_inode = 0;
+            uint64_t file_device = 0;
+            uint32_t file_head_hash = 0;        //crc32 of the first file_head_length bytes
+            int64_t file_head_length = 0;
+
+            //multiline records (see MultilineAggregator): indented lines and, with a start pattern, lines that don't match it
+            //are joined onto the record before them; the pattern is a LinePattern (eg. "\d\d\d\d-\d\d-\d\d")
+            bool multiline = false;
+            string multiline_start_pattern;
+
+            //a file found by a pattern watch (id is the pattern watch's); its offset is kept in watch_files
+            bool pattern_file = false;
+
+            //the file name is a glob pattern (eg. "/var/log/app/*.log"); run by a PatternWatcher
+            bool isPattern() const;
+
 	        pid_t pid;
 	        pid_t last_pid;
 
 	    	pid_t start( LogPort* logport );
             void runNow( LogPort* logport ); //blocks; runs in current process
-	    	void stop( LogPort* logport );
 
 	    	void savePid( Database& db );
 	    	void saveOffset( Database& db );
+	    	void saveFileIdentity( Database& db );  //the fingerprint, along with file_offset
+	    	void queueOffset( Database& db ) const;  //saved by the next db.commitOffsets() (eg. once per checkpoint tick)
 	    	void loadOffset( Database& db );
 
 	        void bind( PreparedStatement& statement, bool skip_id = true ) const;
 
-	        string filterLogLine( const string& unfiltered_log_line ) const;
+	        string filterLogLine( std::string_view unfiltered_log_line ) const;
+	        void filterLogLine( std::string_view unfiltered_log_line, string& filtered_log_line ) const;  //reuses filtered_log_line's buffer
+
+            //pre-renders the envelope fields; call after changing hostname, watched_filepath, product_code or log_type
+            void renderEnvelope();
+
+        protected:
+            JsonEnvelopeEncoder envelope_encoder;
 
 	};
 
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+#include <map>
+using std::map;
+
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "Watch.h"
+#include "LevelTriggeredEpollWatcher.h"
+
+
+namespace logport{
+
+    class LogPort;
+
+
+    //a watch is restarted when it goes past these (checked every WATCH_RESOURCE_CHECK_INTERVAL_MS); see MultiFileWatcher for consolidated mode
+    #define WATCH_RESOURCE_CHECK_INTERVAL_MS 60000
+    #define WATCH_MAX_RSS_KB 250000             //250MB
+    #define WATCH_MAX_CPU_TIME_SECONDS 300      //5 minutes
+
+
+    /**
+     * Runs each watch in a process of its own (the default "watch.mode") and restarts it when it exits.
+     *
+     * Everything is driven from one epoll set: a pidfd per child (readable once it exits), a signalfd for the service's
+     * signals and a timerfd armed for the next deadline (a restart backoff, a shutdown deadline or the periodic
+     * resource check). Nothing sleeps:
+     *
+     *   - a watch that exits is restarted right away; one that keeps exiting shortly after it starts backs off (1s, 2s,
+     *     4s, ... up to "watch.restart.backoff.max.ms")
+     *   - stopping (SIGINT/SIGTERM, or SIGUSR1 to pause) signals every watch at once; the ones still running after
+     *     "watch.stop.timeout.ms" are killed
+     *
+     * Children without a pidfd (kernels before 5.3) are reaped on SIGCHLD, through the same signalfd, instead.
+     */
+    class WatchSupervisor{
+
+        public:
+            WatchSupervisor( LogPort* logport );  //throws on failure; blocks the service's signals in this process
+            ~WatchSupervisor();
+
+            WatchSupervisor( const WatchSupervisor& ) = delete;
+            WatchSupervisor& operator=( const WatchSupervisor& ) = delete;
+
+            void run();  //main loop (blocks) until the service is stopped and every watch has exited
+
+        protected:
+            typedef std::chrono::steady_clock::time_point TimePoint;
+
+            enum struct State{
+                STOPPED,
+                RUNNING,
+                STOPPING,   //signaled; killed at kill_time if it hasn't exited
+                WAITING     //restarts at restart_time
+            };
+
+            struct SupervisedWatch{
+                Watch watch;
+                State state = State::STOPPED;
+                int pid_fd = -1;
+                bool removed = false;               //no longer in the database; forgotten once it has exited
+                TimePoint start_time;
+                TimePoint restart_time;
+                TimePoint kill_time;
+                int quick_exits = 0;                //consecutive exits shortly after starting (drives the backoff)
+            };
+
+            void loadWatches();  //starts new watches (and stopped ones, unless paused); stops the ones that were removed
+
+            void startWatch( SupervisedWatch& supervised_watch );
+            void stopWatch( SupervisedWatch& supervised_watch );  //SIGINT; restarted when it exits unless the service is stopping
+            void stopAllWatches();
+            void scheduleRestart( SupervisedWatch& supervised_watch );  //right away, or after the backoff if it keeps exiting
+            void forgetRemovedWatches();
+
+            void handleSignals();
+            void handlePidFd( int pid_fd );
+            void reapChildren();  //SIGCHLD; only the watches without a pidfd
+            void handleExit( SupervisedWatch& supervised_watch, int status );
+
+            void handleTimer();
+            void checkResources();
+            void armTimer();
+
+            bool hasRunningWatches() const;
+
+            LogPort* logport;
+
+            LevelTriggeredEpollWatcher epoll_watcher;
+
+            sigset_t signal_mask;
+            sigset_t previous_signal_mask;
+            int signal_fd = -1;
+            int timer_fd = -1;
+            bool use_pid_fds = true;
+
+            int64_t stop_timeout_ms;
+            int64_t restart_backoff_max_ms;
+
+            vector<std::unique_ptr<SupervisedWatch>> watches;
+            map<int, SupervisedWatch*> watches_by_pid_fd;
+
+            TimePoint next_resource_check_time;
+
+    };
+
+}
@@ -146,6 +146,43 @@ namespace logport{
 	}
 
 
+	string get_parent_directory( const string& filepath ){
+
+		size_t last_slash = filepath.find_last_of( '/' );
+
+		if( last_slash == string::npos ){
+			return ".";
+		}
+
+		if( last_slash == 0 ){
+			return "/";
+		}
+
+		return filepath.substr( 0, last_slash );
+
+	}
+
+
+	string get_file_name( const string& filepath ){
+
+		size_t last_slash = filepath.find_last_of( '/' );
+
+		if( last_slash == string::npos ){
+			return filepath;
+		}
+
+		return filepath.substr( last_slash + 1 );
+
+	}
+
+
+	bool is_glob_pattern( const string& file_name ){
+
+		return file_name.find_first_of( "*?[" ) != string::npos;
+
+	}
+
+
 	vector<string> split_string( const string& source, char delimiter ){
 
 		std::vector<std::string> output;
@@ -407,6 +444,25 @@ namespace logport{
 
 	}
 
+	double proc_stat_get_cpu_time_seconds( pid_t pid ){
+
+		long clock_ticks_per_second = sysconf(_SC_CLK_TCK);
+		if( clock_ticks_per_second <= 0 ){
+			clock_ticks_per_second = 100;
+		}
+
+		vector<string> proc_stats = proc_stat_values( pid );
+		if( proc_stats.size() <= 23 ){
+			return 0;
+		}
+
+		unsigned long user_time_ticks = string_to_ulong( proc_stats[13] );
+		unsigned long kernel_time_ticks = string_to_ulong( proc_stats[14] );
+
+		return double(user_time_ticks + kernel_time_ticks) / double(clock_ticks_per_second);
+
+	}
+
 
 
 	       
@@ -433,6 +489,22 @@ namespace logport{
   		return strtoul( input.c_str(), NULL, 10 );
     }
 
+
+    int64_t get_setting_int64( const map<string,string>& settings, const string& key, int64_t default_value ){
+
+        map<string,string>::const_iterator it = settings.find( key );
+        if( it == settings.end() || it->second.size() == 0 ){
+            return default_value;
+        }
+
+        try{
+            return std::stoll( it->second );
+        }catch( std::exception& ){
+            return default_value;
+        }
+
+    }
+
 }
 
 
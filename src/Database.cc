@@ -9,30 +9,21 @@ using std::string;
 #include "Watch.h"
 #include "PreparedStatement.h"
 
-#include <unistd.h>
+#include <memory>
+#include <algorithm>
 
 
 namespace logport{
 
-    Database::Database(){
-
-        this->db = NULL;
+    //how long a statement waits on another connection's lock before it fails with SQLITE_BUSY
+    #define DATABASE_BUSY_TIMEOUT_MS 10000
 
-        int attempt = 0;
-        int result_code;
 
-        while( attempt < 1000 ){
+    Database::Database(){
 
-            result_code = sqlite3_open_v2( "/usr/local/logport/logport.db", &this->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
-            }
-            usleep(10000);  // 10ms
-            attempt++;
+        this->db = NULL;
 
-        }
-         
+        int result_code = sqlite3_open_v2( "/usr/local/logport/logport.db", &this->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL );
 
         if( result_code != SQLITE_OK ){
 
@@ -49,12 +40,31 @@ namespace logport{
 
         }
 
+        //sqlite's busy handler sleeps with backoff until the lock is released or the timeout passes
+        sqlite3_busy_timeout( this->db, DATABASE_BUSY_TIMEOUT_MS );
+
+        try{
+
+            //readers (eg. the service polling watches) no longer block offset writers, and commits don't fsync the database
+            //journal_mode is persistent; once the database is in WAL mode, this doesn't need the write lock
+            this->execute( "PRAGMA journal_mode=WAL;" );
+            this->execute( "PRAGMA synchronous=NORMAL;" );
+
+        }catch( std::exception& ){
+
+            sqlite3_close( this->db );
+            throw;
+
+        }
 
     }    
 
 
     Database::~Database(){
 
+        //statements must be finalized before the connection is closed
+        this->statement_cache.clear();
+
         sqlite3_close( this->db );
 
     }
@@ -72,7 +82,25 @@ namespace logport{
                 "product_code TEXT, "
                 "log_type TEXT, "
                 "hostname TEXT, "
-                "pid INTEGER DEFAULT -1 "
+                "pid INTEGER DEFAULT -1, "
+                "file_inode INTEGER DEFAULT 0, "
+                "file_device INTEGER DEFAULT 0, "
+                "file_head_hash INTEGER DEFAULT 0, "
+                "file_head_length INTEGER DEFAULT 0, "
+                "multiline INTEGER DEFAULT 0, "
+                "multiline_start_pattern TEXT DEFAULT '' "
+            ")"
+        );
+
+        this->execute( "CREATE TABLE watch_files ( "
+                "watch_id INTEGER NOT NULL, "
+                "filepath TEXT NOT NULL, "
+                "file_offset INTEGER DEFAULT 0, "
+                "file_inode INTEGER DEFAULT 0, "
+                "file_device INTEGER DEFAULT 0, "
+                "file_head_hash INTEGER DEFAULT 0, "
+                "file_head_length INTEGER DEFAULT 0, "
+                "PRIMARY KEY ( watch_id, filepath ) "
             ")"
         );
 
@@ -85,28 +113,65 @@ namespace logport{
     }
 
 
-    void Database::execute( const string& command ){
+    void Database::upgradeDatabase(){
 
-        char *error_message = 0;
+        vector<string> column_names;
+
+        {
+            PreparedStatement statement( *this, "PRAGMA table_info(watches);" );
+            while( statement.step() == SQLITE_ROW ){
+                column_names.push_back( statement.getText(1) );
+            }
+        }
 
-        int attempt = 0;
-        int result_code;
+        if( column_names.empty() ){
+            //not installed yet
+            return;
+        }
 
-        while( attempt < 1000 ){
+        //the fingerprint of the file that each watch's offset belongs to (see FileTailer::open())
+        const char* file_identity_columns[] = { "file_inode", "file_device", "file_head_hash", "file_head_length" };
 
-            result_code = sqlite3_exec( this->db, command.c_str(), NULL, 0, &error_message );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
+        for( const char* column_name : file_identity_columns ){
+            if( std::find(column_names.begin(), column_names.end(), column_name) == column_names.end() ){
+                this->execute( "ALTER TABLE watches ADD COLUMN " + string(column_name) + " INTEGER DEFAULT 0;" );
             }
-            usleep(10000);  // 10ms
-            attempt++;
+        }
 
+        //how each watch joins multiline records (see Watch::multiline)
+        if( std::find(column_names.begin(), column_names.end(), "multiline") == column_names.end() ){
+            this->execute( "ALTER TABLE watches ADD COLUMN multiline INTEGER DEFAULT 0;" );
+        }
+        if( std::find(column_names.begin(), column_names.end(), "multiline_start_pattern") == column_names.end() ){
+            this->execute( "ALTER TABLE watches ADD COLUMN multiline_start_pattern TEXT DEFAULT '';" );
         }
 
+        //the offsets of the files found by pattern watches (see PatternWatcher)
+        this->execute( "CREATE TABLE IF NOT EXISTS watch_files ( "
+                "watch_id INTEGER NOT NULL, "
+                "filepath TEXT NOT NULL, "
+                "file_offset INTEGER DEFAULT 0, "
+                "file_inode INTEGER DEFAULT 0, "
+                "file_device INTEGER DEFAULT 0, "
+                "file_head_hash INTEGER DEFAULT 0, "
+                "file_head_length INTEGER DEFAULT 0, "
+                "PRIMARY KEY ( watch_id, filepath ) "
+            ")"
+        );
+
+    }
+
+
+    void Database::execute( const string& command ){
+
+        char *error_message = 0;
+
+        //waits on locks through the busy handler
+        int result_code = sqlite3_exec( this->db, command.c_str(), NULL, 0, &error_message );
+
         if( result_code != SQLITE_OK ){
 
-            string error_message_string( error_message );
+            string error_message_string( error_message != NULL ? error_message : sqlite3_errmsg(this->db) );
             sqlite3_free( error_message );
 
             throw std::runtime_error( "Sqlite: " + error_message_string );
@@ -154,21 +219,97 @@ namespace logport{
 
     Watch Database::getWatchById( int64_t id ){
 
-        PreparedStatement statement( *this, "SELECT * FROM watches WHERE id = ? ;" );
+        PreparedStatement& statement = this->getCachedStatement( "SELECT * FROM watches WHERE id = ? ;" );
         statement.bindInt64( 0, id );
 
-        while( statement.step() == SQLITE_ROW ){
+        if( statement.step() == SQLITE_ROW ){
 
-            return Watch(statement);
+            Watch watch(statement);
+
+            //ends the read transaction
+            statement.reset();
+
+            return watch;
             
         }
 
+        statement.reset();
+
         throw std::runtime_error( "Watch id not found." );
 
     }
 
 
 
+    void Database::loadWatchFile( Watch& watch ){
+
+        PreparedStatement& statement = this->getCachedStatement( "SELECT file_offset, file_inode, file_device, file_head_hash, file_head_length FROM watch_files WHERE watch_id = ? AND filepath = ? ;" );
+        statement.bindInt64( 0, watch.id );
+        statement.bindText( 1, watch.watched_filepath );
+
+        //a file seen for the first time starts at the beginning
+        watch.file_offset = 0;
+        watch.file_inode = 0;
+        watch.file_device = 0;
+        watch.file_head_hash = 0;
+        watch.file_head_length = 0;
+
+        if( statement.step() == SQLITE_ROW ){
+            watch.file_offset = statement.getInt64( 0 );
+            watch.file_inode = uint64_t( statement.getInt64(1) );
+            watch.file_device = uint64_t( statement.getInt64(2) );
+            watch.file_head_hash = uint32_t( statement.getInt64(3) );
+            watch.file_head_length = statement.getInt64( 4 );
+        }
+
+        //ends the read transaction
+        statement.reset();
+
+    }
+
+
+
+    void Database::saveWatchFile( const Watch& watch ){
+
+        //replaces any offset still queued for this file (it may belong to the previous file at this path)
+        this->queueFileOffset( watch.id, watch.watched_filepath, watch.file_offset );
+
+        PreparedStatement& statement = this->getCachedStatement( "INSERT INTO watch_files ( watch_id, filepath, file_offset, file_inode, file_device, file_head_hash, file_head_length ) VALUES ( ?, ?, ?, ?, ?, ?, ? ) "
+            "ON CONFLICT ( watch_id, filepath ) DO UPDATE SET file_offset = excluded.file_offset, file_inode = excluded.file_inode, file_device = excluded.file_device, file_head_hash = excluded.file_head_hash, file_head_length = excluded.file_head_length ;" );
+
+        statement.bindInt64( 0, watch.id );
+        statement.bindText( 1, watch.watched_filepath );
+        statement.bindInt64( 2, watch.file_offset );
+        statement.bindInt64( 3, int64_t(watch.file_inode) );
+        statement.bindInt64( 4, int64_t(watch.file_device) );
+        statement.bindInt64( 5, int64_t(watch.file_head_hash) );
+        statement.bindInt64( 6, watch.file_head_length );
+
+        statement.step();
+        statement.reset();
+        statement.clearBindings();
+
+    }
+
+
+
+    void Database::forgetWatchFile( int64_t watch_id, const string& filepath ){
+
+        this->queued_file_offsets.erase( std::make_pair(watch_id, filepath) );
+
+        PreparedStatement& statement = this->getCachedStatement( "DELETE FROM watch_files WHERE watch_id = ? AND filepath = ? ;" );
+
+        statement.bindInt64( 0, watch_id );
+        statement.bindText( 1, filepath );
+
+        statement.step();
+        statement.reset();
+        statement.clearBindings();
+
+    }
+
+
+
     map<string,string> Database::getSettings(){
 
         PreparedStatement statement( *this, "SELECT * FROM settings;" );
@@ -206,4 +347,103 @@ namespace logport{
     }
 
 
+
+    PreparedStatement& Database::getCachedStatement( const string& statement_sql ){
+
+        map<string, std::unique_ptr<PreparedStatement>>::iterator it = this->statement_cache.find( statement_sql );
+
+        if( it == this->statement_cache.end() ){
+            it = this->statement_cache.emplace( statement_sql, std::make_unique<PreparedStatement>(*this, statement_sql, SQLITE_PREPARE_PERSISTENT) ).first;
+            return *it->second;
+        }
+
+        PreparedStatement& statement = *it->second;
+
+        //a previous use may have thrown before it was reset; the error it returns again was already reported
+        sqlite3_reset( statement.statement );
+        sqlite3_clear_bindings( statement.statement );
+        statement.last_step_result = SQLITE_ERROR;
+        statement.column_count = 0;
+
+        return statement;
+
+    }
+
+
+
+    void Database::queueOffset( int64_t watch_id, int64_t file_offset ){
+
+        this->queued_offsets[ watch_id ] = file_offset;
+
+    }
+
+
+
+    void Database::queueFileOffset( int64_t watch_id, const string& filepath, int64_t file_offset ){
+
+        this->queued_file_offsets[ std::make_pair(watch_id, filepath) ] = file_offset;
+
+    }
+
+
+
+    void Database::commitOffsets(){
+
+        if( this->queued_offsets.empty() && this->queued_file_offsets.empty() ){
+            return;
+        }
+
+        //take the write lock up front so the updates can't fail halfway on a lock upgrade
+        this->execute( "BEGIN IMMEDIATE;" );
+
+        try{
+
+            PreparedStatement& statement = this->getCachedStatement( "UPDATE watches SET file_offset = ? WHERE id = ? ;" );
+
+            for( const auto& [watch_id, file_offset] : this->queued_offsets ){
+
+                statement.bindInt64( 0, file_offset );
+                statement.bindInt64( 1, watch_id );
+
+                statement.step();
+                statement.reset();
+                statement.clearBindings();
+
+            }
+
+            if( !this->queued_file_offsets.empty() ){
+
+                PreparedStatement& file_statement = this->getCachedStatement( "INSERT INTO watch_files ( watch_id, filepath, file_offset ) VALUES ( ?, ?, ? ) ON CONFLICT ( watch_id, filepath ) DO UPDATE SET file_offset = excluded.file_offset ;" );
+
+                for( const auto& [watch_file, file_offset] : this->queued_file_offsets ){
+
+                    file_statement.bindInt64( 0, watch_file.first );
+                    file_statement.bindText( 1, watch_file.second );
+                    file_statement.bindInt64( 2, file_offset );
+
+                    file_statement.step();
+                    file_statement.reset();
+                    file_statement.clearBindings();
+
+                }
+
+            }
+
+            this->execute( "COMMIT;" );
+
+        }catch( std::exception& ){
+
+            if( !sqlite3_get_autocommit(this->db) ){
+                sqlite3_exec( this->db, "ROLLBACK;", NULL, 0, NULL );
+            }
+            throw;
+
+        }
+
+        this->queued_offsets.clear();
+        this->queued_file_offsets.clear();
+
+    }
+
+
 }
@@ -0,0 +1,159 @@
+#include "DeliveryTracker.h"
+
+
+namespace logport{
+
+
+    DeliveryTracker::DeliveryTracker( int64_t acknowledged_offset )
+        :acknowledged_offset(acknowledged_offset)
+    {
+
+    }
+
+
+    DeliveryTicket* DeliveryTracker::track( int64_t end_offset ){
+
+        std::scoped_lock lock( this->mutex );
+
+        this->tickets.push_back( DeliveryTicket{ this, end_offset, 1 } );
+        this->pending_count++;
+
+        return &this->tickets.back();
+
+    }
+
+
+    DeliveryTicket* DeliveryTracker::trackReplay( int64_t replay_position ){
+
+        std::scoped_lock lock( this->mutex );
+
+        this->tickets.push_back( DeliveryTicket{ this, -1, 1, replay_position } );
+        this->pending_count++;
+
+        return &this->tickets.back();
+
+    }
+
+
+    void DeliveryTracker::acknowledge( DeliveryTicket* ticket ){
+
+        if( ticket == nullptr ) return;
+
+        ticket->tracker->acknowledgeTicket( ticket );
+
+    }
+
+
+    void DeliveryTracker::require( DeliveryTicket* ticket, uint32_t acknowledgements ){
+
+        if( ticket == nullptr ) return;
+
+        ticket->tracker->requireTicket( ticket, acknowledgements );
+
+    }
+
+
+    void DeliveryTracker::acknowledgeTicket( DeliveryTicket* ticket ){
+
+        std::scoped_lock lock( this->mutex );
+
+        if( ticket->pending == 0 ) return;
+
+        ticket->pending--;
+        if( ticket->pending == 0 ){
+            this->advance();
+        }
+
+    }
+
+
+    void DeliveryTracker::requireTicket( DeliveryTicket* ticket, uint32_t acknowledgements ){
+
+        std::scoped_lock lock( this->mutex );
+
+        if( ticket->pending == 0 ) return;
+
+        ticket->pending = acknowledgements;
+        if( ticket->pending == 0 ){
+            //nothing to wait for
+            this->advance();
+        }
+
+    }
+
+
+    void DeliveryTracker::advance(){
+
+        this->pending_count--;
+
+        //move past the contiguous run of acknowledged tickets
+        while( this->tickets.size() && this->tickets.front().pending == 0 ){
+
+            if( this->tickets.front().end_offset >= 0 ){
+                this->acknowledged_offset = this->tickets.front().end_offset;
+            }
+            if( this->tickets.front().replay_position >= 0 ){
+                this->acknowledged_replay_position = this->tickets.front().replay_position;
+            }
+            this->tickets.pop_front();
+
+        }
+
+    }
+
+
+    int64_t DeliveryTracker::getAcknowledgedOffset() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->acknowledged_offset;
+
+    }
+
+
+    int64_t DeliveryTracker::getAcknowledgedReplayPosition() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->acknowledged_replay_position;
+
+    }
+
+
+    size_t DeliveryTracker::getPendingCount() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->pending_count;
+
+    }
+
+
+    void DeliveryTracker::reset( int64_t acknowledged_offset ){
+
+        std::scoped_lock lock( this->mutex );
+
+        for( DeliveryTicket& ticket : this->tickets ){
+            ticket.end_offset = -1;
+        }
+
+        this->acknowledged_offset = acknowledged_offset;
+
+    }
+
+
+
+    void DeliveryTracker::setSpool( std::shared_ptr<Spool> spool ){
+
+        std::scoped_lock lock( this->mutex );
+        this->spool = std::move( spool );
+
+    }
+
+
+    std::shared_ptr<Spool> DeliveryTracker::getSpool() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->spool;
+
+    }
+
+
+}
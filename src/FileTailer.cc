@@ -0,0 +1,1299 @@
+#include "FileTailer.h"
+
+#include <stdexcept>
+
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "Common.h"
+#include "Observer.h"
+#include "LogPort.h"
+#include "Producer.h"
+
+#include "Database.h"
+#include "Watch.h"
+#include "LinePipeline.h"
+#include "RotatedBacklog.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+
+namespace logport{
+
+
+    #define LOG_READ_BUFFER_SIZE 64 * 1024
+
+    //bounds the work done in one service() call so that other files (and producer polls) aren't starved
+    #define MAX_READS_PER_SERVICE 16
+
+    //how much of the head of a file is hashed into its fingerprint (fewer while the file is smaller)
+    #define FILE_HEAD_HASH_BYTES 1024
+
+    //while catching up, the lines of each large read are produced this many bytes at a time (one batch each)
+    #define CATCH_UP_CHUNK_BYTES 1024 * 1024
+
+    //truncated or split lines are counted in the metrics log at most this often
+    #define LONG_LINE_METRIC_INTERVAL_MS 10000
+
+
+    //crc32 of the first length bytes; false if they can't all be read
+    static bool read_head_hash( int fd, int64_t length, uint32_t& head_hash ){
+
+        char head[FILE_HEAD_HASH_BYTES];
+
+        if( length < 0 || length > FILE_HEAD_HASH_BYTES ){
+            return false;
+        }
+
+        int64_t total_read = 0;
+
+        while( total_read < length ){
+
+            ssize_t bytes_read = pread64( fd, head + total_read, size_t(length - total_read), total_read );
+
+            if( bytes_read == -1 && errno == EINTR ){
+                continue;
+            }
+
+            if( bytes_read <= 0 ){
+                return false;
+            }
+
+            total_read += bytes_read;
+
+        }
+
+        head_hash = uint32_t( crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(head), uInt(length)) );
+
+        return true;
+
+    }
+
+
+
+    FileTailer::FileTailer( Producer& producer, Watch& watch, LogPort* logport, DeliveryTracker& delivery_tracker, const map<string,string>& settings )
+        :producer(producer), watch(watch), logport(logport), delivery_tracker(delivery_tracker), settings(settings),
+         watched_file(watch.watched_filepath), undelivered_log(watch.undelivered_log_filepath),
+         last_checkpoint_time(std::chrono::steady_clock::now())
+    {
+
+        //the acknowledged offset is committed at whichever of these limits comes first
+        //eg. "logport set watch.checkpoint.interval.ms 1000"
+        this->checkpoint_interval_ms = get_setting_int64( settings, "watch.checkpoint.interval.ms", 1000 );
+        this->checkpoint_bytes = get_setting_int64( settings, "watch.checkpoint.bytes", 1024 * 1024 );
+
+        //after a rotation, an empty replacement is only followed once the rotated file has been quiet this long (the writer may not have reopened yet)
+        this->rotate_wait_ms = std::max<int64_t>( get_setting_int64(settings, "watch.rotate.wait.ms", 5000), 0 );
+
+        //a file this far behind is read in large sequential reads until it has caught up (0 disables)
+        //eg. "logport set watch.catchup.threshold.bytes 67108864"
+        this->catch_up_threshold_bytes = get_setting_int64( settings, "watch.catchup.threshold.bytes", 64 * 1024 * 1024 );
+        this->catch_up_read_bytes = std::max<int64_t>( get_setting_int64(settings, "watch.catchup.read.bytes", 4 * 1024 * 1024), LOG_READ_BUFFER_SIZE );
+
+        //the rest of a file that was rotated (and compressed) while it wasn't watched is read from its sibling first (0 disables)
+        //eg. "logport set watch.rotated.recover 0"
+        this->recover_rotated = get_setting_int64( settings, "watch.rotated.recover", 1 ) != 0;
+
+        //lines longer than this are truncated (and marked) or split into fragments; the partial line buffer never grows past it
+        //eg. "logport set watch.line.max.bytes 1048576" and "logport set watch.line.long.policy split" (0 is unlimited)
+        const int64_t max_line_bytes = std::max<int64_t>( get_setting_int64(settings, "watch.line.max.bytes", 1024 * 1024), 0 );
+        map<string,string>::const_iterator long_line_policy_it = settings.find( "watch.line.long.policy" );
+        if( long_line_policy_it != settings.end() && long_line_policy_it->second == "split" ){
+            this->line_splitter.setMaxLineBytes( size_t(max_line_bytes), LongLinePolicy::SPLIT );
+        }else{
+            this->line_splitter.setMaxLineBytes( size_t(max_line_bytes), LongLinePolicy::TRUNCATE );
+        }
+        this->last_long_line_report_time = std::chrono::steady_clock::now();
+
+        //multiline records are set per watch (eg. "logport watch --multiline-start-pattern '\d\d\d\d-\d\d-\d\d' /var/log/app.log");
+        //indented lines (and, with a start pattern, lines that don't match it) are joined onto the record before them
+        if( watch.multiline || watch.multiline_start_pattern.size() ){
+
+            LinePattern compiled_start_pattern;
+            try{
+                compiled_start_pattern = LinePattern( watch.multiline_start_pattern );
+            }catch( std::exception& e ){
+                Observer observer;
+                observer.addLogEntry( "logport: invalid multiline start pattern for " + watch.watched_filepath + " (" + string(e.what()) + "); only indented lines continue a record" );
+            }
+
+            const int64_t max_record_bytes = std::max<int64_t>( get_setting_int64(settings, "watch.multiline.max.bytes", 256 * 1024), 1 );
+            this->multiline = std::make_unique<MultilineAggregator>( compiled_start_pattern, size_t(max_record_bytes) );
+
+        }
+
+        this->multiline_flush_ms = std::max<int64_t>( get_setting_int64(settings, "watch.multiline.flush.ms", 1000), 0 );
+
+    }
+
+
+    FileTailer::~FileTailer(){
+
+        this->close();
+
+    }
+
+
+
+    void FileTailer::startPipeline(){
+
+        //eg. "logport set watch.pipeline.encoder.threads 2" (0 reads, encodes and produces on the calling thread)
+        const int64_t encoder_threads = get_setting_int64( this->settings, "watch.pipeline.encoder.threads", 0 );
+        if( encoder_threads <= 0 || this->pipeline ){
+            return;
+        }
+
+        const int64_t ring_bytes = get_setting_int64( this->settings, "watch.pipeline.ring.bytes", 4 * 1024 * 1024 );
+        const int64_t stats_interval_ms = get_setting_int64( this->settings, "watch.pipeline.stats.interval.ms", 10000 );
+
+        this->pipeline = std::make_unique<LinePipeline>( this->producer, this->watch, this->delivery_tracker, this->logport, size_t(encoder_threads), size_t(std::max<int64_t>(ring_bytes, 0)), stats_interval_ms );
+
+    }
+
+
+
+    void FileTailer::drainPipeline(){
+
+        if( this->pipeline ){
+            this->pipeline->drain();
+        }
+
+    }
+
+
+
+    void FileTailer::open( Database& db ){
+
+        char error_string_buffer[1024];
+
+        this->watched_file_fd = ::open( this->watched_file.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
+        if( this->watched_file_fd == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to open log file: errno " + string(error_string_buffer) );
+        }
+
+
+        //set the offset to the last read position
+            {
+
+                struct stat64 file_status;
+                if( fstat64(this->watched_file_fd, &file_status) == -1 ){
+                    snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+                    ::close( this->watched_file_fd );
+                    this->watched_file_fd = -1;
+                    throw std::runtime_error( "Failed to stat log file: errno " + string(error_string_buffer) );
+                }
+
+                const int64_t current_file_size = file_status.st_size;
+
+                Observer observer;
+                observer.addLogEntry( "logport: starting to watch " + this->watched_file + " Filesize(" + logport::to_string<int64_t>(current_file_size) + ") SavedResumePoint(" +  logport::to_string<int64_t>(this->watch.file_offset) + ")" );
+
+                string reset_reason;
+
+                if( this->watch.file_inode != 0 ){
+
+                    //the saved offset belongs to the file with this fingerprint (eg. not to a file that replaced it while we were down)
+                    uint32_t head_hash = 0;
+                    const bool same_inode = uint64_t(file_status.st_ino) == this->watch.file_inode && uint64_t(file_status.st_dev) == this->watch.file_device;
+                    const bool same_head = current_file_size >= this->watch.file_head_length && read_head_hash( this->watched_file_fd, this->watch.file_head_length, head_hash ) && head_hash == this->watch.file_head_hash;
+
+                    if( !same_inode ){
+                        reset_reason = "is not the file the saved offset belongs to (different inode)";
+                    }else if( !same_head ){
+                        reset_reason = "was rewritten since the saved offset (different head of file)";
+                    }
+
+                }
+
+                if( reset_reason.empty() && this->watch.file_offset > current_file_size ){
+                    reset_reason = "is smaller than the saved offset";
+                }
+
+                //the file the saved offset belongs to may have been rotated (and compressed) next to it while we were down
+                if( !reset_reason.empty() && this->recover_rotated && !this->watch.pattern_file ){
+                    try{
+                        this->rotated_backlog = RotatedBacklog::find( this->watch );
+                    }catch( std::exception& e ){
+                        observer.addLogEntry( "logport: failed to open the rotated file for " + this->watched_file + ": " + string(e.what()) );
+                    }
+                }
+
+                if( this->rotated_backlog ){
+
+                    //the saved offset (and fingerprint) stay with the rotated file until it has been read; then this file is read from the beginning
+                    observer.addLogEntry( "logport: " + this->watched_file + " " + reset_reason + ". Resuming the rotated file " + this->rotated_backlog->getFilepath() + " at offset " + logport::to_string<int64_t>(this->watch.file_offset) + " first." );
+
+                }else if( !reset_reason.empty() ){
+
+                    observer.addLogEntry( "logport: " + this->watched_file + " " + reset_reason + ". Resetting to beginning of file." );
+                    this->watch.file_offset = 0;
+
+                }else{
+
+                    off64_t current_file_position = lseek64( this->watched_file_fd, this->watch.file_offset, SEEK_SET );
+
+                    if( current_file_position == -1 ){
+
+                        observer.addLogEntry( "logport: error seeking for " + this->watched_file + ". Resetting to beginning of file." );
+
+                        //error is seeking, reset to 0
+                        this->watch.file_offset = 0;
+
+                    }else{
+
+                        observer.addLogEntry( "logport: resuming seeking for " + this->watched_file + " at offset: " + logport::to_string<off64_t>(current_file_position) + ", filesize: " + logport::to_string<int64_t>(current_file_size) );
+
+                    }
+
+                }
+
+                //the offset saved from here on belongs to this file
+                if( !this->rotated_backlog ){
+                    this->saveFileIdentity( db, file_status );
+                }
+
+            }
+
+
+        //messages are acknowledged against the offsets of the watched file, starting from where we resume
+            this->read_position = this->watch.file_offset;
+            this->delivery_tracker.reset( this->read_position );
+            this->last_checkpoint_offset = this->read_position;
+            this->last_checkpoint_time = std::chrono::steady_clock::now();
+
+
+        //failed messages are spooled from here on; anything already spooled is replayed alongside the watched file
+            this->openSpool();
+
+            if( this->spool_replay && !this->replayer ){
+                this->replayer = std::make_unique<SpoolReplayer>( this->spool, this->producer, this->delivery_tracker, this->settings, this->watched_file );
+            }
+
+            //a pattern watch announces itself once, not for every file it finds (see PatternWatcher)
+            if( !this->watch.pattern_file ){
+                if( this->spool->hasUnread() ){
+                    this->produceLine( "starting up - replaying undelivered messages", -1 );
+                }else{
+                    this->produceLine( "starting up", -1 );
+                }
+            }
+
+        //startup will continue until read = zero bytes
+            this->startup = true;
+
+    }
+
+
+
+    void FileTailer::openSpool(){
+
+        if( this->spool ){
+            return;
+        }
+
+        //the tracker outlives this tailer (eg. when a consolidated watch is reactivated); keep using its spool
+        this->spool = this->delivery_tracker.getSpool();
+        if( this->spool ){
+            return;
+        }
+
+        std::shared_ptr<Spool> new_spool = std::make_shared<Spool>( Spool::getDirectoryFor(this->undelivered_log), this->settings );
+
+        //older versions kept failed messages in a flat file (renamed to "_temp" while it was replayed)
+        this->migrateUndeliveredLog( *new_spool, this->undelivered_log + "_temp" );
+        this->migrateUndeliveredLog( *new_spool, this->undelivered_log );
+
+        this->spool = new_spool;
+        this->delivery_tracker.setSpool( this->spool );
+
+    }
+
+
+
+    //how far a ".migrating" undelivered log has been moved into the spool; 0 if it hasn't been started
+    static uint64_t load_migrated_offset( const string& offset_filepath ){
+
+        unsigned long long migrated_offset = 0;
+
+        FILE* offset_file = fopen( offset_filepath.c_str(), "r" );
+        if( offset_file != NULL ){
+            if( fscanf(offset_file, "%llu", &migrated_offset) != 1 ){
+                migrated_offset = 0;
+            }
+            fclose( offset_file );
+        }
+
+        return uint64_t( migrated_offset );
+
+    }
+
+
+
+    //written atomically (like the spool's cursor), so it's either the old offset or the new one
+    static bool save_migrated_offset( const string& offset_filepath, uint64_t migrated_offset ){
+
+        const string temp_offset_filepath = offset_filepath + ".tmp";
+
+        FILE* offset_file = fopen( temp_offset_filepath.c_str(), "w" );
+        if( offset_file == NULL ){
+            return false;
+        }
+
+        const bool written = fprintf( offset_file, "%llu\n", (unsigned long long)migrated_offset ) > 0;
+
+        return fclose( offset_file ) == 0 && written && rename( temp_offset_filepath.c_str(), offset_filepath.c_str() ) == 0;
+
+    }
+
+
+
+    void FileTailer::migrateUndeliveredLog( Spool& new_spool, const string& undelivered_log_filepath ){
+
+        char error_string_buffer[1024];
+
+        //the file is renamed before it's moved, and the offset moved so far is saved as it goes; an interrupted migration
+        //(eg. a failed read or a crash) resumes where it stopped instead of appending the same messages again
+        const string migrating_filepath = undelivered_log_filepath + ".migrating";
+
+        if( file_exists(migrating_filepath) ){
+            this->migrateUndeliveredFile( new_spool, migrating_filepath );
+        }
+
+        if( !file_exists(undelivered_log_filepath) ){
+            return;
+        }
+
+        //left behind if the last migration stopped between removing the file and its offset
+        unlink( ( migrating_filepath + ".offset" ).c_str() );
+
+        if( rename(undelivered_log_filepath.c_str(), migrating_filepath.c_str()) == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to rename undelivered log " + undelivered_log_filepath + " before moving it into the spool: errno " + string(error_string_buffer) );
+        }
+
+        this->migrateUndeliveredFile( new_spool, migrating_filepath );
+
+    }
+
+
+
+    void FileTailer::migrateUndeliveredFile( Spool& new_spool, const string& migrating_filepath ){
+
+        char error_string_buffer[1024];
+
+        const string offset_filepath = migrating_filepath + ".offset";
+
+        //return 0 if file does not exist
+        const uint64_t undelivered_file_size = get_file_size( migrating_filepath );
+        const uint64_t resume_offset = load_migrated_offset( offset_filepath );
+
+        if( undelivered_file_size <= resume_offset ){
+            //empty, or moved already (and only the removal failed)
+            if( unlink(migrating_filepath.c_str()) == -1 && errno != ENOENT ){
+                snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+                throw std::runtime_error( "Failed to remove undelivered log " + migrating_filepath + " after moving it into the spool: errno " + string(error_string_buffer) );
+            }
+            unlink( offset_filepath.c_str() );
+            return;
+        }
+
+        int undelivered_log_fd = ::open( migrating_filepath.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
+        if( undelivered_log_fd == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to open undelivered log " + migrating_filepath + ": errno " + string(error_string_buffer) );
+        }
+
+        //the saved offset is always at the start of a line
+        if( lseek64(undelivered_log_fd, off64_t(resume_offset), SEEK_SET) == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            ::close( undelivered_log_fd );
+            throw std::runtime_error( "Failed to seek in undelivered log " + migrating_filepath + ": errno " + string(error_string_buffer) );
+        }
+
+        static thread_local char undelivered_read_buffer[LOG_READ_BUFFER_SIZE];
+
+        LineSplitter undelivered_line_splitter;
+        vector<LineSpan> undelivered_lines;
+        vector<std::string_view> payloads;
+        uint64_t read_offset = resume_offset;
+        uint64_t migrated_offset = resume_offset;
+        bool migrated = true;
+
+        while( migrated ){
+
+            ssize_t bytes_read = read( undelivered_log_fd, undelivered_read_buffer, LOG_READ_BUFFER_SIZE );
+
+            if( bytes_read == -1 && errno == EINTR ){
+                continue;
+            }
+
+            if( bytes_read == -1 ){
+                migrated = false;
+                break;
+            }
+
+            if( bytes_read == 0 ){
+                //a partial last line is kept too
+                if( undelivered_line_splitter.getPartialSize() ){
+                    migrated = new_spool.append( undelivered_line_splitter.getPartial().data(), undelivered_line_splitter.getPartialSize() );
+                    if( migrated ){
+                        migrated_offset = read_offset;
+                        migrated = save_migrated_offset( offset_filepath, migrated_offset );
+                    }
+                }
+                break;
+            }
+
+            read_offset += uint64_t( bytes_read );
+
+            undelivered_line_splitter.split( undelivered_read_buffer, size_t(bytes_read), undelivered_lines );
+
+            payloads.clear();
+            for( const LineSpan& line : undelivered_lines ){
+                payloads.push_back( line.text );
+            }
+
+            if( payloads.empty() ){
+                continue;
+            }
+
+            migrated = new_spool.append( payloads.data(), payloads.size() );
+
+            //up to the end of the last whole line; a crash before this is saved appends this chunk's lines again (at most)
+            if( migrated ){
+                migrated_offset = read_offset - undelivered_line_splitter.getPartialSourceBytes();
+                migrated = save_migrated_offset( offset_filepath, migrated_offset );
+            }
+
+        }
+
+        ::close( undelivered_log_fd );
+
+        if( !migrated ){
+            //keep the file (and its offset); the rest is moved on the next start
+            throw std::runtime_error( "Failed to move undelivered log " + migrating_filepath + " into the spool (moved " + logport::to_string<uint64_t>(migrated_offset) + " of " + logport::to_string<uint64_t>(undelivered_file_size) + " bytes)" );
+        }
+
+        //the file goes first: a leftover offset without its file is ignored (see migrateUndeliveredLog())
+        if( unlink(migrating_filepath.c_str()) == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            save_migrated_offset( offset_filepath, undelivered_file_size );
+            throw std::runtime_error( "Failed to remove undelivered log " + migrating_filepath + " after moving it into the spool: errno " + string(error_string_buffer) );
+        }
+        unlink( offset_filepath.c_str() );
+
+        Observer observer;
+        observer.addLogEntry( "logport: moved undelivered log " + migrating_filepath + " (" + logport::to_string<uint64_t>(undelivered_file_size - resume_offset) + " bytes) into the spool" );
+
+    }
+
+
+
+    void FileTailer::close(){
+
+        if( this->watched_file_fd != -1 ){
+            ::close( this->watched_file_fd );
+            this->watched_file_fd = -1;
+        }
+
+    }
+
+
+
+    void FileTailer::reopen( Database& db ){
+
+        //the old file's lines get their tickets before the tracker is reset for the new one
+        this->drainPipeline();
+
+        this->close();
+
+        //the spool carries over to the new file
+
+        this->rotated_backlog.reset();
+        this->line_splitter.clear();
+        if( this->multiline ){
+            this->multiline->clear();
+        }
+        this->catching_up = false;
+        this->startup = true;
+        this->finished = false;
+        this->try_read = false;
+        this->log_being_rotated = false;
+        this->rotation_noticed = false;
+        this->replacement_seen = false;
+
+        this->watch.file_offset = 0;
+
+        this->open( db );
+
+    }
+
+
+
+    void FileTailer::handleInotifyEvent( uint32_t mask ){
+
+        if( mask & IN_MOVE_SELF ){
+            //this is being logrotated
+            this->log_being_rotated = true;
+            this->try_read = true;
+        }
+
+        if( mask & IN_MODIFY || mask & IN_CLOSE_WRITE ){
+            //this is being modified
+            this->try_read = true;
+        }
+
+        if( mask & IN_CREATE || mask & IN_MOVED_TO ){
+            //a file was created at the watched path (forwarded from the parent directory's watch); it may be the replacement of a rotated file
+            this->try_read = true;
+        }
+
+    }
+
+
+
+    bool FileTailer::hasPendingReads() const{
+
+        if( this->finished ){
+            return false;
+        }
+
+        //a rotated file that has been drained only waits for its replacement (see getWaitTimeoutMs())
+        if( ( this->startup || this->try_read ) && !this->isBlocked() ){
+            return true;
+        }
+
+        return this->replayer && this->replayer->getDelayMs() == 0;
+
+    }
+
+
+    bool FileTailer::hasPendingRecord() const{
+
+        return this->multiline && this->multiline->hasPending();
+
+    }
+
+
+    bool FileTailer::isFinished() const{
+
+        return this->finished;
+
+    }
+
+
+    bool FileTailer::isBlocked() const{
+
+        return this->spool && this->spool->isFull();
+
+    }
+
+
+
+    int FileTailer::getWaitTimeoutMs( int idle_timeout_ms ) const{
+
+        if( this->hasPendingReads() ){
+            return 0;
+        }
+
+        int timeout_ms = idle_timeout_ms;
+
+        //wake up when the replay is allowed to continue
+        const int64_t replay_delay_ms = this->replayer ? this->replayer->getDelayMs() : -1;
+        if( replay_delay_ms > 0 && replay_delay_ms < timeout_ms ){
+            timeout_ms = int( replay_delay_ms );
+        }
+
+        //wake up when an empty replacement of the rotated file may be followed
+        if( this->replacement_seen && !this->finished ){
+            const int64_t quiet_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - this->last_data_time ).count();
+            const int64_t rotate_delay_ms = std::max<int64_t>( this->rotate_wait_ms - quiet_ms, 1 );
+            if( rotate_delay_ms < timeout_ms ){
+                timeout_ms = int( rotate_delay_ms );
+            }
+        }
+
+        return timeout_ms;
+
+    }
+
+
+
+    void FileTailer::service( Database& db ){
+
+        if( this->finished ){
+            return;
+        }
+
+        //with the "block" policy, the watched file waits (and inotify events accumulate) until the replay makes room
+        const bool blocked = this->isBlocked();
+        if( blocked != this->blocked ){
+            this->blocked = blocked;
+            Observer observer;
+            if( blocked ){
+                observer.addLogEntry( "logport: spool for " + this->watched_file + " is full; pausing until it has been replayed" );
+            }else{
+                observer.addLogEntry( "logport: spool for " + this->watched_file + " has room; resuming" );
+            }
+        }
+
+        if( !blocked && ( this->startup || this->try_read || this->log_being_rotated ) ){
+            this->readFile( db );
+        }
+
+        //a record is complete once the file has been quiet for a while (checked every tick, so up to a tick later)
+        if( this->hasPendingRecord() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - this->multiline_append_time).count() >= this->multiline_flush_ms ){
+            if( this->multiline->flush(this->multiline_record) ){
+                this->produceLine( this->multiline_record.text, this->multiline_record.end_offset );
+            }
+        }
+
+        //the live file goes first while it's behind (unless it's waiting for the replay to make room in the spool)
+        if( this->replayer ){
+            this->replayer->service( !this->blocked && !this->finished && ( this->startup || this->try_read ) );
+        }
+
+        this->reportLongLines();
+
+    }
+
+
+
+    void FileTailer::reportLongLines(){
+
+        const uint64_t long_lines = this->line_splitter.getLongLineCount();
+        if( long_lines == this->reported_long_lines ){
+            return;
+        }
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if( std::chrono::duration_cast<std::chrono::milliseconds>(now - this->last_long_line_report_time).count() < LONG_LINE_METRIC_INTERVAL_MS ){
+            return;
+        }
+
+        Observer observer;
+        observer.addMetricEntry( "{\"name\":\"watch.long_lines\",\"source\":\"" + escape_to_json_string(this->watched_file) + "\",\"stats\":{\"long_lines\":" + logport::to_string<uint64_t>(long_lines) + ",\"new_long_lines\":" + logport::to_string<uint64_t>(long_lines - this->reported_long_lines) + "}}" );
+
+        this->reported_long_lines = long_lines;
+        this->last_long_line_report_time = now;
+
+    }
+
+
+
+    void FileTailer::readFile( Database& db ){
+
+        //shared by every tailer serviced on this thread; line spans never outlive a single read
+        static thread_local char log_read_buffer[LOG_READ_BUFFER_SIZE];
+
+        if( this->beginRead(db) < 0 ){
+            return;
+        }
+
+        for( int read_count = 0; read_count < MAX_READS_PER_SERVICE; read_count++ ){
+
+            //read some input from the log file
+            ssize_t bytes_read = read( this->watched_file_fd, log_read_buffer, LOG_READ_BUFFER_SIZE );
+
+            if( bytes_read == -1 && errno == EINTR ){
+                continue;
+            }
+
+            if( !this->completeRead(db, log_read_buffer, bytes_read) ){
+                return;
+            }
+
+        }
+
+        //read budget exhausted; there's probably more waiting
+        this->try_read = true;
+
+    }
+
+
+
+    int64_t FileTailer::beginRead( Database& db ){
+
+        if( this->finished || this->blocked || !( this->startup || this->try_read || this->log_being_rotated ) ){
+            return -1;
+        }
+
+        this->try_read = false;
+
+        //the rotated file comes first; its offsets aren't this file's
+        if( this->rotated_backlog ){
+            this->readRotatedBacklog( db );
+            return -1;
+        }
+
+        //copytruncate (or anything else that shrinks the file under us) starts it over
+        const int64_t file_size = this->checkTruncation( db );
+
+        if( this->log_being_rotated && !this->rotation_noticed ){
+            this->rotation_noticed = true;
+            this->last_data_time = std::chrono::steady_clock::now();
+            Observer observer;
+            observer.addLogEntry( "logport: " + this->watched_file + " was rotated; draining it until its replacement is ready" );
+        }
+
+        //far behind (eg. after an outage): large sequential reads until it has caught up, then back to tailing
+        if( this->isCatchingUp(file_size) ){
+            this->readBacklog( file_size );
+            return -1;
+        }
+
+        return std::max<int64_t>( file_size - this->read_position, 0 );
+
+    }
+
+
+
+    bool FileTailer::completeRead( Database& db, const char* data, ssize_t bytes_read ){
+
+        if( bytes_read > 0 ){
+
+            this->produceChunk( data, size_t(bytes_read) );
+
+            if( this->rotation_noticed ){
+                this->last_data_time = std::chrono::steady_clock::now();
+            }
+
+            return true;
+
+        }
+
+
+        //no bytes read (EOF)
+
+        if( this->startup ){
+            //startup will continue until read = zero bytes
+            this->startup = false;
+        }
+
+        if( this->log_being_rotated ){
+
+            //ensure that logrotate has the `delaycompress` option so that trailing bytes are properly drained
+
+            //keep tailing the rotated file (the writer may still be appending to it) until there's a new file to follow
+            if( !this->isReplacementReady() ){
+                return false;
+            }
+
+            //if there's any partial line left over, flush it before moving on
+            this->flushPartialLine();
+
+            //the next file at this path starts at the first byte; the rotated one has been read, so nothing is recovered from it after a restart
+            this->watch.file_offset = 0;
+            this->watch.file_inode = 0;
+            this->watch.file_device = 0;
+            this->watch.file_head_hash = 0;
+            this->watch.file_head_length = 0;
+            try{
+                this->watch.saveFileIdentity( db );
+            }catch( std::exception &e ){
+                Observer observer;
+                observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
+            }
+
+            this->finished = true;
+
+        }
+
+        return false;
+
+    }
+
+
+
+    void FileTailer::produceChunk( const char* data, size_t length ){
+
+        //send multiple lines as multiple messages, produced together as one batch
+        //no partial line will ever be sent; the trailing partial is carried over by the splitter
+        this->line_splitter.split( data, length, this->lines );
+
+        if( !this->pipeline ){
+            this->batch.clear();
+        }
+
+        if( this->multiline ){
+
+            //each record is acknowledged at the offset just past its last line's newline
+            for( const LineSpan& line : this->lines ){
+                const int64_t end_offset = this->read_position + int64_t( line.end );
+                if( this->multiline->add(line.text, this->read_position + line.begin, end_offset, this->multiline_record) ){
+                    this->addRecord( this->multiline_record.text, this->multiline_record.end_offset );
+                }
+            }
+
+            if( this->lines.size() ){
+                this->multiline_append_time = std::chrono::steady_clock::now();
+            }
+
+        }else{
+
+            //each line is acknowledged at the offset just past its newline
+            for( const LineSpan& line : this->lines ){
+                this->addRecord( line.text, this->read_position + int64_t(line.end) );
+            }
+
+        }
+
+        this->read_position += int64_t( length );
+
+        if( this->pipeline ){
+            this->pipeline->endChunk();
+        }else{
+            this->producer.produceBatch( this->batch );
+        }
+
+    }
+
+
+
+    void FileTailer::addRecord( std::string_view record, int64_t end_offset ){
+
+        if( this->pipeline ){
+            //encoded and produced on the pipeline's threads; blocks while its rings are full
+            this->pipeline->push( record, end_offset );
+        }else{
+            this->addLineToBatch( record, end_offset );
+        }
+
+    }
+
+
+
+    bool FileTailer::isCatchingUp( int64_t file_size ){
+
+        if( this->catching_up || this->catch_up_threshold_bytes <= 0 || file_size - this->read_position < this->catch_up_threshold_bytes ){
+            return this->catching_up;
+        }
+
+        this->catching_up = true;
+        this->catch_up_start_time = std::chrono::steady_clock::now();
+        this->catch_up_start_position = this->read_position;
+
+        //the kernel reads ahead further for a file that's read sequentially
+        posix_fadvise64( this->watched_file_fd, this->read_position, 0, POSIX_FADV_SEQUENTIAL );
+
+        Observer observer;
+        observer.addLogEntry( "logport: " + this->watched_file + " is " + logport::to_string<int64_t>(file_size - this->read_position) + " bytes behind; catching up" );
+
+        return true;
+
+    }
+
+
+
+    void FileTailer::readBacklog( int64_t file_size ){
+
+        //shared by every tailer serviced on this thread, like the read buffer; sized on first use
+        static thread_local std::unique_ptr<char[]> backlog_buffer;
+        static thread_local size_t backlog_buffer_size = 0;
+
+        const size_t read_bytes = size_t( this->catch_up_read_bytes );
+        if( backlog_buffer_size < read_bytes ){
+            backlog_buffer.reset( new char[read_bytes] );
+            backlog_buffer_size = read_bytes;
+        }
+
+        //one large read per call (instead of a 64 KiB read per system call); positioned, so the descriptor's offset is left alone until the end
+        const int64_t read_start = this->read_position;
+        const size_t wanted_bytes = size_t( std::min<int64_t>(int64_t(read_bytes), std::max<int64_t>(file_size - read_start, 0)) );
+
+        ssize_t bytes_read = 0;
+        while( size_t(bytes_read) < wanted_bytes ){
+            const ssize_t result = pread64( this->watched_file_fd, backlog_buffer.get() + bytes_read, wanted_bytes - size_t(bytes_read), read_start + bytes_read );
+            if( result == -1 && errno == EINTR ){
+                continue;
+            }
+            if( result <= 0 ){
+                break;
+            }
+            bytes_read += result;
+        }
+
+        //start reading the next range while this one is being produced
+        if( bytes_read > 0 ){
+            posix_fadvise64( this->watched_file_fd, read_start + bytes_read, off64_t(read_bytes), POSIX_FADV_WILLNEED );
+        }
+
+        //the line spans point straight into the buffer; one batch per chunk
+        for( ssize_t chunk_start = 0; chunk_start < bytes_read; chunk_start += CATCH_UP_CHUNK_BYTES ){
+            const size_t chunk_length = std::min<size_t>( CATCH_UP_CHUNK_BYTES, size_t(bytes_read - chunk_start) );
+            this->produceChunk( backlog_buffer.get() + chunk_start, chunk_length );
+        }
+
+        //the backlog won't be read again; don't let it push the rest of the page cache out
+        if( bytes_read > 0 ){
+            posix_fadvise64( this->watched_file_fd, read_start, off64_t(bytes_read), POSIX_FADV_DONTNEED );
+            if( this->rotation_noticed ){
+                this->last_data_time = std::chrono::steady_clock::now();
+            }
+        }
+
+        //within one large read of where the file ended: the regular reads (and inotify) take it from here
+        if( bytes_read <= 0 || file_size - this->read_position < this->catch_up_read_bytes ){
+
+            if( lseek64(this->watched_file_fd, this->read_position, SEEK_SET) == -1 ){
+                char error_string_buffer[1024];
+                snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+                throw std::runtime_error( "Failed to seek log file after catching up: errno " + string(error_string_buffer) );
+            }
+
+            posix_fadvise64( this->watched_file_fd, 0, 0, POSIX_FADV_NORMAL );
+            this->catching_up = false;
+
+            const double elapsed_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - this->catch_up_start_time ).count();
+            Observer observer;
+            observer.addLogEntry( "logport: " + this->watched_file + " caught up; read " + logport::to_string<int64_t>(this->read_position - this->catch_up_start_position) + " bytes in " + logport::to_string<int64_t>(int64_t(elapsed_seconds * 1000)) + "ms" );
+
+        }
+
+        //there's more to read either way
+        this->try_read = true;
+
+    }
+
+
+
+    void FileTailer::readRotatedBacklog( Database& db ){
+
+        //shared by every tailer serviced on this thread; line spans never outlive a single read
+        static thread_local char rotated_read_buffer[LOG_READ_BUFFER_SIZE];
+
+        for( int read_count = 0; read_count < MAX_READS_PER_SERVICE; read_count++ ){
+
+            ssize_t bytes_read = 0;
+
+            try{
+                bytes_read = this->rotated_backlog->read( rotated_read_buffer, LOG_READ_BUFFER_SIZE );
+            }catch( std::exception& e ){
+                //eg. a truncated .gz; whatever was decompressed before the error has been produced
+                Observer observer;
+                observer.addLogEntry( "logport: " + string(e.what()) + ". Moving on to " + this->watched_file + "." );
+            }
+
+            if( bytes_read <= 0 ){
+                this->finishRotatedBacklog( db );
+                return;
+            }
+
+            this->produceChunk( rotated_read_buffer, size_t(bytes_read) );
+
+        }
+
+        //read budget exhausted; there's probably more waiting
+        this->try_read = true;
+
+    }
+
+
+
+    void FileTailer::finishRotatedBacklog( Database& db ){
+
+        //like the end of a rotated file (see completeRead()); its lines get their tickets before the tracker is reset
+        this->flushPartialLine();
+        this->drainPipeline();
+
+        Observer observer;
+        observer.addLogEntry( "logport: finished the rotated file " + this->rotated_backlog->getFilepath() + " at offset " + logport::to_string<int64_t>(this->rotated_backlog->getOffset()) + "; continuing with " + this->watched_file + " from the beginning" );
+
+        this->rotated_backlog.reset();
+
+        struct stat64 file_status;
+        if( fstat64(this->watched_file_fd, &file_status) == -1 || lseek64(this->watched_file_fd, 0, SEEK_SET) == -1 ){
+            char error_string_buffer[1024];
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to rewind log file after its rotated file: errno " + string(error_string_buffer) );
+        }
+
+        this->read_position = 0;
+        this->delivery_tracker.reset( 0 );
+        this->last_checkpoint_offset = 0;
+        this->last_checkpoint_time = std::chrono::steady_clock::now();
+
+        //the offset saved from here on belongs to this file
+        this->watch.file_offset = 0;
+        this->saveFileIdentity( db, file_status );
+
+        this->startup = true;
+        this->try_read = true;
+
+    }
+
+
+
+    int64_t FileTailer::checkTruncation( Database& db ){
+
+        struct stat64 file_status;
+        if( fstat64(this->watched_file_fd, &file_status) == -1 ){
+            return this->read_position;
+        }
+
+        if( file_status.st_size >= this->read_position ){
+            return file_status.st_size;
+        }
+
+        Observer observer;
+        observer.addLogEntry( "logport: " + this->watched_file + " was truncated to " + logport::to_string<int64_t>(file_status.st_size) + " bytes (read up to offset " + logport::to_string<int64_t>(this->read_position) + "). Resetting to beginning of file." );
+
+        //the rest of a partial line is gone with the truncated bytes
+        this->flushPartialLine();
+
+        //lines read before the truncation get their tickets before the tracker is reset
+        this->drainPipeline();
+
+        if( lseek64(this->watched_file_fd, 0, SEEK_SET) == -1 ){
+            char error_string_buffer[1024];
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to seek log file after truncation: errno " + string(error_string_buffer) );
+        }
+
+        //messages still in flight no longer move the acknowledged offset
+        this->read_position = 0;
+        this->catching_up = false;
+        this->delivery_tracker.reset( 0 );
+        this->last_checkpoint_offset = 0;
+        this->last_checkpoint_time = std::chrono::steady_clock::now();
+
+        this->watch.file_offset = 0;
+        this->saveFileIdentity( db, file_status );
+
+        return file_status.st_size;
+
+    }
+
+
+
+    void FileTailer::saveFileIdentity( Database& db, const struct stat64& file_status ){
+
+        uint32_t head_hash = 0;
+        const int64_t head_length = std::min<int64_t>( file_status.st_size, FILE_HEAD_HASH_BYTES );
+
+        if( !read_head_hash(this->watched_file_fd, head_length, head_hash) ){
+            //eg. truncated again in the meantime; the next checkpoint tries again
+            this->watch.file_inode = 0;
+            return;
+        }
+
+        this->watch.file_inode = uint64_t( file_status.st_ino );
+        this->watch.file_device = uint64_t( file_status.st_dev );
+        this->watch.file_head_hash = head_hash;
+        this->watch.file_head_length = head_length;
+
+        try{
+            this->watch.saveFileIdentity( db );
+        }catch( std::exception &e ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
+        }
+
+    }
+
+
+
+    bool FileTailer::isReplacementReady(){
+
+        struct stat64 path_status;
+        if( stat64(this->watched_file.c_str(), &path_status) == -1 ){
+            //not created yet; its IN_CREATE (or IN_MOVED_TO) will wake us up
+            return false;
+        }
+
+        struct stat64 file_status;
+        if( fstat64(this->watched_file_fd, &file_status) == 0 && file_status.st_dev == path_status.st_dev && file_status.st_ino == path_status.st_ino ){
+            //moved back; it's still the file we're reading
+            this->log_being_rotated = false;
+            this->rotation_noticed = false;
+            this->replacement_seen = false;
+            return false;
+        }
+
+        this->replacement_seen = true;
+
+        //the writer has moved on to the new file
+        if( path_status.st_size > 0 ){
+            return true;
+        }
+
+        const int64_t quiet_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - this->last_data_time ).count();
+
+        return quiet_ms >= this->rotate_wait_ms;
+
+    }
+
+
+
+    void FileTailer::flushPartialLine(){
+
+        if( this->multiline ){
+
+            if( this->line_splitter.getPartialSize() ){
+                if( this->multiline->add(this->line_splitter.getPartial(), -1, -1, this->multiline_record) ){
+                    this->produceLine( this->multiline_record.text, this->multiline_record.end_offset );
+                }
+                this->line_splitter.clear();
+            }
+
+            if( this->multiline->flush(this->multiline_record) ){
+                this->produceLine( this->multiline_record.text, this->multiline_record.end_offset );
+            }
+
+            return;
+
+        }
+
+        if( this->line_splitter.getPartialSize() ){
+            this->produceLine( this->line_splitter.getPartial(), -1 );
+            this->line_splitter.clear();
+        }
+
+    }
+
+
+
+    void FileTailer::produceLine( std::string_view line, int64_t end_offset ){
+
+        if( this->pipeline ){
+            //in order with the lines already in the pipeline
+            this->pipeline->push( line, end_offset );
+            this->pipeline->endChunk();
+            return;
+        }
+
+        DeliveryTicket* ticket = this->delivery_tracker.track( end_offset );
+
+        this->watch.filterLogLine( line, this->filtered_line );
+        this->producer.produce( this->filtered_line, ticket );
+
+    }
+
+
+
+    void FileTailer::addLineToBatch( std::string_view line, int64_t end_offset ){
+
+        DeliveryTicket* ticket = this->delivery_tracker.track( end_offset );
+
+        this->watch.filterLogLine( line, this->filtered_line );
+
+        //copied straight into the block the producer sends from, when it has a pool (see KafkaProducer::produceBatch())
+        PayloadPool* payload_pool = this->producer.getPayloadPool();
+
+        if( payload_pool != nullptr ){
+            this->batch.add( payload_pool->acquire(this->filtered_line.data(), this->filtered_line.size(), ticket) );
+        }else{
+            this->batch.add( this->filtered_line, ticket );
+        }
+
+    }
+
+
+
+    void FileTailer::checkpoint( Database& db, bool force ){
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        //replay resumes after the last acknowledged record after a restart
+        if( this->replayer ){
+            this->replayer->saveCursor( force );
+        }
+
+        if( this->log_being_rotated || this->finished ){
+            //offsets in flight belong to the file that was rotated away
+            return;
+        }
+
+        const int64_t acknowledged_offset = this->delivery_tracker.getAcknowledgedOffset();
+
+        if( acknowledged_offset == this->last_checkpoint_offset ){
+            return;
+        }
+
+        const int64_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>( now - this->last_checkpoint_time ).count();
+
+        if( !force && elapsed_ms < this->checkpoint_interval_ms && acknowledged_offset - this->last_checkpoint_offset < this->checkpoint_bytes ){
+            return;
+        }
+
+        //written with the other watches' offsets when the caller commits this tick (a failed commit keeps it queued)
+        this->watch.file_offset = acknowledged_offset;
+        this->watch.queueOffset( db );
+
+        //the fingerprint covers more of the head of the file as the file grows (up to FILE_HEAD_HASH_BYTES); not while it's the rotated file's
+        if( !this->rotated_backlog && ( this->watch.file_inode == 0 || ( this->watch.file_head_length < FILE_HEAD_HASH_BYTES && this->read_position > this->watch.file_head_length ) ) ){
+            struct stat64 file_status;
+            if( fstat64(this->watched_file_fd, &file_status) == 0 ){
+                this->saveFileIdentity( db, file_status );
+            }
+        }
+
+        this->last_checkpoint_offset = acknowledged_offset;
+        this->last_checkpoint_time = now;
+
+    }
+
+
+
+    void FileTailer::saveShutdownOffset( Database& db ){
+
+        //everything read is handed to the producer (which flushes it when it's destroyed)
+        try{
+            this->drainPipeline();
+        }catch( std::exception &e ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to drain the pipeline for " + this->watched_file + " " + string(e.what()) );
+        }
+
+        if( this->replayer ){
+            this->replayer->saveCursor( true );
+        }
+
+        if( this->finished ){
+            //rotated and drained; the offset for the next file (0) has already been saved
+            return;
+        }
+
+        if( this->watched_file_fd == -1 ){
+            return;
+        }
+
+        const int64_t current_file_position = this->read_position;
+        this->watch.file_offset = current_file_position - int64_t( this->line_splitter.getPartialSourceBytes() );
+
+        //a pending multiline record is read again (whole) after a restart
+        if( this->hasPendingRecord() && this->multiline->getPendingBeginOffset() >= 0 ){
+            this->watch.file_offset = std::min( this->watch.file_offset, this->multiline->getPendingBeginOffset() );
+        }
+
+        Observer observer;
+        try{
+            this->watch.saveOffset( db );
+            observer.addLogEntry( "logport: saved " + this->watch.watched_filepath + " offset on shutdown (" + logport::to_string<int64_t>(current_file_position) + ")" );
+        }catch( std::exception &e ){
+            observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
+        }
+
+    }
+
+
+
+    string FileTailer::filterLogLine( std::string_view unfiltered_log_line ) const{
+
+        return this->watch.filterLogLine( unfiltered_log_line );
+
+    }
+
+
+}
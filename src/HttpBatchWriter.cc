@@ -0,0 +1,193 @@
+#include "HttpBatchWriter.h"
+
+#include "Common.h"
+
+#include <zlib.h>
+
+
+namespace logport{
+
+
+    static inline bool is_json_whitespace( char c ){
+
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+
+    }
+
+
+
+    std::string_view HttpBatch::getMessage( size_t index, string& buffer ) const{
+
+        const MessageSpan& span = this->spans[index];
+
+        if( span.metadata_length == 0 ){
+            return std::string_view( this->body.data() + span.offset, span.length );
+        }
+
+        buffer.assign( this->body, span.offset, span.metadata_offset );
+        buffer.append( this->body, span.offset + span.metadata_offset + span.metadata_length, span.length - span.metadata_offset );
+
+        return std::string_view( buffer );
+
+    }
+
+
+
+    bool HttpBatch::compress( int level ){
+
+        z_stream stream{};
+
+        //15 + 16: the deflate stream gets a gzip header and trailer
+        if( deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK ){
+            this->compressed_body.clear();
+            return false;
+        }
+
+        this->compressed_body.resize( deflateBound(&stream, uLong(this->body.size())) );
+
+        stream.next_in = reinterpret_cast<Bytef*>( const_cast<char*>(this->body.data()) );
+        stream.avail_in = uInt( this->body.size() );
+        stream.next_out = reinterpret_cast<Bytef*>( &this->compressed_body[0] );
+        stream.avail_out = uInt( this->compressed_body.size() );
+
+        const int result = deflate( &stream, Z_FINISH );
+        const size_t compressed_bytes = stream.total_out;
+        deflateEnd( &stream );
+
+        if( result != Z_STREAM_END ){
+            this->compressed_body.clear();
+            return false;
+        }
+
+        this->compressed_body.resize( compressed_bytes );
+
+        return true;
+
+    }
+
+
+
+    HttpBatchWriter::HttpBatchWriter( Framing framing, const string& metadata_fields )
+        :framing(framing), metadata_fields(metadata_fields)
+    {
+
+    }
+
+
+
+    void HttpBatchWriter::append( std::string_view message, DeliveryTicket* ticket ){
+
+        string& body = this->batch.body;
+
+        if( this->batch.tickets.empty() ){
+            body.assign( this->framing == Framing::RECORDS ? "{\"records\":[" : "{\"messages\":[" );
+        }else{
+            body += ',';
+        }
+
+        this->batch.tickets.push_back( ticket );
+
+        if( this->framing == Framing::MESSAGES ){
+            this->batch.spans.push_back( HttpBatch::MessageSpan{ body.size(), message.size(), 0, 0 } );
+            body.append( message.data(), message.size() );
+            return;
+        }
+
+        body.append( "{\"value\":" );
+
+        HttpBatch::MessageSpan span{ body.size(), message.size(), 0, 0 };
+
+        //the closing brace of the message's object, if it is one
+        size_t close_position = message.size();
+        while( close_position > 0 && is_json_whitespace(message[close_position - 1]) ){
+            close_position--;
+        }
+
+        if( this->metadata_fields.empty() || close_position == 0 || message[close_position - 1] != '}' ){
+
+            body.append( message.data(), message.size() );
+
+        }else{
+
+            close_position--;
+
+            //an empty object takes the fields without the leading comma
+            size_t last_position = close_position;
+            while( last_position > 0 && is_json_whitespace(message[last_position - 1]) ){
+                last_position--;
+            }
+            const bool empty_object = last_position > 0 && message[last_position - 1] == '{';
+
+            body.append( message.data(), close_position );
+            if( empty_object ){
+                body.append( this->metadata_fields, 1, string::npos );
+            }else{
+                body.append( this->metadata_fields );
+            }
+            body.append( message.data() + close_position, message.size() - close_position );
+
+            span.metadata_offset = close_position;
+            span.metadata_length = empty_object ? this->metadata_fields.size() - 1 : this->metadata_fields.size();
+
+        }
+
+        this->batch.spans.push_back( span );
+
+        body += '}';
+
+    }
+
+
+
+    size_t HttpBatchWriter::predictBodySize( size_t message_bytes ) const{
+
+        const bool records = this->framing == Framing::RECORDS;
+
+        size_t message_count = this->batch.tickets.size();
+        size_t size = message_count ? this->batch.body.size() : ( records ? sizeof("{\"records\":[") : sizeof("{\"messages\":[") ) - 1;
+
+        if( message_bytes ){
+            //the separator, the record wrapper and (if it's an object) the metadata
+            size += ( message_count ? 1 : 0 ) + message_bytes + ( records ? sizeof("{\"value\":}") - 1 + this->metadata_fields.size() : 0 );
+            message_count++;
+        }
+
+        if( records ){
+            return size + sizeof("]}") - 1;
+        }
+
+        //"],\"count\":N}"
+        return size + sizeof("],\"count\":}") - 1 + logport::to_string<size_t>(message_count).size();
+
+    }
+
+
+
+    HttpBatch HttpBatchWriter::finish(){
+
+        string& body = this->batch.body;
+
+        if( this->batch.tickets.empty() ){
+            body.assign( this->framing == Framing::RECORDS ? "{\"records\":[" : "{\"messages\":[" );
+        }
+
+        if( this->framing == Framing::RECORDS ){
+            body.append( "]}" );
+        }else{
+            body.append( "],\"count\":" + logport::to_string<size_t>(this->batch.tickets.size()) + "}" );
+        }
+
+        HttpBatch finished = std::move( this->batch );
+
+        //about the same size next time
+        this->batch = HttpBatch();
+        this->batch.body.reserve( finished.body.size() );
+        this->batch.tickets.reserve( finished.tickets.size() );
+        this->batch.spans.reserve( finished.spans.size() );
+
+        return finished;
+
+    }
+
+
+}
@@ -27,11 +27,112 @@ using std::endl;
 
 #include <chrono>
 #include <thread>
+#include <random>
 
 
 namespace logport{
 
 
+    enum struct HttpOutcome{
+        DELIVERED,
+        RETRY,      //no response (eg. connection refused or timed out), or a response that may succeed later
+        REJECTED    //the same request would be rejected again (eg. 400 or 413)
+    };
+
+
+    static HttpOutcome classify_result( const httplib::Result& result ){
+
+        if( !result ){
+            return HttpOutcome::RETRY;
+        }
+
+        const int status = result->status;
+
+        if( status >= 200 && status < 300 ){
+            return HttpOutcome::DELIVERED;
+        }
+
+        //request timeout, too early, too many requests, and server errors
+        if( status == 408 || status == 425 || status == 429 || status >= 500 ){
+            return HttpOutcome::RETRY;
+        }
+
+        return HttpOutcome::REJECTED;
+
+    }
+
+
+    //a delay requested with Retry-After (in seconds; the http-date form is ignored); 0 if there isn't one
+    static int64_t get_retry_after_ms( const httplib::Result& result ){
+
+        if( !result || !result->has_header("Retry-After") ){
+            return 0;
+        }
+
+        const string retry_after = result->get_header_value( "Retry-After" );
+        if( retry_after.empty() || retry_after.size() > 6 || retry_after.find_first_not_of("0123456789") != string::npos ){
+            return 0;
+        }
+
+        return std::stoll( retry_after ) * 1000;
+
+    }
+
+
+    //"full jitter" between half the backoff and the backoff, so the targets' retries don't synchronize
+    static int64_t get_jittered_backoff_ms( int64_t backoff_ms ){
+
+        static thread_local std::minstd_rand generator{ std::random_device{}() };
+
+        if( backoff_ms < 2 ){
+            return backoff_ms;
+        }
+
+        std::uniform_int_distribution<int64_t> distribution( backoff_ms / 2, backoff_ms );
+
+        return distribution( generator );
+
+    }
+
+
+    //the request may not outlast timeout_ms (each of connecting, writing and reading is bounded by it)
+    template <typename Client>
+    static httplib::Result post_within( Client& client, const HttpProducer::HttpConnection& connection, const httplib::Headers& headers, const string& body, int64_t timeout_ms ){
+
+        const time_t seconds = static_cast<time_t>( timeout_ms / 1000 );
+        const time_t microseconds = static_cast<time_t>( (timeout_ms % 1000) * 1000 );
+
+        client.set_connection_timeout( seconds, microseconds );
+        client.set_write_timeout( seconds, microseconds );
+        client.set_read_timeout( seconds, microseconds );
+
+        return client.Post( connection.full_path_template.c_str(), headers, body, connection.format_str.c_str() );
+
+    }
+
+
+
+    string HttpProducer::HttpTargetStats::toJson() const{
+
+        return "{\"batches_delivered\":" + logport::to_string<uint64_t>(this->batches_delivered) +
+            ",\"messages_delivered\":" + logport::to_string<uint64_t>(this->messages_delivered) +
+            ",\"batches_undelivered\":" + logport::to_string<uint64_t>(this->batches_undelivered) +
+            ",\"messages_undelivered\":" + logport::to_string<uint64_t>(this->messages_undelivered) +
+            ",\"retries\":" + logport::to_string<uint64_t>(this->retries) +
+            ",\"in_flight\":" + logport::to_string<size_t>(this->in_flight) +
+            ",\"last_status\":" + logport::to_string<int>(this->last_status) +
+            ",\"latency_batches\":" + logport::to_string<uint64_t>(this->latency_batches) +
+            ",\"latency_avg_ms\":" + logport::to_string<int64_t>(this->latency_batches ? this->latency_total_ms / int64_t(this->latency_batches) : 0) +
+            ",\"latency_max_ms\":" + logport::to_string<int64_t>(this->latency_max_ms) +
+            ",\"latency_ewma_ms\":" + logport::to_string<int64_t>(static_cast<int64_t>(this->latency_ewma_ms)) +
+            ",\"error_rate\":" + logport::to_string<double>(this->error_rate) +
+            ",\"ejections\":" + logport::to_string<uint64_t>(this->ejections) +
+            ",\"ejected\":" + string(this->ejected ? "true" : "false") +
+            "}";
+
+    }
+
+
 
 
 
@@ -45,9 +146,20 @@ namespace logport{
         //    "logport settings"
         http_settings["message.timeout.ms"] = "5000";   //5 seconds; this must be shorter than the timeout for flush below (in the deconstructor) or messages will be lost and not recorded in the undelivered_log
         http_settings["batch.num.messages"] = "1000";
+        http_settings["batch.max.bytes"] = "1048576";  //request body (before compression); a batch is sent before a message would take it past this
+        http_settings["linger.ms"] = "1000";  //a batch that isn't full is sent this long after its first message
         http_settings["compress"] = "true";  //gzip request
         http_settings["format"] = "application/json";
         http_settings["metadata"] = "{}"; //json metadata that will be sent with each message (if keys set)
+        http_settings["max.in.flight"] = "4";  //requests outstanding per target; produce() blocks while they're all busy
+        http_settings["retries"] = "2147483647";  //failed requests are retried until message.timeout.ms runs out
+        http_settings["retry.backoff.ms"] = "100";  //doubled on each retry of a batch (with jitter)
+        http_settings["retry.backoff.max.ms"] = "1000";
+        http_settings["stats.interval.ms"] = "60000";  //per target delivery stats in the metrics log; 0 disables them
+        http_settings["dispatch"] = "fanout";  //fanout, round_robin, least_inflight or failover
+        http_settings["breaker.failures"] = "5";  //consecutive failed requests that eject a target (not with fanout)
+        http_settings["breaker.latency.ms"] = "2000";  //smoothed request latency that ejects a target; 0 disables
+        http_settings["breaker.open.ms"] = "10000";  //how long a target stays ejected before it's probed
 
 
         //copy over the overridden logport http producer settings
@@ -63,14 +175,37 @@ namespace logport{
         }
         this->settings = http_settings;
 
-        bool compress = true;
         if( this->settings.count("compress") ){
             const string compress_str = this->settings.at("compress");
             if( compress_str == "false" ){
-                compress = false;
+                this->compress = false;
             }
         }
 
+        this->message_timeout_ms = std::max<int64_t>( get_setting_int64(this->settings, "message.timeout.ms", 5000), 1 );
+        this->max_retries = std::max<int64_t>( get_setting_int64(this->settings, "retries", 2147483647), 0 );
+        this->retry_backoff_ms = std::max<int64_t>( get_setting_int64(this->settings, "retry.backoff.ms", 100), 1 );
+        this->retry_backoff_max_ms = std::max<int64_t>( get_setting_int64(this->settings, "retry.backoff.max.ms", 1000), this->retry_backoff_ms );
+        this->stats_interval_ms = get_setting_int64( this->settings, "stats.interval.ms", 60000 );
+        this->batch_max_bytes = static_cast<size_t>( std::clamp<int64_t>(get_setting_int64(this->settings, "batch.max.bytes", 1048576), 1024, 1073741824) );
+        this->linger_ms = std::max<int64_t>( get_setting_int64(this->settings, "linger.ms", 1000), 0 );
+
+        const string dispatch_str = this->settings["dispatch"];
+        if( dispatch_str == "round_robin" ){
+            this->dispatch = DispatchMode::ROUND_ROBIN;
+        }else if( dispatch_str == "least_inflight" ){
+            this->dispatch = DispatchMode::LEAST_INFLIGHT;
+        }else if( dispatch_str == "failover" ){
+            this->dispatch = DispatchMode::FAILOVER;
+        }else{
+            this->dispatch = DispatchMode::FANOUT;
+        }
+        this->breaker_failures = std::max<int64_t>( get_setting_int64(this->settings, "breaker.failures", 5), 1 );
+        this->breaker_latency_ms = std::max<int64_t>( get_setting_int64(this->settings, "breaker.latency.ms", 2000), 0 );
+        this->breaker_open_ms = std::max<int64_t>( get_setting_int64(this->settings, "breaker.open.ms", 10000), 1 );
+
+        const size_t max_in_flight = static_cast<size_t>( std::clamp<int64_t>(get_setting_int64(this->settings, "max.in.flight", 4), 1, 100) );
+
         //create the connections
 
         uint32_t batch_size = 1000;
@@ -83,15 +218,19 @@ namespace logport{
         }catch( std::exception& ){
 
         }
+        this->batch_size = batch_size;
 
-        json metadata = json::object();
+        //pre-rendered once; spliced into every record (see HttpBatchWriter)
+        string metadata_fields;
         try{
             const string metadata_str = this->settings["metadata"];
             json metadata_temp = json::parse( metadata_str );
             if( !metadata_temp.is_object() ){
                 throw std::runtime_error("Metadata JSON expects a JSON object.");
             }
-            metadata = metadata_temp;
+            for( const auto& [key, value] : metadata_temp.items() ){
+                metadata_fields += "," + json(key).dump() + ":" + value.dump();
+            }
         }catch( std::exception& e ){
             //failed to parse metadata
             throw e;
@@ -130,7 +269,7 @@ namespace logport{
             connection.format = format;
             connection.format_str = format_str;
             connection.secure = secure;
-            connection.compress = compress;
+            connection.compress = this->compress;
             connection.request_headers_template = httplib::Headers{
                 { "Host", hostname },
                 { "User-Agent", "logport" }
@@ -145,20 +284,29 @@ namespace logport{
 
             connection.full_path_template = connection.url.getFullPath();
             connection.batch_size = batch_size;
+            connection.description = scheme + "://" + hostname + ":" + logport::to_string<unsigned short>(port) + path;
+
+            //the body is compressed once in flush() (for every target), not by each client
+            for( size_t x = 0; x < max_in_flight; x++ ){
+
+                HttpClient client;
+
+                if( connection.secure ){
+                    client.https_client = std::make_unique<httplib::SSLClient>( hostname, port );
+                    client.https_client->set_keep_alive(true);
+                    client.https_client->set_follow_location(true);
+                    client.https_client->set_compress(false);
+                }else{
+                    client.client = std::make_unique<httplib::Client>( hostname, port );
+                    client.client->set_keep_alive(true);
+                    client.client->set_follow_location(true);
+                    client.client->set_compress(false);
+                }
 
-            if( connection.secure ){
-                connection.https_client = std::make_unique<httplib::SSLClient>( hostname, port );
-                connection.https_client->set_keep_alive(true);
-                connection.https_client->set_follow_location(true);
-                connection.https_client->set_compress(connection.compress);
-            }else{
-                connection.client = std::make_unique<httplib::Client>( hostname, port );
-                connection.client->set_keep_alive(true);
-                connection.client->set_follow_location(true);
-                connection.client->set_compress(connection.compress);
-            }
+                connection.clients.push_back( std::move(client) );
+                connection.idle_clients.push_back( x );
 
-            connection.metadata = metadata;
+            }
 
             this->connections.push_back( std::move(connection) );
 
@@ -166,6 +314,10 @@ namespace logport{
 
         }
 
+        this->batch_writer = HttpBatchWriter( format == FormatType::KAFKA_JSON_V2_JSON ? HttpBatchWriter::Framing::RECORDS : HttpBatchWriter::Framing::MESSAGES, metadata_fields );
+
+        //connections aren't added or removed after this
+        this->linger_thread = std::thread( [this]{ this->runLinger(); } );
 
     }
 
@@ -175,9 +327,25 @@ namespace logport{
 
         this->logport->getObserver().addLogEntry( "Flushing final HTTP messages." );
 
+        {
+            std::scoped_lock lock( this->model_mutex );
+            this->linger_stopping = true;
+        }
+        this->linger_changed.notify_all();
+        this->linger_thread.join();
+
         //rd_kafka_flush(this->rk, 6 * 1000 /* wait for max 6 seconds */);
         //this wait must be longer than the message.timeout.ms in the conf above or the messages will be lost and not stored in the undelivered_log
 
+        try{
+            this->flush();
+        }catch( const std::exception& e ){
+            this->logport->getObserver().addLogEntry( string("Logport: failed to flush final http messages: ") + e.what() );
+        }
+
+        //failed batches are written to the undelivered log, so it stays open until every request has completed
+        this->pool.wait_for_tasks();
+
         if( this->undelivered_log_open ){
             close( this->undelivered_log_fd );
             this->undelivered_log_open = false;
@@ -189,40 +357,159 @@ namespace logport{
 
 
 
-    void HttpProducer::produce( const string& message ){
+    void HttpProducer::produce( const string& message, DeliveryTicket* ticket ){
 
-        if( message.size() == 0 ) return;
+        if( message.size() == 0 ){
+            DeliveryTracker::acknowledge( ticket );
+            return;
+        }
 
-        for( auto& connection : this->connections ){
+        //every target (or, unless it's fanned out, any one of them) must accept the message before it counts as delivered
+        DeliveryTracker::require( ticket, this->getRequiredAcknowledgements() );
 
-            try{
+        if( this->connections.empty() ){
+            return;
+        }
+
+        try{
+
+            bool appended = false;
+
+            while( !appended ){
 
                 bool should_flush = false;
 
                 {
-                    //critical section on connection.messages
+                    //critical section on batch_writer
                     std::scoped_lock lock( this->model_mutex );
-                    connection.messages.push_back( message );
-                    if( connection.messages.size() == connection.batch_size ){
-                        should_flush = true;
-                    }
+                    appended = this->appendMessage( message, ticket, should_flush );
                 }
 
                 if( should_flush ){
                     //cout << "io flush" << endl;
-                    this->flush( &connection );  //this will lock on the mutex too
+                    this->flush();  //this will lock on the mutex too
                 }
 
-            }catch( const std::exception& e ){
+            }
+
+        }catch( const std::exception& e ){
 
-                const string error_message = string("Logport: failed to send log lines to http target: ") + string(e.what());
-                cerr << error_message << '\n';
-                this->logport->getObserver().addLogEntry( error_message );
+            const string error_message = string("Logport: failed to send log lines to http target: ") + string(e.what());
+            cerr << error_message << '\n';
+            this->logport->getObserver().addLogEntry( error_message );
 
+        }
+
+    }
+
+
+
+    void HttpProducer::produceBatch( MessageBatch& batch ){
+
+        //every target (or, unless it's fanned out, any one of them) must accept each message before it counts as delivered
+        for( size_t x = 0; x < batch.size(); x++ ){
+            if( batch.getMessage(x).size() ){
+                DeliveryTracker::require( batch.getTicket(x), this->getRequiredAcknowledgements() );
+            }else{
+                DeliveryTracker::acknowledge( batch.getTicket(x) );
             }
+        }
 
+        if( this->connections.empty() ){
+            return;
         }
 
+        try{
+
+            size_t x = 0;
+
+            while( x < batch.size() ){
+
+                bool should_flush = false;
+
+                {
+                    //critical section on batch_writer; released to flush a full batch
+                    std::scoped_lock lock( this->model_mutex );
+
+                    while( x < batch.size() && !should_flush ){
+
+                        const std::string_view message = batch.getMessage( x );
+
+                        if( message.size() == 0 || this->appendMessage(message, batch.getTicket(x), should_flush) ){
+                            x++;
+                        }
+
+                    }
+                }
+
+                if( should_flush ){
+                    this->flush();  //this will lock on the mutex too
+                }
+
+            }
+
+        }catch( const std::exception& e ){
+
+            const string error_message = string("Logport: failed to send log lines to http target: ") + string(e.what());
+            cerr << error_message << '\n';
+            this->logport->getObserver().addLogEntry( error_message );
+
+        }
+
+    }
+
+
+
+    bool HttpProducer::appendMessage( std::string_view message, DeliveryTicket* ticket, bool& should_flush ){
+
+        //cut the batch before the body would grow past batch.max.bytes (a message that's larger on its own is sent by itself)
+        if( !this->batch_writer.empty() && this->batch_writer.predictBodySize(message.size()) > this->batch_max_bytes ){
+            should_flush = true;
+            return false;
+        }
+
+        if( this->batch_writer.empty() ){
+            this->linger_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->linger_ms );
+            this->linger_changed.notify_one();
+        }
+
+        this->batch_writer.append( message, ticket );
+
+        should_flush = this->batch_writer.getMessageCount() >= this->batch_size || this->batch_writer.predictBodySize() >= this->batch_max_bytes;
+
+        return true;
+
+    }
+
+
+
+    void HttpProducer::runLinger(){
+
+        std::unique_lock<std::mutex> lock( this->model_mutex );
+
+        while( !this->linger_stopping ){
+
+            if( this->batch_writer.empty() ){
+                this->linger_changed.wait( lock );
+                continue;
+            }
+
+            if( std::chrono::steady_clock::now() < this->linger_deadline ){
+                this->linger_changed.wait_until( lock, this->linger_deadline );
+                continue;
+            }
+
+            lock.unlock();
+
+            try{
+                this->flush();  //this will lock on the mutex too
+            }catch( const std::exception& e ){
+                this->logport->getObserver().addLogEntry( string("Logport: failed to send log lines to http target: ") + e.what() );
+            }
+
+            lock.lock();
+
+        }
 
     }
 
@@ -235,23 +522,50 @@ namespace logport{
 
         //std::this_thread::sleep_for( std::chrono::milliseconds(1000) );
 
-        for( auto& connection : this->connections ){
+        //batches are sent by size or by linger.ms (see runLinger()), not on this call's schedule
 
-            bool should_flush = false;
+        if( this->stats_interval_ms > 0 ){
 
-            {
-                //critical section on connection.messages
-                std::scoped_lock lock( this->model_mutex );
-                if( connection.messages.size() > 0 ){
-                    should_flush = true;
+            const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+            int64_t next_stats_ms = this->next_stats_ms;
+
+            //poll() may be called from several threads; only one of them reports
+            if( now_ms >= next_stats_ms && this->next_stats_ms.compare_exchange_strong(next_stats_ms, now_ms + this->stats_interval_ms) ){
+                if( next_stats_ms != 0 ){  //skip the first poll
+                    this->addTargetMetrics();
                 }
             }
 
-            if( should_flush ){
-                //cout << "poll flush" << endl;
-                this->flush( &connection );  //this will lock on the mutex too
+        }
+
+    }
+
+
+
+    void HttpProducer::addTargetMetrics(){
+
+        vector<string> metrics;
+
+        {
+            std::scoped_lock lock( this->model_mutex );
+
+            for( auto& connection : this->connections ){
+
+                connection.stats.in_flight = connection.clients.size() - connection.idle_clients.size();
+                connection.stats.ejected = connection.ejected;
+
+                metrics.push_back( "{\"name\":\"http.target\",\"target\":\"" + escape_to_json_string(connection.description) + "\",\"stats\":" + connection.stats.toJson() + "}" );
+
+                //latency is reported per interval; the counts are totals
+                connection.stats.latency_batches = 0;
+                connection.stats.latency_total_ms = 0;
+                connection.stats.latency_max_ms = 0;
+
             }
+        }
 
+        for( const string& metric : metrics ){
+            this->logport->getObserver().addMetricEntry( metric );
         }
 
     }
@@ -287,62 +601,372 @@ namespace logport{
 
 
 
-    void HttpProducer::flush( HttpConnection* connection ){
+    void HttpProducer::flush(){
 
-        json batch_json = json::object();
-        json messages_json = json::array();
+        //shared by the requests to every target; released when the last of them completes
+        auto batch = std::make_shared<HttpBatch>();
 
         {
-            //critical section on connection->messages
+            //critical section on batch_writer
             std::scoped_lock lock( this->model_mutex );
 
-            switch( connection->format ){
+            if( this->batch_writer.empty() ){
+                return;  //eg. another thread flushed it first
+            }
+
+            //the messages were encoded by the watch (see JsonEnvelopeEncoder); they're framed as they are, not parsed again
+            *batch = this->batch_writer.finish();
+        }
+
+        //once for every target; sent uncompressed if zlib fails
+        if( this->compress ){
+            batch->compress();
+        }
+
+        const size_t target_count = this->dispatch == DispatchMode::FANOUT ? this->connections.size() : 1;
+
+        for( size_t x = 0; x < target_count; x++ ){
+
+            HttpConnection* target = nullptr;
+            size_t client_index = 0;
 
-                case FormatType::KAFKA_JSON_V2_JSON:
-                    for( const auto& message : connection->messages ){
-                        json record = json::object();
-                        json temp_object = json::parse(message);
-                        if( connection->metadata.size() > 0 ){
-                            for( const auto& [key, value] : connection->metadata.items() ){
-                                temp_object[key] = value;
-                            }
+            {
+                std::unique_lock<std::mutex> lock( this->model_mutex );
+
+                //backpressure: the caller (ie. the watch) waits for a request to complete
+                if( this->dispatch == DispatchMode::FANOUT ){
+                    target = &this->connections[x];
+                    this->client_released.wait( lock, [target]{ return !target->idle_clients.empty(); } );
+                }else{
+                    this->client_released.wait( lock, [this, &target]{ target = this->selectTarget(nullptr, true); return target != nullptr; } );
+                }
+
+                client_index = target->idle_clients.back();
+                target->idle_clients.pop_back();
+
+                if( target->ejected ){
+                    target->probing = true;
+                }
+            }
+
+            const std::chrono::steady_clock::time_point cut_time = std::chrono::steady_clock::now();
+
+            this->pool.push_task([ this, target, client_index, batch, cut_time ]{
+                this->deliver( target, client_index, *batch, cut_time );
+            });
+
+        }
+
+    }
+
+
+
+    HttpProducer::HttpConnection* HttpProducer::selectTarget( const HttpConnection* excluded, bool last_resort ){
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        const size_t target_count = this->connections.size();
+
+        //healthy, or ejected long enough ago to be probed (once)
+        auto is_usable = [now, excluded]( const HttpConnection& connection ){
+            if( &connection == excluded ){
+                return false;
+            }
+            return !connection.ejected || ( now >= connection.ejected_until && !connection.probing );
+        };
+
+        //usable, with a client free right now
+        auto is_available = [&is_usable]( const HttpConnection& connection ){
+            return !connection.idle_clients.empty() && is_usable( connection );
+        };
+
+        HttpConnection* selected = nullptr;
+
+        switch( this->dispatch ){
+
+            case DispatchMode::ROUND_ROBIN:
+                for( size_t x = 0; x < target_count; x++ ){
+                    const size_t index = ( this->next_target + x ) % target_count;
+                    if( is_available(this->connections[index]) ){
+                        selected = &this->connections[index];
+                        this->next_target = index + 1;
+                        break;
+                    }
+                }
+                break;
+
+            case DispatchMode::LEAST_INFLIGHT:
+                for( auto& connection : this->connections ){
+                    if( !is_available(connection) ){
+                        continue;
+                    }
+                    if( selected == nullptr || connection.idle_clients.size() > selected->idle_clients.size() ||
+                        ( connection.idle_clients.size() == selected->idle_clients.size() && connection.stats.latency_ewma_ms < selected->stats.latency_ewma_ms ) ){
+                        selected = &connection;
+                    }
+                }
+                break;
+
+            case DispatchMode::FAILOVER:
+                //the first target that isn't ejected, even while its clients are busy (the caller waits for one);
+                //the next one only gets batches while the ones before it are ejected
+                for( auto& connection : this->connections ){
+                    if( is_usable(connection) ){
+                        if( !connection.idle_clients.empty() ){
+                            selected = &connection;
                         }
-                        record["value"] = temp_object;
-                        messages_json.push_back( std::move(record) );
+                        return selected;
                     }
-                    batch_json["records"] = messages_json;
+                }
+                break;
+
+            case DispatchMode::FANOUT:
+                for( auto& connection : this->connections ){
+                    if( is_available(connection) ){
+                        selected = &connection;
+                        break;
+                    }
+                }
+                break;
+
+        };
+
+        if( selected != nullptr || !last_resort ){
+            return selected;
+        }
+
+        //better a batch to an ejected target than none at all (while one is healthy, wait for it instead)
+        for( const auto& connection : this->connections ){
+            if( !connection.ejected ){
+                return nullptr;
+            }
+        }
+
+        for( auto& connection : this->connections ){
+            if( &connection != excluded && !connection.idle_clients.empty() && ( selected == nullptr || connection.ejected_until < selected->ejected_until ) ){
+                selected = &connection;
+            }
+        }
+
+        return selected;
+
+    }
+
+
+
+    void HttpProducer::recordAttempt( HttpConnection* connection, bool failed, int64_t latency_ms ){
+
+        //each request weighs a fifth of the score
+        const double weight = 0.2;
+
+        HttpTargetStats& stats = connection->stats;
+
+        stats.error_rate = stats.error_rate * ( 1.0 - weight ) + ( failed ? weight : 0.0 );
+        stats.latency_ewma_ms = stats.latency_ewma_ms == 0.0 ? double(latency_ms) : stats.latency_ewma_ms * ( 1.0 - weight ) + double(latency_ms) * weight;
+
+        connection->consecutive_failures = failed ? connection->consecutive_failures + 1 : 0;
+
+        //with fanout, every target gets every batch anyway; its health is only reported
+        if( this->dispatch == DispatchMode::FANOUT ){
+            return;
+        }
 
-                    break;
+        const bool slow = this->breaker_latency_ms > 0 && stats.latency_ewma_ms > double(this->breaker_latency_ms);
+
+        if( connection->ejected ){
+
+            //the probe (or a request sent before the target was ejected)
+            const bool fast = this->breaker_latency_ms == 0 || latency_ms <= this->breaker_latency_ms;
+
+            if( !failed && fast ){
+                connection->ejected = false;
+                connection->probing = false;
+                stats.latency_ewma_ms = double( latency_ms );
+                this->logport->getObserver().addLogEntry( "logport: http target " + connection->description + " is healthy again" );
+            }else if( connection->probing ){
+                connection->probing = false;
+                connection->ejected_until = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->breaker_open_ms );
+                stats.ejections++;
+            }
+
+            return;
+
+        }
+
+        if( connection->consecutive_failures >= uint64_t(this->breaker_failures) || slow ){
+
+            connection->ejected = true;
+            connection->probing = false;
+            connection->ejected_until = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->breaker_open_ms );
+            stats.ejections++;
+
+            this->logport->getObserver().addLogEntry( "logport: http target " + connection->description + " ejected for " + logport::to_string<int64_t>(this->breaker_open_ms) + "ms (" + ( slow ? "latency " + logport::to_string<int64_t>(static_cast<int64_t>(stats.latency_ewma_ms)) + "ms" : logport::to_string<uint32_t>(connection->consecutive_failures) + " consecutive failures" ) + ")" );
+
+        }
+
+    }
+
+
+
+    void HttpProducer::deliver( HttpConnection* connection, size_t client_index, HttpBatch& batch, std::chrono::steady_clock::time_point cut_time ){
+
+        using std::chrono::steady_clock;
+        using std::chrono::milliseconds;
+        using std::chrono::duration_cast;
+
+        const steady_clock::time_point deadline = cut_time + milliseconds( this->message_timeout_ms );
+
+        const bool compressed = !batch.compressed_body.empty();
+        const string& request_body = compressed ? batch.compressed_body : batch.body;
+
+        httplib::Headers request_headers;
+        auto set_request_headers = [&request_headers, compressed]( const HttpConnection* target ){
+            request_headers = target->request_headers_template;
+            if( compressed ){
+                request_headers.emplace( "Content-Encoding", "gzip" );
+            }
+        };
+        set_request_headers( connection );
+
+        HttpOutcome outcome = HttpOutcome::RETRY;
+        int last_status = 0;
+        int64_t retries = 0;
+        int64_t backoff_ms = this->retry_backoff_ms;
+
+        while( true ){
+
+            const int64_t remaining_ms = duration_cast<milliseconds>( deadline - steady_clock::now() ).count();
+            if( remaining_ms <= 0 ){
+                break;
+            }
+
+            HttpClient& client = connection->clients[client_index];
+            const steady_clock::time_point attempt_time = steady_clock::now();
+
+            httplib::Result result = connection->secure
+                ? post_within( *client.https_client, *connection, request_headers, request_body, remaining_ms )
+                : post_within( *client.client, *connection, request_headers, request_body, remaining_ms );
+
+            outcome = classify_result( result );
+            last_status = result ? result->status : 0;
+
+            bool rerouted = false;
+
+            {
+                std::scoped_lock lock( this->model_mutex );
+
+                this->recordAttempt( connection, outcome == HttpOutcome::RETRY, duration_cast<milliseconds>(steady_clock::now() - attempt_time).count() );
+
+                //a batch that isn't fanned out is retried on another target right away, if one can take it
+                if( outcome == HttpOutcome::RETRY && retries < this->max_retries && this->dispatch != DispatchMode::FANOUT ){
+
+                    HttpConnection* other = this->selectTarget( connection, false );
+
+                    if( other != nullptr ){
+
+                        connection->idle_clients.push_back( client_index );
+
+                        client_index = other->idle_clients.back();
+                        other->idle_clients.pop_back();
+                        if( other->ejected ){
+                            other->probing = true;
+                        }
+
+                        connection = other;
+                        rerouted = true;
 
-                case FormatType::JSON:
-                    for( const auto& message : connection->messages ){
-                        messages_json.push_back( json::parse(message) );
                     }
-                    batch_json["messages"] = messages_json;
-                    batch_json["count"] = connection->messages.size();
 
-                    break;
+                }
+            }
 
-                default:
-                    throw std::runtime_error("Unknown format.");
+            if( outcome != HttpOutcome::RETRY || retries >= this->max_retries ){
+                break;
+            }
 
-            };
+            if( rerouted ){
+                this->client_released.notify_all();
+                set_request_headers( connection );
+                retries++;
+                continue;
+            }
+
+            const int64_t wait_ms = std::max( get_jittered_backoff_ms(backoff_ms), get_retry_after_ms(result) );
+            if( steady_clock::now() + milliseconds(wait_ms) >= deadline ){
+                break;
+            }
+
+            std::this_thread::sleep_for( milliseconds(wait_ms) );
+
+            retries++;
+            backoff_ms = std::min( backoff_ms * 2, this->retry_backoff_max_ms );
+
+        }
+
+        const bool delivered = outcome == HttpOutcome::DELIVERED;
+        const size_t message_count = batch.getMessageCount();
+
+        bool record_undelivered = !delivered;
+
+        if( !delivered && this->dispatch == DispatchMode::FANOUT ){
+            //every target shares the batch; it's spooled once however many of them fail (see getRequiredAcknowledgements())
+            std::scoped_lock lock( this->model_mutex );
+            record_undelivered = !batch.undelivered_recorded;
+            batch.undelivered_recorded = true;
+        }
+
+        if( !delivered ){
+            this->logport->getObserver().addLogEntry( "logport: http batch of " + logport::to_string<size_t>(message_count) + " messages to " + connection->description + " undelivered after " + logport::to_string<int64_t>(retries) + " retries (last status " + logport::to_string<int>(last_status) + ")" + ( record_undelivered ? "" : "; already recorded for another target" ) );
+        }
+
+        if( record_undelivered ){
+
+            //the undelivered messages are recorded as they were produced (without the framing or metadata)
+            vector<string> buffers( message_count );
+            vector<UndeliveredMessage> undelivered_messages;
+            undelivered_messages.reserve( message_count );
+
+            for( size_t x = 0; x < message_count; x++ ){
+                undelivered_messages.push_back( UndeliveredMessage{ batch.getMessage(x, buffers[x]), batch.tickets[x] } );
+            }
+
+            this->recordUndelivered( undelivered_messages );
 
-            connection->messages.clear();
+        }
 
+        //only a delivered (or recorded) batch lets the watch checkpoint past these messages
+        for( DeliveryTicket* ticket : batch.tickets ){
+            DeliveryTracker::acknowledge( ticket );
         }
 
-        const string batch_str = batch_json.dump();
+        const int64_t latency_ms = duration_cast<milliseconds>( steady_clock::now() - cut_time ).count();
+
+        {
+            std::scoped_lock lock( this->model_mutex );
+
+            HttpTargetStats& stats = connection->stats;
 
-        this->pool.push_task([ connection, batch_str ]{
-            if( connection->secure ){
-                connection->https_client->Post( connection->full_path_template.c_str(), connection->request_headers_template, batch_str, connection->format_str.c_str() );
+            if( delivered ){
+                stats.batches_delivered++;
+                stats.messages_delivered += message_count;
             }else{
-                connection->client->Post( connection->full_path_template.c_str(), connection->request_headers_template, batch_str, connection->format_str.c_str() );
+                stats.batches_undelivered++;
+                stats.messages_undelivered += message_count;
             }
-        });
+            stats.retries += uint64_t( retries );
+            stats.latency_batches++;
+            stats.latency_total_ms += latency_ms;
+            stats.latency_max_ms = std::max( stats.latency_max_ms, latency_ms );
+            stats.last_status = last_status;
+
+            connection->idle_clients.push_back( client_index );
+        }
+
+        this->client_released.notify_all();
+
+        //wake the watcher (eg. so it can checkpoint the acknowledged offset)
+        this->signalEvent();
 
     }
 
 
-}
\ No newline at end of file
+}
@@ -71,11 +71,10 @@ namespace logport{
 
     #define INOTIFY_EVENT_BUFFER_LENGTH (10 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 
-    #define LOG_READ_BUFFER_SIZE 64 * 1024
 
-
-    InotifyWatcher::InotifyWatcher( Database& db, Producer &producer, Watch& watch, LogPort* logport )
-        :db(db), run(true), watched_file(watch.watched_filepath), undelivered_log(watch.undelivered_log_filepath), producer(producer), watch(watch), logport(logport)
+    InotifyWatcher::InotifyWatcher( Database& db, Producer &producer, Watch& watch, LogPort* logport, DeliveryTracker& delivery_tracker )
+        :db(db), run(true), watched_file(watch.watched_filepath), watched_file_name(get_file_name(watch.watched_filepath)), producer(producer), watch(watch), logport(logport),
+         tailer( producer, watch, logport, delivery_tracker, db.getSettings() )
     {
 
         /* Create inotify instance; add watch descriptors */
@@ -92,12 +91,22 @@ namespace logport{
 
         if( (this->inotify_watch_descriptor = inotify_add_watch(inotify_fd, watched_file.c_str(), IN_ALL_EVENTS)) == -1 ){
             //fprintf(stderr, "%% Failed to add inotify watch descriptor: errno %d\n", errno );
+            //the supervisor backs off before restarting a watch that keeps failing (eg. until logrotate creates the file)
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
             close( this->inotify_fd );
 
-            sleep( 3 ); //pause until the file is created (to prevent busy waiting on logrotate)
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for file: " + watched_file );
+        }
+
 
+        //the parent directory tells us when logrotate puts a new file at the watched path
+        const string watched_directory = get_parent_directory( this->watched_file );
+
+        if( (this->directory_watch_descriptor = inotify_add_watch(inotify_fd, watched_directory.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)) == -1 ){
             snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
-            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for file: " + watched_file );
+            close( this->inotify_fd );
+
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for directory: " + watched_directory );
         }
 
 
@@ -123,138 +132,38 @@ namespace logport{
 
         //sleep(2); //avoids intermittent race condition on rotate (before open())
 
-        int watched_file_fd = open( this->watched_file.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
-        if( watched_file_fd == -1 ){
-            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
-            throw std::runtime_error( "Failed to open log file: errno " + string(error_string_buffer) );
-        }
-
-
-        //set the offset to the last read position
-            {
-
-                int64_t current_file_size = get_file_size( this->watched_file );
-
-                Observer observer;               
-                observer.addLogEntry( "logport: starting to watch " + this->watched_file + " Filesize(" + logport::to_string<int64_t>(current_file_size) + ") SavedResumePoint(" +  logport::to_string<int64_t>(this->watch.file_offset) + ")" );
-
-                if( this->watch.file_offset > current_file_size ){
-
-                    observer.addLogEntry( "logport: file size is greater than watched offset for " + this->watched_file + ". Resetting to beginning of file." );
-
-                    sleep(1);
-
-                    //error is seeking, reset to 0
-                    this->watch.file_offset = 0;
-                    try{
-                        Database db;
-                        this->watch.saveOffset( db );
-                    }catch( std::exception &e ){
-                        observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
-                    }
-
-                }else{
-
-                    off64_t current_file_position = lseek64( watched_file_fd, this->watch.file_offset, SEEK_SET );
-
-                    if( current_file_position == -1 ){
-
-                        observer.addLogEntry( "logport: error seeking for " + this->watched_file + ". Resetting to beginning of file." );
-
-                        sleep(1);
-
-                        //error is seeking, reset to 0
-                        this->watch.file_offset = 0;
-
-                        try{
-                            Database db;
-                            this->watch.saveOffset( db );
-                        }catch( std::exception &e ){
-                            observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
-                        }
-                        
-
-                    }else{
-                        
-                        observer.addLogEntry( "logport: resuming seeking for " + this->watched_file + " at offset: " + logport::to_string<off64_t>(current_file_position) + ", filesize: " + logport::to_string<int64_t>(current_file_size) );
-
-                    }
-
-                }
-
-            }
+        this->tailer.startPipeline();  //only if enabled
 
+        this->tailer.open( this->db );  //seeks to the saved offset and opens the spool (moving any flat undelivered log into it first)
 
-
-
-
-        char log_read_buffer[LOG_READ_BUFFER_SIZE];
+        //failed messages go to the spool; this producer's own undelivered log only catches messages without one
+        this->producer.openUndeliveredLog();
 
 
         LevelTriggeredEpollWatcher epoll_watcher( this->inotify_fd );
 
-        bool log_being_rotated = false;
-        //bool log_being_modified = false;
-        bool startup = true;
-        bool try_read = false;
-        bool replaying_undelivered_log = false;
-
-        string previous_log_partial;
-
-
-
-
-
-        //replay the undelivered log entries
-
-            const string temp_log_file = undelivered_log + "_temp";
-
-            //return 0 if file does not exist
-            uint64_t undelivered_file_size = get_file_size( undelivered_log );
-
-            if( undelivered_file_size > 0 ){
-                //if undelivered_log file exists and is not empty
-
-                if( file_exists(temp_log_file) ){
-                    //temp log file exists; abort with error
-                    throw std::runtime_error( "Error: temp undelivered_log exists. Aborting to prevent overwriting." );
-                }
-
-                //move the file (now that we know temp_log_file doesn't exist)
-                int rename_result = rename( undelivered_log.c_str(), temp_log_file.c_str() );
-                if( rename_result == -1 ){
-                    snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
-                    throw std::runtime_error( "Failed to rename undelivered_log: errno " + string(error_string_buffer) );
-                }
-
-                this->producer.openUndeliveredLog(); //must be called before first message; this is why we use a temp file above
-                this->producer.produce( this->filterLogLine("starting up - replaying undelivered log") );
+        //delivery reports (and other producer completions) wake this loop as soon as they're ready
+        const int producer_event_fd = this->producer.getEventFd();
+        epoll_watcher.add( producer_event_fd );
 
-                //ingest the undelivered_log contents
-                replaying_undelivered_log = true;
-
-                this->undelivered_log_fd = open( temp_log_file.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
-                if( this->undelivered_log_fd == -1 ){
-                    snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
-                    throw std::runtime_error( "Failed to open undelivered log temp file: errno " + string(error_string_buffer) );
-                }
-
-            }else{
-
-                this->producer.openUndeliveredLog(); //must be called before first message; this is why we use a temp file above
-                this->producer.produce( this->filterLogLine("starting up") );
-
-            }
+        vector<int> ready_file_descriptors;
 
 
         // Listen for events.
         // If this->shutting_down == true (controlled by signal handler), this->run will be true
         while( this->run ){
 
+            //don't block while there's more to read (or replay); still pick up whatever is ready
+            const int timeout_ms = this->tailer.getWaitTimeoutMs( 1000 );
+
+            if( epoll_watcher.watch(timeout_ms, ready_file_descriptors) > 0 ){  //returns immediately if there are events waiting; returns after timeout_ms if no events;
 
-            if( !startup ){
+                for( int ready_file_descriptor : ready_file_descriptors ){
 
-                if( epoll_watcher.watch(1000) ){  //returns immediately if there are inotify events waiting; returns after 1000ms if no events;
+                    if( ready_file_descriptor == producer_event_fd ){
+                        this->producer.handleEvents();
+                        continue;
+                    }
 
                     //if there are new events waiting on the inotify_fd, read the events
                         inotify_event_num_read = read( this->inotify_fd, inotify_event_buffer, INOTIFY_EVENT_BUFFER_LENGTH );
@@ -278,16 +187,16 @@ namespace logport{
 
                             in_event = (struct inotify_event *) p;
 
-                            if( in_event->mask & IN_MOVE_SELF ){
-                                //this is being logrotated
-                                log_being_rotated = true;
-                                try_read = true;
-                            }
-
-                            if( in_event->mask & IN_MODIFY || in_event->mask & IN_CLOSE_WRITE ){
-                                //this is being modified
-                                //log_being_modified = true;
-                                try_read = true;
+                            if( in_event->wd == this->directory_watch_descriptor ){
+                                //only the watched file's name matters in its directory
+                                if( in_event->len > 0 && this->watched_file_name == in_event->name ){
+                                    this->tailer.handleInotifyEvent( in_event->mask );
+                                }
+                            }else if( in_event->mask & IN_Q_OVERFLOW ){
+                                //events were dropped; check for new data (and for a replacement, if rotating)
+                                this->tailer.handleInotifyEvent( IN_MODIFY );
+                            }else{
+                                this->tailer.handleInotifyEvent( in_event->mask );
                             }
 
                             if( 0 ) displayInotifyEvent(in_event);
@@ -296,229 +205,89 @@ namespace logport{
 
                         }
 
-
-
-                }else{
-
-                    //we only want this to fire on timeout (not startup)
-                    //no events waiting on inotify_fd; timed out watching for 1000ms
-
-                    /* A producer application should continually serve
-                     * the delivery report queue by calling rd_kafka_poll()
-                     * at frequent intervals.
-                     * Either put the poll call in your main loop, or in a
-                     * dedicated thread, or call it after every
-                     * rd_kafka_produce() call.
-                     * Just make sure that rd_kafka_poll() is still called
-                     * during periods where you are not producing any messages
-                     * to make sure previously produced messages have their
-                     * delivery report callback served (and any other callbacks
-                     * you register). */
-                    this->producer.poll();
-
                 }
 
-            }
+            }else if( timeout_ms > 0 ){
 
-            if( this->producer.getType() == ProducerType::KAFKA ){
+                //we only want this to fire on timeout (not startup)
+                //no events waiting; timed out watching for 1000ms
+                //delivery reports are served through the event descriptor; this reports http target stats (the linger thread sends partial batches)
                 this->producer.poll();
-            }
-                
-
-            if( startup || try_read || log_being_rotated ){
-
-                //read some input from the log file
-
-                    int current_fd;
-                    if( replaying_undelivered_log ){
-                        current_fd = this->undelivered_log_fd;
-                    }else{
-                        current_fd = watched_file_fd;
-                    }
-
-
-                    // read the next bytes
-
-                    int bytes_read = read( current_fd, log_read_buffer, LOG_READ_BUFFER_SIZE );
-
-                    if( bytes_read > 0 ){
-
-                        string log_chunk( log_read_buffer, bytes_read );
-
-                        //append previous, if applicable
-                            if( previous_log_partial.size() ){
-                                log_chunk = previous_log_partial + log_chunk;
-                                previous_log_partial.clear();
-                            }
-
-                        //send multiple lines as multiple kafka messages (no need to batch because rdkafka batches internally)
-                        //no partial line will ever be sent
-                            string::iterator current_message_begin_it = log_chunk.begin();
-                            string::iterator current_message_end_it = log_chunk.begin();
-
-                            char current_char;
-
-                            while( current_message_end_it != log_chunk.end() ){
-                                                                    
-                                current_char = *current_message_end_it; //safe to deref because "bytes_read > 0" above
-
-                                if( current_char == '\n' ){
-
-                                    string sent_message;
-                                    sent_message.reserve( log_chunk.size() );
-
-                                    //only copy if there's something to copy
-                                    if( current_message_end_it != current_message_begin_it ){
-                                        std::copy( current_message_begin_it, current_message_end_it, std::back_inserter(sent_message) );  //drops the new line    
-                                    }
-
-                                    
-
-                                    if( sent_message.size() > 0 ){
-
-                                        string filtered_log_line = this->filterLogLine( sent_message );
-
-                                        //handle consecutive newline characters (by dropping them)
-                                        this->producer.produce( filtered_log_line );
-                                        
-                                        //skips the new line
-                                        current_message_end_it++;
-
-                                        //re-sync the being and end iterators
-                                        current_message_begin_it = current_message_end_it;
-
-                                        /*
-                                        std::cout << "log_chunk(" << log_chunk.size() << "): " << std::endl;
-                                        std::cout << "unfiltered_message(" << sent_message.size() << "): " << sent_message << std::endl;
-                                        std::cout << "filtered_sent_message(" << filtered_log_line.size() << "): " << filtered_log_line << std::endl;
-                                        std::cout << "previous_log_partial(" << previous_log_partial.size() << "): " << previous_log_partial << std::endl;
-                                        */
-                                    }else{
-
-                                        current_message_end_it++;
-                                    
-                                    }
-
-
-                                }else{
-
-                                    current_message_end_it++;
-
-                                }
-
-                            }
-
-                            //if we're at the end and we have an incomplete message, copy remaining incomplete line
-                            if( current_message_begin_it != current_message_end_it ){
-                                previous_log_partial.reserve( log_chunk.size() );
-                                std::copy( current_message_begin_it, log_chunk.end(), std::back_inserter(previous_log_partial) );
-                            }
-
 
+            }
 
-                    }else{
-
-                        //no bytes read (EOF)
 
-                        if( startup && !replaying_undelivered_log ){
-                            //startup will continue until read = zero bytes
-                            startup = false;
-                        }
+            //read some input from the log file (and replay some of the spool)
+            this->tailer.service( this->db );
 
-                        if( replaying_undelivered_log ){
-                            //remove the temp file
-
-                            int unlink_result = unlink( temp_log_file.c_str() );
-                            if( unlink_result == -1 ){
-                                snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
-                                throw std::runtime_error( "Failed to remove temporary undelivered log. errno: " + string(error_string_buffer) );
-                            }
+            if( this->tailer.isFinished() ){
+                //logrotate moved the file away, it has been drained and there's a new file at its path; switch to it with the same producer
+                this->followReplacement();
+            }
 
-                            replaying_undelivered_log = false;
 
-                            //if there's any previous_log_partial left over, flush it before continuing
-                            if( previous_log_partial.size() ){
-                                string filtered_previous_log_partial = this->filterLogLine( previous_log_partial );
-                                this->producer.produce( filtered_previous_log_partial );
-                                //this->producer.poll();
-                                previous_log_partial.clear();
-                            }
+            //periodically commit the offset that has been acknowledged so a crash only replays the last few seconds
+            if( this->run ){
+                this->tailer.checkpoint( this->db );
+                this->commitOffsets();
+            }
 
-                            Observer observer;
-                            observer.addLogEntry( "logport: Finished replaying undelivered log." );
 
-                        }
+            //save the unsent offset, if this is shutting down
+            if( this->run == false ){
+                sleep(1);
+                this->producer.poll();
+                this->tailer.saveShutdownOffset( this->db );
+            }
 
 
+        } //end this->run
 
-                        if( log_being_rotated ){
 
-                            this->run = false;  //to exit on logrotate (after all bytes are drained)
-                            //ensure that logrotate has the `delaycompress` option so that trailing bytes are properly drained
 
-                            //if there's any previous_log_partial left over, flush it before shutting down
-                            if( previous_log_partial.size() ){
-                                string filtered_previous_log_partial = this->filterLogLine( previous_log_partial );
-                                this->producer.produce( filtered_previous_log_partial );
-                                //this->producer.poll();
-                                previous_log_partial.clear();
-                            }
+    }
 
-                            //update and save the committed offset back to the first byte
-                            this->watch.file_offset = 0;
-                            try{
-                                this->watch.saveOffset( this->db );
-                            }catch( std::exception &e ){
-                                Observer observer;
-                                observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
-                            }
 
-                            //sleep(5); //avoids intermittent race condition on rotate (before open())
 
-                        }
 
 
 
-                    }
+    void InotifyWatcher::followReplacement(){
 
-                    //log_being_modified = false;
-                    try_read = false;
+        char error_string_buffer[1024];
 
-            }
+        //the old watch follows the rotated file's inode
+        inotify_rm_watch( this->inotify_fd, this->inotify_watch_descriptor );
 
+        //watched before it's opened so no modification is missed
+        if( (this->inotify_watch_descriptor = inotify_add_watch(this->inotify_fd, this->watched_file.c_str(), IN_ALL_EVENTS)) == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for file: " + this->watched_file );
+        }
 
+        Observer observer;
+        observer.addLogEntry( "logport: following the new file at " + this->watched_file );
 
-            //save the unsent offset, if this is shutting down
-            if( this->run == false ){                
-                sleep(1);
-                this->producer.poll();
-                Database db;
-                off64_t current_file_position = lseek64( watched_file_fd, 0, SEEK_CUR );
-                this->watch.file_offset = current_file_position - previous_log_partial.size();
-
-                Observer observer;
-                try{
-                    this->watch.saveOffset( db );
-                    observer.addLogEntry( "logport: saved " + this->watch.watched_filepath + " offset on shutdown (" + logport::to_string<off64_t>(current_file_position) + ")" );
-                }catch( std::exception &e ){
-                    observer.addLogEntry( "logport: failed to save offset for " + this->watched_file + " " + string(e.what()) );
-                }
+        this->tailer.reopen( this->db );
 
-            }
+    }
 
 
-        } //end this->run
 
+    void InotifyWatcher::commitOffsets(){
 
+        try{
+            this->db.commitOffsets();
+        }catch( std::exception &e ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to checkpoint offset for " + this->watched_file + " " + string(e.what()) );
+        }
 
     }
 
 
 
-
-
-
-    string InotifyWatcher::filterLogLine( const string& unfiltered_log_line ) const{
+    string InotifyWatcher::filterLogLine( std::string_view unfiltered_log_line ) const{
 
         return this->watch.filterLogLine( unfiltered_log_line );
 
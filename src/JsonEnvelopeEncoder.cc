@@ -0,0 +1,582 @@
+#include "JsonEnvelopeEncoder.h"
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+
+#include <time.h>
+
+
+namespace logport{
+
+
+    //0: copied as is; 1: needs a backslash escape; 2: the first byte of a multi-byte (or invalid) UTF-8 sequence
+    static constexpr std::array<uint8_t, 256> build_escape_table(){
+
+        std::array<uint8_t, 256> table{};
+
+        for( size_t x = 0; x < 0x20; x++ ){
+            table[x] = 1;
+        }
+        table['"'] = 1;
+        table['\\'] = 1;
+
+        for( size_t x = 0x80; x < 256; x++ ){
+            table[x] = 2;
+        }
+
+        return table;
+
+    }
+
+    static constexpr std::array<uint8_t, 256> escape_table = build_escape_table();
+
+    static const char hex_digits[] = "0123456789abcdef";
+
+
+
+    /*
+     * Returns the length of the valid UTF-8 sequence (RFC 3629) starting at current (2 to 4 bytes), or, if it isn't valid,
+     * the negated length of its maximal invalid subpart (the bytes to replace with one U+FFFD).
+     */
+    static inline int utf8_sequence_length( const unsigned char* current, const unsigned char* end ){
+
+        const unsigned char lead = current[0];
+
+        int length;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+
+        if( lead >= 0xC2 && lead <= 0xDF ){
+            length = 2;
+        }else if( lead == 0xE0 ){
+            length = 3;
+            low = 0xA0;
+        }else if( (lead >= 0xE1 && lead <= 0xEC) || lead == 0xEE || lead == 0xEF ){
+            length = 3;
+        }else if( lead == 0xED ){
+            length = 3;
+            high = 0x9F;   //excludes the surrogates
+        }else if( lead == 0xF0 ){
+            length = 4;
+            low = 0x90;
+        }else if( lead >= 0xF1 && lead <= 0xF3 ){
+            length = 4;
+        }else if( lead == 0xF4 ){
+            length = 4;
+            high = 0x8F;   //excludes code points past U+10FFFF
+        }else{
+            return -1;
+        }
+
+        for( int x = 1; x < length; x++ ){
+
+            if( current + x >= end ){
+                return -x;
+            }
+
+            const unsigned char continuation = current[x];
+
+            if( x == 1 ){
+                if( continuation < low || continuation > high ) return -1;
+            }else{
+                if( continuation < 0x80 || continuation > 0xBF ) return -x;
+            }
+
+        }
+
+        return length;
+
+    }
+
+
+
+    static inline void append_timestamp( string& output ){
+
+        //seconds and nanoseconds since the epoch, eg. 1556352653.816769123 (see get_timestamp())
+        timespec current_time;
+        if( clock_gettime(CLOCK_REALTIME, &current_time) != 0 ){
+            output.append( "0.0" );
+            return;
+        }
+
+        char buffer[32];
+
+        char* current = std::to_chars( buffer, buffer + 20, (long long)current_time.tv_sec ).ptr;
+
+        *current++ = '.';
+
+        long nanoseconds = current_time.tv_nsec;
+        for( int x = 8; x >= 0; x-- ){
+            current[x] = char( '0' + nanoseconds % 10 );
+            nanoseconds /= 10;
+        }
+        current += 9;
+
+        output.append( buffer, current - buffer );
+
+    }
+
+
+
+    static void append_field( string& output, const char* key, const string& value ){
+
+        if( value.size() == 0 ){
+            return;
+        }
+
+        output += ",\"";
+        output += key;
+        output += "\":\"";
+        JsonEnvelopeEncoder::appendEscaped( value, output );
+        output += '"';
+
+    }
+
+
+
+    JsonEnvelopeEncoder::JsonEnvelopeEncoder()
+        :trailer( "}" )
+    {
+
+    }
+
+
+
+    JsonEnvelopeEncoder::JsonEnvelopeEncoder( const string& hostname, const string& source, const string& product_code, const string& log_type ){
+
+        //keys in the order nlohmann::json sorted them: @timestamp, host, log|log_obj, log_type, prd, source
+
+        append_field( this->header, "host", hostname );
+
+        append_field( this->trailer, "log_type", log_type );
+        append_field( this->trailer, "prd", product_code );
+        append_field( this->trailer, "source", source );
+        this->trailer += '}';
+
+    }
+
+
+
+    void JsonEnvelopeEncoder::encode( std::string_view log_line, string& output ) const{
+
+        output.clear();
+
+        if( log_line.size() == 0 ){
+            return;
+        }
+
+        output.reserve( log_line.size() + this->header.size() + this->trailer.size() + 64 );
+
+        output.append( "{\"@timestamp\":\"" );
+        append_timestamp( output );
+        output += '"';
+
+        output += this->header;
+
+        bool embedded = false;
+
+        if( log_line[0] == '{' || log_line[0] == '[' ){
+
+            //the JSON parser this replaced treated a NUL byte as the end of the input
+            std::string_view json_text = log_line.substr( 0, log_line.find('\0') );
+
+            if( JsonEnvelopeEncoder::isValidJson(json_text) ){
+
+                //drop trailing whitespace (eg. "\r"); there's no leading whitespace
+                size_t length = json_text.size();
+                while( json_text[length - 1] == ' ' || json_text[length - 1] == '\t' || json_text[length - 1] == '\r' || json_text[length - 1] == '\n' ){
+                    length--;
+                }
+
+                output.append( ",\"log_obj\":" );
+                output.append( json_text.data(), length );
+                embedded = true;
+
+            }
+
+        }
+
+        if( !embedded ){
+            output.append( ",\"log\":\"" );
+            JsonEnvelopeEncoder::appendEscaped( log_line, output );
+            output += '"';
+        }
+
+        output += this->trailer;
+
+    }
+
+
+
+    void JsonEnvelopeEncoder::appendEscaped( std::string_view text, string& output ){
+
+        const unsigned char* current = reinterpret_cast<const unsigned char*>( text.data() );
+        const unsigned char* end = current + text.size();
+
+        while( current < end ){
+
+            //copy the run of bytes that don't need escaping in one go
+            const unsigned char* run_begin = current;
+            while( current < end && escape_table[*current] == 0 ){
+                current++;
+            }
+            if( current != run_begin ){
+                output.append( reinterpret_cast<const char*>(run_begin), current - run_begin );
+            }
+
+            if( current == end ){
+                break;
+            }
+
+            const unsigned char character = *current;
+
+            if( escape_table[character] == 2 ){
+
+                const int sequence_length = utf8_sequence_length( current, end );
+
+                if( sequence_length > 0 ){
+                    output.append( reinterpret_cast<const char*>(current), sequence_length );
+                    current += sequence_length;
+                }else{
+                    output.append( "\xEF\xBF\xBD" );  //U+FFFD
+                    current += -sequence_length;
+                }
+
+                continue;
+
+            }
+
+            switch( character ){
+                case '"': output.append( "\\\"" ); break;
+                case '\\': output.append( "\\\\" ); break;
+                case '\b': output.append( "\\b" ); break;
+                case '\f': output.append( "\\f" ); break;
+                case '\n': output.append( "\\n" ); break;
+                case '\r': output.append( "\\r" ); break;
+                case '\t': output.append( "\\t" ); break;
+                default:
+                    {
+                        const char escaped[6] = { '\\', 'u', '0', '0', hex_digits[character >> 4], hex_digits[character & 0x0F] };
+                        output.append( escaped, 6 );
+                    }
+            };
+
+            current++;
+
+        }
+
+    }
+
+
+
+    static inline const char* skip_whitespace( const char* current, const char* end ){
+
+        while( current < end && (*current == ' ' || *current == '\t' || *current == '\n' || *current == '\r') ){
+            current++;
+        }
+
+        return current;
+
+    }
+
+
+
+    static inline int hex_value( char character ){
+
+        if( character >= '0' && character <= '9' ) return character - '0';
+        if( character >= 'a' && character <= 'f' ) return character - 'a' + 10;
+        if( character >= 'A' && character <= 'F' ) return character - 'A' + 10;
+        return -1;
+
+    }
+
+
+
+    //reads the 4 hex digits after "\u"; returns -1 if they aren't there
+    static inline int read_code_unit( const char* current, const char* end ){
+
+        if( end - current < 4 ){
+            return -1;
+        }
+
+        int code_unit = 0;
+
+        for( int x = 0; x < 4; x++ ){
+            const int digit = hex_value( current[x] );
+            if( digit < 0 ) return -1;
+            code_unit = (code_unit << 4) | digit;
+        }
+
+        return code_unit;
+
+    }
+
+
+
+    //current is at the opening quote; returns the position after the closing quote, or nullptr if the string is invalid
+    static const char* scan_string( const char* current, const char* end ){
+
+        current++;
+
+        while( current < end ){
+
+            const unsigned char character = static_cast<unsigned char>( *current );
+
+            if( character == '"' ){
+                return current + 1;
+            }
+
+            if( character < 0x20 ){
+                return nullptr;
+            }
+
+            if( character >= 0x80 ){
+
+                const int sequence_length = utf8_sequence_length( reinterpret_cast<const unsigned char*>(current), reinterpret_cast<const unsigned char*>(end) );
+                if( sequence_length < 0 ){
+                    return nullptr;
+                }
+                current += sequence_length;
+                continue;
+
+            }
+
+            if( character == '\\' ){
+
+                current++;
+                if( current == end ){
+                    return nullptr;
+                }
+
+                switch( *current ){
+
+                    case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                        current++;
+                        break;
+
+                    case 'u':
+                        {
+                            const int code_unit = read_code_unit( current + 1, end );
+                            if( code_unit < 0 ){
+                                return nullptr;
+                            }
+                            current += 5;
+
+                            if( code_unit >= 0xDC00 && code_unit <= 0xDFFF ){
+                                return nullptr;  //unpaired low surrogate
+                            }
+
+                            if( code_unit >= 0xD800 && code_unit <= 0xDBFF ){
+                                //a high surrogate must be followed by a low one
+                                if( end - current < 2 || current[0] != '\\' || current[1] != 'u' ){
+                                    return nullptr;
+                                }
+                                const int low_surrogate = read_code_unit( current + 2, end );
+                                if( low_surrogate < 0xDC00 || low_surrogate > 0xDFFF ){
+                                    return nullptr;
+                                }
+                                current += 6;
+                            }
+                        }
+                        break;
+
+                    default:
+                        return nullptr;
+
+                };
+
+                continue;
+
+            }
+
+            current++;
+
+        }
+
+        return nullptr;
+
+    }
+
+
+
+    //returns the position after the number, or nullptr if it isn't a valid number
+    static const char* scan_number( const char* current, const char* end ){
+
+        if( *current == '-' ){
+            current++;
+        }
+
+        if( current == end ){
+            return nullptr;
+        }
+
+        if( *current == '0' ){
+            current++;
+        }else if( *current >= '1' && *current <= '9' ){
+            while( current < end && *current >= '0' && *current <= '9' ) current++;
+        }else{
+            return nullptr;
+        }
+
+        if( current < end && *current == '.' ){
+            current++;
+            const char* digits_begin = current;
+            while( current < end && *current >= '0' && *current <= '9' ) current++;
+            if( current == digits_begin ) return nullptr;
+        }
+
+        if( current < end && (*current == 'e' || *current == 'E') ){
+            current++;
+            if( current < end && (*current == '+' || *current == '-') ) current++;
+            const char* digits_begin = current;
+            while( current < end && *current >= '0' && *current <= '9' ) current++;
+            if( current == digits_begin ) return nullptr;
+        }
+
+        return current;
+
+    }
+
+
+
+    static inline const char* scan_literal( const char* current, const char* end, std::string_view literal ){
+
+        if( size_t(end - current) < literal.size() || std::string_view(current, literal.size()) != literal ){
+            return nullptr;
+        }
+
+        return current + literal.size();
+
+    }
+
+
+
+    bool JsonEnvelopeEncoder::isValidJson( std::string_view text ){
+
+        const char* current = text.data();
+        const char* end = current + text.size();
+
+        //the open containers, innermost last ('{' or '['); short enough to stay in the small string buffer for most lines
+        string containers;
+
+        enum class Expecting{ VALUE, KEY, AFTER_VALUE };
+        Expecting expecting = Expecting::VALUE;
+
+        while( true ){
+
+            current = skip_whitespace( current, end );
+
+            if( expecting == Expecting::AFTER_VALUE ){
+
+                if( containers.size() == 0 ){
+                    return current == end;
+                }
+
+                if( current == end ){
+                    return false;
+                }
+
+                const char container = containers.back();
+
+                if( *current == ',' ){
+                    current++;
+                    expecting = ( container == '{' ) ? Expecting::KEY : Expecting::VALUE;
+                    continue;
+                }
+
+                if( (*current == '}' && container == '{') || (*current == ']' && container == '[') ){
+                    current++;
+                    containers.pop_back();
+                    continue;
+                }
+
+                return false;
+
+            }
+
+            if( current == end ){
+                return false;
+            }
+
+            if( expecting == Expecting::KEY ){
+
+                if( *current != '"' ){
+                    return false;
+                }
+
+                current = scan_string( current, end );
+                if( current == nullptr ){
+                    return false;
+                }
+
+                current = skip_whitespace( current, end );
+                if( current == end || *current != ':' ){
+                    return false;
+                }
+                current++;
+
+                expecting = Expecting::VALUE;
+                continue;
+
+            }
+
+
+            //Expecting::VALUE
+
+            switch( *current ){
+
+                case '{':
+                    current = skip_whitespace( current + 1, end );
+                    if( current < end && *current == '}' ){
+                        current++;
+                        expecting = Expecting::AFTER_VALUE;
+                    }else{
+                        containers.push_back( '{' );
+                        expecting = Expecting::KEY;
+                    }
+                    continue;
+
+                case '[':
+                    current = skip_whitespace( current + 1, end );
+                    if( current < end && *current == ']' ){
+                        current++;
+                        expecting = Expecting::AFTER_VALUE;
+                    }else{
+                        containers.push_back( '[' );
+                    }
+                    continue;
+
+                case '"':
+                    current = scan_string( current, end );
+                    break;
+
+                case 't':
+                    current = scan_literal( current, end, "true" );
+                    break;
+
+                case 'f':
+                    current = scan_literal( current, end, "false" );
+                    break;
+
+                case 'n':
+                    current = scan_literal( current, end, "null" );
+                    break;
+
+                default:
+                    current = scan_number( current, end );
+
+            };
+
+            if( current == nullptr ){
+                return false;
+            }
+
+            expecting = Expecting::AFTER_VALUE;
+
+        }
+
+    }
+
+
+}
@@ -62,12 +62,11 @@
 #include <map>
 using std::map;
 
+#include <chrono>
 
-namespace logport{
 
+namespace logport{
 
-    static int undelivered_log_fd_static;
-    static LogPort* logport_ptr;
 
     /**
      * @brief Message delivery report callback.
@@ -79,49 +78,71 @@ namespace logport{
      *
      * The callback is triggered from rd_kafka_poll() and executes on
      * the application's thread.
+     *
+     * The opaque is the KafkaProducer (see rd_kafka_conf_set_opaque), so several producers can live in one process.
      */
-    static void delivery_report_message_callback( rd_kafka_t */*rk*/, const rd_kafka_message_t *rkmessage, void */*opaque*/ ){
+    static void delivery_report_message_callback( rd_kafka_t */*rk*/, const rd_kafka_message_t *rkmessage, void *opaque ){
+
+        static_cast<KafkaProducer*>( opaque )->handleDeliveryReport( rkmessage );
+
+        /* The rkmessage is destroyed automatically by librdkafka */
+
+    }
+
+
+
+    //failed delivery reports served by rd_kafka_poll() on this thread; recorded together once it returns (see recordFailedDeliveries())
+    static thread_local vector<PayloadBlock*> failed_deliveries;
+
+
+
+    void KafkaProducer::handleDeliveryReport( const rd_kafka_message_t *rkmessage ){
+
+        PayloadBlock* payload_block = static_cast<PayloadBlock*>( rkmessage->_private );
 
         if( rkmessage->err ){
 
-            logport_ptr->getObserver().addLogEntry( "Message delivery failed: " + string(rd_kafka_err2str(rkmessage->err)) );
+            this->logport->getObserver().addLogEntry( "Message delivery failed: " + string(rd_kafka_err2str(rkmessage->err)) );
 
-            if( undelivered_log_fd_static != -1 ){
+            //acknowledged and released once it's been recorded
+            failed_deliveries.push_back( payload_block );
+            return;
 
-                int result_bytes = write( undelivered_log_fd_static, rkmessage->payload, rkmessage->len );
+        }
 
-                if( result_bytes < 0 ){
-                    logport_ptr->getObserver().addLogEntry( "Failed to write to undelivered_log. errno: " + logport::to_string<int>(errno) );
-                }else{
-                    if( (size_t)result_bytes != rkmessage->len ){
-                        logport_ptr->getObserver().addLogEntry( "Write mismatch in undelivered_log. " + logport::to_string<size_t>(rkmessage->len) + " bytes expected but only " + logport::to_string<int>(result_bytes) + " written." );
-                    }
-                }
+        //message successfully delivered; it won't need to be re-read from the watched file
+        DeliveryTracker::acknowledge( payload_block->ticket );
 
-                //append newline
-                    char newline_buffer[10];
-                    newline_buffer[0] = '\n';
+        //rdkafka is done with the payload
+        PayloadPool::release( payload_block );
 
-                    result_bytes = write( undelivered_log_fd_static, newline_buffer, 1 );
-                    if( result_bytes < 0 ){
-                        logport_ptr->getObserver().addLogEntry( "Failed to write to undelivered_log newline. errno: " + logport::to_string<int>(errno) );
-                    }
-                
+    }
 
-            }else{
 
 
-                logport_ptr->getObserver().addLogEntry( "Failed to record undelivered message." );
+    void KafkaProducer::recordFailedDeliveries(){
 
-            }
+        if( failed_deliveries.empty() ){
+            return;
+        }
+
+        static thread_local vector<UndeliveredMessage> undelivered_messages;
 
-        }else{
+        undelivered_messages.clear();
+        for( PayloadBlock* payload_block : failed_deliveries ){
+            undelivered_messages.push_back( UndeliveredMessage{ std::string_view(payload_block->data(), payload_block->length), payload_block->ticket } );
+        }
 
-            //message successfully delivered
+        this->recordUndelivered( undelivered_messages );
 
+        //recorded in the spool; it won't need to be re-read from the watched file either
+        for( PayloadBlock* payload_block : failed_deliveries ){
+            DeliveryTracker::acknowledge( payload_block->ticket );
+            PayloadPool::release( payload_block );
         }
 
-        /* The rkmessage is destroyed automatically by librdkafka */
+        failed_deliveries.clear();
+        undelivered_messages.clear();
 
     }
 
@@ -133,8 +154,15 @@ namespace logport{
         :Producer( ProducerType::KAFKA, settings, logport, undelivered_log ), brokers_list(brokers_list), topic(topic)
     {
 
-        undelivered_log_fd_static = -1;
-        logport_ptr = logport;
+        //payload blocks; size them with the kafka.payload_pool metrics (see addPayloadPoolMetric)
+        const int64_t payload_block_bytes = get_setting_int64( this->settings, "kafka.producer.payload.block.bytes", 1024 );
+        const int64_t payload_max_blocks = get_setting_int64( this->settings, "kafka.producer.payload.max.blocks", 32768 );
+        if( payload_block_bytes < 1 || payload_block_bytes > 1048576 || payload_max_blocks < 0 ){
+            throw std::runtime_error( "KafkaProducer: Invalid kafka.producer.payload.block.bytes or kafka.producer.payload.max.blocks setting." );
+        }
+        this->payload_pool = std::make_unique<PayloadPool>( payload_block_bytes, payload_max_blocks );
+
+        this->payload_pool_stats_interval_ms = get_setting_int64( this->settings, "kafka.producer.payload.stats.interval.ms", 60000 );  //0 disables
 
         /*
          * Create Kafka client configuration place-holder
@@ -206,6 +234,7 @@ namespace logport{
          * the application if delivery succeeded or failed.
          * See dr_msg_cb() above. */
         rd_kafka_conf_set_dr_msg_cb(conf, delivery_report_message_callback);
+        rd_kafka_conf_set_opaque(conf, this);
 
 
         /*
@@ -234,6 +263,13 @@ namespace logport{
         }
 
 
+        /* Have rdkafka write to the event pipe whenever the main queue (delivery reports)
+         * goes from empty to non-empty, so watchers can wait on it with epoll
+         * instead of calling rd_kafka_poll() on a timer. */
+        this->main_queue = rd_kafka_queue_get_main( this->rk );
+        rd_kafka_queue_io_event_enable( this->main_queue, this->event_write_fd, "1", 1 );
+
+
     }
 
 
@@ -247,6 +283,27 @@ namespace logport{
 
         rd_kafka_flush(this->rk, 6 * 1000 /* wait for max 6 seconds */);
         //this wait must be longer than the message.timeout.ms in the conf above or the messages will be lost and not stored in the undelivered_log
+        this->recordFailedDeliveries();
+
+        if( rd_kafka_outq_len(this->rk) > 0 ){
+            //rdkafka still references payload blocks; fail what's left so the delivery reports record them in the undelivered_log and return the blocks
+            rd_kafka_purge( this->rk, RD_KAFKA_PURGE_F_QUEUE | RD_KAFKA_PURGE_F_INFLIGHT );
+            rd_kafka_flush( this->rk, 1000 );
+            this->recordFailedDeliveries();
+        }
+
+        //the event pipe is closed with this producer, but rdkafka lives on (see below)
+        rd_kafka_queue_io_event_enable( this->main_queue, -1, NULL, 0 );
+        rd_kafka_queue_destroy( this->main_queue );
+
+        this->addPayloadPoolMetric();
+
+        const PayloadPoolStats payload_pool_stats = this->payload_pool->getStats();
+        if( payload_pool_stats.blocks_in_use + payload_pool_stats.overflow_blocks_in_use > 0 ){
+            //the rdkafka instance isn't destroyed (see below) and may still read these payloads; leak the pool along with it
+            this->logport->getObserver().addLogEntry( "Kafka producer shutdown with payloads still held by rdkafka; not freeing the payload pool." );
+            this->payload_pool.release();
+        }
 
 
 
@@ -262,7 +319,6 @@ namespace logport{
 
 
         if( this->undelivered_log_open ){
-            undelivered_log_fd_static = -1;
             close( this->undelivered_log_fd );
             this->undelivered_log_open = false;
         }
@@ -273,7 +329,7 @@ namespace logport{
 
 
 
-    void KafkaProducer::produce( const string& message ){
+    void KafkaProducer::produce( const string& message, DeliveryTicket* ticket ){
 
 
         /**
@@ -382,6 +438,9 @@ namespace logport{
          * (dr_msg_cb) is used to signal back to the application
          * when the message has been delivered (or failed).
          */
+        //the payload block travels as the msg_opaque and is released by the delivery report
+        PayloadBlock* payload_block = this->payload_pool->acquire( message.data(), message.size(), ticket );
+
     retry:
 
         if( rd_kafka_produce(
@@ -389,16 +448,16 @@ namespace logport{
                     this->rkt,
                     /* Use builtin partitioner to select partition*/
                     RD_KAFKA_PARTITION_UA,
-                    /* Make a copy of the payload. */
-                    RD_KAFKA_MSG_F_COPY,
+                    /* No copy; the payload block outlives the message (until its delivery report). */
+                    0,
                     /* Message payload (value) and length */
-                    const_cast<void*>( static_cast<const void*>(message.c_str()) ), message.size(),
+                    payload_block->data(), payload_block->length,
                     /* Optional key and its length */
                     NULL, 0,
                     /* Message opaque, provided in
                      * delivery report callback as
                      * msg_opaque. */
-                    NULL) == -1) {
+                    payload_block) == -1) {
                 /**
                  * Failed to *enqueue* message for producing.
                  */
@@ -424,6 +483,11 @@ namespace logport{
 
                 this->logport->getObserver().addLogEntry( "Failed to produce to topic " + string(rd_kafka_topic_name(this->rkt)) + ": " + string(rd_kafka_err2str(rd_kafka_last_error())) );
 
+                //no delivery report will follow; keep the message and don't hold back the acknowledged offset
+                this->recordUndelivered( payload_block->data(), payload_block->length, ticket );
+                DeliveryTracker::acknowledge( ticket );
+                PayloadPool::release( payload_block );
+
 
         } else {
 
@@ -436,10 +500,142 @@ namespace logport{
 
 
 
+    void KafkaProducer::produceBatch( MessageBatch& batch ){
+
+        if( batch.empty() ){
+            return;
+        }
+
+        //reused by every batch produced on this thread
+        static thread_local vector<rd_kafka_message_t> messages;
+
+        messages.clear();
+        messages.resize( batch.size() );
+
+        for( size_t x = 0; x < batch.size(); x++ ){
+
+            //the payload block travels as the msg_opaque and is released by the delivery report (see produce());
+            //messages that were added to the batch as blocks from this pool are sent without another copy
+            PayloadBlock* payload_block = batch.takeBlock( x );
+
+            if( payload_block == nullptr ){
+                const std::string_view message = batch.getMessage( x );
+                payload_block = this->payload_pool->acquire( message.data(), message.size(), batch.getTicket(x) );
+            }
+
+            messages[x].payload = payload_block->data();
+            messages[x].len = payload_block->length;
+            messages[x]._private = payload_block;
+
+        }
+
+
+        rd_kafka_message_t* pending_messages = messages.data();
+        size_t pending_count = messages.size();
+
+        while( pending_count > 0 ){
+
+            /* No copy; the payload blocks outlive the messages (until their delivery reports).
+             * Returns the number of messages accepted; the rest have their err set. */
+            const int accepted_count = rd_kafka_produce_batch( this->rkt, RD_KAFKA_PARTITION_UA, 0, pending_messages, int(pending_count) );
+
+            if( accepted_count == int(pending_count) ){
+                break;
+            }
+
+            size_t queue_full_count = 0;
+            size_t rejected_count = 0;
+            rd_kafka_resp_err_t rejected_error = RD_KAFKA_RESP_ERR_NO_ERROR;
+
+            for( size_t x = 0; x < pending_count; x++ ){
+
+                rd_kafka_message_t& message = pending_messages[x];
+
+                if( message.err == RD_KAFKA_RESP_ERR_NO_ERROR ){
+                    continue;
+                }
+
+                if( message.err == RD_KAFKA_RESP_ERR__QUEUE_FULL ){
+                    //retried (in order) once some delivery reports have been served; see produce()
+                    message.err = RD_KAFKA_RESP_ERR_NO_ERROR;
+                    pending_messages[ queue_full_count++ ] = message;
+                    continue;
+                }
+
+                //no delivery report will follow; keep the message and don't hold back the acknowledged offset
+                PayloadBlock* payload_block = static_cast<PayloadBlock*>( message._private );
+                this->recordUndelivered( payload_block->data(), payload_block->length, payload_block->ticket );
+                DeliveryTracker::acknowledge( payload_block->ticket );
+                PayloadPool::release( payload_block );
+
+                rejected_count++;
+                rejected_error = message.err;
+
+            }
+
+            if( rejected_count > 0 ){
+                this->logport->getObserver().addLogEntry( "Failed to produce " + logport::to_string<size_t>(rejected_count) + " messages to topic " + string(rd_kafka_topic_name(this->rkt)) + ": " + string(rd_kafka_err2str(rejected_error)) );
+            }
+
+            pending_count = queue_full_count;
+
+            if( pending_count > 0 ){
+                this->poll( 1000 ); //block for max 1000ms
+            }
+
+        }
+
+    }
+
+
+
+    void KafkaProducer::handleEvents(){
+
+        this->poll( 0 );
+
+    }
+
+
+
     void KafkaProducer::poll( int timeout_ms ){
 
+        //clear before serving; a report queued after this re-signals the event descriptor
+        this->clearEvent();
+
         rd_kafka_poll( this->rk, timeout_ms );
 
+        this->recordFailedDeliveries();
+
+        if( this->payload_pool_stats_interval_ms > 0 ){
+
+            const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+            int64_t next_stats_ms = this->next_payload_pool_stats_ms;
+
+            //poll() may be called from several threads; only one of them reports
+            if( now_ms >= next_stats_ms && this->next_payload_pool_stats_ms.compare_exchange_strong(next_stats_ms, now_ms + this->payload_pool_stats_interval_ms) ){
+                if( next_stats_ms != 0 ){  //skip the first poll
+                    this->addPayloadPoolMetric();
+                }
+            }
+
+        }
+
+    }
+
+
+
+    PayloadPoolStats KafkaProducer::getPayloadPoolStats() const{
+
+        return this->payload_pool->getStats();
+
+    }
+
+
+
+    void KafkaProducer::addPayloadPoolMetric(){
+
+        this->logport->getObserver().addMetricEntry( "{\"name\":\"kafka.payload_pool\",\"topic\":\"" + escape_to_json_string(this->topic) + "\",\"stats\":" + this->payload_pool->getStats().toJson() + "}" );
+
     }
 
 
@@ -467,8 +663,6 @@ namespace logport{
             throw std::runtime_error( "Failed to open undelivered log file for writing: errno " + string(error_string_buffer) );
         }
 
-        undelivered_log_fd_static = this->undelivered_log_fd;
-
         this->undelivered_log_open = true;
 
     }
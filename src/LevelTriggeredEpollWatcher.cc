@@ -18,31 +18,32 @@ using std::string;
 
 namespace logport{
 
-    LevelTriggeredEpollWatcher::LevelTriggeredEpollWatcher( int watching_file_descriptor )
-        :watching_file_descriptor(watching_file_descriptor)
+    LevelTriggeredEpollWatcher::LevelTriggeredEpollWatcher()
+        :watching_file_descriptor(-1)
     {
 
         char error_string_buffer[1024];
 
-        struct epoll_event ev;
-
-        int epoll_result;
-
         this->epollfd = epoll_create(1);
         if( this->epollfd == -1 ){
             snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", this->epollfd );
             throw std::runtime_error( "Failed to create epoll fd: " + string(error_string_buffer) );
         }
 
-        ev.events = EPOLLIN;
-        ev.data.fd = this->watching_file_descriptor;
+    }
 
-        epoll_result = epoll_ctl( this->epollfd, EPOLL_CTL_ADD, this->watching_file_descriptor, &ev );
 
-        if( epoll_result == -1 ){
+    LevelTriggeredEpollWatcher::LevelTriggeredEpollWatcher( int watching_file_descriptor )
+        :LevelTriggeredEpollWatcher()
+    {
+
+        this->watching_file_descriptor = watching_file_descriptor;
+
+        try{
+            this->add( this->watching_file_descriptor );
+        }catch( std::exception& e ){
             close( this->epollfd );
-            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d %d", epoll_result, this->watching_file_descriptor );
-            throw std::runtime_error( "Failed to add epoll watched file: " + string(error_string_buffer) );
+            throw;
         }
 
     }
@@ -56,29 +57,78 @@ namespace logport{
 
 
 
+    void LevelTriggeredEpollWatcher::add( int file_descriptor ){
+
+        char error_string_buffer[1024];
+
+        struct epoll_event ev;
+
+        ev.events = EPOLLIN;
+        ev.data.fd = file_descriptor;
+
+        int epoll_result = epoll_ctl( this->epollfd, EPOLL_CTL_ADD, file_descriptor, &ev );
+
+        if( epoll_result == -1 ){
+            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d %d", epoll_result, file_descriptor );
+            throw std::runtime_error( "Failed to add epoll watched file: " + string(error_string_buffer) );
+        }
+
+    }
+
+
+    void LevelTriggeredEpollWatcher::remove( int file_descriptor ){
+
+        struct epoll_event ev;  //ignored; required by kernels before 2.6.9
+
+        epoll_ctl( this->epollfd, EPOLL_CTL_DEL, file_descriptor, &ev );
+
+    }
+
+
 
     bool LevelTriggeredEpollWatcher::watch( int timeout_ms ){
 
+        vector<int> ready_file_descriptors;
+
+        this->watch( timeout_ms, ready_file_descriptors );
+
+        for( int ready_file_descriptor : ready_file_descriptors ){
+
+            if( ready_file_descriptor == this->watching_file_descriptor ){
+                return true;
+            }
+
+        }
+
+        return false;
+
+    }
+
+
+
+    int LevelTriggeredEpollWatcher::watch( int timeout_ms, vector<int>& ready_file_descriptors ){
+
         struct epoll_event events[MAX_EVENTS];
         int number_of_fds;
 
         char error_string_buffer[1024];
 
+        ready_file_descriptors.clear();
+
         number_of_fds = epoll_wait( this->epollfd, events, MAX_EVENTS, timeout_ms );
-        if( number_of_fds == -1 && errno != EINTR ){
-            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
-            throw std::runtime_error( "Failed on epoll_wait. errno: " + string(error_string_buffer) );
+        if( number_of_fds == -1 ){
+            if( errno != EINTR ){
+                snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+                throw std::runtime_error( "Failed on epoll_wait. errno: " + string(error_string_buffer) );
+            }
+            return 0;
         }
 
         for( int n = 0; n < number_of_fds; ++n ){
-
-            if( events[n].data.fd == this->watching_file_descriptor ){
-                return true;
-            }
-
+            ready_file_descriptors.push_back( events[n].data.fd );
         }
 
-        return false;
+        return number_of_fds;
 
     }
 
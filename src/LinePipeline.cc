@@ -0,0 +1,479 @@
+#include "LinePipeline.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#include "Common.h"
+#include "Observer.h"
+#include "LogPort.h"
+#include "Producer.h"
+#include "Watch.h"
+#include "DeliveryTracker.h"
+
+
+namespace logport{
+
+
+    //every record is the line's end offset followed by the line (or its encoded message)
+    #define LINE_RECORD_HEADER_BYTES sizeof(int64_t)
+
+    //the end offset of the record that closes a chunk
+    #define CHUNK_END_OFFSET INT64_MIN
+
+    //a waiting stage looks again at least this often (eg. for the stats); progress wakes it right away
+    #define PIPELINE_WAIT_MS 100
+
+    #define PIPELINE_MIN_RING_BYTES 64 * 1024
+
+    //encoding a line grows it at most this many times (eg. a control character escaped as \u0000)
+    #define MAX_ENCODED_GROWTH 6
+
+
+
+    string LinePipelineStats::toJson() const{
+
+        string json = "{\"lines_read\":" + logport::to_string<uint64_t>(this->lines_read) +
+            ",\"lines_encoded\":" + logport::to_string<uint64_t>(this->lines_encoded) +
+            ",\"lines_produced\":" + logport::to_string<uint64_t>(this->lines_produced) +
+            ",\"batches_produced\":" + logport::to_string<uint64_t>(this->batches_produced) +
+            ",\"lines_bypassed\":" + logport::to_string<uint64_t>(this->lines_bypassed) +
+            ",\"stages\":[";
+
+        for( size_t x = 0; x < this->stages.size(); x++ ){
+
+            const LinePipelineStageStats& stage = this->stages[x];
+
+            if( x > 0 ){
+                json += ",";
+            }
+
+            json += "{\"stage\":\"" + stage.stage + "\"" +
+                ",\"ring\":" + logport::to_string<size_t>(stage.ring) +
+                ",\"capacity_bytes\":" + logport::to_string<size_t>(stage.capacity_bytes) +
+                ",\"depth_bytes\":" + logport::to_string<size_t>(stage.depth_bytes) +
+                ",\"depth_bytes_high_water_mark\":" + logport::to_string<size_t>(stage.depth_bytes_high_water_mark) +
+                ",\"full_waits\":" + logport::to_string<uint64_t>(stage.full_waits) +
+                "}";
+
+        }
+
+        json += "]}";
+
+        return json;
+
+    }
+
+
+
+    LinePipeline::LinePipeline( Producer& producer, const Watch& watch, DeliveryTracker& delivery_tracker, LogPort* logport, size_t encoder_threads, size_t ring_bytes, int64_t stats_interval_ms )
+        :producer(producer), watch(watch), delivery_tracker(delivery_tracker), logport(logport), stats_interval_ms(stats_interval_ms)
+    {
+
+        encoder_threads = std::max<size_t>( encoder_threads, 1 );
+        ring_bytes = std::max<size_t>( ring_bytes, PIPELINE_MIN_RING_BYTES );
+
+        for( size_t x = 0; x < encoder_threads; x++ ){
+            std::unique_ptr<Encoder> encoder = std::make_unique<Encoder>();
+            encoder->input = std::make_unique<SpscRing>( ring_bytes );
+            encoder->output = std::make_unique<SpscRing>( ring_bytes );
+            this->encoders.push_back( std::move(encoder) );
+        }
+
+        //an encoded line always fits the output ring; longer lines bypass the pipeline (see bypass())
+        const size_t envelope_bytes = this->watch.filterLogLine( "x" ).size();
+        const size_t max_record_bytes = this->encoders[0]->output->getMaxRecordBytes() - LINE_RECORD_HEADER_BYTES;
+        this->max_line_bytes = max_record_bytes > envelope_bytes ? ( max_record_bytes - envelope_bytes ) / MAX_ENCODED_GROWTH : 0;
+
+        try{
+
+            for( std::unique_ptr<Encoder>& encoder : this->encoders ){
+                Encoder* encoder_ptr = encoder.get();
+                encoder->thread = std::thread( [this, encoder_ptr](){ this->runEncoder( *encoder_ptr ); } );
+            }
+
+            this->producer_thread = std::thread( [this](){ this->runProducer(); } );
+
+        }catch( ... ){
+
+            this->stopping = true;
+            for( std::unique_ptr<Encoder>& encoder : this->encoders ){
+                if( encoder->thread.joinable() ){
+                    encoder->thread.join();
+                }
+            }
+            throw;
+
+        }
+
+    }
+
+
+
+    LinePipeline::~LinePipeline(){
+
+        this->stopping = true;
+
+        {
+            std::lock_guard<std::mutex> lock( this->wait_mutex );
+            this->wait_condition.notify_all();
+        }
+
+        for( std::unique_ptr<Encoder>& encoder : this->encoders ){
+            encoder->thread.join();
+        }
+
+        this->producer_thread.join();
+
+    }
+
+
+
+    bool LinePipeline::waitForProgress( uint64_t seen_progress ){
+
+        //waiting is raised before progress is checked and progress before waiting is checked (both sequentially consistent), so a notification can't be missed
+        this->waiting++;
+        {
+            std::unique_lock<std::mutex> lock( this->wait_mutex );
+            this->wait_condition.wait_for( lock, std::chrono::milliseconds(PIPELINE_WAIT_MS), [this, seen_progress](){
+                return this->progress.load() != seen_progress || this->stopping;
+            });
+        }
+        this->waiting--;
+
+        return !this->stopping;
+
+    }
+
+
+
+    void LinePipeline::notifyProgress(){
+
+        this->progress++;
+
+        if( this->waiting.load() > 0 ){
+            std::lock_guard<std::mutex> lock( this->wait_mutex );
+            this->wait_condition.notify_all();
+        }
+
+    }
+
+
+
+    void LinePipeline::throwIfFailed(){
+
+        if( this->failed ){
+            std::rethrow_exception( this->failure );
+        }
+
+    }
+
+
+
+    void LinePipeline::push( std::string_view line, int64_t end_offset ){
+
+        this->throwIfFailed();
+
+        if( line.size() > this->max_line_bytes ){
+            this->bypass( line, end_offset );
+            return;
+        }
+
+        Encoder& encoder = *this->encoders[ this->next_input ];
+
+        char* record;
+        for( ;; ){
+            const uint64_t seen_progress = this->progress.load();
+            if( (record = encoder.input->reserve(LINE_RECORD_HEADER_BYTES + line.size())) != nullptr ){
+                break;
+            }
+            //the encoder is behind (and so, probably, is the producer)
+            if( this->reader_notify_pending ){
+                this->reader_notify_pending = false;
+                this->notifyProgress();
+                continue;
+            }
+            encoder.input_full_waits.fetch_add( 1, std::memory_order_relaxed );
+            this->waitForProgress( seen_progress );
+            this->throwIfFailed();
+        }
+
+        memcpy( record, &end_offset, LINE_RECORD_HEADER_BYTES );
+        memcpy( record + LINE_RECORD_HEADER_BYTES, line.data(), line.size() );
+        encoder.input->commit();
+
+        this->chunk_open = true;
+        this->reader_notify_pending = true;
+        this->lines_read.fetch_add( 1, std::memory_order_relaxed );
+
+    }
+
+
+
+    void LinePipeline::endChunk(){
+
+        if( !this->chunk_open ){
+            return;
+        }
+
+        Encoder& encoder = *this->encoders[ this->next_input ];
+
+        const int64_t chunk_end_offset = CHUNK_END_OFFSET;
+
+        char* record;
+        for( ;; ){
+            const uint64_t seen_progress = this->progress.load();
+            if( (record = encoder.input->reserve(LINE_RECORD_HEADER_BYTES)) != nullptr ){
+                break;
+            }
+            if( this->reader_notify_pending ){
+                this->reader_notify_pending = false;
+                this->notifyProgress();
+                continue;
+            }
+            encoder.input_full_waits.fetch_add( 1, std::memory_order_relaxed );
+            this->waitForProgress( seen_progress );
+            this->throwIfFailed();
+        }
+
+        memcpy( record, &chunk_end_offset, LINE_RECORD_HEADER_BYTES );
+        encoder.input->commit();
+        this->reader_notify_pending = false;
+
+        this->chunk_open = false;
+        this->chunks_pushed++;
+        this->next_input = ( this->next_input + 1 ) % this->encoders.size();
+
+        this->notifyProgress();
+
+    }
+
+
+
+    void LinePipeline::drain(){
+
+        this->endChunk();
+
+        for( ;; ){
+            const uint64_t seen_progress = this->progress.load();
+            this->throwIfFailed();
+            if( this->chunks_produced.load() == this->chunks_pushed ){
+                break;
+            }
+            this->waitForProgress( seen_progress );
+        }
+
+        this->throwIfFailed();
+
+    }
+
+
+
+    void LinePipeline::bypass( std::string_view line, int64_t end_offset ){
+
+        //everything before it is produced first, so the order of the file is kept
+        this->drain();
+
+        string filtered_line;
+        this->watch.filterLogLine( line, filtered_line );
+
+        DeliveryTicket* ticket = this->delivery_tracker.track( end_offset );
+        this->producer.produce( filtered_line, ticket );
+
+        this->lines_bypassed.fetch_add( 1, std::memory_order_relaxed );
+
+    }
+
+
+
+    void LinePipeline::runEncoder( Encoder& encoder ){
+
+        string encoded_line;  //reused for every line
+        bool notify_pending = false;  //records were released (or published) since the last notification
+
+        while( !this->stopping ){
+
+            const uint64_t seen_progress = this->progress.load();
+
+            std::string_view record;
+            if( !encoder.input->peek(record) ){
+                //let the others know about the room (and messages) made before waiting for more
+                if( notify_pending ){
+                    notify_pending = false;
+                    this->notifyProgress();
+                    continue;
+                }
+                this->waitForProgress( seen_progress );
+                continue;
+            }
+
+            int64_t end_offset;
+            memcpy( &end_offset, record.data(), LINE_RECORD_HEADER_BYTES );
+
+            if( end_offset == CHUNK_END_OFFSET ){
+                encoded_line.clear();
+            }else{
+                this->watch.filterLogLine( record.substr(LINE_RECORD_HEADER_BYTES), encoded_line );
+            }
+
+            char* output_record;
+            for( ;; ){
+                const uint64_t seen_output_progress = this->progress.load();
+                if( (output_record = encoder.output->reserve(LINE_RECORD_HEADER_BYTES + encoded_line.size())) != nullptr ){
+                    break;
+                }
+                if( notify_pending ){
+                    notify_pending = false;
+                    this->notifyProgress();
+                    continue;
+                }
+                encoder.output_full_waits.fetch_add( 1, std::memory_order_relaxed );
+                if( !this->waitForProgress(seen_output_progress) ){
+                    return;
+                }
+            }
+
+            memcpy( output_record, &end_offset, LINE_RECORD_HEADER_BYTES );
+            memcpy( output_record + LINE_RECORD_HEADER_BYTES, encoded_line.data(), encoded_line.size() );
+            encoder.output->commit();
+
+            encoder.input->release();
+
+            if( end_offset == CHUNK_END_OFFSET ){
+                notify_pending = false;
+                this->notifyProgress();
+            }else{
+                notify_pending = true;
+                this->lines_encoded.fetch_add( 1, std::memory_order_relaxed );
+            }
+
+        }
+
+    }
+
+
+
+    void LinePipeline::runProducer(){
+
+        MessageBatch batch;  //the lines of one chunk; reused
+        PayloadPool* payload_pool = this->producer.getPayloadPool();
+        size_t next_output = 0;
+        bool notify_pending = false;
+
+        std::chrono::steady_clock::time_point next_stats_time = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->stats_interval_ms );
+
+        while( !this->stopping ){
+
+            if( this->stats_interval_ms > 0 && std::chrono::steady_clock::now() >= next_stats_time ){
+                next_stats_time = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->stats_interval_ms );
+                this->logport->getObserver().addMetricEntry( "{\"name\":\"watch.pipeline\",\"source\":\"" + escape_to_json_string(this->watch.watched_filepath) + "\",\"stats\":" + this->getStats().toJson() + "}" );
+            }
+
+            Encoder& encoder = *this->encoders[ next_output ];
+
+            const uint64_t seen_progress = this->progress.load();
+
+            std::string_view record;
+            if( !encoder.output->peek(record) ){
+                if( notify_pending ){
+                    notify_pending = false;
+                    this->notifyProgress();
+                    continue;
+                }
+                this->waitForProgress( seen_progress );
+                continue;
+            }
+
+            int64_t end_offset;
+            memcpy( &end_offset, record.data(), LINE_RECORD_HEADER_BYTES );
+
+            if( end_offset != CHUNK_END_OFFSET ){
+
+                //tickets are issued here, in file order, so the acknowledged offset only covers lines that were handed to the producer
+                DeliveryTicket* ticket = this->delivery_tracker.track( end_offset );
+                const std::string_view message = record.substr( LINE_RECORD_HEADER_BYTES );
+
+                //out of the ring and straight into the block the producer sends from, when it has a pool
+                if( payload_pool != nullptr ){
+                    batch.add( payload_pool->acquire(message.data(), message.size(), ticket) );
+                }else{
+                    batch.add( message, ticket );
+                }
+                encoder.output->release();
+                notify_pending = true;
+                continue;
+
+            }
+
+            encoder.output->release();
+
+            if( !batch.empty() ){
+
+                try{
+                    this->producer.produceBatch( batch );  //blocks while the producer's queue is full
+                }catch( ... ){
+                    this->failure = std::current_exception();
+                    this->failed = true;
+                    this->notifyProgress();
+                    return;
+                }
+
+                this->lines_produced.fetch_add( batch.size(), std::memory_order_relaxed );
+                this->batches_produced.fetch_add( 1, std::memory_order_relaxed );
+                batch.clear();
+
+            }
+
+            this->chunks_produced++;
+            next_output = ( next_output + 1 ) % this->encoders.size();
+
+            notify_pending = false;
+            this->notifyProgress();
+
+        }
+
+    }
+
+
+
+    LinePipelineStats LinePipeline::getStats() const{
+
+        LinePipelineStats stats;
+
+        stats.lines_read = this->lines_read.load( std::memory_order_relaxed );
+        stats.lines_encoded = this->lines_encoded.load( std::memory_order_relaxed );
+        stats.lines_produced = this->lines_produced.load( std::memory_order_relaxed );
+        stats.batches_produced = this->batches_produced.load( std::memory_order_relaxed );
+        stats.lines_bypassed = this->lines_bypassed.load( std::memory_order_relaxed );
+
+        for( size_t x = 0; x < this->encoders.size(); x++ ){
+
+            const Encoder& encoder = *this->encoders[x];
+
+            LinePipelineStageStats input_stats;
+            input_stats.stage = "encode";
+            input_stats.ring = x;
+            input_stats.capacity_bytes = encoder.input->getCapacity();
+            input_stats.depth_bytes = encoder.input->getUsedBytes();
+            input_stats.depth_bytes_high_water_mark = encoder.input->getUsedBytesHighWaterMark();
+            input_stats.full_waits = encoder.input_full_waits.load( std::memory_order_relaxed );
+            stats.stages.push_back( input_stats );
+
+            LinePipelineStageStats output_stats;
+            output_stats.stage = "produce";
+            output_stats.ring = x;
+            output_stats.capacity_bytes = encoder.output->getCapacity();
+            output_stats.depth_bytes = encoder.output->getUsedBytes();
+            output_stats.depth_bytes_high_water_mark = encoder.output->getUsedBytesHighWaterMark();
+            output_stats.full_waits = encoder.output_full_waits.load( std::memory_order_relaxed );
+            stats.stages.push_back( output_stats );
+
+        }
+
+        return stats;
+
+    }
+
+
+}
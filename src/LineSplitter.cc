@@ -0,0 +1,302 @@
+#include "LineSplitter.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define LOGPORT_X86_SIMD 1
+    #include <immintrin.h>
+#endif
+
+
+namespace logport{
+
+
+#ifdef LOGPORT_X86_SIMD
+
+    __attribute__((target("avx2")))
+    static const char* find_newline_avx2( const char* begin, const char* end ){
+
+        const __m256i newlines = _mm256_set1_epi8( '\n' );
+
+        while( end - begin >= 32 ){
+
+            const __m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(begin) );
+            const unsigned int mask = static_cast<unsigned int>( _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines)) );
+
+            if( mask ){
+                return begin + __builtin_ctz( mask );
+            }
+
+            begin += 32;
+
+        }
+
+        const void* found = memchr( begin, '\n', end - begin );
+        return found ? static_cast<const char*>(found) : end;
+
+    }
+
+
+    __attribute__((target("sse2")))
+    static const char* find_newline_sse2( const char* begin, const char* end ){
+
+        const __m128i newlines = _mm_set1_epi8( '\n' );
+
+        while( end - begin >= 16 ){
+
+            const __m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i*>(begin) );
+            const unsigned int mask = static_cast<unsigned int>( _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines)) );
+
+            if( mask ){
+                return begin + __builtin_ctz( mask );
+            }
+
+            begin += 16;
+
+        }
+
+        const void* found = memchr( begin, '\n', end - begin );
+        return found ? static_cast<const char*>(found) : end;
+
+    }
+
+#endif
+
+
+    static const char* find_newline_scalar( const char* begin, const char* end ){
+
+        const void* found = memchr( begin, '\n', end - begin );
+        return found ? static_cast<const char*>(found) : end;
+
+    }
+
+
+    typedef const char* (*find_newline_function)( const char*, const char* );
+
+    static find_newline_function select_find_newline(){
+
+#ifdef LOGPORT_X86_SIMD
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports("avx2") ) return find_newline_avx2;
+        if( __builtin_cpu_supports("sse2") ) return find_newline_sse2;
+#endif
+        return find_newline_scalar;
+
+    }
+
+
+    const char* find_newline( const char* begin, const char* end ){
+
+        static const find_newline_function implementation = select_find_newline();
+
+        return implementation( begin, end );
+
+    }
+
+
+
+
+    void LineSplitter::setMaxLineBytes( size_t max_line_bytes, LongLinePolicy policy ){
+
+        this->max_line_bytes = max_line_bytes;
+        this->long_line_policy = policy;
+
+    }
+
+
+
+    string& LineSplitter::nextTruncatedLine(){
+
+        if( this->truncated_lines_used == this->truncated_lines.size() ){
+            this->truncated_lines.emplace_back();
+        }
+
+        return this->truncated_lines[ this->truncated_lines_used++ ];
+
+    }
+
+
+
+    void LineSplitter::countLongLine(){
+
+        //a line split across several chunks is only counted once
+        if( !this->long_line_counted ){
+            this->long_lines++;
+            this->long_line_counted = true;
+        }
+
+    }
+
+
+
+    void LineSplitter::split( const char* data, size_t length, vector<LineSpan>& lines ){
+
+        lines.clear();
+        this->truncated_lines_used = 0;
+
+        const char* chunk_end = data + length;
+        const char* line_begin = data;
+
+        bool continues_line = false;  //a fragment of the carried-over line was cut; the main loop splits the rest
+
+        //finish the line carried over from the previous chunk
+            if( this->partial_source_bytes ){
+
+                const char* newline = find_newline( data, chunk_end );
+                const size_t head_bytes = size_t( newline - data );
+                const int64_t begin = -int64_t( this->partial_source_bytes );
+
+                if( this->discarding ){
+
+                    //already truncated (and marked); drop everything up to the newline
+                    if( newline == chunk_end ){
+                        this->partial_source_bytes += length;
+                        return;
+                    }
+
+                    this->discarding = false;
+
+                }else if( this->max_line_bytes && this->partial.size() + head_bytes > this->max_line_bytes ){
+
+                    const size_t room = this->max_line_bytes - std::min( this->partial.size(), this->max_line_bytes );
+                    this->partial.append( data, room );
+                    this->countLongLine();
+
+                    if( this->long_line_policy == LongLinePolicy::SPLIT ){
+
+                        this->assembled.swap( this->partial );
+                        this->partial.clear();
+                        this->partial_source_bytes = 0;
+
+                        lines.push_back( LineSpan{ std::string_view(this->assembled), begin, room } );
+
+                        //the rest of the line is split like any other long line
+                        line_begin = data + room;
+                        continues_line = true;
+
+                    }else{
+
+                        this->partial.append( LONG_LINE_TRUNCATED_MARKER );
+
+                        if( newline == chunk_end ){
+                            this->discarding = true;
+                            this->partial_source_bytes += length;
+                            return;
+                        }
+
+                    }
+
+                }else{
+
+                    if( newline == chunk_end ){
+                        //still no newline; keep accumulating (amortized append, never a full re-copy)
+                        this->partial.append( data, length );
+                        this->partial_source_bytes += length;
+                        return;
+                    }
+
+                    this->partial.append( data, head_bytes );
+
+                }
+
+                if( !continues_line ){
+
+                    this->long_line_counted = false;
+
+                    this->assembled.swap( this->partial );
+                    this->partial.clear();
+                    this->partial_source_bytes = 0;
+
+                    lines.push_back( LineSpan{ std::string_view(this->assembled), begin, head_bytes + 1 } );
+
+                    line_begin = newline + 1;
+
+                }
+
+            }
+
+
+        //every other complete line is a view into the chunk
+            while( line_begin < chunk_end ){
+
+                const char* newline = find_newline( line_begin, chunk_end );
+                size_t line_bytes = size_t( newline - line_begin );
+
+                if( this->max_line_bytes && line_bytes > this->max_line_bytes ){
+
+                    this->countLongLine();
+
+                    if( this->long_line_policy == LongLinePolicy::SPLIT ){
+
+                        //full-length fragments; what's left is an ordinary line (or the trailing partial)
+                        while( line_bytes > this->max_line_bytes ){
+                            const size_t fragment_end = size_t( line_begin - data ) + this->max_line_bytes;
+                            lines.push_back( LineSpan{ std::string_view(line_begin, this->max_line_bytes), int64_t(line_begin - data), fragment_end } );
+                            line_begin += this->max_line_bytes;
+                            line_bytes -= this->max_line_bytes;
+                        }
+
+                    }else{
+
+                        if( newline == chunk_end ){
+                            //the rest of the line is dropped as it arrives
+                            this->partial.assign( line_begin, this->max_line_bytes );
+                            this->partial.append( LONG_LINE_TRUNCATED_MARKER );
+                            this->partial_source_bytes = size_t( chunk_end - line_begin );
+                            this->discarding = true;
+                            return;
+                        }
+
+                        string& truncated_line = this->nextTruncatedLine();
+                        truncated_line.assign( line_begin, this->max_line_bytes );
+                        truncated_line.append( LONG_LINE_TRUNCATED_MARKER );
+
+                        lines.push_back( LineSpan{ std::string_view(truncated_line), int64_t(line_begin - data), size_t(newline - data) + 1 } );
+
+                        line_begin = newline + 1;
+                        this->long_line_counted = false;
+                        continue;
+
+                    }
+
+                }
+
+                if( newline == chunk_end ){
+                    break;
+                }
+
+                this->long_line_counted = false;
+
+                if( newline != line_begin ){
+                    lines.push_back( LineSpan{ std::string_view(line_begin, newline - line_begin), int64_t(line_begin - data), size_t(newline - data) + 1 } );
+                }
+
+                line_begin = newline + 1;
+
+            }
+
+
+        //carry over the trailing partial line (never longer than max_line_bytes)
+            if( line_begin < chunk_end ){
+                this->partial.assign( line_begin, chunk_end - line_begin );
+                this->partial_source_bytes = size_t( chunk_end - line_begin );
+            }
+
+    }
+
+
+
+    void LineSplitter::clear(){
+
+        this->partial.clear();
+        this->assembled.clear();
+        this->partial_source_bytes = 0;
+        this->discarding = false;
+        this->long_line_counted = false;
+
+    }
+
+
+}
@@ -11,11 +11,15 @@ using std::endl;
 #include <signal.h>
 
 #include "InotifyWatcher.h"
+#include "MultiFileWatcher.h"
+#include "PatternWatcher.h"
+#include "WatchSupervisor.h"
 #include "LevelTriggeredEpollWatcher.h"
 
 #include "Producer.h"
 #include "KafkaProducer.h"
 #include "HttpProducer.h"
+#include "Spool.h"
 
 #include "Database.h"
 #include "PreparedStatement.h"
@@ -25,6 +29,7 @@ using std::endl;
 #include <cstdio>
 #include <stdexcept>
 #include <memory>
+#include <thread>
 #include <stdio.h>
 #include <fstream>
 #include <sstream>
@@ -40,6 +45,9 @@ using std::endl;
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <malloc.h>
+#include <chrono>
 
 #include "Inspector.h"
 
@@ -58,6 +66,7 @@ static void signal_handler_stop( int sig ){
     
     logport_app_ptr->run = false;
     logport_app_ptr->watches_paused = false;  //we "unpause" the watches so that the SIGINT can win over the pauses
+    logport_app_ptr->signalEvent();
 
     logport::Observer observer;
 
@@ -72,6 +81,7 @@ static void signal_handler_stop( int sig ){
 static void signal_handler_reload_config( int /*sig*/ ){
 
     logport_app_ptr->reload_required = true;
+    logport_app_ptr->signalEvent();
     logport::Observer observer;
 	observer.addLogEntry( "logport: SIGHUP received. Reloading configuration." );
 
@@ -87,11 +97,13 @@ static void signal_handler_pause_resume( int sig ){
     		observer.addLogEntry( "logport: SIGUSR1 received. Stopping all watches." );
     		logport_app_ptr->watches_paused = true;
     		logport_app_ptr->run = false;    		
+    		logport_app_ptr->signalEvent();
     		break;
 
     	case SIGUSR2:
     		logport_app_ptr->run = true;
     		logport_app_ptr->watches_paused = false;
+    		logport_app_ptr->signalEvent();
     		observer.addLogEntry( "logport: SIGUSR2 received. Resuming all watches." ); 
     		logport_app_ptr->closeObserver();
     		break;
@@ -107,7 +119,7 @@ static void signal_handler_pause_resume( int sig ){
 namespace logport{
 
 	LogPort::LogPort()
-		:db(NULL), inspector(NULL), observer(NULL), run(true), reload_required(false), watches_paused(false), current_version("0.3.0"), pid_filename("/var/run/logport.pid"), verbose_mode(false)
+		:db(NULL), inspector(NULL), observer(NULL), event_fd(-1), run(true), reload_required(false), watches_paused(false), current_version("0.3.0"), pid_filename("/var/run/logport.pid"), verbose_mode(false)
 	{
 
 
@@ -127,6 +139,10 @@ namespace logport{
 			delete this->observer;
 		}
 
+		if( this->event_fd != -1 ){
+			close( this->event_fd );
+		}
+
 	}
 
 
@@ -156,6 +172,15 @@ namespace logport{
 
 		logport_app_ptr = this;
 
+		if( this->event_fd == -1 ){
+			this->event_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+			if( this->event_fd == -1 ){
+				char error_string_buffer[1024];
+				snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+				throw std::runtime_error( "Failed to create the service's eventfd. errno: " + string(error_string_buffer) );
+			}
+		}
+
         // Signal handler for clean shutdown 
         signal( SIGINT, signal_handler_stop );
         signal( SIGTERM, signal_handler_stop );
@@ -168,6 +193,29 @@ namespace logport{
 	}
 
 
+
+	void LogPort::signalEvent(){
+
+		if( this->event_fd == -1 ){
+			return;
+		}
+
+		const uint64_t event = 1;
+		ssize_t result = write( this->event_fd, &event, sizeof(event) );
+		(void)result;  //EAGAIN: it's already readable
+
+	}
+
+
+
+	void LogPort::clearEvent(){
+
+		uint64_t events;
+		while( read(this->event_fd, &events, sizeof(events)) == -1 && errno == EINTR );
+
+	}
+
+
 	void LogPort::install(){
 
 
@@ -186,6 +234,8 @@ namespace logport{
 				Database db; //creates the db
 				if( !database_exists ){
 					db.createDatabase();
+				}else{
+					db.upgradeDatabase();
 				}
 
 				Observer observer;  //create all of the log files
@@ -524,6 +574,8 @@ namespace logport{
 
 		cerr << "Usage: logport watch [OPTION]... [FILE]...\n"
 				"Adds one or more files to be watched.\n"
+				"A FILE whose name is a quoted wildcard pattern (eg. '/var/log/app/*.log') watches every matching file\n"
+				"in that directory, including the ones created later.\n"
 				"\n"
 				"Mandatory arguments to long options are mandatory for short options too.\n"
 				"  -b, --brokers [BROKERS]             a csv list of kafka brokers\n"
@@ -535,7 +587,12 @@ namespace logport{
 				"  -l, --log-type [LOG_TYPE]           a user-defined category for the watch\n"
 				"                                      (optional; defaults to setting: default.log_type)\n"
 				"  -h, --hostname [HOSTNAME]           the name of this host that will appear in the log entries\n"
-				"                                      (optional; defaults to setting: default.hostname)"
+				"                                      (optional; defaults to setting: default.hostname)\n"
+				"  -m, --multiline                     joins indented lines (eg. stack traces) onto the record before them\n"
+				"                                      (optional; off by default)\n"
+				"      --multiline-start-pattern [PATTERN]\n"
+				"                                      only lines matching PATTERN start a record; implies --multiline\n"
+				"                                      (optional; eg. '\\d\\d\\d\\d-\\d\\d-\\d\\d')"
 		<< endl;
 
 	}
@@ -641,6 +698,8 @@ namespace logport{
     		string this_product_code = this->getDefaultProductCode();
     		string this_log_type = this->getDefaultLogType();
     		string this_hostname = this->getDefaultHostname();
+    		bool this_multiline = false;
+    		string this_multiline_start_pattern;
 
     		int number_of_added_watches = 0;
 
@@ -753,6 +812,40 @@ namespace logport{
     			}
 
 
+    			if( current_argument == "--multiline" || current_argument == "-m" ){
+
+    				this_multiline = true;
+
+					current_argument_offset++;
+    				if( current_argument_offset >= argc ){
+						this->printHelpWatch();
+						return -1;
+    				}
+    				continue;
+
+    			}
+
+
+    			if( current_argument == "--multiline-start-pattern" ){
+
+    				current_argument_offset++;
+    				if( current_argument_offset >= argc ){
+						this->printHelpWatch();
+						return -1;
+    				}
+    				this_multiline_start_pattern = this->command_line_arguments[ current_argument_offset ];
+    				this_multiline = true;
+
+					current_argument_offset++;
+    				if( current_argument_offset >= argc ){
+						this->printHelpWatch();
+						return -1;
+    				}
+    				continue;
+
+    			}
+
+
     			if( this->command == "adopt" ){
 
     				this->additional_arguments.push_back( current_argument );
@@ -780,8 +873,17 @@ namespace logport{
 					watch.product_code = this_product_code;
 					watch.log_type = this_log_type;
 					watch.hostname = this_hostname;
-					watch.watched_filepath = get_real_filepath(current_argument);
-					watch.undelivered_log_filepath = watch.watched_filepath + "_undelivered";
+					watch.multiline = this_multiline;
+					watch.multiline_start_pattern = this_multiline_start_pattern;
+					if( is_glob_pattern(get_file_name(current_argument)) ){
+						//a pattern watch (eg. '/var/log/app/*.log'); only its directory has to exist
+						const string directory = get_real_filepath( get_parent_directory(current_argument) );
+						watch.watched_filepath = ( directory == "/" ? "" : directory ) + "/" + get_file_name( current_argument );
+						watch.undelivered_log_filepath = ( directory == "/" ? "" : directory ) + "/logport_now_undelivered";  //replaced by the watch id once saved
+					}else{
+						watch.watched_filepath = get_real_filepath(current_argument);
+						watch.undelivered_log_filepath = watch.watched_filepath + "_undelivered";
+					}
 
 		    		if( this->command == "now" ){
 		    			this->watchNow( watch );	    			
@@ -1207,7 +1309,7 @@ namespace logport{
 
 		Database& db = this->getDatabase();
 
-		PreparedStatement statement( db, "INSERT INTO watches ( filepath, file_offset, producer_type, brokers, topic, product_code, log_type, hostname, pid ) VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ? );" );
+		PreparedStatement statement( db, "INSERT INTO watches ( filepath, file_offset, producer_type, brokers, topic, product_code, log_type, hostname, pid, multiline, multiline_start_pattern ) VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? );" );
 
 		watch.bind( statement, true );
 
@@ -1377,7 +1479,18 @@ namespace logport{
 
 	void LogPort::adopt( const Watch& watch ){
 
-		Watch current_watch = watch;
+		//the envelope's "source" names the stream each line came from (see Watch::renderEnvelope)
+		Watch process_exit_watch = watch;
+		process_exit_watch.watched_filepath = "process_exit";
+		process_exit_watch.renderEnvelope();
+
+		Watch stdout_watch = watch;
+		stdout_watch.watched_filepath = "stdout";
+		stdout_watch.renderEnvelope();
+
+		Watch stderr_watch = watch;
+		stderr_watch.watched_filepath = "stderr";
+		stderr_watch.renderEnvelope();
 
 
 		if( this->additional_arguments.size() == 0 ){
@@ -1532,8 +1645,7 @@ namespace logport{
 
 				}
 
-				current_watch.watched_filepath = "process_exit";
-				string filtered_log_line = current_watch.filterLogLine( log_line );
+				string filtered_log_line = process_exit_watch.filterLogLine( log_line );
                 kafka_producer.produce( filtered_log_line );
 				
 			}
@@ -1625,8 +1737,7 @@ namespace logport{
 
                                 if( sent_message.size() > 0 ){
 
-                                	current_watch.watched_filepath = "stdout";
-                                    string filtered_log_line = current_watch.filterLogLine( sent_message );
+                                    string filtered_log_line = stdout_watch.filterLogLine( sent_message );
 
                                     //handle consecutive newline characters (by dropping them)
 					                kafka_producer.produce( filtered_log_line );
@@ -1729,8 +1840,7 @@ namespace logport{
 
                                 if( sent_message.size() > 0 ){
 
-                                	current_watch.watched_filepath = "stderr";
-                                    string filtered_log_line = current_watch.filterLogLine( sent_message );
+                                    string filtered_log_line = stderr_watch.filterLogLine( sent_message );
 
                                     //handle consecutive newline characters (by dropping them)
 					                kafka_producer.produce( filtered_log_line );
@@ -2117,441 +2227,153 @@ namespace logport{
 
 		if( seconds <= 0 ) return;
 
-		int current_second = 0;
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds( seconds );
 
-		while( current_second < seconds ){
+		LevelTriggeredEpollWatcher epoll_watcher( this->event_fd );
 
-			sleep( 1 );
+		while( this->run && !this->reload_required ){
 
-			if( this->run == false || this->reload_required == true ){
+			const int64_t remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>( deadline - std::chrono::steady_clock::now() ).count();
+			if( remaining_ms <= 0 ){
 				return;
 			}
 
-			current_second++;
-		}
-
-	}
-
-
-	void LogPort::startWatches(){
-
-		this->getObserver().addLogEntry( "logport: started" );
-
-
-		vector<Watch> watches;
-
-		{
-			Database db;
-			watches = db.getWatches();
-		}
-
-		 
-		if( watches.size() == 0 ){
-
-			this->getObserver().addLogEntry( "Started logport service with no files being watched." );
-
-		}else{
-
-			for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-				Watch& watch = *it;
-				//this forks for each watch
-				watch.start( this );
+			if( epoll_watcher.watch(int(remaining_ms)) ){
+				this->clearEvent();
 			}
 
 		}
 
+	}
 
-		bool have_initiated_all_stop = false;
-		bool shutdown_complete = false;
-
-		bool initiate_resuming_of_watches = false;
-
-
-		int status;
-
-		while( this->run || ( !shutdown_complete && !have_initiated_all_stop ) || this->watches_paused ){
-
-			//WNOHANG makes this return immediately (so we can monitor RSS)
-			pid_t child_pid = waitpid(-1, &status, WUNTRACED | WNOHANG | WCONTINUED );
-			//pid_t child_pid = waitpid( -1, &status, WUNTRACED | WCONTINUED );
-
-
-			/*
-			cout << "-------------------" << endl;
-			cout << "this->run: " << this->run << endl;
-			cout << "shutdown_complete: " << shutdown_complete << endl;
-			cout << "this->watches_paused " << this->watches_paused << endl;
-			cout << "have_initiated_all_stop " << have_initiated_all_stop << endl;
-			cout << "initiate_resuming_of_watches " << initiate_resuming_of_watches << endl;
-			*/
-
-
-
-			// determine if we should resume watches after they were paused
-				if( shutdown_complete && this->run == true && this->watches_paused == false && have_initiated_all_stop == true ){
 
-					initiate_resuming_of_watches = true;
+	void LogPort::startConsolidatedWatches(){
 
-					//reset others to resume normal operations
-					have_initiated_all_stop = false;
-					shutdown_complete = false;
+		while( this->run || this->watches_paused ){
 
+			if( !this->run ){
+				//paused (SIGUSR1) until resumed (SIGUSR2) or stopped; the signal handlers wake this through the event descriptor
+				LevelTriggeredEpollWatcher epoll_watcher( this->event_fd );
+				if( epoll_watcher.watch(-1) ){
+					this->clearEvent();
 				}
+				continue;
+			}
 
+			vector<Watch> watches;
+			map<string,string> settings;
 
-			//determine if all watches have shutdown
-				if( this->run == false && have_initiated_all_stop == true && shutdown_complete == false ){
-
-					bool some_watches_still_running = false;
-
-					for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-						Watch& watch = *it;
-						if( watch.pid > 0 ){
-							some_watches_still_running = true;
-						}
-					}
-
-					if( !some_watches_still_running ){
-						shutdown_complete = true;
-					}
-
+			{
+				Database& db = this->getDatabase();
+				watches = db.getWatches();
+				settings = db.getSettings();
+
+				//the watches all run in this process
+				for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
+					Watch& watch = *it;
+					watch.pid = getpid();
+					watch.savePid( db );
 				}
+			}
 
+			this->reload_required = false;
 
-			//determine if some watches should startup (if reload is required or resuming watches)
-				if( ( this->reload_required == true || initiate_resuming_of_watches == true ) && this->run == true && have_initiated_all_stop == false ){
-
-					//reload from db
-					{
-						Database db;
-						watches = db.getWatches();
-					}
-
-					for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-						Watch& watch = *it;
-						if( watch.pid < 0 ){
-							//not running watch; let's start it
-
-							//wait for watches to start so the offset is saved properly
-							sleep(10);
-							{
-								Database db;
-								watch.loadOffset( db );
-							}
-
-							watch.start( this );
-						}
-					}
-
-					if( this->reload_required ){
-						this->reload_required = false;
-					}					
-
-					if( initiate_resuming_of_watches ){
-						initiate_resuming_of_watches = false;
-					}
-
-					//reset others to resume normal operations
-					shutdown_complete = false;
-					have_initiated_all_stop = false;
+			if( watches.size() == 0 ){
+				this->getObserver().addLogEntry( "Started logport service with no files being watched." );
+			}
 
+			//pattern watches each run on their own thread (with their own connection); the rest share the MultiFileWatcher
+			vector<Watch> file_watches;
+			vector<Watch> pattern_watches;
+			for( const Watch& watch : watches ){
+				if( watch.isPattern() ){
+					pattern_watches.push_back( watch );
+				}else{
+					file_watches.push_back( watch );
 				}
-
-
-
-			if( child_pid == -1 ){
-				//error, or no child processes
-                this->getObserver().addLogEntry( "logport: waitpid() error or no watches present. errno: " + logport::to_string<int>(errno) );
-                if( have_initiated_all_stop ){
-                	shutdown_complete = true;
-                }               	
-				this->waitUnlessEvent( 5 );
 			}
 
-			if( child_pid == 0 ){
-				//no children have exited
-
-
-				//stop all children
-					if( this->run == false && have_initiated_all_stop == false ){
-
-						Database db;
-
-						this->getObserver().addLogEntry( "logport: gracefully stopping all watches..." );
-
-						for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-
-							Watch& watch = *it;
-
-							if( watch.pid > 0 ){
-								watch.last_pid = watch.pid;
-								
-								//we're not going to use watch.stop() because it contains a shutdown delay and we want the delays to run in parallel (without needing to add threading, if possible)
-								//watch.stop( this );
-
-						        //terminate gracefully first, then forcefully if graceful shutdown lasts longer than 20s
-						        if( kill(watch.pid, SIGINT) == -1 ){
-						            this->getObserver().addLogEntry( "logport: failed to kill watch with SIGINT." );
-						        }
-						        
-								watch.pid = -1;
-								watch.savePid( db );
-
-							}
-
-						}
-
-						have_initiated_all_stop = true;
-
-					}
-
-
-				//ensure each watch is not using more than 250MB of memory
-
-				if( this->run == true && have_initiated_all_stop == false ){
-
-					for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-
-						Watch& watch = *it;
-
-						if( watch.pid > 0 ){
-							//if there's an existing process (ie. not the first loop iteration)
-
-							int watch_process_rss = proc_status_get_rss_usage_in_kb( watch.pid );
-							const string process_name = proc_status_get_name( watch.pid );
-
-							vector<string> proc_stats = proc_stat_values( watch.pid );
-							double total_time_seconds = 0;
-							unsigned long user_time_ticks = 0;
-							unsigned long kernel_time_ticks = 0;
-							if( proc_stats.size() > 23 ){
-								user_time_ticks = string_to_ulong( proc_stats[13] );
-								kernel_time_ticks = string_to_ulong( proc_stats[14] );
-								long clock_ticks_per_second = sysconf(_SC_CLK_TCK);
-								if( clock_ticks_per_second == 0 ){
-									clock_ticks_per_second = 100;
-								}
-								total_time_seconds = double(user_time_ticks + kernel_time_ticks) / double(clock_ticks_per_second);
-							}
-
-							int64_t undelivered_log_file_size = get_file_size( watch.undelivered_log_filepath );
-
-							this->getObserver().addLogEntry( "logport: watch process_name(" + process_name + "), RSS(" + logport::to_string<int>(watch_process_rss) + "KB), PID(" + logport::to_string<pid_t>(watch.pid) + "), cpu_time(" + logport::to_string<double>(total_time_seconds) + "), undelivered_file_size(" + logport::to_string<int64_t>(undelivered_log_file_size) + ")" );
-
-							if( watch_process_rss > 250000 ){ //250MB
-								//kill -9
-								//wait
-								//respawn
-
-								this->getObserver().addLogEntry( "logport: watch (pid: " + logport::to_string<pid_t>(watch.pid) + ", file: " + watch.watched_filepath + ") was killed because the RSS exceeded 250MB." );
-
-								watch.last_pid = watch.pid;
-
-								watch.stop( this );
-
-								sleep(10);
-
-								{
-									Database db;
-									watch.loadOffset( db );
-								}
-
-								
-								watch.start( this );
-								if( watch.last_pid == watch.pid ){
-
-									this->getObserver().addLogEntry( "logport: watch was killed and the new process has the same PID. Exiting." );
-
-								}
-
-								sleep(5);
-
-							}
-
-
-
-							if( total_time_seconds > 300 ){ //300 = 5 minutes 
-								//kill -9
-								//wait
-								//respawn
-
-								this->getObserver().addLogEntry( "logport: watch (pid: " + logport::to_string<pid_t>(watch.pid) + ", file: " + watch.watched_filepath + ") was killed because the CPU time exceeded 5 minutes." );
-
-								watch.last_pid = watch.pid;
-
-								watch.stop( this );
-
-								sleep(10);
-
-								{
-									Database db;
-									watch.loadOffset( db );
-								}
-								
-								watch.start( this );
-								if( watch.last_pid == watch.pid ){
-
-									this->getObserver().addLogEntry( "logport: watch was killed and the new process has the same PID. Exiting." );
-
-								}
-
-								sleep(5);
-
-							}
-
-
-							if( undelivered_log_file_size > 0 && watch.last_undelivered_size == undelivered_log_file_size ){ //when non-zero and size has stabilized
-								//kill -9
-								//wait
-								//respawn
-
-								this->getObserver().addLogEntry( "logport: watch (pid: " + logport::to_string<pid_t>(watch.pid) + ", file: " + watch.watched_filepath + ") was killed because undelivered_file_size has stabilized and is not empty. Closing to replay undelivered log." );
-
-								watch.last_pid = watch.pid;
-
-								watch.stop( this );
-
-								sleep(10);
-
-								{
-									Database db;
-									watch.loadOffset( db );
-								}
-								
-								watch.start( this );
-								if( watch.last_pid == watch.pid ){
-
-									this->getObserver().addLogEntry( "logport: watch was killed and the new process has the same PID. Exiting." );
-
-								}
-
-								watch.last_undelivered_size = 0;
-
-								sleep(5);
-
-							}else{
-
-								watch.last_undelivered_size = undelivered_log_file_size;
-
-							}
-
-							
-
-
-
-						}
-
-
-					}
-
-					this->waitUnlessEvent( 60 );
-					continue;
+			vector<std::unique_ptr<Database>> pattern_databases;
+			vector<std::unique_ptr<PatternWatcher>> pattern_watchers;
+			vector<std::thread> pattern_threads;
 
+			for( Watch& pattern_watch : pattern_watches ){
+				try{
+					pattern_databases.push_back( std::make_unique<Database>() );
+					pattern_watchers.push_back( std::make_unique<PatternWatcher>(*pattern_databases.back(), pattern_watch, this, settings) );
+				}catch( std::exception& e ){
+					this->getObserver().addLogEntry( "logport: failed to start pattern watch " + pattern_watch.watched_filepath + ": " + string(e.what()) );
 				}
+			}
 
-
+			for( std::unique_ptr<PatternWatcher>& pattern_watcher : pattern_watchers ){
+				PatternWatcher* pattern_watcher_ptr = pattern_watcher.get();
+				pattern_threads.emplace_back( [this, pattern_watcher_ptr](){
+					try{
+						pattern_watcher_ptr->startWatching();
+					}catch( std::exception& e ){
+						this->getObserver().addLogEntry( "logport: pattern watch exception: " + string(e.what()) );
+					}
+				});
 			}
 
+			try{
 
+				MultiFileWatcher watcher( this, file_watches, settings );
+				watcher.startWatching();
 
-			bool just_killed = false;
-			for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
+			}catch( std::exception& e ){
 
-				Watch& watch = *it;
+				this->getObserver().addLogEntry( "logport: consolidated watches exception: " + string(e.what()) );
+				this->waitUnlessEvent( 10 );
 
-				if( child_pid == watch.last_pid ){
-					//we just killed this process; ignore that it died
-					watch.last_pid = -1;
-					this->getObserver().addLogEntry( "logport: Notified of last PID." );
-					just_killed = true;
-				}
+			}
 
+			for( std::unique_ptr<PatternWatcher>& pattern_watcher : pattern_watchers ){
+				pattern_watcher->stop();
 			}
-			if( just_killed ){
-				continue;
+			for( std::thread& pattern_thread : pattern_threads ){
+				pattern_thread.join();
 			}
-			
-
-			if( child_pid > 0 ){
-
-				//find current watch
-					Watch* current_watch = NULL;
-					for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
-
-						Watch& watch = *it;
-
-						if( child_pid == watch.pid ){
-							current_watch = &watch;
-						}
-
-					}
 
-				// restart, if necessary
-				if( WIFEXITED(status) ){
-
-					int exit_status = WEXITSTATUS(status);
-					this->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(child_pid) + ") exited with status " + logport::to_string<int>(exit_status) );
-					
-					if( current_watch != NULL && this->run == true ){
-						this->getObserver().addLogEntry( "restarting..." );
-						current_watch->last_pid = child_pid;
-
-						//wait for previous watch to save offset
-						{
-							sleep(10);
-							Database db;
-							current_watch->loadOffset( db );
-						}
-
-						current_watch->start( this );
-					}
-
-
-				}else if( WIFSIGNALED(status) ){
+			{
+				Database& db = this->getDatabase();
+				for( vector<Watch>::iterator it = watches.begin(); it != watches.end(); ++it ){
+					Watch& watch = *it;
+					watch.last_pid = watch.pid;
+					watch.pid = -1;
+					watch.savePid( db );
+				}
+			}
 
-					int signal_number = WTERMSIG(status);
-					this->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(child_pid) + ") killed by signal " + logport::to_string<int>(signal_number) );
-					
-					if( current_watch != NULL && this->run == true ){
-						this->getObserver().addLogEntry( "restarting..." );
-						current_watch->last_pid = child_pid;
-
-						//wait for previous watch to save offset
-						{
-							sleep(10);
-							Database db;
-							current_watch->loadOffset( db );
-						}
-						
-						current_watch->start( this );
-					}
+			//return what the watchers freed to the system before they're started again (eg. after exceeding the RSS limit)
+			malloc_trim( 0 );
 
+		}
 
-				}else if( WIFSTOPPED(status) ){
+		this->getObserver().addLogEntry( "logport: all watches stopped" );
 
-					int signal_number = WSTOPSIG(status);
-					this->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(child_pid) + ") stopped by signal " + logport::to_string<int>(signal_number) );
-					if( current_watch != NULL && this->run == true ){
-						current_watch->last_pid = child_pid;
-						current_watch->pid = -1;
-						Database db;
-						current_watch->savePid( db );
-					}
+	}
 
-				}else if( WIFCONTINUED(status) ){
 
-					this->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(child_pid) + ") continued" );
+	void LogPort::startWatches(){
 
+		this->getObserver().addLogEntry( "logport: started" );
 
-				}else{
+		//the database may have been created by an older version
+		this->getDatabase().upgradeDatabase();
 
-					this->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(child_pid) + ") unknown return from waitpid " + logport::to_string<int>(status) );
 
-				}
+		//tail every watch from this process instead of forking a process per watch
+		if( this->getSetting("watch.mode") == "consolidated" ){
+			this->startConsolidatedWatches();
+			return;
+		}
 
-			}
 
-		}
+		//forks a process per watch and restarts them as they exit; blocks until the service is stopped
+		WatchSupervisor supervisor( this );
+		supervisor.run();
 
 		this->getObserver().addLogEntry( "logport: service shutdown complete" );
 
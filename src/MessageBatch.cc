@@ -0,0 +1,78 @@
+#include "MessageBatch.h"
+
+
+namespace logport{
+
+
+    MessageBatch::~MessageBatch(){
+
+        this->clear();
+
+    }
+
+
+
+    void MessageBatch::add( std::string_view message, DeliveryTicket* ticket ){
+
+        this->payloads.append( message.data(), message.size() );
+        this->payload_ends.push_back( this->payloads.size() );
+        this->tickets.push_back( ticket );
+        this->blocks.push_back( nullptr );
+
+    }
+
+
+
+    void MessageBatch::add( PayloadBlock* block ){
+
+        this->payload_ends.push_back( this->payloads.size() );
+        this->tickets.push_back( block->ticket );
+        this->blocks.push_back( block );
+
+    }
+
+
+
+    void MessageBatch::clear(){
+
+        for( PayloadBlock* block : this->blocks ){
+            PayloadPool::release( block );
+        }
+
+        this->payloads.clear();
+        this->payload_ends.clear();
+        this->tickets.clear();
+        this->blocks.clear();
+
+    }
+
+
+
+    std::string_view MessageBatch::getMessage( size_t index ) const{
+
+        PayloadBlock* block = this->blocks[index];
+
+        if( block != nullptr ){
+            return std::string_view( block->data(), block->length );
+        }
+
+        const size_t begin = ( index == 0 ) ? 0 : this->payload_ends[index - 1];
+
+        return std::string_view( this->payloads.data() + begin, this->payload_ends[index] - begin );
+
+    }
+
+
+
+    PayloadBlock* MessageBatch::takeBlock( size_t index ){
+
+        PayloadBlock* block = this->blocks[index];
+
+        this->blocks[index] = nullptr;
+
+        return block;
+
+    }
+
+
+}
@@ -0,0 +1,535 @@
+#include "MultiFileWatcher.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Common.h"
+#include "Observer.h"
+#include "LogPort.h"
+
+#include "Database.h"
+#include "KafkaProducer.h"
+#include "HttpProducer.h"
+#include "WatchSupervisor.h"
+
+
+namespace logport{
+
+
+    #define INOTIFY_EVENT_BUFFER_LENGTH (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+    //how long to wait before trying to tail a watch again after it failed (eg. the file doesn't exist yet)
+    #define ACTIVATION_RETRY_MS 3000
+
+
+    MultiFileWatcher::MultiFileWatcher( LogPort* logport, const vector<Watch>& watches, const map<string,string>& settings )
+        :logport(logport), settings(settings)
+    {
+
+        char error_string_buffer[1024];
+
+        this->inotify_fd = inotify_init();
+        if( this->inotify_fd == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to create inotify instance: errno " + string(error_string_buffer) );
+        }
+
+        this->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+        if( this->timer_fd == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            close( this->inotify_fd );
+            throw std::runtime_error( "Failed to create the resource check timerfd: errno " + string(error_string_buffer) );
+        }
+
+        //the limits for every watch together; 0 disables them
+        //eg. "logport set watch.consolidated.max.rss.kb 1000000"
+        this->max_rss_kb = get_setting_int64( this->settings, "watch.consolidated.max.rss.kb", WATCH_MAX_RSS_KB );
+        this->max_cpu_time_seconds = get_setting_int64( this->settings, "watch.consolidated.max.cpu.seconds", WATCH_MAX_CPU_TIME_SECONDS );
+
+
+        //a small fixed pool of workers; each watch is pinned to one of them
+        //eg. "logport set watch.consolidated.threads 4"
+        int64_t number_of_workers = get_setting_int64( this->settings, "watch.consolidated.threads", 4 );
+        if( number_of_workers > int64_t(watches.size()) ) number_of_workers = watches.size();
+        if( number_of_workers < 1 ) number_of_workers = 1;
+        if( number_of_workers > 64 ) number_of_workers = 64;
+
+        for( int64_t x = 0; x < number_of_workers; x++ ){
+            this->workers.push_back( std::make_unique<Worker>() );
+        }
+
+
+        size_t watch_index = 0;
+
+        for( const Watch& watch : watches ){
+
+            std::unique_ptr<WatchState> watch_state = std::make_unique<WatchState>();
+
+            watch_state->watch = watch;
+            watch_state->file_name = get_file_name( watch.watched_filepath );
+            watch_state->producer = &this->getProducer( watch );
+            watch_state->delivery_tracker = std::make_unique<DeliveryTracker>( watch.file_offset );
+            watch_state->worker_index = watch_index % this->workers.size();
+            watch_state->next_activation_attempt = std::chrono::steady_clock::now();
+
+            this->workers[ watch_state->worker_index ]->watch_states.push_back( watch_state.get() );
+            this->watch_states.push_back( std::move(watch_state) );
+
+            watch_index++;
+
+        }
+
+    }
+
+
+
+    MultiFileWatcher::~MultiFileWatcher(){
+
+        this->run = false;
+
+        for( std::unique_ptr<Worker>& worker : this->workers ){
+            worker->condition.notify_all();
+            if( worker->thread.joinable() ){
+                worker->thread.join();
+            }
+        }
+
+        close( this->timer_fd );
+        close( this->inotify_fd );
+
+    }
+
+
+
+    Producer& MultiFileWatcher::getProducer( const Watch& watch ){
+
+        //watches sending to the same place share one producer (and its connections and threads)
+        string producer_key = watch.producer_type_description + "|" + watch.brokers;
+        if( watch.producer_type == ProducerType::KAFKA ){
+            producer_key += "|" + watch.topic;
+        }
+
+        map<string, Producer*>::iterator it = this->producers_by_key.find( producer_key );
+        if( it != this->producers_by_key.end() ){
+            return *it->second;
+        }
+
+        std::unique_ptr<Producer> producer;
+
+        //failed messages are routed to each watch's own spool (see FileTailer), so shared producers don't have an undelivered log
+        switch( watch.producer_type ){
+
+            case ProducerType::KAFKA:
+                producer = std::make_unique<KafkaProducer>( this->settings, this->logport, "", watch.brokers, watch.topic );
+                break;
+
+            case ProducerType::HTTP:
+                producer = std::make_unique<HttpProducer>( this->settings, this->logport, "", watch.brokers );
+                break;
+
+            default:
+                throw std::runtime_error( "Unknown producer type." );
+
+        };
+
+        Producer* producer_ptr = producer.get();
+        this->producers.push_back( std::move(producer) );
+        this->producers_by_key[ producer_key ] = producer_ptr;
+
+        return *producer_ptr;
+
+    }
+
+
+
+    void MultiFileWatcher::startWatching(){
+
+        this->logport->getObserver().addLogEntry( "logport: consolidated mode watching " + logport::to_string<size_t>(this->watch_states.size()) + " files with " + logport::to_string<size_t>(this->workers.size()) + " worker threads" );
+
+        LevelTriggeredEpollWatcher epoll_watcher( this->inotify_fd );
+
+        //delivery reports (and other producer completions) are served as soon as they're ready
+        map<int, Producer*> producers_by_event_fd;
+        for( std::unique_ptr<Producer>& producer : this->producers ){
+            epoll_watcher.add( producer->getEventFd() );
+            producers_by_event_fd[ producer->getEventFd() ] = producer.get();
+        }
+
+        //stopping, reloading and pausing (see LogPort::registerSignalHandlers()) are seen right away instead of at the next timeout
+        const int logport_event_fd = this->logport->getEventFd();
+        if( logport_event_fd != -1 ){
+            epoll_watcher.add( logport_event_fd );
+        }
+
+        epoll_watcher.add( this->timer_fd );
+
+        struct itimerspec timer_spec;
+        memset( &timer_spec, 0, sizeof(timer_spec) );
+        timer_spec.it_value.tv_sec = WATCH_RESOURCE_CHECK_INTERVAL_MS / 1000;
+        timer_spec.it_interval.tv_sec = WATCH_RESOURCE_CHECK_INTERVAL_MS / 1000;
+
+        if( timerfd_settime(this->timer_fd, 0, &timer_spec, NULL) == -1 ){
+            char error_string_buffer[1024];
+            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+            throw std::runtime_error( "Failed to arm the resource check timerfd. errno: " + string(error_string_buffer) );
+        }
+
+        this->start_cpu_time_seconds = proc_stat_get_cpu_time_seconds( getpid() );
+
+        for( std::unique_ptr<Worker>& worker : this->workers ){
+            Worker* worker_ptr = worker.get();
+            worker->thread = std::thread( [this, worker_ptr]{ this->runWorker( *worker_ptr ); } );
+        }
+
+
+        vector<int> ready_file_descriptors;
+
+        while( this->logport->run && !this->logport->reload_required && !this->restart_required ){
+
+            if( epoll_watcher.watch(1000, ready_file_descriptors) > 0 ){  //returns immediately if there are events waiting; returns after 1000ms if no events;
+
+                for( int ready_file_descriptor : ready_file_descriptors ){
+
+                    if( ready_file_descriptor == this->inotify_fd ){
+                        this->readInotifyEvents();
+                    }else if( ready_file_descriptor == logport_event_fd ){
+                        this->logport->clearEvent();  //the loop's condition picks up the change
+                    }else if( ready_file_descriptor == this->timer_fd ){
+                        this->checkResources();
+                    }else{
+                        producers_by_event_fd.at( ready_file_descriptor )->handleEvents();
+                    }
+
+                }
+
+            }else{
+
+                //timed out; flush partial http batches (see InotifyWatcher::startWatching)
+                for( std::unique_ptr<Producer>& producer : this->producers ){
+                    producer->poll();
+                }
+
+            }
+
+        }
+
+
+        //workers save their shutdown offsets before they exit
+        this->run = false;
+
+        for( std::unique_ptr<Worker>& worker : this->workers ){
+            {
+                std::scoped_lock lock( worker->mutex );
+                worker->signaled = true;
+            }
+            worker->condition.notify_all();
+            if( worker->thread.joinable() ){
+                worker->thread.join();
+            }
+        }
+
+        for( std::unique_ptr<Producer>& producer : this->producers ){
+            producer->poll();
+        }
+
+    }
+
+
+
+    void MultiFileWatcher::readInotifyEvents(){
+
+        char inotify_event_buffer[INOTIFY_EVENT_BUFFER_LENGTH] __attribute__ ((aligned(8)));
+        char error_string_buffer[1024];
+
+        ssize_t inotify_event_num_read = read( this->inotify_fd, inotify_event_buffer, INOTIFY_EVENT_BUFFER_LENGTH );
+        if( inotify_event_num_read == 0 ){
+            throw std::runtime_error( "read() from inotify fd returned 0" );
+        }
+
+        if( inotify_event_num_read == -1 ){
+            if( errno == EINTR || errno == EAGAIN ){
+                return;
+            }
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "read() from inotify fd returned errno " + string(error_string_buffer) );
+        }
+
+
+        std::scoped_lock lock( this->watch_descriptors_mutex );
+
+        for( char *p = inotify_event_buffer; p < inotify_event_buffer + inotify_event_num_read; ){
+
+            struct inotify_event *in_event = (struct inotify_event *) p;
+
+            if( in_event->mask & IN_Q_OVERFLOW ){
+
+                //events were dropped; have every file check for new data
+                for( const auto& [watch_descriptor, watch_state] : this->watch_states_by_descriptor ){
+                    watch_state->tailer->handleInotifyEvent( IN_MODIFY );
+                    this->signalWorker( watch_state->worker_index );
+                }
+
+            }else{
+
+                map<int, WatchState*>::iterator it = this->watch_states_by_descriptor.find( in_event->wd );
+                if( it != this->watch_states_by_descriptor.end() ){
+                    it->second->tailer->handleInotifyEvent( in_event->mask );
+                    this->signalWorker( it->second->worker_index );
+                }
+
+                //a file was created in a watched directory; it may replace a rotated watch
+                map<int, vector<WatchState*>>::iterator directory_it = this->watch_states_by_directory_descriptor.find( in_event->wd );
+                if( directory_it != this->watch_states_by_directory_descriptor.end() && in_event->len > 0 ){
+                    for( WatchState* watch_state : directory_it->second ){
+                        if( watch_state->file_name == in_event->name ){
+                            watch_state->tailer->handleInotifyEvent( in_event->mask );
+                            this->signalWorker( watch_state->worker_index );
+                        }
+                    }
+                }
+
+            }
+
+            p += sizeof(struct inotify_event) + in_event->len;
+
+        }
+
+    }
+
+
+
+    void MultiFileWatcher::checkResources(){
+
+        uint64_t expirations;
+        while( read(this->timer_fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR );
+
+        const pid_t pid = getpid();
+        const int rss_kb = proc_status_get_rss_usage_in_kb( pid );
+        const double cpu_time_seconds = proc_stat_get_cpu_time_seconds( pid ) - this->start_cpu_time_seconds;
+
+        this->logport->getObserver().addLogEntry( "logport: consolidated watches RSS(" + logport::to_string<int>(rss_kb) + "KB), PID(" + logport::to_string<pid_t>(pid) + "), cpu_time(" + logport::to_string<double>(cpu_time_seconds) + ")" );
+
+        //every watch is stopped (saving its offset) and started again, like a watch process that's restarted by WatchSupervisor
+        if( this->max_rss_kb > 0 && rss_kb > this->max_rss_kb ){
+            this->logport->getObserver().addLogEntry( "logport: consolidated watches are being restarted because the RSS exceeded " + logport::to_string<int64_t>(this->max_rss_kb) + "KB." );
+            this->restart_required = true;
+        }else if( this->max_cpu_time_seconds > 0 && cpu_time_seconds > double(this->max_cpu_time_seconds) ){
+            this->logport->getObserver().addLogEntry( "logport: consolidated watches are being restarted because the CPU time exceeded " + logport::to_string<int64_t>(this->max_cpu_time_seconds) + " seconds." );
+            this->restart_required = true;
+        }
+
+    }
+
+
+
+    void MultiFileWatcher::signalWorker( size_t worker_index ){
+
+        Worker& worker = *this->workers[ worker_index ];
+
+        {
+            std::scoped_lock lock( worker.mutex );
+            worker.signaled = true;
+        }
+
+        worker.condition.notify_one();
+
+    }
+
+
+
+    void MultiFileWatcher::runWorker( Worker& worker ){
+
+        Database db;  //one connection per thread
+
+        int wait_timeout_ms = 0;
+
+        while( this->run ){
+
+            if( wait_timeout_ms > 0 ){
+                std::unique_lock<std::mutex> lock( worker.mutex );
+                worker.condition.wait_for( lock, std::chrono::milliseconds(wait_timeout_ms), [&]{ return worker.signaled || !this->run; } );
+                worker.signaled = false;
+            }
+
+            if( !this->run ){
+                break;
+            }
+
+            wait_timeout_ms = 1000;
+
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            for( WatchState* watch_state : worker.watch_states ){
+
+                try{
+
+                    if( !watch_state->active ){
+                        if( now >= watch_state->next_activation_attempt ){
+                            this->activate( *watch_state, db );
+                        }else{
+                            continue;
+                        }
+                    }
+
+                    FileTailer& tailer = *watch_state->tailer;
+
+                    tailer.service( db );
+
+                    if( tailer.isFinished() ){
+                        //logrotate moved the file away, it has been drained and there's a new file at its path; follow it
+                        if( this->rewatch(*watch_state) ){
+                            tailer.reopen( db );
+                        }
+                    }
+
+                    //periodically commit the offset that has been acknowledged so a crash only replays the last few seconds
+                    tailer.checkpoint( db );
+
+                    //more to read, or spool replay due before the idle timeout
+                    wait_timeout_ms = std::min( wait_timeout_ms, tailer.getWaitTimeoutMs(1000) );
+
+                }catch( std::exception& e ){
+
+                    this->logport->getObserver().addLogEntry( "logport: consolidated watch exception for " + watch_state->watch.watched_filepath + ": " + string(e.what()) );
+                    this->deactivate( *watch_state );
+
+                }
+
+            }
+
+            //every offset checkpointed above is written in one transaction
+            try{
+                db.commitOffsets();
+            }catch( std::exception& e ){
+                this->logport->getObserver().addLogEntry( "logport: failed to checkpoint consolidated watch offsets: " + string(e.what()) );
+            }
+
+        }
+
+
+        //save the unsent offsets
+        for( WatchState* watch_state : worker.watch_states ){
+            if( watch_state->active ){
+                watch_state->tailer->saveShutdownOffset( db );
+            }
+        }
+
+    }
+
+
+
+    void MultiFileWatcher::activate( WatchState& watch_state, Database& db ){
+
+        char error_string_buffer[1024];
+
+        watch_state.next_activation_attempt = std::chrono::steady_clock::now() + std::chrono::milliseconds( ACTIVATION_RETRY_MS );
+
+        //resume from the saved offset (it may have moved since the last attempt)
+        try{
+            watch_state.watch.loadOffset( db );
+        }catch( std::exception& e ){
+            //the watch was removed; keep the offset we have
+        }
+
+        watch_state.tailer = std::make_unique<FileTailer>( *watch_state.producer, watch_state.watch, this->logport, *watch_state.delivery_tracker, this->settings );
+
+        int watch_descriptor = inotify_add_watch( this->inotify_fd, watch_state.watch.watched_filepath.c_str(), IN_ALL_EVENTS );
+        if( watch_descriptor == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for file: " + watch_state.watch.watched_filepath );
+        }
+
+        //the parent directory tells us when logrotate puts a new file at the watched path (directories are shared by their watches)
+        const string watched_directory = get_parent_directory( watch_state.watch.watched_filepath );
+
+        int directory_watch_descriptor = inotify_add_watch( this->inotify_fd, watched_directory.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR );
+        if( directory_watch_descriptor == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            inotify_rm_watch( this->inotify_fd, watch_descriptor );
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for directory: " + watched_directory );
+        }
+
+        try{
+            watch_state.tailer->open( db );
+        }catch( std::exception& e ){
+            inotify_rm_watch( this->inotify_fd, watch_descriptor );
+            throw;
+        }
+
+        {
+            std::scoped_lock lock( this->watch_descriptors_mutex );
+            watch_state.watch_descriptor = watch_descriptor;
+            this->watch_states_by_descriptor[ watch_descriptor ] = &watch_state;
+            watch_state.directory_watch_descriptor = directory_watch_descriptor;
+            this->watch_states_by_directory_descriptor[ directory_watch_descriptor ].push_back( &watch_state );
+        }
+
+        watch_state.active = true;
+
+    }
+
+
+
+    void MultiFileWatcher::deactivate( WatchState& watch_state ){
+
+        {
+            std::scoped_lock lock( this->watch_descriptors_mutex );
+
+            if( watch_state.watch_descriptor != -1 ){
+                this->watch_states_by_descriptor.erase( watch_state.watch_descriptor );
+                inotify_rm_watch( this->inotify_fd, watch_state.watch_descriptor );
+                watch_state.watch_descriptor = -1;
+            }
+
+            //the directory's own watch stays; other watches may share it
+            if( watch_state.directory_watch_descriptor != -1 ){
+                vector<WatchState*>& directory_watch_states = this->watch_states_by_directory_descriptor[ watch_state.directory_watch_descriptor ];
+                directory_watch_states.erase( std::remove(directory_watch_states.begin(), directory_watch_states.end(), &watch_state), directory_watch_states.end() );
+                watch_state.directory_watch_descriptor = -1;
+            }
+        }
+
+        watch_state.active = false;
+
+        if( watch_state.tailer ){
+            watch_state.tailer->close();
+        }
+
+    }
+
+
+
+    bool MultiFileWatcher::rewatch( WatchState& watch_state ){
+
+        int watch_descriptor = inotify_add_watch( this->inotify_fd, watch_state.watch.watched_filepath.c_str(), IN_ALL_EVENTS );
+        if( watch_descriptor == -1 ){
+            //the new file hasn't been created yet; try again on the next pass
+            return false;
+        }
+
+        std::scoped_lock lock( this->watch_descriptors_mutex );
+
+        if( watch_state.watch_descriptor != -1 && watch_state.watch_descriptor != watch_descriptor ){
+            this->watch_states_by_descriptor.erase( watch_state.watch_descriptor );
+            inotify_rm_watch( this->inotify_fd, watch_state.watch_descriptor );
+        }
+
+        watch_state.watch_descriptor = watch_descriptor;
+        this->watch_states_by_descriptor[ watch_descriptor ] = &watch_state;
+
+        return true;
+
+    }
+
+
+}
@@ -0,0 +1,210 @@
+#include "MultilineAggregator.h"
+
+#include <stdexcept>
+
+
+namespace logport{
+
+
+    LinePattern::LinePattern( const string& pattern ){
+
+        const size_t length = pattern.size();
+        size_t x = 0;
+
+        while( x < length ){
+
+            std::bitset<256> accepted;
+            const unsigned char c = static_cast<unsigned char>( pattern[x] );
+
+            if( c == '\\' ){
+
+                if( x + 1 >= length ){
+                    throw std::runtime_error( "Pattern ends with an escape: " + pattern );
+                }
+
+                const unsigned char escaped = static_cast<unsigned char>( pattern[x + 1] );
+
+                switch( escaped ){
+                    case 'd':
+                        for( unsigned char b = '0'; b <= '9'; b++ ) accepted.set( b );
+                        break;
+                    case 's':
+                        accepted.set( ' ' );
+                        accepted.set( '\t' );
+                        break;
+                    case 'w':
+                        for( unsigned char b = '0'; b <= '9'; b++ ) accepted.set( b );
+                        for( unsigned char b = 'a'; b <= 'z'; b++ ) accepted.set( b );
+                        for( unsigned char b = 'A'; b <= 'Z'; b++ ) accepted.set( b );
+                        accepted.set( '_' );
+                        break;
+                    default:
+                        accepted.set( escaped );
+                }
+
+                x += 2;
+
+            }else if( c == '.' ){
+
+                accepted.set();
+                x++;
+
+            }else if( c == '[' ){
+
+                //eg. "[0-9]", "[ab]", "[^ ]"; a ']' right after the opening bracket is a member
+                size_t y = x + 1;
+
+                bool negated = false;
+                if( y < length && pattern[y] == '^' ){
+                    negated = true;
+                    y++;
+                }
+
+                const size_t first = y;
+
+                while( y < length && ( pattern[y] != ']' || y == first ) ){
+
+                    unsigned char low = static_cast<unsigned char>( pattern[y] );
+
+                    if( low == '\\' && y + 1 < length ){
+                        low = static_cast<unsigned char>( pattern[++y] );
+                    }
+
+                    if( y + 2 < length && pattern[y + 1] == '-' && pattern[y + 2] != ']' ){
+                        const unsigned char high = static_cast<unsigned char>( pattern[y + 2] );
+                        for( unsigned b = low; b <= high; b++ ) accepted.set( b );
+                        y += 3;
+                    }else{
+                        accepted.set( low );
+                        y++;
+                    }
+
+                }
+
+                if( y >= length ){
+                    throw std::runtime_error( "Pattern has an unterminated set: " + pattern );
+                }
+
+                if( negated ){
+                    accepted.flip();
+                }
+
+                x = y + 1;
+
+            }else{
+
+                accepted.set( c );
+                x++;
+
+            }
+
+            this->positions.push_back( accepted );
+
+        }
+
+    }
+
+
+
+    bool LinePattern::matches( std::string_view line ) const{
+
+        const size_t pattern_length = this->positions.size();
+
+        if( line.size() < pattern_length ){
+            return false;
+        }
+
+        for( size_t x = 0; x < pattern_length; x++ ){
+            if( !this->positions[x].test(static_cast<unsigned char>(line[x])) ){
+                return false;
+            }
+        }
+
+        return true;
+
+    }
+
+
+
+
+    MultilineAggregator::MultilineAggregator( const LinePattern& start_pattern, size_t max_record_bytes )
+        :start_pattern(start_pattern), max_record_bytes(max_record_bytes)
+    {
+
+    }
+
+
+
+    bool MultilineAggregator::isContinuation( std::string_view line ) const{
+
+        if( line.size() && ( line[0] == ' ' || line[0] == '\t' ) ){
+            return true;
+        }
+
+        return !this->start_pattern.empty() && !this->start_pattern.matches( line );
+
+    }
+
+
+
+    bool MultilineAggregator::add( std::string_view line, int64_t begin_offset, int64_t end_offset, MultilineRecord& completed ){
+
+        if( this->pending_lines && this->isContinuation(line) && this->pending.size() + 1 + line.size() <= this->max_record_bytes ){
+
+            this->pending += '\n';
+            this->pending.append( line.data(), line.size() );
+            this->pending_lines++;
+            this->pending_end_offset = end_offset;
+
+            return false;
+
+        }
+
+        //the line starts a new record (or nothing was pending, eg. the first line read was a continuation)
+        const bool completed_previous = this->flush( completed );
+
+        this->pending.assign( line.data(), line.size() );
+        this->pending_lines = 1;
+        this->pending_begin_offset = begin_offset;
+        this->pending_end_offset = end_offset;
+
+        return completed_previous;
+
+    }
+
+
+
+    bool MultilineAggregator::flush( MultilineRecord& completed ){
+
+        if( !this->pending_lines ){
+            return false;
+        }
+
+        this->completed.swap( this->pending );
+        this->pending.clear();
+
+        completed.text = std::string_view( this->completed );
+        completed.end_offset = this->pending_end_offset;
+
+        this->pending_lines = 0;
+        this->pending_begin_offset = -1;
+        this->pending_end_offset = -1;
+
+        return true;
+
+    }
+
+
+
+    void MultilineAggregator::clear(){
+
+        this->pending.clear();
+        this->completed.clear();
+        this->pending_lines = 0;
+        this->pending_begin_offset = -1;
+        this->pending_end_offset = -1;
+
+    }
+
+
+}
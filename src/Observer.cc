@@ -38,6 +38,8 @@ namespace logport{
 
         string json_meta = "{\"generated_at\":" + get_timestamp();
 
+        std::scoped_lock lock( this->mutex );
+
         //unstructured single-line entry
             if( metric_entry[0] != '{' ){
                 this->metrics_file << json_meta + ",\"metric\":\"" + escape_to_json_string(metric_entry) + "\"}" << endl;
@@ -62,6 +64,8 @@ namespace logport{
 
         string json_meta = "{\"generated_at\":" + get_timestamp();
 
+        std::scoped_lock lock( this->mutex );
+
         //unstructured single-line entry
             if( event_entry[0] != '{' ){
                 this->events_file << json_meta + ",\"event\":\"" + escape_to_json_string(event_entry) + "\"}" << endl;
@@ -87,6 +91,8 @@ namespace logport{
 
         string json_meta = "{\"generated_at\":" + get_timestamp();
 
+        std::scoped_lock lock( this->mutex );
+
         //unstructured single-line entry
             if( trace_entry[0] != '{' ){
                 this->traces_file << json_meta + ",\"trace\":\"" + escape_to_json_string(trace_entry) + "\"}" << endl;
@@ -111,6 +117,8 @@ namespace logport{
 
         string json_meta = "{\"generated_at\":" + get_timestamp();
 
+        std::scoped_lock lock( this->mutex );
+
         //unstructured single-line entry
             if( telemetry_entry[0] != '{' ){
                 this->telemetry_file << json_meta + ",\"telemetry\":\"" + escape_to_json_string(telemetry_entry) + "\"}" << endl;
@@ -135,6 +143,8 @@ namespace logport{
 
         string json_meta = "{\"generated_at\":" + get_timestamp();
 
+        std::scoped_lock lock( this->mutex );
+
         //unstructured single-line entry
             if( log_line[0] != '{' ){
                 this->log_file << json_meta + ",\"log\":\"" + escape_to_json_string(log_line) + "\"}" << endl;
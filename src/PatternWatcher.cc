@@ -0,0 +1,670 @@
+#include "PatternWatcher.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Common.h"
+#include "Observer.h"
+#include "LogPort.h"
+
+#include "Database.h"
+#include "KafkaProducer.h"
+#include "HttpProducer.h"
+#include "LevelTriggeredEpollWatcher.h"
+
+
+namespace logport{
+
+
+    #define INOTIFY_EVENT_BUFFER_LENGTH (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+    #define PATTERN_DIRECTORY_EVENTS ( IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR )
+
+
+    PatternWatcher::PatternWatcher( Database& db, Watch& watch, LogPort* logport, const map<string,string>& settings )
+        :db(db), watch(watch), logport(logport), settings(settings),
+         directory(get_parent_directory(watch.watched_filepath)), pattern(get_file_name(watch.watched_filepath))
+    {
+
+        char error_string_buffer[1024];
+
+        //eg. "logport set watch.pattern.idle.ms 300000"
+        this->idle_ms = std::max<int64_t>( get_setting_int64(settings, "watch.pattern.idle.ms", 300000), 0 );
+        this->rotate_wait_ms = std::max<int64_t>( get_setting_int64(settings, "watch.rotate.wait.ms", 5000), 0 );
+        this->max_open_files = size_t( std::max<int64_t>(get_setting_int64(settings, "watch.pattern.max.open.files", 256), 1) );
+
+
+        switch( this->watch.producer_type ){
+
+            case ProducerType::KAFKA:
+                this->producer = std::make_unique<KafkaProducer>( settings, logport, this->watch.undelivered_log_filepath, this->watch.brokers, this->watch.topic );
+                break;
+
+            case ProducerType::HTTP:
+                this->producer = std::make_unique<HttpProducer>( settings, logport, this->watch.undelivered_log_filepath, this->watch.brokers );
+                break;
+
+            default:
+                throw std::runtime_error( "Unknown producer type." );
+
+        };
+
+        this->spool = std::make_shared<Spool>( Spool::getDirectoryFor(this->watch.undelivered_log_filepath), settings );
+
+        //replayed records that fail again go back into the spool
+        this->replay_tracker = std::make_unique<DeliveryTracker>();
+        this->replay_tracker->setSpool( this->spool );
+        this->replayer = std::make_unique<SpoolReplayer>( this->spool, *this->producer, *this->replay_tracker, settings, this->watch.watched_filepath );
+
+
+        this->inotify_fd = inotify_init();
+        if( this->inotify_fd == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to create inotify instance: errno " + string(error_string_buffer) );
+        }
+
+        //one watch for the whole directory; its events name the file they're about
+        this->directory_watch_descriptor = inotify_add_watch( this->inotify_fd, this->directory.c_str(), PATTERN_DIRECTORY_EVENTS );
+        if( this->directory_watch_descriptor == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            close( this->inotify_fd );
+            throw std::runtime_error( "Failed to add inotify watch descriptor: errno " + string(error_string_buffer) + " for directory: " + this->directory );
+        }
+
+    }
+
+
+
+    PatternWatcher::~PatternWatcher(){
+
+        close( this->inotify_fd );
+
+    }
+
+
+
+    void PatternWatcher::startWatching(){
+
+        this->producer->openUndeliveredLog();
+
+        this->logport->getObserver().addLogEntry( "logport: starting pattern watch " + this->watch.watched_filepath );
+
+        {
+            string starting_up_message;
+            this->watch.filterLogLine( this->spool->hasUnread() ? "starting up - replaying undelivered messages" : "starting up", starting_up_message );
+            this->producer->produce( starting_up_message );
+        }
+
+        //the directory watch is already in place, so no file created from here on is missed
+        this->scanDirectory();
+
+
+        LevelTriggeredEpollWatcher epoll_watcher( this->inotify_fd );
+
+        const int producer_event_fd = this->producer->getEventFd();
+        epoll_watcher.add( producer_event_fd );
+
+        vector<int> ready_file_descriptors;
+
+        while( this->run ){
+
+            const int timeout_ms = this->getWaitTimeoutMs();
+
+            if( epoll_watcher.watch(timeout_ms, ready_file_descriptors) > 0 ){
+
+                for( int ready_file_descriptor : ready_file_descriptors ){
+
+                    if( ready_file_descriptor == producer_event_fd ){
+                        this->producer->handleEvents();
+                    }else{
+                        this->readInotifyEvents();
+                    }
+
+                }
+
+            }else if( timeout_ms > 0 ){
+
+                //delivery reports are served through the event descriptor; this reports http target stats (the linger thread sends partial batches)
+                this->producer->poll();
+
+            }
+
+            this->serviceFiles();
+
+            this->serviceReplay();
+
+            this->retireFiles();
+
+            //every offset checkpointed above is written in one transaction
+            this->commitOffsets();
+
+        }
+
+
+        //save the unsent offsets
+        this->producer->poll();
+
+        for( auto& [file_name, watched_file] : this->watched_files ){
+            watched_file->tailer->saveShutdownOffset( this->db );
+        }
+
+        this->replayer->saveCursor( true );
+
+    }
+
+
+
+    void PatternWatcher::scanDirectory(){
+
+        char error_string_buffer[1024];
+
+        DIR* directory_stream = opendir( this->directory.c_str() );
+        if( directory_stream == NULL ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to open directory " + this->directory + ": errno " + string(error_string_buffer) );
+        }
+
+        vector<string> file_names;
+
+        struct dirent* entry;
+        while( (entry = readdir(directory_stream)) != NULL ){
+            if( fnmatch(this->pattern.c_str(), entry->d_name, FNM_PERIOD) == 0 ){
+                file_names.push_back( entry->d_name );
+            }
+        }
+
+        closedir( directory_stream );
+
+        std::sort( file_names.begin(), file_names.end() );
+
+
+        for( const string& file_name : file_names ){
+
+            if( this->watched_files.count(file_name) ){
+                this->watched_files[ file_name ]->tailer->handleInotifyEvent( IN_MODIFY );
+                continue;
+            }
+
+            //files that were read to their end before are only opened again when they're modified
+            const string filepath = this->directory + "/" + file_name;
+
+            struct stat64 file_status;
+            if( stat64(filepath.c_str(), &file_status) == -1 || !S_ISREG(file_status.st_mode) ){
+                continue;
+            }
+
+            Watch file_watch = this->watch;
+            file_watch.watched_filepath = filepath;
+            file_watch.pattern_file = true;
+
+            try{
+                file_watch.loadOffset( this->db );
+            }catch( std::exception& e ){
+                this->logport->getObserver().addLogEntry( "logport: failed to load the offset of " + filepath + ": " + string(e.what()) );
+            }
+
+            if( file_watch.file_inode == uint64_t(file_status.st_ino) && file_watch.file_device == uint64_t(file_status.st_dev) && file_watch.file_offset == file_status.st_size ){
+                continue;
+            }
+
+            this->discover( file_name );
+
+        }
+
+    }
+
+
+
+    void PatternWatcher::readInotifyEvents(){
+
+        char inotify_event_buffer[INOTIFY_EVENT_BUFFER_LENGTH] __attribute__ ((aligned(8)));
+        char error_string_buffer[1024];
+
+        ssize_t inotify_event_num_read = read( this->inotify_fd, inotify_event_buffer, INOTIFY_EVENT_BUFFER_LENGTH );
+        if( inotify_event_num_read == 0 ){
+            throw std::runtime_error( "read() from inotify fd returned 0" );
+        }
+
+        if( inotify_event_num_read == -1 ){
+            if( errno == EINTR || errno == EAGAIN ){
+                return;
+            }
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "read() from inotify fd returned errno " + string(error_string_buffer) );
+        }
+
+
+        //the two halves of a rename are reported next to each other
+        uint32_t moved_from_cookie = 0;
+        string moved_from_name;
+
+        for( char *p = inotify_event_buffer; p < inotify_event_buffer + inotify_event_num_read; ){
+
+            struct inotify_event *in_event = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + in_event->len;
+
+            if( in_event->mask & IN_Q_OVERFLOW ){
+
+                //events were dropped; have every open file check for new data and look for new files
+                for( auto& [file_name, watched_file] : this->watched_files ){
+                    watched_file->tailer->handleInotifyEvent( IN_MODIFY );
+                }
+                this->scanDirectory();
+                continue;
+
+            }
+
+            if( in_event->wd != this->directory_watch_descriptor ){
+                continue;
+            }
+
+            if( in_event->mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED ) ){
+                //the supervisor restarts the watch (once the directory exists again)
+                throw std::runtime_error( "Watched directory " + this->directory + " was removed or moved" );
+            }
+
+            if( in_event->len == 0 || ( in_event->mask & IN_ISDIR ) || fnmatch(this->pattern.c_str(), in_event->name, FNM_PERIOD) != 0 ){
+                continue;
+            }
+
+            const string file_name( in_event->name );
+
+            if( in_event->mask & IN_DELETE ){
+
+                this->detach( file_name, true );
+
+            }else if( in_event->mask & IN_MOVED_FROM ){
+
+                this->detach( file_name, false );
+                moved_from_cookie = in_event->cookie;
+                moved_from_name = file_name;
+
+            }else if( in_event->mask & ( IN_CREATE | IN_MOVED_TO ) ){
+
+                //a new file at this name; whatever was open under it has been replaced
+                this->detach( file_name, false );
+
+                //renamed within the directory (eg. "app.log" to "app.log.1" for 'app.log*'): it keeps its place
+                if( ( in_event->mask & IN_MOVED_TO ) && moved_from_cookie != 0 && in_event->cookie == moved_from_cookie ){
+                    moved_from_cookie = 0;
+                    if( this->reattach(moved_from_name, file_name) ){
+                        continue;
+                    }
+                }
+
+                this->discover( file_name );
+
+            }else{
+
+                //IN_MODIFY or IN_CLOSE_WRITE
+                map<string, std::unique_ptr<WatchedFile>>::iterator it = this->watched_files.find( file_name );
+                if( it != this->watched_files.end() ){
+                    it->second->tailer->handleInotifyEvent( in_event->mask );
+                }else{
+                    this->discover( file_name );
+                }
+
+            }
+
+        }
+
+    }
+
+
+
+    void PatternWatcher::discover( const string& file_name ){
+
+        if( this->watched_files.count(file_name) ){
+            return;
+        }
+
+        if( std::find(this->queued_file_names.begin(), this->queued_file_names.end(), file_name) != this->queued_file_names.end() ){
+            return;
+        }
+
+        if( this->getOpenFileCount() >= this->max_open_files ){
+            this->queued_file_names.push_back( file_name );
+            return;
+        }
+
+        this->open( file_name );
+
+    }
+
+
+
+    void PatternWatcher::open( const string& file_name ){
+
+        const string filepath = this->directory + "/" + file_name;
+
+        struct stat64 file_status;
+        if( stat64(filepath.c_str(), &file_status) == -1 || !S_ISREG(file_status.st_mode) ){
+            //gone already, or not a regular file
+            return;
+        }
+
+        std::unique_ptr<WatchedFile> watched_file = std::make_unique<WatchedFile>();
+
+        watched_file->watch = this->watch;
+        watched_file->watch.watched_filepath = filepath;
+        watched_file->watch.pattern_file = true;
+        watched_file->watch.renderEnvelope();
+
+        try{
+
+            watched_file->watch.loadOffset( this->db );
+
+            watched_file->delivery_tracker = std::make_unique<DeliveryTracker>( watched_file->watch.file_offset );
+            watched_file->delivery_tracker->setSpool( this->spool );
+
+            watched_file->tailer = std::make_unique<FileTailer>( *this->producer, watched_file->watch, this->logport, *watched_file->delivery_tracker, this->settings );
+            watched_file->tailer->setSpoolReplay( false );
+            watched_file->tailer->open( this->db );
+
+        }catch( std::exception& e ){
+
+            this->logport->getObserver().addLogEntry( "logport: failed to open " + filepath + " for pattern watch " + this->watch.watched_filepath + ": " + string(e.what()) );
+            return;
+
+        }
+
+        watched_file->last_read_position = watched_file->tailer->getReadPosition();
+        watched_file->last_activity_time = std::chrono::steady_clock::now();
+
+        this->watched_files[ file_name ] = std::move( watched_file );
+
+    }
+
+
+
+    void PatternWatcher::detach( const string& file_name, bool deleted ){
+
+        this->queued_file_names.erase( std::remove(this->queued_file_names.begin(), this->queued_file_names.end(), file_name), this->queued_file_names.end() );
+
+        map<string, std::unique_ptr<WatchedFile>>::iterator it = this->watched_files.find( file_name );
+        if( it == this->watched_files.end() ){
+            if( deleted ){
+                try{
+                    this->db.forgetWatchFile( this->watch.id, this->directory + "/" + file_name );
+                }catch( std::exception& e ){
+                    this->logport->getObserver().addLogEntry( "logport: failed to forget " + file_name + " for pattern watch " + this->watch.watched_filepath + ": " + string(e.what()) );
+                }
+            }
+            return;
+        }
+
+        std::unique_ptr<WatchedFile> watched_file = std::move( it->second );
+        this->watched_files.erase( it );
+
+        //the open descriptor keeps reading the file until it's drained; a new file may take over its path (and its row) right away
+        try{
+            this->db.forgetWatchFile( this->watch.id, watched_file->watch.watched_filepath );
+        }catch( std::exception& e ){
+            this->logport->getObserver().addLogEntry( "logport: failed to forget " + watched_file->watch.watched_filepath + " for pattern watch " + this->watch.watched_filepath + ": " + string(e.what()) );
+        }
+
+        watched_file->watch.id = 0;  //nothing more is saved for it
+        watched_file->detached = true;
+        watched_file->deleted = deleted;
+        watched_file->tailer->handleInotifyEvent( IN_MODIFY );
+
+        this->detached_files.push_back( std::move(watched_file) );
+
+    }
+
+
+
+    bool PatternWatcher::reattach( const string& old_file_name, const string& new_file_name ){
+
+        const string old_filepath = this->directory + "/" + old_file_name;
+
+        for( vector<std::unique_ptr<WatchedFile>>::reverse_iterator it = this->detached_files.rbegin(); it != this->detached_files.rend(); ++it ){
+
+            if( (*it)->deleted || (*it)->watch.watched_filepath != old_filepath ){
+                continue;
+            }
+
+            std::unique_ptr<WatchedFile> watched_file = std::move( *it );
+            this->detached_files.erase( std::next(it).base() );
+
+            watched_file->watch.id = this->watch.id;
+            watched_file->watch.watched_filepath = this->directory + "/" + new_file_name;
+            watched_file->watch.renderEnvelope();
+            watched_file->detached = false;
+
+            //its row moves with it (the old one was forgotten when it was detached)
+            try{
+                watched_file->watch.saveFileIdentity( this->db );
+            }catch( std::exception& e ){
+                this->logport->getObserver().addLogEntry( "logport: failed to save the offset of " + watched_file->watch.watched_filepath + ": " + string(e.what()) );
+            }
+
+            this->watched_files[ new_file_name ] = std::move( watched_file );
+            return true;
+
+        }
+
+        return false;
+
+    }
+
+
+
+    void PatternWatcher::serviceFiles(){
+
+        const TimePoint now = std::chrono::steady_clock::now();
+
+        for( map<string, std::unique_ptr<WatchedFile>>::iterator it = this->watched_files.begin(); it != this->watched_files.end(); ){
+
+            WatchedFile& watched_file = *it->second;
+            ++it;
+
+            try{
+
+                watched_file.tailer->service( this->db );
+
+                if( watched_file.tailer->getReadPosition() != watched_file.last_read_position ){
+                    watched_file.last_read_position = watched_file.tailer->getReadPosition();
+                    watched_file.last_activity_time = now;
+                }
+
+                //periodically commit the offset that has been acknowledged so a crash only replays the last few seconds
+                watched_file.tailer->checkpoint( this->db );
+
+            }catch( std::exception& e ){
+
+                this->logport->getObserver().addLogEntry( "logport: pattern watch exception for " + watched_file.watch.watched_filepath + ": " + string(e.what()) );
+                this->detach( get_file_name(watched_file.watch.watched_filepath), false );
+
+            }
+
+        }
+
+        for( std::unique_ptr<WatchedFile>& watched_file : this->detached_files ){
+
+            try{
+
+                watched_file->tailer->service( this->db );
+
+                if( watched_file->tailer->getReadPosition() != watched_file->last_read_position ){
+                    watched_file->last_read_position = watched_file->tailer->getReadPosition();
+                    watched_file->last_activity_time = now;
+                }
+
+            }catch( std::exception& e ){
+
+                //retired once its messages are acknowledged
+                this->logport->getObserver().addLogEntry( "logport: pattern watch exception for " + watched_file->watch.watched_filepath + ": " + string(e.what()) );
+                watched_file->tailer->close();
+
+            }
+
+        }
+
+    }
+
+
+
+    void PatternWatcher::serviceReplay(){
+
+        //replay yields while any of the files is behind
+        bool live_reading = false;
+
+        for( const auto& [file_name, watched_file] : this->watched_files ){
+            if( watched_file->tailer->hasPendingReads() ){
+                live_reading = true;
+                break;
+            }
+        }
+
+        try{
+
+            this->replayer->service( live_reading );
+
+            this->replayer->saveCursor();
+
+        }catch( std::exception& e ){
+
+            this->logport->getObserver().addLogEntry( "logport: pattern watch replay exception for " + this->watch.watched_filepath + ": " + string(e.what()) );
+
+        }
+
+    }
+
+
+
+    bool PatternWatcher::canRetire( const WatchedFile& watched_file, TimePoint now ) const{
+
+        //a pending multiline record is flushed by the tailer once the file has been quiet for a moment
+        if( watched_file.tailer->hasPendingReads() || watched_file.tailer->hasPendingRecord() ){
+            return false;
+        }
+
+        //a drained file that was deleted or renamed may still be written to for a moment; a quiet one may be written to again later
+        //files waiting for a slot make the open ones give way sooner
+        int64_t quiet_limit_ms = this->idle_ms;
+        if( watched_file.detached || !this->queued_file_names.empty() ){
+            quiet_limit_ms = std::min( quiet_limit_ms, this->rotate_wait_ms );
+        }
+
+        const int64_t quiet_ms = std::chrono::duration_cast<std::chrono::milliseconds>( now - watched_file.last_activity_time ).count();
+        if( quiet_ms < quiet_limit_ms ){
+            return false;
+        }
+
+        //its tracker must outlive every message it produced
+        return watched_file.delivery_tracker->getPendingCount() == 0;
+
+    }
+
+
+
+    void PatternWatcher::retireFiles(){
+
+        const TimePoint now = std::chrono::steady_clock::now();
+
+        for( map<string, std::unique_ptr<WatchedFile>>::iterator it = this->watched_files.begin(); it != this->watched_files.end(); ){
+
+            if( this->canRetire(*it->second, now) ){
+                this->retire( *it->second );
+                it = this->watched_files.erase( it );
+            }else{
+                ++it;
+            }
+
+        }
+
+        for( vector<std::unique_ptr<WatchedFile>>::iterator it = this->detached_files.begin(); it != this->detached_files.end(); ){
+
+            if( this->canRetire(**it, now) ){
+                this->retire( **it );
+                it = this->detached_files.erase( it );
+            }else{
+                ++it;
+            }
+
+        }
+
+        while( !this->queued_file_names.empty() && this->getOpenFileCount() < this->max_open_files ){
+            const string file_name = this->queued_file_names.front();
+            this->queued_file_names.pop_front();
+            this->open( file_name );
+        }
+
+    }
+
+
+
+    void PatternWatcher::retire( WatchedFile& watched_file ){
+
+        if( !watched_file.detached ){
+            //everything it produced has been acknowledged; a partial line at the end is read again if the file grows
+            watched_file.tailer->checkpoint( this->db, true );
+        }
+
+        watched_file.tailer->close();
+
+        Observer observer;
+        observer.addLogEntry( "logport: stopped watching " + watched_file.watch.watched_filepath + ( watched_file.deleted ? " (deleted)" : ( watched_file.detached ? " (moved)" : " (idle)" ) ) );
+
+    }
+
+
+
+    int PatternWatcher::getWaitTimeoutMs() const{
+
+        //retirement is checked at least once a second
+        int timeout_ms = 1000;
+
+        //wake up when the replay is allowed to continue
+        const int64_t replay_delay_ms = this->replayer->getDelayMs();
+        if( replay_delay_ms >= 0 && replay_delay_ms < timeout_ms ){
+            timeout_ms = int( replay_delay_ms );
+        }
+
+        for( const auto& [file_name, watched_file] : this->watched_files ){
+            timeout_ms = std::min( timeout_ms, watched_file->tailer->getWaitTimeoutMs(1000) );
+        }
+
+        for( const std::unique_ptr<WatchedFile>& watched_file : this->detached_files ){
+            timeout_ms = std::min( timeout_ms, watched_file->tailer->getWaitTimeoutMs(1000) );
+        }
+
+        return timeout_ms;
+
+    }
+
+
+
+    size_t PatternWatcher::getOpenFileCount() const{
+
+        return this->watched_files.size() + this->detached_files.size();
+
+    }
+
+
+
+    void PatternWatcher::commitOffsets(){
+
+        try{
+            this->db.commitOffsets();
+        }catch( std::exception &e ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to checkpoint offsets for pattern watch " + this->watch.watched_filepath + " " + string(e.what()) );
+        }
+
+    }
+
+
+}
@@ -0,0 +1,210 @@
+#include "PayloadPool.h"
+
+#include "Common.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+
+namespace logport{
+
+
+    static inline size_t align_block_stride( size_t block_bytes ){
+
+        const size_t alignment = alignof( std::max_align_t );
+        const size_t stride = sizeof( PayloadBlock ) + block_bytes;
+
+        return ( stride + alignment - 1 ) / alignment * alignment;
+
+    }
+
+
+
+    PayloadPool::PayloadPool( size_t block_bytes, size_t max_blocks, size_t blocks_per_slab )
+        :block_bytes( block_bytes ), block_stride( align_block_stride(block_bytes) ), max_blocks( max_blocks ), blocks_per_slab( blocks_per_slab > 0 ? blocks_per_slab : 1 )
+    {
+
+        this->stats.block_bytes = this->block_bytes;
+        this->stats.max_blocks = this->max_blocks;
+
+    }
+
+
+
+    PayloadPool::~PayloadPool(){
+
+        for( char* slab : this->slabs ){
+            free( slab );
+        }
+
+    }
+
+
+
+    bool PayloadPool::allocateSlab(){
+
+        size_t slab_blocks = this->blocks_per_slab;
+        if( this->stats.allocated_blocks + slab_blocks > this->max_blocks ){
+            slab_blocks = this->max_blocks - this->stats.allocated_blocks;
+        }
+
+        if( slab_blocks == 0 ){
+            return false;
+        }
+
+        char* slab = static_cast<char*>( malloc(slab_blocks * this->block_stride) );
+        if( slab == nullptr ){
+            return false;
+        }
+
+        this->slabs.push_back( slab );
+
+        for( size_t x = 0; x < slab_blocks; x++ ){
+
+            PayloadBlock* block = reinterpret_cast<PayloadBlock*>( slab + x * this->block_stride );
+
+            block->pool = this;
+            block->capacity = uint32_t( this->block_bytes );
+            block->pooled = true;
+            block->next_free = this->free_list;
+
+            this->free_list = block;
+
+        }
+
+        this->stats.allocated_blocks += slab_blocks;
+
+        return true;
+
+    }
+
+
+
+    PayloadBlock* PayloadPool::acquire( const char* payload, size_t length, DeliveryTicket* ticket ){
+
+        PayloadBlock* block = nullptr;
+
+        {
+            std::scoped_lock lock( this->mutex );
+
+            if( length <= this->block_bytes && (this->free_list != nullptr || this->allocateSlab()) ){
+
+                block = this->free_list;
+                this->free_list = block->next_free;
+
+                this->stats.blocks_in_use++;
+                if( this->stats.blocks_in_use > this->stats.blocks_in_use_high_water_mark ){
+                    this->stats.blocks_in_use_high_water_mark = this->stats.blocks_in_use;
+                }
+
+            }else{
+
+                this->stats.overflow_allocations++;
+                this->stats.overflow_blocks_in_use++;
+                if( this->stats.overflow_blocks_in_use > this->stats.overflow_blocks_in_use_high_water_mark ){
+                    this->stats.overflow_blocks_in_use_high_water_mark = this->stats.overflow_blocks_in_use;
+                }
+
+            }
+
+            this->stats.bytes_in_use += length;
+            if( this->stats.bytes_in_use > this->stats.bytes_in_use_high_water_mark ){
+                this->stats.bytes_in_use_high_water_mark = this->stats.bytes_in_use;
+            }
+        }
+
+
+        if( block == nullptr ){
+
+            block = static_cast<PayloadBlock*>( malloc(sizeof(PayloadBlock) + length) );
+
+            if( block == nullptr ){
+                std::scoped_lock lock( this->mutex );
+                this->stats.overflow_blocks_in_use--;
+                this->stats.bytes_in_use -= length;
+                throw std::bad_alloc();
+            }
+
+            block->pool = this;
+            block->capacity = uint32_t( length );
+            block->pooled = false;
+
+        }
+
+        block->ticket = ticket;
+        block->next_free = nullptr;
+        block->length = uint32_t( length );
+
+        if( length ){
+            memcpy( block->data(), payload, length );
+        }
+
+        return block;
+
+    }
+
+
+
+    void PayloadPool::release( PayloadBlock* block ){
+
+        if( block == nullptr ) return;
+
+        block->pool->releaseBlock( block );
+
+    }
+
+
+
+    void PayloadPool::releaseBlock( PayloadBlock* block ){
+
+        std::scoped_lock lock( this->mutex );
+
+        this->stats.bytes_in_use -= block->length;
+
+        if( block->pooled ){
+
+            block->next_free = this->free_list;
+            this->free_list = block;
+
+            this->stats.blocks_in_use--;
+
+        }else{
+
+            this->stats.overflow_blocks_in_use--;
+            free( block );
+
+        }
+
+    }
+
+
+
+    PayloadPoolStats PayloadPool::getStats() const{
+
+        std::scoped_lock lock( this->mutex );
+
+        return this->stats;
+
+    }
+
+
+
+    string PayloadPoolStats::toJson() const{
+
+        return "{\"block_bytes\":" + logport::to_string<size_t>(this->block_bytes) +
+            ",\"max_blocks\":" + logport::to_string<size_t>(this->max_blocks) +
+            ",\"allocated_blocks\":" + logport::to_string<size_t>(this->allocated_blocks) +
+            ",\"blocks_in_use\":" + logport::to_string<size_t>(this->blocks_in_use) +
+            ",\"blocks_in_use_high_water_mark\":" + logport::to_string<size_t>(this->blocks_in_use_high_water_mark) +
+            ",\"overflow_blocks_in_use\":" + logport::to_string<size_t>(this->overflow_blocks_in_use) +
+            ",\"overflow_blocks_in_use_high_water_mark\":" + logport::to_string<size_t>(this->overflow_blocks_in_use_high_water_mark) +
+            ",\"bytes_in_use\":" + logport::to_string<size_t>(this->bytes_in_use) +
+            ",\"bytes_in_use_high_water_mark\":" + logport::to_string<size_t>(this->bytes_in_use_high_water_mark) +
+            ",\"overflow_allocations\":" + logport::to_string<uint64_t>(this->overflow_allocations) +
+            "}";
+
+    }
+
+
+}
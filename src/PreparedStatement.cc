@@ -7,13 +7,11 @@
 #include <string>
 using std::string;
 
-#include <unistd.h>
-
 
 
 namespace logport{
 
-    PreparedStatement::PreparedStatement( const Database& database, const string& statement_sql ){
+    PreparedStatement::PreparedStatement( const Database& database, const string& statement_sql, unsigned int prepare_flags ){
 
         this->statement = NULL;
         this->db = database.db;
@@ -21,20 +19,8 @@ namespace logport{
         this->column_count = 0;
 
 
-        int attempt = 0;
-        int result_code;
-
-        while( attempt < 1000 ){
-
-            result_code = sqlite3_prepare_v3( this->db, statement_sql.c_str(), static_cast<int>(statement_sql.size()), 0, &this->statement, NULL );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
-            }
-            usleep(10000);  // 10ms
-            attempt++;
-
-        }
+        //waits on locks through the connection's busy handler (see Database)
+        int result_code = sqlite3_prepare_v3( this->db, statement_sql.c_str(), static_cast<int>(statement_sql.size()), prepare_flags, &this->statement, NULL );
 
         if( result_code != SQLITE_OK ){
 
@@ -137,24 +123,12 @@ namespace logport{
 
         // https://sqlite.org/c3ref/step.html
 
-        int attempt = 0;
-        int result_code;
-
-        while( attempt < 1000 ){
-
-            result_code = sqlite3_step( this->statement );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
-            }
-            usleep(10000);  // 10ms
-            attempt++;
-
-        }
+        //waits on locks through the connection's busy handler (see Database)
+        int result_code = sqlite3_step( this->statement );
 
         this->last_step_result = result_code;
 
-        if( result_code == SQLITE_ERROR ){
+        if( result_code == SQLITE_ERROR || result_code == SQLITE_BUSY || result_code == SQLITE_LOCKED ){
 
             string error_message_string( sqlite3_errmsg( this->db ) );
 
@@ -179,20 +153,7 @@ namespace logport{
 
         // https://sqlite.org/c3ref/reset.html
 
-        int attempt = 0;
-        int result_code;
-
-        while( attempt < 1000 ){
-
-            result_code = sqlite3_reset( this->statement );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
-            }
-            usleep(10000);  // 10ms
-            attempt++;
-
-        }
+        int result_code = sqlite3_reset( this->statement );
 
         this->last_step_result = SQLITE_ERROR;
         this->column_count = 0;
@@ -214,21 +175,7 @@ namespace logport{
 
         // https://sqlite.org/c3ref/clear_bindings.html
 
-        int attempt = 0;
-        int result_code;
-
-        while( attempt < 1000 ){
-
-            result_code = sqlite3_clear_bindings( this->statement );
-            
-            if( result_code != SQLITE_BUSY && result_code != SQLITE_LOCKED ){
-                break;                
-            }
-            usleep(10000);  // 10ms
-            attempt++;
-
-        }
-
+        int result_code = sqlite3_clear_bindings( this->statement );
 
         if( result_code != SQLITE_OK ){
 
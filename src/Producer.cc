@@ -1,7 +1,16 @@
 #include "Producer.h"
 #include "LogPort.h"
 
+#include "Common.h"
+#include "Spool.h"
+
 #include <unistd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include <stdexcept>
 
 namespace logport{
 
@@ -36,6 +45,16 @@ namespace logport{
         :type(type), settings(settings), logport(logport), undelivered_log(undelivered_log)
     {
 
+        char error_string_buffer[1024];
+
+        int event_pipe[2];
+        if( pipe2(event_pipe, O_NONBLOCK | O_CLOEXEC) == -1 ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to create producer event pipe: errno " + string(error_string_buffer) );
+        }
+
+        this->event_read_fd = event_pipe[0];
+        this->event_write_fd = event_pipe[1];
 
     }
 
@@ -47,6 +66,130 @@ namespace logport{
             this->undelivered_log_open = false;
         }
 
+        close( this->event_read_fd );
+        close( this->event_write_fd );
+
+    }
+
+
+
+    void Producer::handleEvents(){
+
+        this->clearEvent();
+
+    }
+
+
+
+    void Producer::signalEvent(){
+
+        //if the pipe is full, it's already readable
+        const char event = 1;
+        ssize_t result = write( this->event_write_fd, &event, 1 );
+        (void)result;
+
+    }
+
+
+
+    void Producer::clearEvent(){
+
+        char events[256];
+        while( read(this->event_read_fd, events, sizeof(events)) > 0 );
+
+    }
+
+
+
+    void Producer::produceBatch( MessageBatch& batch ){
+
+        string message;
+
+        for( size_t x = 0; x < batch.size(); x++ ){
+            message.assign( batch.getMessage(x) );
+            this->produce( message, batch.getTicket(x) );
+        }
+
+    }
+
+
+
+    void Producer::recordUndelivered( const void* payload, size_t length, DeliveryTicket* ticket ){
+
+        const vector<UndeliveredMessage> messages{ UndeliveredMessage{ std::string_view(static_cast<const char*>(payload), length), ticket } };
+
+        this->recordUndelivered( messages );
+
+    }
+
+
+
+    void Producer::recordUndelivered( const vector<UndeliveredMessage>& messages ){
+
+        //reused by every call on this thread
+        static thread_local vector<std::string_view> spool_payloads;
+
+        size_t x = 0;
+
+        while( x < messages.size() ){
+
+            DeliveryTracker* tracker = messages[x].ticket != nullptr ? messages[x].ticket->tracker : nullptr;
+
+            std::shared_ptr<Spool> spool;
+            if( tracker != nullptr ){
+                spool = tracker->getSpool();
+            }
+
+            if( spool ){
+
+                spool_payloads.clear();
+
+                //one tracker per watch, so one spool per tracker
+                while( x < messages.size() && messages[x].ticket != nullptr && messages[x].ticket->tracker == tracker ){
+                    spool_payloads.push_back( messages[x].payload );
+                    x++;
+                }
+
+                if( !spool->append(spool_payloads.data(), spool_payloads.size()) ){
+                    this->logport->getObserver().addLogEntry( "Failed to record " + logport::to_string<size_t>(spool_payloads.size()) + " undelivered messages in " + spool->getDirectory() );
+                }
+
+                continue;
+
+            }
+
+
+            //no spool; fall back to this producer's undelivered log
+
+            if( !this->undelivered_log_open ){
+                this->logport->getObserver().addLogEntry( "Failed to record undelivered message." );
+                x++;
+                continue;
+            }
+
+            const char newline = '\n';
+            struct iovec record[2] = {
+                { const_cast<char*>(messages[x].payload.data()), messages[x].payload.size() },
+                { const_cast<char*>(&newline), 1 }
+            };
+
+            {
+                //the payload and its newline must not interleave with another thread's record
+                std::scoped_lock lock( this->undelivered_log_mutex );
+
+                ssize_t result_bytes = writev( this->undelivered_log_fd, record, 2 );
+
+                if( result_bytes < 0 ){
+                    this->logport->getObserver().addLogEntry( "Failed to write to undelivered_log. errno: " + logport::to_string<int>(errno) );
+                }else if( (size_t)result_bytes != messages[x].payload.size() + 1 ){
+                    this->logport->getObserver().addLogEntry( "Write mismatch in undelivered_log. " + logport::to_string<size_t>(messages[x].payload.size() + 1) + " bytes expected but only " + logport::to_string<ssize_t>(result_bytes) + " written." );
+                }
+            }
+
+            x++;
+
+        }
+
     }
 
 
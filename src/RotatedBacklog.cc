@@ -0,0 +1,232 @@
+#include "RotatedBacklog.h"
+
+#include <stdexcept>
+#include <vector>
+using std::vector;
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "Common.h"
+#include "Watch.h"
+
+
+namespace logport{
+
+
+    //zlib's input buffer; rotated files are read sequentially, once
+    #define ROTATED_BACKLOG_GZ_BUFFER_BYTES 128 * 1024
+
+    //the most bytes compared for a fingerprint (see FILE_HEAD_HASH_BYTES in FileTailer)
+    #define ROTATED_BACKLOG_MAX_HEAD_BYTES 1024
+
+
+    static gzFile open_gz( const string& filepath ){
+
+        const int fd = ::open( filepath.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
+        if( fd == -1 ){
+            return nullptr;
+        }
+
+        //gzclose() closes fd
+        gzFile file = gzdopen( fd, "rb" );
+        if( file == nullptr ){
+            ::close( fd );
+            return nullptr;
+        }
+
+        gzbuffer( file, ROTATED_BACKLOG_GZ_BUFFER_BYTES );
+
+        return file;
+
+    }
+
+
+    //the crc32 of the first length bytes of the (uncompressed) file matches; false if they can't all be read
+    static bool head_hash_matches( const string& filepath, int64_t length, uint32_t head_hash ){
+
+        if( length <= 0 || length > ROTATED_BACKLOG_MAX_HEAD_BYTES ){
+            return false;
+        }
+
+        gzFile file = open_gz( filepath );
+        if( file == nullptr ){
+            return false;
+        }
+
+        char head[ROTATED_BACKLOG_MAX_HEAD_BYTES];
+        const int bytes_read = gzread( file, head, unsigned(length) );
+        gzclose( file );
+
+        if( bytes_read != int(length) ){
+            return false;
+        }
+
+        return uint32_t( crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(head), uInt(length)) ) == head_hash;
+
+    }
+
+
+
+    //false if the file is known to end at (or before) offset, so it doesn't have to be decompressed to find out
+    static bool may_have_unread_bytes( const string& filepath, const struct stat64& file_status, int64_t offset ){
+
+        const int fd = ::open( filepath.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW );
+        if( fd == -1 ){
+            return false;
+        }
+
+        unsigned char magic[2] = { 0, 0 };
+        unsigned char trailer[4] = { 0, 0, 0, 0 };
+
+        const bool compressed = pread64( fd, magic, 2, 0 ) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+        const bool has_trailer = compressed && file_status.st_size >= 18 && pread64( fd, trailer, 4, file_status.st_size - 4 ) == 4;
+
+        ::close( fd );
+
+        if( !compressed ){
+            return file_status.st_size > offset;
+        }
+
+        //a gzip member ends with its uncompressed size (mod 2^32); logrotate writes a single member
+        if( has_trailer ){
+            const uint32_t uncompressed_size = uint32_t(trailer[0]) | uint32_t(trailer[1]) << 8 | uint32_t(trailer[2]) << 16 | uint32_t(trailer[3]) << 24;
+            if( uncompressed_size == uint32_t(offset) ){
+                return false;
+            }
+        }
+
+        return true;
+
+    }
+
+
+
+    std::unique_ptr<RotatedBacklog> RotatedBacklog::find( const Watch& watch ){
+
+        //without a fingerprint, a rotated file can't be told apart from any other
+        if( watch.file_inode == 0 || watch.file_head_length <= 0 ){
+            return nullptr;
+        }
+
+        const string directory = get_parent_directory( watch.watched_filepath );
+        const string file_name = get_file_name( watch.watched_filepath );
+
+        DIR* directory_stream = opendir( directory.c_str() );
+        if( directory_stream == NULL ){
+            return nullptr;
+        }
+
+        //logrotate's names: "app.log.1", "app.log.1.gz", "app.log-20240101", "app.log-20240101.gz"
+        vector<string> sibling_names;
+        struct dirent* entry;
+        while( (entry = readdir(directory_stream)) != NULL ){
+            const string name = entry->d_name;
+            if( name.size() > file_name.size() + 1 && name.compare(0, file_name.size(), file_name) == 0 && ( name[file_name.size()] == '.' || name[file_name.size()] == '-' ) ){
+                sibling_names.push_back( name );
+            }
+        }
+        closedir( directory_stream );
+
+        string best_filepath;
+        bool best_same_inode = false;
+        time_t best_modified_time = 0;
+
+        for( const string& sibling_name : sibling_names ){
+
+            const string sibling_filepath = directory + "/" + sibling_name;
+
+            struct stat64 file_status;
+            if( lstat64(sibling_filepath.c_str(), &file_status) == -1 || !S_ISREG(file_status.st_mode) ){
+                continue;
+            }
+
+            if( !head_hash_matches(sibling_filepath, watch.file_head_length, watch.file_head_hash) ){
+                continue;
+            }
+
+            //the renamed file itself (eg. with "delaycompress") beats a copy; otherwise the latest one
+            const bool same_inode = uint64_t(file_status.st_ino) == watch.file_inode && uint64_t(file_status.st_dev) == watch.file_device;
+
+            if( best_filepath.empty() || ( same_inode && !best_same_inode ) || ( same_inode == best_same_inode && file_status.st_mtime > best_modified_time ) ){
+                best_filepath = sibling_filepath;
+                best_same_inode = same_inode;
+                best_modified_time = file_status.st_mtime;
+            }
+
+        }
+
+        if( best_filepath.empty() ){
+            return nullptr;
+        }
+
+        //eg. everything had been shipped before it was rotated
+        struct stat64 best_file_status;
+        if( stat64(best_filepath.c_str(), &best_file_status) == -1 || !may_have_unread_bytes(best_filepath, best_file_status, watch.file_offset) ){
+            return nullptr;
+        }
+
+        return std::make_unique<RotatedBacklog>( best_filepath, watch.file_offset );
+
+    }
+
+
+
+    RotatedBacklog::RotatedBacklog( const string& filepath, int64_t offset )
+        :filepath(filepath)
+    {
+
+        char error_string_buffer[1024];
+
+        this->file = open_gz( filepath );
+        if( this->file == nullptr ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to open rotated file " + filepath + ": errno " + string(error_string_buffer) );
+        }
+
+        //compressed files are decompressed up to the offset (and the rest read from there)
+        if( offset > 0 && gzseek64(this->file, offset, SEEK_SET) == -1 ){
+            gzclose( this->file );
+            this->file = nullptr;
+            throw std::runtime_error( "Failed to skip to offset " + logport::to_string<int64_t>(offset) + " in rotated file " + filepath );
+        }
+
+        this->offset = offset;
+
+    }
+
+
+
+    RotatedBacklog::~RotatedBacklog(){
+
+        if( this->file ){
+            gzclose( this->file );
+        }
+
+    }
+
+
+
+    ssize_t RotatedBacklog::read( char* buffer, size_t length ){
+
+        const int bytes_read = gzread( this->file, buffer, unsigned(length) );
+
+        if( bytes_read < 0 ){
+            int error_number = 0;
+            const char* error_message = gzerror( this->file, &error_number );
+            throw std::runtime_error( "Failed to read rotated file " + this->filepath + ": " + string(error_message ? error_message : "unknown error") );
+        }
+
+        this->offset += bytes_read;
+
+        return bytes_read;
+
+    }
+
+
+}
@@ -0,0 +1,798 @@
+#include "Spool.h"
+
+#include "Common.h"
+#include "Observer.h"
+#include "DeliveryTracker.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <zlib.h>
+
+
+namespace logport{
+
+
+    #define SPOOL_RECORD_HEADER_SIZE 8  //uint32 length, uint32 crc32
+
+    //the smallest amount read from a segment at once; records are parsed out of the read
+    #define SPOOL_READ_CHUNK_SIZE 64 * 1024
+
+    #define SPOOL_MIN_SEGMENT_BYTES 64 * 1024
+
+    //a replay position is a segment sequence and an offset in that segment, in one signed 64-bit value
+    #define SPOOL_POSITION_OFFSET_BITS 40
+    #define SPOOL_MAX_SEGMENT_BYTES ( 1ULL << 32 )
+
+
+    static inline uint32_t payload_crc32( const char* payload, size_t length ){
+
+        return uint32_t( crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(payload), uInt(length)) );
+
+    }
+
+
+    static inline int64_t steady_now_ns(){
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+
+    }
+
+
+    //reads exactly length bytes unless the file ends first; returns the bytes read or -1
+    static ssize_t pread_fully( int fd, char* buffer, size_t length, off64_t offset ){
+
+        size_t total_read = 0;
+
+        while( total_read < length ){
+
+            ssize_t bytes_read = pread64( fd, buffer + total_read, length - total_read, offset + total_read );
+
+            if( bytes_read == -1 ){
+                if( errno == EINTR ) continue;
+                return -1;
+            }
+
+            if( bytes_read == 0 ){
+                break;
+            }
+
+            total_read += size_t( bytes_read );
+
+        }
+
+        return ssize_t( total_read );
+
+    }
+
+
+
+    Spool::Spool( const string& directory, const map<string,string>& settings )
+        :directory(directory), cursor_path(directory + "/cursor")
+    {
+
+        char error_string_buffer[1024];
+
+        //eg. "logport set watch.spool.max.bytes 1073741824"
+        int64_t max_bytes_setting = get_setting_int64( settings, "watch.spool.max.bytes", 1024LL * 1024 * 1024 );
+        int64_t segment_bytes_setting = get_setting_int64( settings, "watch.spool.segment.bytes", 16 * 1024 * 1024 );
+
+        this->max_bytes = max_bytes_setting > 0 ? uint64_t( max_bytes_setting ) : 0;  //0 is unlimited
+        this->segment_bytes = segment_bytes_setting > 0 ? std::min<uint64_t>( uint64_t(segment_bytes_setting), SPOOL_MAX_SEGMENT_BYTES ) : 16 * 1024 * 1024;
+
+        //dropping or blocking works a segment at a time; keep a few segments under the cap
+        if( this->max_bytes > 0 && this->segment_bytes > this->max_bytes / 4 ){
+            this->segment_bytes = std::max<uint64_t>( this->max_bytes / 4, SPOOL_MIN_SEGMENT_BYTES );
+        }
+
+        map<string,string>::const_iterator policy_it = settings.find( "watch.spool.full.policy" );
+        if( policy_it != settings.end() && policy_it->second == "block" ){
+            this->full_policy = FullPolicy::BLOCK;
+        }else{
+            this->full_policy = FullPolicy::DROP_OLDEST;
+        }
+
+
+        if( mkdir(this->directory.c_str(), S_IRWXU) == -1 && errno != EEXIST ){
+            snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+            throw std::runtime_error( "Failed to create spool directory " + this->directory + ": errno " + string(error_string_buffer) );
+        }
+
+
+        //find the existing segments
+
+            DIR* spool_dir = opendir( this->directory.c_str() );
+            if( spool_dir == NULL ){
+                snprintf(error_string_buffer, sizeof(error_string_buffer), "%d", errno);
+                throw std::runtime_error( "Failed to open spool directory " + this->directory + ": errno " + string(error_string_buffer) );
+            }
+
+            struct dirent* entry;
+            while( (entry = readdir(spool_dir)) != NULL ){
+
+                const size_t name_length = strlen( entry->d_name );
+                if( name_length != 24 || strcmp(entry->d_name + 20, ".seg") != 0 ){
+                    continue;
+                }
+
+                char* end = NULL;
+                const uint64_t sequence = strtoull( entry->d_name, &end, 10 );
+                if( end != entry->d_name + 20 ){
+                    continue;
+                }
+
+                this->segments.push_back( Segment{ sequence, get_file_size(this->getSegmentPath(sequence)) } );
+
+            }
+
+            closedir( spool_dir );
+
+            std::sort( this->segments.begin(), this->segments.end(), []( const Segment& a, const Segment& b ){ return a.sequence < b.sequence; } );
+
+            for( const Segment& segment : this->segments ){
+                this->total_bytes += segment.size;
+            }
+
+
+        //resume at the saved cursor
+
+            FILE* cursor_file = fopen( this->cursor_path.c_str(), "r" );
+            if( cursor_file != NULL ){
+
+                unsigned long long saved_sequence = 0, saved_offset = 0;
+                if( fscanf(cursor_file, "%llu %llu", &saved_sequence, &saved_offset) == 2 ){
+                    this->read_sequence = saved_sequence;
+                    this->read_offset = saved_offset;
+                }
+                fclose( cursor_file );
+
+            }
+
+            //segments before the cursor have been read
+            while( this->segments.size() && this->segments.front().sequence < this->read_sequence ){
+                this->total_bytes -= this->segments.front().size;
+                unlink( this->getSegmentPath(this->segments.front().sequence).c_str() );
+                this->segments.pop_front();
+            }
+
+            if( this->segments.empty() || this->segments.front().sequence != this->read_sequence ){
+                //the cursor's segment is gone (eg. dropped); start at the oldest one left
+                this->read_offset = 0;
+                if( this->segments.size() ){
+                    this->read_sequence = this->segments.front().sequence;
+                }
+            }
+
+            //every existing segment is sealed (a new one is started for the first append); drop any that were read to the end
+            while( this->segments.size() && this->read_offset >= this->segments.front().size ){
+                this->removeReadSegment();
+            }
+
+            this->saved_read_sequence = this->read_sequence;
+            this->saved_read_offset = this->read_offset;
+
+            if( this->hasUnreadLocked() ){
+                Observer observer;
+                observer.addLogEntry( "logport: spool " + this->directory + " has " + logport::to_string<uint64_t>(this->total_bytes - this->read_offset) + " bytes to replay" );
+            }
+
+    }
+
+
+
+    Spool::~Spool(){
+
+        std::scoped_lock lock( this->mutex );
+
+        this->closeWriteSegment();
+
+        if( this->read_fd != -1 ){
+            ::close( this->read_fd );
+            this->read_fd = -1;
+        }
+
+        if( !this->hasUnreadLocked() ){
+
+            //everything was replayed (and the producer has flushed, or spooled again, whatever was in flight); leave an empty spool behind
+            for( const Segment& segment : this->read_segments ){
+                unlink( this->getSegmentPath(segment.sequence).c_str() );
+            }
+            this->read_segments.clear();
+            for( const Segment& segment : this->segments ){
+                unlink( this->getSegmentPath(segment.sequence).c_str() );
+            }
+            this->segments.clear();
+            unlink( this->cursor_path.c_str() );
+
+        }
+
+    }
+
+
+
+    string Spool::getDirectoryFor( const string& undelivered_log_filepath ){
+
+        return undelivered_log_filepath + ".spool";
+
+    }
+
+
+
+    int64_t Spool::getPosition( uint64_t sequence, uint64_t offset ){
+
+        return int64_t( ( sequence << SPOOL_POSITION_OFFSET_BITS ) | offset );
+
+    }
+
+
+
+    string Spool::getSegmentPath( uint64_t sequence ) const{
+
+        char segment_name[32];
+        snprintf( segment_name, sizeof(segment_name), "/%020llu.seg", (unsigned long long)sequence );
+
+        return this->directory + segment_name;
+
+    }
+
+
+
+    uint64_t Spool::getDiskUsage( const string& directory ){
+
+        DIR* spool_dir = opendir( directory.c_str() );
+        if( spool_dir == NULL ){
+            return 0;
+        }
+
+        uint64_t disk_usage = 0;
+
+        struct dirent* entry;
+        while( (entry = readdir(spool_dir)) != NULL ){
+
+            if( entry->d_name[0] == '.' ){
+                continue;
+            }
+
+            struct stat file_stat;
+            if( stat((directory + "/" + entry->d_name).c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) ){
+                disk_usage += uint64_t( file_stat.st_size );
+            }
+
+        }
+
+        closedir( spool_dir );
+
+        return disk_usage;
+
+    }
+
+
+
+    bool Spool::openWriteSegment(){
+
+        const uint64_t sequence = this->segments.size() ? this->segments.back().sequence + 1 : std::max<uint64_t>( this->read_sequence, 1 );
+        const string segment_path = this->getSegmentPath( sequence );
+
+        this->write_fd = ::open( segment_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR );
+        if( this->write_fd == -1 ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to create spool segment " + segment_path + ". errno: " + logport::to_string<int>(errno) );
+            return false;
+        }
+
+        if( this->segments.empty() ){
+            this->read_sequence = sequence;
+            this->read_offset = 0;
+        }
+
+        this->segments.push_back( Segment{ sequence, 0 } );
+
+        return true;
+
+    }
+
+
+
+    void Spool::closeWriteSegment(){
+
+        if( this->write_fd != -1 ){
+            ::close( this->write_fd );
+            this->write_fd = -1;
+        }
+
+    }
+
+
+
+    bool Spool::append( const void* payload, size_t length ){
+
+        const std::string_view record( static_cast<const char*>(payload), length );
+
+        return this->append( &record, 1 );
+
+    }
+
+
+
+    bool Spool::append( const std::string_view* payloads, size_t count ){
+
+        if( count == 0 ){
+            return true;
+        }
+
+        std::scoped_lock lock( this->mutex );
+
+        //one header per record; the iovecs point into these
+        this->record_headers.resize( count * 2 );
+
+        bool success = true;
+        size_t first_record = 0;
+        uint64_t pending_bytes = 0;
+
+        for( size_t x = 0; x < count; x++ ){
+
+            const uint64_t record_bytes = SPOOL_RECORD_HEADER_SIZE + payloads[x].size();
+
+            if( this->write_fd == -1 || (this->segments.back().size + pending_bytes > 0 && this->segments.back().size + pending_bytes + record_bytes > this->segment_bytes) ){
+
+                //write what belongs to the current segment before starting the next one
+                if( x > first_record ){
+                    success = this->writeRecords( first_record, x - first_record, payloads ) && success;
+                    first_record = x;
+                    pending_bytes = 0;
+                }
+
+                this->closeWriteSegment();
+
+                this->makeRoom( record_bytes );
+
+                if( !this->openWriteSegment() ){
+                    return false;
+                }
+
+            }
+
+            pending_bytes += record_bytes;
+
+        }
+
+        success = this->writeRecords( first_record, count - first_record, payloads ) && success;
+
+        this->last_append_time_ns = steady_now_ns();
+
+        return success;
+
+    }
+
+
+
+    bool Spool::writeRecords( size_t first_record, size_t count, const std::string_view* payloads ){
+
+        if( this->write_fd == -1 ){
+            return false;
+        }
+
+        this->iovecs.clear();
+
+        uint64_t expected_bytes = 0;
+
+        for( size_t x = first_record; x < first_record + count; x++ ){
+
+            uint32_t* header = &this->record_headers[ x * 2 ];
+            header[0] = uint32_t( payloads[x].size() );
+            header[1] = payload_crc32( payloads[x].data(), payloads[x].size() );
+
+            this->iovecs.push_back( iovec{ header, SPOOL_RECORD_HEADER_SIZE } );
+            if( payloads[x].size() ){
+                this->iovecs.push_back( iovec{ const_cast<char*>(payloads[x].data()), payloads[x].size() } );
+            }
+
+            expected_bytes += SPOOL_RECORD_HEADER_SIZE + payloads[x].size();
+
+        }
+
+
+        uint64_t written_bytes = 0;
+        size_t iovec_offset = 0;
+
+        while( iovec_offset < this->iovecs.size() ){
+
+            const int iovec_count = int( std::min<size_t>(this->iovecs.size() - iovec_offset, IOV_MAX) );
+
+            ssize_t result_bytes = writev( this->write_fd, &this->iovecs[iovec_offset], iovec_count );
+
+            if( result_bytes == -1 && errno == EINTR ){
+                continue;
+            }
+
+            if( result_bytes > 0 ){
+                written_bytes += uint64_t( result_bytes );
+                this->segments.back().size += uint64_t( result_bytes );
+                this->total_bytes += uint64_t( result_bytes );
+            }
+
+            size_t chunk_bytes = 0;
+            for( int x = 0; x < iovec_count; x++ ){
+                chunk_bytes += this->iovecs[iovec_offset + x].iov_len;
+            }
+
+            if( result_bytes < 0 || size_t(result_bytes) != chunk_bytes ){
+
+                Observer observer;
+                if( result_bytes < 0 ){
+                    observer.addLogEntry( "logport: failed to write to spool " + this->directory + ". errno: " + logport::to_string<int>(errno) );
+                }else{
+                    observer.addLogEntry( "logport: write mismatch in spool " + this->directory + ". " + logport::to_string<size_t>(chunk_bytes) + " bytes expected but only " + logport::to_string<ssize_t>(result_bytes) + " written." );
+                }
+
+                //a torn record ends the segment; the reader skips anything after it
+                this->closeWriteSegment();
+                return false;
+
+            }
+
+            iovec_offset += size_t( iovec_count );
+
+        }
+
+        return written_bytes == expected_bytes;
+
+    }
+
+
+
+    void Spool::makeRoom( uint64_t record_bytes ){
+
+        if( this->max_bytes == 0 || this->full_policy != FullPolicy::DROP_OLDEST ){
+            //the BLOCK policy is applied by the tailer (see isFull()); failed messages are always kept
+            return;
+        }
+
+        uint64_t dropped_bytes = 0;
+
+        while( this->total_bytes + record_bytes > this->max_bytes ){
+
+            const uint64_t segment_size = this->segments.size() ? this->segments.front().size : 0;
+
+            if( !this->dropOldestSegment() ){
+                break;
+            }
+
+            dropped_bytes += segment_size;
+
+        }
+
+        if( dropped_bytes > 0 ){
+            Observer observer;
+            observer.addLogEntry( "logport: spool " + this->directory + " is full; dropped the oldest " + logport::to_string<uint64_t>(dropped_bytes) + " bytes of undelivered messages" );
+        }
+
+    }
+
+
+
+    bool Spool::dropOldestSegment(){
+
+        //read but not acknowledged yet; its records in flight are lost only if logport stops before they're delivered
+        if( this->read_segments.size() ){
+            const Segment segment = this->read_segments.front();
+            unlink( this->getSegmentPath(segment.sequence).c_str() );
+            this->total_bytes -= segment.size;
+            this->read_segments_bytes -= segment.size;
+            this->read_segments.pop_front();
+            return true;
+        }
+
+        if( this->segments.empty() || (this->write_fd != -1 && this->segments.size() == 1) ){
+            return false;
+        }
+
+        //the oldest unread segment is always the one being read
+        this->removeReadSegment();
+
+        return true;
+
+    }
+
+
+
+    void Spool::removeReadSegment(){
+
+        const Segment segment = this->segments.front();
+
+        if( this->read_fd != -1 && this->read_fd_sequence == segment.sequence ){
+            ::close( this->read_fd );
+            this->read_fd = -1;
+        }
+
+        unlink( this->getSegmentPath(segment.sequence).c_str() );
+
+        this->total_bytes -= segment.size;
+        this->segments.pop_front();
+
+        this->read_sequence = this->segments.size() ? this->segments.front().sequence : segment.sequence + 1;
+        this->read_offset = 0;
+
+    }
+
+
+
+    void Spool::finishReadSegment(){
+
+        const Segment segment = this->segments.front();
+
+        if( this->read_fd != -1 && this->read_fd_sequence == segment.sequence ){
+            ::close( this->read_fd );
+            this->read_fd = -1;
+        }
+
+        this->read_segments.push_back( segment );
+        this->read_segments_bytes += segment.size;
+        this->segments.pop_front();
+
+        this->read_sequence = this->segments.size() ? this->segments.front().sequence : segment.sequence + 1;
+        this->read_offset = 0;
+
+    }
+
+
+
+    size_t Spool::read( MessageBatch& batch, size_t max_bytes, DeliveryTracker& delivery_tracker ){
+
+        std::scoped_lock lock( this->mutex );
+
+        //another tracker's acknowledged position could pass records that are still in flight here
+        if( this->replay_tracker == nullptr ){
+            this->replay_tracker = &delivery_tracker;
+        }else if( this->replay_tracker != &delivery_tracker ){
+            throw std::runtime_error( "Spool " + this->directory + " is already replayed through another delivery tracker" );
+        }
+
+        size_t payload_bytes_read = 0;
+        size_t records_read = 0;
+
+        while( this->segments.size() && (records_read == 0 || payload_bytes_read < max_bytes) ){
+
+            const Segment& segment = this->segments.front();
+            const bool sealed = !( this->write_fd != -1 && this->segments.size() == 1 );
+
+            if( this->read_offset >= segment.size ){
+                if( !sealed ){
+                    //caught up with the writer
+                    break;
+                }
+                this->finishReadSegment();
+                continue;
+            }
+
+            if( this->read_fd == -1 || this->read_fd_sequence != segment.sequence ){
+
+                if( this->read_fd != -1 ){
+                    ::close( this->read_fd );
+                }
+
+                this->read_fd = ::open( this->getSegmentPath(segment.sequence).c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME | O_NOFOLLOW | O_CLOEXEC );
+                if( this->read_fd == -1 ){
+                    Observer observer;
+                    observer.addLogEntry( "logport: failed to open spool segment " + this->getSegmentPath(segment.sequence) + " for replay; skipping it. errno: " + logport::to_string<int>(errno) );
+                    this->read_offset = segment.size;
+                    continue;
+                }
+                this->read_fd_sequence = segment.sequence;
+
+            }
+
+
+            //read whole records up to what the writer has completed
+
+                const uint64_t available_bytes = segment.size - this->read_offset;
+                size_t chunk_bytes = size_t( std::min<uint64_t>(available_bytes, std::max<size_t>(max_bytes > payload_bytes_read ? max_bytes - payload_bytes_read : 0, SPOOL_READ_CHUNK_SIZE)) );
+
+                this->read_buffer.resize( chunk_bytes );
+                ssize_t bytes_read = pread_fully( this->read_fd, &this->read_buffer[0], chunk_bytes, off64_t(this->read_offset) );
+
+                bool corrupt = bytes_read < 0 || size_t(bytes_read) != chunk_bytes;
+                size_t position = 0;
+
+                while( !corrupt && position + SPOOL_RECORD_HEADER_SIZE <= chunk_bytes ){
+
+                    uint32_t header[2];
+                    memcpy( header, this->read_buffer.data() + position, SPOOL_RECORD_HEADER_SIZE );
+
+                    const size_t record_bytes = SPOOL_RECORD_HEADER_SIZE + header[0];
+
+                    if( record_bytes > available_bytes - position ){
+                        corrupt = true;
+                        break;
+                    }
+
+                    if( position + record_bytes > chunk_bytes ){
+
+                        if( position > 0 ){
+                            //the rest of this record is read next time around
+                            break;
+                        }
+
+                        //a record larger than the chunk
+                        chunk_bytes = record_bytes;
+                        this->read_buffer.resize( chunk_bytes );
+                        bytes_read = pread_fully( this->read_fd, &this->read_buffer[0], chunk_bytes, off64_t(this->read_offset) );
+                        corrupt = bytes_read < 0 || size_t(bytes_read) != chunk_bytes;
+                        continue;
+
+                    }
+
+                    const char* payload = this->read_buffer.data() + position + SPOOL_RECORD_HEADER_SIZE;
+
+                    if( payload_crc32(payload, header[0]) != header[1] ){
+                        corrupt = true;
+                        break;
+                    }
+
+                    batch.add( std::string_view(payload, header[0]), delivery_tracker.trackReplay(getPosition(segment.sequence, this->read_offset + position + record_bytes)) );
+
+                    position += record_bytes;
+                    payload_bytes_read += header[0];
+                    records_read++;
+
+                    if( payload_bytes_read >= max_bytes ){
+                        break;
+                    }
+
+                }
+
+                this->read_offset += position;
+
+                if( !corrupt && position + SPOOL_RECORD_HEADER_SIZE > chunk_bytes && position < chunk_bytes && chunk_bytes == available_bytes ){
+                    //a partial header at the end of what's been written; only possible after a torn write
+                    corrupt = true;
+                }
+
+                if( corrupt ){
+
+                    //the framing can't be trusted past this point
+                    Observer observer;
+                    observer.addLogEntry( "logport: corrupt record in spool segment " + this->getSegmentPath(segment.sequence) + " at offset " + logport::to_string<uint64_t>(this->read_offset) + "; skipping the rest of the segment (" + logport::to_string<uint64_t>(segment.size - this->read_offset) + " bytes)" );
+
+                    this->read_offset = segment.size;
+
+                    if( !sealed ){
+                        //don't append after the damage
+                        this->closeWriteSegment();
+                    }
+
+                }
+
+        }
+
+        return payload_bytes_read;
+
+    }
+
+
+
+    void Spool::saveCursor( const DeliveryTracker& delivery_tracker ){
+
+        {
+            std::scoped_lock lock( this->mutex );
+            if( this->replay_tracker != &delivery_tracker ){
+                //nothing has been read through it
+                return;
+            }
+        }
+
+        const int64_t acknowledged_position = delivery_tracker.getAcknowledgedReplayPosition();
+
+        if( acknowledged_position < 0 ){
+            //nothing replayed has been acknowledged yet
+            return;
+        }
+
+        const uint64_t sequence = uint64_t( acknowledged_position ) >> SPOOL_POSITION_OFFSET_BITS;
+        const uint64_t offset = uint64_t( acknowledged_position ) & ( ( 1ULL << SPOOL_POSITION_OFFSET_BITS ) - 1 );
+
+        {
+            std::scoped_lock lock( this->mutex );
+
+            //segments read to their ends whose last record has been acknowledged (or that come before the acknowledged one)
+            while( this->read_segments.size() && ( this->read_segments.front().sequence < sequence || ( this->read_segments.front().sequence == sequence && offset >= this->read_segments.front().size ) ) ){
+                const Segment segment = this->read_segments.front();
+                unlink( this->getSegmentPath(segment.sequence).c_str() );
+                this->total_bytes -= segment.size;
+                this->read_segments_bytes -= segment.size;
+                this->read_segments.pop_front();
+            }
+
+            if( sequence < this->saved_read_sequence || ( sequence == this->saved_read_sequence && offset <= this->saved_read_offset ) ){
+                return;
+            }
+        }
+
+        const string temp_cursor_path = this->cursor_path + ".tmp";
+
+        FILE* cursor_file = fopen( temp_cursor_path.c_str(), "w" );
+        if( cursor_file == NULL ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to save spool cursor for " + this->directory + ". errno: " + logport::to_string<int>(errno) );
+            return;
+        }
+
+        const bool written = fprintf( cursor_file, "%llu %llu\n", (unsigned long long)sequence, (unsigned long long)offset ) > 0;
+
+        if( fclose(cursor_file) != 0 || !written || rename(temp_cursor_path.c_str(), this->cursor_path.c_str()) == -1 ){
+            Observer observer;
+            observer.addLogEntry( "logport: failed to save spool cursor for " + this->directory + ". errno: " + logport::to_string<int>(errno) );
+            return;
+        }
+
+        std::scoped_lock lock( this->mutex );
+        this->saved_read_sequence = sequence;
+        this->saved_read_offset = offset;
+
+    }
+
+
+
+    bool Spool::hasUnreadLocked() const{
+
+        if( this->segments.empty() ){
+            return false;
+        }
+
+        return this->segments.size() > 1 || this->read_offset < this->segments.front().size;
+
+    }
+
+
+
+    bool Spool::hasUnread() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->hasUnreadLocked();
+
+    }
+
+
+
+    bool Spool::isFull() const{
+
+        if( this->full_policy != FullPolicy::BLOCK || this->max_bytes == 0 ){
+            return false;
+        }
+
+        std::scoped_lock lock( this->mutex );
+        return this->total_bytes - this->read_segments_bytes - this->read_offset >= this->max_bytes;
+
+    }
+
+
+
+    uint64_t Spool::getSize() const{
+
+        std::scoped_lock lock( this->mutex );
+        return this->total_bytes;
+
+    }
+
+
+
+    std::chrono::steady_clock::time_point Spool::getLastAppendTime() const{
+
+        return std::chrono::steady_clock::time_point( std::chrono::nanoseconds(this->last_append_time_ns.load()) );
+
+    }
+
+
+}
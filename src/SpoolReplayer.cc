@@ -0,0 +1,130 @@
+#include "SpoolReplayer.h"
+
+#include <algorithm>
+
+#include "Common.h"
+#include "Observer.h"
+#include "Producer.h"
+
+
+namespace logport{
+
+
+    //the most spooled payload bytes replayed in one service() call
+    #define SPOOL_REPLAY_BATCH_BYTES 64 * 1024
+
+
+    SpoolReplayer::SpoolReplayer( std::shared_ptr<Spool> spool, Producer& producer, DeliveryTracker& delivery_tracker, const map<string,string>& settings, const string& description )
+        :spool(spool), producer(producer), delivery_tracker(delivery_tracker), description(description),
+         tokens_time(std::chrono::steady_clock::now()), last_cursor_save_time(std::chrono::steady_clock::now())
+    {
+
+        //eg. "logport set watch.spool.replay.bytes.per.second 4194304" (0 is unlimited)
+        this->bytes_per_second = get_setting_int64( settings, "watch.spool.replay.bytes.per.second", 4 * 1024 * 1024 );
+        this->backoff_ms = get_setting_int64( settings, "watch.spool.replay.backoff.ms", 5000 );
+
+        //replay yields to the watched file: while the file has more to read, replay gets one batch per interval
+        //eg. "logport set watch.spool.replay.yield.ms 1000" (0 interleaves them evenly)
+        this->yield_ms = std::max<int64_t>( get_setting_int64(settings, "watch.spool.replay.yield.ms", 1000), 0 );
+
+        //the cursor is saved as often as the watched file's offset
+        this->cursor_interval_ms = get_setting_int64( settings, "watch.checkpoint.interval.ms", 1000 );
+
+    }
+
+
+
+    int64_t SpoolReplayer::getDelayMs() const{
+
+        if( !this->spool->hasUnread() ){
+            return -1;
+        }
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        //the brokers (or targets) are probably still failing
+        const int64_t since_append_ms = std::chrono::duration_cast<std::chrono::milliseconds>( now - this->spool->getLastAppendTime() ).count();
+        if( since_append_ms < this->backoff_ms ){
+            return this->backoff_ms - since_append_ms;
+        }
+
+        if( this->bytes_per_second <= 0 ){
+            return 0;
+        }
+
+        //the bucket holds up to one second of replay
+        const double rate = double( this->bytes_per_second );
+        const double elapsed_seconds = std::chrono::duration<double>( now - this->tokens_time ).count();
+        const double tokens = std::min( this->tokens + elapsed_seconds * rate, rate );
+        const double needed_tokens = std::min<double>( SPOOL_REPLAY_BATCH_BYTES, rate );
+
+        if( tokens >= needed_tokens ){
+            return 0;
+        }
+
+        return std::max<int64_t>( int64_t((needed_tokens - tokens) * 1000 / rate), 1 );
+
+    }
+
+
+
+    void SpoolReplayer::service( bool live_reading ){
+
+        if( this->getDelayMs() != 0 ){
+            return;
+        }
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        //the live file goes first while it's behind
+        if( live_reading && std::chrono::duration_cast<std::chrono::milliseconds>(now - this->last_replay_time).count() < this->yield_ms ){
+            return;
+        }
+        this->last_replay_time = now;
+
+        size_t max_bytes = SPOOL_REPLAY_BATCH_BYTES;
+
+        if( this->bytes_per_second > 0 ){
+            const double rate = double( this->bytes_per_second );
+            const double elapsed_seconds = std::chrono::duration<double>( now - this->tokens_time ).count();
+
+            this->tokens = std::min( this->tokens + elapsed_seconds * rate, rate );
+            this->tokens_time = now;
+
+            max_bytes = std::min<size_t>( max_bytes, size_t(this->tokens) );
+
+        }
+
+        //spooled messages were already filtered when they were first produced; they're sent as they are
+        this->batch.clear();
+        const size_t replayed_bytes = this->spool->read( this->batch, max_bytes, this->delivery_tracker );
+
+        if( !this->batch.empty() ){
+            this->producer.produceBatch( this->batch );
+        }
+
+        this->tokens -= double( replayed_bytes );
+
+        if( !this->spool->hasUnread() && replayed_bytes > 0 ){
+            Observer observer;
+            observer.addLogEntry( "logport: Finished replaying undelivered messages for " + this->description + "." );
+        }
+
+    }
+
+
+
+    void SpoolReplayer::saveCursor( bool force ){
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        //replay resumes after the last acknowledged record after a restart
+        if( force || std::chrono::duration_cast<std::chrono::milliseconds>(now - this->last_cursor_save_time).count() >= this->cursor_interval_ms ){
+            this->spool->saveCursor( this->delivery_tracker );
+            this->last_cursor_save_time = now;
+        }
+
+    }
+
+
+}
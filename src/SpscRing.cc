@@ -0,0 +1,155 @@
+#include "SpscRing.h"
+
+#include <cstring>
+
+
+namespace logport{
+
+
+    //every record starts with its length; a record that doesn't fit before the end of the buffer leaves this marker behind
+    #define SPSC_RING_WRAP_MARKER UINT32_MAX
+
+    #define SPSC_RING_HEADER_BYTES 8
+
+    #define SPSC_RING_MIN_CAPACITY 4096
+
+
+    static size_t round_up_to_power_of_two( size_t value ){
+
+        size_t power = SPSC_RING_MIN_CAPACITY;
+        while( power < value ){
+            power <<= 1;
+        }
+        return power;
+
+    }
+
+
+
+    SpscRing::SpscRing( size_t capacity_bytes )
+        :capacity( round_up_to_power_of_two(capacity_bytes) ), mask( capacity - 1 ), buffer( new char[capacity] )
+    {
+
+    }
+
+
+
+    size_t SpscRing::getRecordBytes( size_t length ){
+
+        return ( SPSC_RING_HEADER_BYTES + length + SPSC_RING_HEADER_BYTES - 1 ) & ~size_t( SPSC_RING_HEADER_BYTES - 1 );
+
+    }
+
+
+
+    size_t SpscRing::getMaxRecordBytes() const{
+
+        //whichever side of the head is longer always holds half the buffer (see reserve())
+        return this->capacity / 2 - SPSC_RING_HEADER_BYTES;
+
+    }
+
+
+
+    char* SpscRing::reserve( size_t length ){
+
+        if( length > this->getMaxRecordBytes() ){
+            return nullptr;
+        }
+
+        const size_t head = this->head.load( std::memory_order_relaxed );
+        const size_t record_bytes = getRecordBytes( length );
+
+        const size_t position = head & this->mask;
+        const size_t contiguous_bytes = this->capacity - position;
+
+        //a record that doesn't fit before the end starts over at the beginning; the rest of the buffer is skipped
+        const size_t padding_bytes = record_bytes > contiguous_bytes ? contiguous_bytes : 0;
+        const size_t needed_bytes = padding_bytes + record_bytes;
+
+        if( head + needed_bytes - this->cached_tail > this->capacity ){
+            this->cached_tail = this->tail.load( std::memory_order_acquire );
+            if( head + needed_bytes - this->cached_tail > this->capacity ){
+                return nullptr;
+            }
+        }
+
+        if( padding_bytes ){
+            const uint32_t wrap_marker = SPSC_RING_WRAP_MARKER;
+            memcpy( this->buffer.get() + position, &wrap_marker, sizeof(wrap_marker) );
+        }
+
+        char* record = this->buffer.get() + ( ( head + padding_bytes ) & this->mask );
+        const uint32_t record_length = uint32_t( length );
+        memcpy( record, &record_length, sizeof(record_length) );
+
+        this->reserved_head = head + needed_bytes;
+
+        return record + SPSC_RING_HEADER_BYTES;
+
+    }
+
+
+
+    void SpscRing::commit(){
+
+        this->head.store( this->reserved_head, std::memory_order_release );
+
+        const size_t used_bytes = this->reserved_head - this->cached_tail;
+        if( used_bytes > this->used_bytes_high_water_mark.load(std::memory_order_relaxed) ){
+            this->used_bytes_high_water_mark.store( used_bytes, std::memory_order_relaxed );
+        }
+
+    }
+
+
+
+    bool SpscRing::peek( std::string_view& record ){
+
+        size_t tail = this->tail.load( std::memory_order_relaxed );
+
+        if( tail == this->cached_head ){
+            this->cached_head = this->head.load( std::memory_order_acquire );
+            if( tail == this->cached_head ){
+                return false;
+            }
+        }
+
+        uint32_t record_length;
+        memcpy( &record_length, this->buffer.get() + ( tail & this->mask ), sizeof(record_length) );
+
+        if( record_length == SPSC_RING_WRAP_MARKER ){
+            //the record is at the beginning of the buffer
+            tail += this->capacity - ( tail & this->mask );
+            memcpy( &record_length, this->buffer.get(), sizeof(record_length) );
+        }
+
+        record = std::string_view( this->buffer.get() + ( tail & this->mask ) + SPSC_RING_HEADER_BYTES, record_length );
+
+        this->peeked_tail = tail + getRecordBytes( record_length );
+
+        return true;
+
+    }
+
+
+
+    void SpscRing::release(){
+
+        this->tail.store( this->peeked_tail, std::memory_order_release );
+
+    }
+
+
+
+    size_t SpscRing::getUsedBytes() const{
+
+        const size_t tail = this->tail.load( std::memory_order_acquire );
+        const size_t head = this->head.load( std::memory_order_acquire );
+
+        return head >= tail ? head - tail : 0;
+
+    }
+
+
+}
@@ -7,6 +7,8 @@
 #include "LogPort.h"
 
 #include "InotifyWatcher.h"
+#include "PatternWatcher.h"
+#include "DeliveryTracker.h"
 
 #include "Producer.h"
 #include "KafkaProducer.h"
@@ -32,16 +34,19 @@ using std::endl;
 
 #include <stdlib.h>
 
-#include "json.hpp"
-using json = nlohmann::json;
 
 
 
 static logport::InotifyWatcher* inotify_watcher_ptr;
+static logport::PatternWatcher* pattern_watcher_ptr;
 
 static void signal_handler_stop( int sig ){
     
-    inotify_watcher_ptr->run = false;
+    if( pattern_watcher_ptr ){
+        pattern_watcher_ptr->stop();
+    }else{
+        inotify_watcher_ptr->run = false;
+    }
 
     logport::Observer observer;
 
@@ -104,11 +109,31 @@ namespace logport{
         this->hostname = statement.getText( 8 );
         this->pid = statement.getInt32( 9 );
 
+        //added by Database::upgradeDatabase()
+        if( statement.getNumberOfColumns() > 13 ){
+            this->file_inode = uint64_t( statement.getInt64(10) );
+            this->file_device = uint64_t( statement.getInt64(11) );
+            this->file_head_hash = uint32_t( statement.getInt64(12) );
+            this->file_head_length = statement.getInt64( 13 );
+        }
+
+        if( statement.getNumberOfColumns() > 15 ){
+            this->multiline = statement.getInt32( 14 ) != 0;
+            this->multiline_start_pattern = statement.getText( 15 );
+        }
+
         this->undelivered_log_filepath = this->watched_filepath + "_undelivered";
 
+        if( this->isPattern() ){
+            //shared by every file the pattern matches; kept out of the pattern's way
+            this->undelivered_log_filepath = get_parent_directory( this->watched_filepath ) + "/logport_watch_" + logport::to_string<int64_t>( this->id ) + "_undelivered";
+        }
+
         //this is set by the "setBrokers" call above
         //this->setProducerType( from_producer_type_description(this->producer_type_description) );
 
+        this->renderEnvelope();
+
     }
 
 
@@ -116,6 +141,7 @@ namespace logport{
         :watched_filepath(watched_filepath), undelivered_log_filepath(undelivered_log_filepath), brokers(brokers), topic(topic), product_code(product_code), log_type(log_type), hostname(hostname), id(0), file_offset(file_offset), pid(pid), last_pid(-1)
     {
         this->setBrokers( brokers );
+        this->renderEnvelope();
     }
 
 
@@ -134,6 +160,13 @@ namespace logport{
     }
 
 
+    bool Watch::isPattern() const{
+
+        return is_glob_pattern( get_file_name(this->watched_filepath) );
+
+    }
+
+
     void Watch::setProducerType( ProducerType producer_type ){
         this->producer_type = producer_type;
         this->producer_type_description = from_producer_type(producer_type);
@@ -157,6 +190,8 @@ namespace logport{
         statement.bindText( current_offset++, this->log_type );
         statement.bindText( current_offset++, this->hostname );
         statement.bindInt32( current_offset++, this->pid );
+        statement.bindInt32( current_offset++, this->multiline ? 1 : 0 );
+        statement.bindText( current_offset++, this->multiline_start_pattern );
 
     }
 
@@ -164,7 +199,7 @@ namespace logport{
 
     void Watch::savePid( Database& db ){
 
-        PreparedStatement statement( db, "UPDATE watches SET pid = ? WHERE id = ? ;" );
+        PreparedStatement& statement = db.getCachedStatement( "UPDATE watches SET pid = ? WHERE id = ? ;" );
 
         statement.bindInt32( 0, this->pid );
         statement.bindInt64( 1, this->id );
@@ -179,10 +214,34 @@ namespace logport{
 
     void Watch::saveOffset( Database& db ){
 
-        PreparedStatement statement( db, "UPDATE watches SET file_offset = ? WHERE id = ? ;" );
+        //written now, along with any offsets already queued on this connection
+        this->queueOffset( db );
+        db.commitOffsets();
+
+    }
+
+
+    void Watch::saveFileIdentity( Database& db ){
+
+        if( this->pattern_file ){
+            //id 0: not saved (eg. "logport now", or a file that was deleted from under its pattern watch)
+            if( this->id != 0 ){
+                db.saveWatchFile( *this );
+            }
+            return;
+        }
+
+        //replaces any offset still queued for this watch (it may belong to the previous file)
+        db.queueOffset( this->id, this->file_offset );
+
+        PreparedStatement& statement = db.getCachedStatement( "UPDATE watches SET file_offset = ?, file_inode = ?, file_device = ?, file_head_hash = ?, file_head_length = ? WHERE id = ? ;" );
 
         statement.bindInt64( 0, this->file_offset );
-        statement.bindInt64( 1, this->id );
+        statement.bindInt64( 1, int64_t(this->file_inode) );
+        statement.bindInt64( 2, int64_t(this->file_device) );
+        statement.bindInt64( 3, int64_t(this->file_head_hash) );
+        statement.bindInt64( 4, this->file_head_length );
+        statement.bindInt64( 5, this->id );
 
         statement.step();
         statement.reset();
@@ -191,8 +250,27 @@ namespace logport{
     }
 
 
+    void Watch::queueOffset( Database& db ) const{
+
+        if( this->pattern_file ){
+            if( this->id != 0 ){
+                db.queueFileOffset( this->id, this->watched_filepath, this->file_offset );
+            }
+            return;
+        }
+
+        db.queueOffset( this->id, this->file_offset );
+
+    }
+
+
     void Watch::loadOffset( Database& db ){
 
+        if( this->pattern_file ){
+            db.loadWatchFile( *this );
+            return;
+        }
+
         Watch reference_watch = db.getWatchById( this->id );
 
         this->file_offset = reference_watch.file_offset;
@@ -211,6 +289,11 @@ namespace logport{
 
             //child
 
+            //the supervisor reads its signals from a signalfd; this process handles its own
+            sigset_t empty_signal_mask;
+            sigemptyset( &empty_signal_mask );
+            sigprocmask( SIG_SETMASK, &empty_signal_mask, NULL );
+
             logport->getObserver().addLogEntry( "logport: Starting watch: " + this->watched_filepath );
             this->runNow( logport );
 
@@ -240,8 +323,7 @@ namespace logport{
 
             this->pid = pid;
 
-            Database db;
-            this->savePid(db);
+            this->savePid( logport->getDatabase() );
 
             return pid;
 
@@ -259,43 +341,67 @@ namespace logport{
 
         try{
 
-            sleep(2);
+            //the fields may have been set after construction (eg. "logport now")
+            this->renderEnvelope();
 
+            //this process's own connection (the parent's isn't used across fork()); kept for every checkpoint
             Database db;
             map<string,string> settings = db.getSettings();
-            unique_ptr<Producer> producer;
 
-            switch( this->producer_type ){
+            if( this->isPattern() ){
+
+                //one process tails every matching file; it has its own producer
+                PatternWatcher pattern_watcher( db, *this, logport, settings );
+                pattern_watcher_ptr = &pattern_watcher;
+
+                signal( SIGINT, signal_handler_stop );
+                signal( SIGTERM, signal_handler_stop );
+
+                try{
+                    pattern_watcher.startWatching(); //main loop; blocks
+                    logport->getObserver().addLogEntry( "logport: pattern watcher completed: id(" + logport::to_string<int64_t>(this->id) + ") " + this->watched_filepath );
+                    exit_code = 0;
+                }catch( std::exception &e ){
+                    logport->getObserver().addLogEntry( "logport: pattern watcher exception: " + string(e.what()) );
+                    exit_code = 1;
+                }
+
+            }else{
+
+                DeliveryTracker delivery_tracker( this->file_offset );  //must outlive the producer; delivery reports are served until it's flushed
+                unique_ptr<Producer> producer;
+
+                switch( this->producer_type ){
 
-                case ProducerType::KAFKA:
-                    producer = std::make_unique<KafkaProducer>( settings, logport, this->undelivered_log_filepath, this->brokers, this->topic );
-                    break;
+                    case ProducerType::KAFKA:
+                        producer = std::make_unique<KafkaProducer>( settings, logport, this->undelivered_log_filepath, this->brokers, this->topic );
+                        break;
 
-                case ProducerType::HTTP:
-                    producer = std::make_unique<HttpProducer>( settings, logport, this->undelivered_log_filepath, this->brokers );
-                    break;
+                    case ProducerType::HTTP:
+                        producer = std::make_unique<HttpProducer>( settings, logport, this->undelivered_log_filepath, this->brokers );
+                        break;
 
-                default:
-                    throw std::runtime_error( "Unknown producer type." );
+                    default:
+                        throw std::runtime_error( "Unknown producer type." );
 
-            };
+                };
 
-            sleep(1);
+                InotifyWatcher watcher( db, *producer, *this, logport, delivery_tracker );
+                inotify_watcher_ptr = &watcher;
 
-            InotifyWatcher watcher( db, *producer, *this, logport );  //expects undelivered log to exist
-            inotify_watcher_ptr = &watcher;
+                //register signal handler
+                signal( SIGINT, signal_handler_stop );
+                signal( SIGTERM, signal_handler_stop );
 
-            //register signal handler
-            signal( SIGINT, signal_handler_stop );
-            signal( SIGTERM, signal_handler_stop );
+                try{
+                    watcher.startWatching(); //main loop; blocks
+                    logport->getObserver().addLogEntry( "logport: watcher.watch completed: id(" + logport::to_string<int64_t>(this->id) + ") " + this->watched_filepath );
+                    exit_code = 0;
+                }catch( std::exception &e ){
+                    logport->getObserver().addLogEntry( "logport: watcher.watch exception: " + string(e.what()) );
+                    exit_code = 1;
+                }
 
-            try{
-                watcher.startWatching(); //main loop; blocks
-                logport->getObserver().addLogEntry( "logport: watcher.watch completed: id(" + logport::to_string<int64_t>(this->id) + ") " + this->watched_filepath );
-                exit_code = 0;
-            }catch( std::exception &e ){
-                logport->getObserver().addLogEntry( "logport: watcher.watch exception: " + string(e.what()) );
-                exit_code = 1;
             }
 
         }catch( std::exception &e ){
@@ -313,115 +419,45 @@ namespace logport{
     }
 
 
-    void Watch::stop( LogPort* logport ){
-
-        int status;
-
-        //observer.addLogEntry( "logport: watcher.watch completed: id(" + logport::to_string<int64_t>(this->id) + ") " + this->watched_filepath );
-
-
-        //terminate gracefully first, then forcefully if graceful shutdown lasts longer than 20s
-        if( kill(this->pid, SIGINT) == -1 ){
-            logport->getObserver().addLogEntry( "logport: failed to kill watch with SIGINT." );
-            return;
-        }
-        
-        logport->getObserver().addLogEntry( "logport: attempting graceful watch shutdown..." );
-
-        //sleep(20);
-        sleep(7);
-        
-        //this waitpid will clear the /proc/PID filesystem record
-        pid_t child_pid2 = waitpid(-1, &status, WUNTRACED | WNOHANG );
-        logport->getObserver().addLogEntry( "logport: child_pid2: " + logport::to_string<pid_t>(child_pid2) );
-        //sleep(2);
-        sleep(1);
-
-        //watch does not respond to SIGINT in certain conditions
-                            
-            //check to see if this->pid is still running
-            int getpgid_result = getpgid(this->pid);
-            logport->getObserver().addLogEntry( "logport: getpgid_result: " + logport::to_string<int>(getpgid_result) );
-            bool watch_still_running = true;
-            if( getpgid_result == -1 ){
-                watch_still_running = false;
-            }
-
-
-            if( watch_still_running ){
-
-                //verify the process name before killing SIGKILL
-                const string verified_process_name = proc_status_get_name( this->pid );
-                logport->getObserver().addLogEntry( "logport: verified process name: " + verified_process_name );
-
-                if( verified_process_name == "logport" ){
-                    logport->getObserver().addLogEntry( "logport: watch PID " + logport::to_string<pid_t>(this->pid) + " required a forceful exit." );
-                    if( kill(this->pid, SIGKILL) == -1 ){
-                        logport->getObserver().addLogEntry( "logport: failed to kill watch " + logport::to_string<pid_t>(this->pid) + " with SIGKILL." );
-                    }
-                }else{
-                    logport->getObserver().addLogEntry( "logport: same PID found, but different program name." );
-                }
-
-            }else{
+    string Watch::filterLogLine( std::string_view unfiltered_log_line ) const{
 
-                logport->getObserver().addLogEntry( "logport: watch PID " + logport::to_string<pid_t>(this->pid) + " has exited gracefully." );
+        string filtered_log_line;
+        this->filterLogLine( unfiltered_log_line, filtered_log_line );
 
-            }
+        return filtered_log_line;
 
     }
 
 
 
-
-    string Watch::filterLogLine( const string& unfiltered_log_line ) const{
-
-        string filtered_log_line = unfiltered_log_line;
+    void Watch::filterLogLine( std::string_view unfiltered_log_line, string& filtered_log_line ) const{
 
         /*
         // add your pre-filtering code here
-        size_t card_number_location = filtered_log_line.find( "\"card_number\":\"" );
+        size_t card_number_location = unfiltered_log_line.find( "\"card_number\":\"" );
         if( card_number_location != std::string::npos ){
             //card_number key found
 
-            size_t redacted_location = filtered_log_line.find( "\"card_number\":\"XXX" );
+            size_t redacted_location = unfiltered_log_line.find( "\"card_number\":\"XXX" );
 
             if( redacted_location == std::string::npos ){
                 //if unredacted credit_card found
-                filtered_log_line = "{\"@timestamp\":" + get_timestamp() + ",\"log\":\"tombstone\"}";
-                return filtered_log_line;
+                this->envelope_encoder.encode( "tombstone", filtered_log_line );
+                return;
             }
 
         }
         */
 
-        size_t log_length = filtered_log_line.size();
-
-        if( log_length == 0 ){
-            return filtered_log_line;
-        }
+        this->envelope_encoder.encode( unfiltered_log_line, filtered_log_line );
 
-        json log_entry = json::object();
+    }
 
-        log_entry["@timestamp"] = get_timestamp();
-        if( this->hostname.size() ) log_entry["host"] = this->hostname;
-        if( this->watched_filepath.size() ) log_entry["source"] = this->watched_filepath;
-        if( this->product_code.size() ) log_entry["prd"] = this->product_code;
-        if( this->log_type.size() ) log_entry["log_type"] = this->log_type;
 
 
-        if( filtered_log_line[0] != '{' && filtered_log_line[0] != '[' ){
-            log_entry["log"] = filtered_log_line;
-        }else{
-            try{
-                json payload = json::parse( filtered_log_line );
-                log_entry["log_obj"] = payload;
-            }catch( std::exception& e ){
-                log_entry["log"] = filtered_log_line;
-            }
-        }
+    void Watch::renderEnvelope(){
 
-        return log_entry.dump();
+        this->envelope_encoder = JsonEnvelopeEncoder( this->hostname, this->watched_filepath, this->product_code, this->log_type );
 
     }
 
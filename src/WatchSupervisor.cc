@@ -0,0 +1,638 @@
+#include "WatchSupervisor.h"
+
+#include "LogPort.h"
+#include "Database.h"
+#include "Common.h"
+#include "Spool.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434  //the same on every architecture
+#endif
+
+
+namespace logport{
+
+
+    //a watch that exits within this long of starting counts towards its restart backoff
+    #define WATCH_QUICK_EXIT_MS 60000
+
+    #define WATCH_RESTART_BACKOFF_BASE_MS 1000
+
+
+    static inline int pidfd_open( pid_t pid ){
+
+        return int( syscall(SYS_pidfd_open, pid, 0) );
+
+    }
+
+
+
+    WatchSupervisor::WatchSupervisor( LogPort* logport )
+        :logport(logport)
+    {
+
+        char error_string_buffer[1024];
+
+        map<string,string> settings = this->logport->getDatabase().getSettings();
+
+        this->stop_timeout_ms = std::max<int64_t>( get_setting_int64(settings, "watch.stop.timeout.ms", 10000), 0 );
+        this->restart_backoff_max_ms = std::max<int64_t>( get_setting_int64(settings, "watch.restart.backoff.max.ms", 60000), WATCH_RESTART_BACKOFF_BASE_MS );
+
+
+        //the signal handlers are replaced by the signalfd while the supervisor runs; SIGCHLD is only used for watches without a pidfd
+        sigemptyset( &this->signal_mask );
+        sigaddset( &this->signal_mask, SIGINT );
+        sigaddset( &this->signal_mask, SIGTERM );
+        sigaddset( &this->signal_mask, SIGHUP );
+        sigaddset( &this->signal_mask, SIGUSR1 );
+        sigaddset( &this->signal_mask, SIGUSR2 );
+        sigaddset( &this->signal_mask, SIGCHLD );
+
+        if( sigprocmask(SIG_BLOCK, &this->signal_mask, &this->previous_signal_mask) == -1 ){
+            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+            throw std::runtime_error( "Failed to block the supervisor's signals. errno: " + string(error_string_buffer) );
+        }
+
+        try{
+
+            this->signal_fd = signalfd( -1, &this->signal_mask, SFD_NONBLOCK | SFD_CLOEXEC );
+            if( this->signal_fd == -1 ){
+                snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+                throw std::runtime_error( "Failed to create the supervisor's signalfd. errno: " + string(error_string_buffer) );
+            }
+
+            this->timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+            if( this->timer_fd == -1 ){
+                snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+                throw std::runtime_error( "Failed to create the supervisor's timerfd. errno: " + string(error_string_buffer) );
+            }
+
+            this->epoll_watcher.add( this->signal_fd );
+            this->epoll_watcher.add( this->timer_fd );
+
+        }catch( ... ){
+
+            if( this->signal_fd != -1 ) close( this->signal_fd );
+            if( this->timer_fd != -1 ) close( this->timer_fd );
+            sigprocmask( SIG_SETMASK, &this->previous_signal_mask, NULL );
+            throw;
+
+        }
+
+
+        int probe_pid_fd = pidfd_open( getpid() );
+        if( probe_pid_fd == -1 ){
+            this->use_pid_fds = false;
+            this->logport->getObserver().addLogEntry( "logport: pidfd_open() is not available (errno: " + logport::to_string<int>(errno) + "); watches will be reaped on SIGCHLD" );
+        }else{
+            close( probe_pid_fd );
+        }
+
+    }
+
+
+
+    WatchSupervisor::~WatchSupervisor(){
+
+        for( std::unique_ptr<SupervisedWatch>& supervised_watch : this->watches ){
+            if( supervised_watch->pid_fd != -1 ){
+                close( supervised_watch->pid_fd );
+            }
+        }
+
+        close( this->timer_fd );
+        close( this->signal_fd );
+
+        sigprocmask( SIG_SETMASK, &this->previous_signal_mask, NULL );
+
+    }
+
+
+
+    void WatchSupervisor::run(){
+
+        this->next_resource_check_time = std::chrono::steady_clock::now() + std::chrono::milliseconds( WATCH_RESOURCE_CHECK_INTERVAL_MS );
+
+        this->loadWatches();
+
+        vector<int> ready_file_descriptors;
+
+        while( this->logport->run || this->logport->watches_paused || this->hasRunningWatches() ){
+
+            this->armTimer();
+
+            this->epoll_watcher.watch( -1, ready_file_descriptors );
+
+            for( int ready_file_descriptor : ready_file_descriptors ){
+
+                if( ready_file_descriptor == this->signal_fd ){
+                    this->handleSignals();
+                }else if( ready_file_descriptor == this->timer_fd ){
+                    this->handleTimer();
+                }else{
+                    this->handlePidFd( ready_file_descriptor );
+                }
+
+            }
+
+            this->forgetRemovedWatches();
+
+        }
+
+        this->logport->getObserver().addLogEntry( "logport: all watches stopped" );
+
+    }
+
+
+
+    void WatchSupervisor::loadWatches(){
+
+        vector<Watch> database_watches = this->logport->getDatabase().getWatches();
+
+        this->logport->reload_required = false;
+
+        if( database_watches.size() == 0 ){
+            this->logport->getObserver().addLogEntry( "Started logport service with no files being watched." );
+        }
+
+
+        vector<bool> still_present( this->watches.size(), false );
+
+        for( Watch& database_watch : database_watches ){
+
+            SupervisedWatch* supervised_watch = nullptr;
+
+            for( size_t x = 0; x < this->watches.size(); x++ ){
+                if( this->watches[x]->watch.id == database_watch.id ){
+                    supervised_watch = this->watches[x].get();
+                    still_present[x] = true;
+                    break;
+                }
+            }
+
+            if( supervised_watch == nullptr ){
+                this->watches.push_back( std::make_unique<SupervisedWatch>() );
+                supervised_watch = this->watches.back().get();
+                supervised_watch->watch = database_watch;
+            }else if( supervised_watch->state == State::STOPPED ){
+                //pick up any changes to the watch; running ones keep what they were started with
+                supervised_watch->watch = database_watch;
+            }
+
+            if( this->logport->run && supervised_watch->state == State::STOPPED ){
+                supervised_watch->quick_exits = 0;
+                this->startWatch( *supervised_watch );
+            }
+
+        }
+
+        for( size_t x = 0; x < still_present.size(); x++ ){
+
+            if( !still_present[x] ){
+                SupervisedWatch& supervised_watch = *this->watches[x];
+                supervised_watch.removed = true;
+                this->stopWatch( supervised_watch );
+            }
+
+        }
+
+    }
+
+
+
+    void WatchSupervisor::startWatch( SupervisedWatch& supervised_watch ){
+
+        Watch& watch = supervised_watch.watch;
+
+        //the previous process (if any) has been reaped, so its last offset is saved
+        try{
+            watch.loadOffset( this->logport->getDatabase() );
+        }catch( std::exception& e ){
+            this->logport->getObserver().addLogEntry( "logport: failed to load the offset of " + watch.watched_filepath + ": " + string(e.what()) );
+        }
+
+        supervised_watch.start_time = std::chrono::steady_clock::now();
+
+        //this forks; the child resets its signal mask
+        pid_t pid = watch.start( this->logport );
+
+        if( pid == -1 ){
+            supervised_watch.state = State::STOPPED;
+            supervised_watch.quick_exits++;
+            this->scheduleRestart( supervised_watch );
+            return;
+        }
+
+        supervised_watch.state = State::RUNNING;
+
+        if( this->use_pid_fds ){
+
+            //if the child has already exited, its pidfd is readable right away
+            int pid_fd = pidfd_open( pid );
+
+            if( pid_fd == -1 ){
+                this->logport->getObserver().addLogEntry( "logport: pidfd_open() failed for PID " + logport::to_string<pid_t>(pid) + " (errno: " + logport::to_string<int>(errno) + "); it will be reaped on SIGCHLD" );
+                return;
+            }
+
+            try{
+                this->epoll_watcher.add( pid_fd );
+            }catch( std::exception& e ){
+                this->logport->getObserver().addLogEntry( "logport: " + string(e.what()) + "; PID " + logport::to_string<pid_t>(pid) + " will be reaped on SIGCHLD" );
+                close( pid_fd );
+                return;
+            }
+
+            supervised_watch.pid_fd = pid_fd;
+            this->watches_by_pid_fd[ pid_fd ] = &supervised_watch;
+
+        }
+
+    }
+
+
+
+    void WatchSupervisor::stopWatch( SupervisedWatch& supervised_watch ){
+
+        switch( supervised_watch.state ){
+
+            case State::WAITING:
+                supervised_watch.state = State::STOPPED;
+                break;
+
+            case State::RUNNING:
+                if( kill(supervised_watch.watch.pid, SIGINT) == -1 ){
+                    this->logport->getObserver().addLogEntry( "logport: failed to kill watch with SIGINT." );
+                }
+                supervised_watch.state = State::STOPPING;
+                supervised_watch.kill_time = std::chrono::steady_clock::now() + std::chrono::milliseconds( this->stop_timeout_ms );
+                break;
+
+            default:
+                break;
+
+        };
+
+    }
+
+
+
+    void WatchSupervisor::stopAllWatches(){
+
+        this->logport->getObserver().addLogEntry( "logport: gracefully stopping all watches..." );
+
+        for( std::unique_ptr<SupervisedWatch>& supervised_watch : this->watches ){
+            this->stopWatch( *supervised_watch );
+        }
+
+    }
+
+
+
+    void WatchSupervisor::scheduleRestart( SupervisedWatch& supervised_watch ){
+
+        if( !this->logport->run || supervised_watch.removed ){
+            supervised_watch.state = State::STOPPED;
+            return;
+        }
+
+        int64_t delay_ms = 0;
+
+        if( supervised_watch.quick_exits > 0 ){
+            int doublings = std::min( supervised_watch.quick_exits - 1, 20 );
+            delay_ms = std::min<int64_t>( int64_t(WATCH_RESTART_BACKOFF_BASE_MS) << doublings, this->restart_backoff_max_ms );
+        }
+
+        if( delay_ms == 0 ){
+            this->logport->getObserver().addLogEntry( "restarting..." );
+            this->startWatch( supervised_watch );
+            return;
+        }
+
+        this->logport->getObserver().addLogEntry( "logport: restarting watch (file: " + supervised_watch.watch.watched_filepath + ") in " + logport::to_string<int64_t>(delay_ms) + "ms" );
+
+        supervised_watch.state = State::WAITING;
+        supervised_watch.restart_time = std::chrono::steady_clock::now() + std::chrono::milliseconds( delay_ms );
+
+    }
+
+
+
+    void WatchSupervisor::forgetRemovedWatches(){
+
+        this->watches.erase(
+            std::remove_if( this->watches.begin(), this->watches.end(), []( const std::unique_ptr<SupervisedWatch>& supervised_watch ){
+                return supervised_watch->removed && supervised_watch->state == State::STOPPED;
+            }),
+            this->watches.end()
+        );
+
+    }
+
+
+
+    void WatchSupervisor::handleSignals(){
+
+        struct signalfd_siginfo signal_info;
+
+        while( true ){
+
+            ssize_t bytes_read = read( this->signal_fd, &signal_info, sizeof(signal_info) );
+
+            if( bytes_read != ssize_t(sizeof(signal_info)) ){
+                if( bytes_read == -1 && errno == EINTR ) continue;
+                return;  //EAGAIN: no more pending
+            }
+
+            switch( signal_info.ssi_signo ){
+
+                case SIGINT:
+                case SIGTERM:
+                    this->logport->getObserver().addLogEntry( signal_info.ssi_signo == SIGINT ? "logport: SIGINT received. Shutting down." : "logport: SIGTERM received. Shutting down." );
+                    this->logport->run = false;
+                    this->logport->watches_paused = false;  //we "unpause" the watches so that the SIGINT can win over the pauses
+                    this->stopAllWatches();
+                    break;
+
+                case SIGHUP:
+                    this->logport->getObserver().addLogEntry( "logport: SIGHUP received. Reloading configuration." );
+                    this->logport->reload_required = true;
+                    if( this->logport->run ){
+                        this->loadWatches();
+                    }
+                    break;
+
+                case SIGUSR1:
+                    this->logport->getObserver().addLogEntry( "logport: SIGUSR1 received. Stopping all watches." );
+                    this->logport->watches_paused = true;
+                    this->logport->run = false;
+                    this->stopAllWatches();
+                    break;
+
+                case SIGUSR2:
+                    this->logport->run = true;
+                    this->logport->watches_paused = false;
+                    this->logport->getObserver().addLogEntry( "logport: SIGUSR2 received. Resuming all watches." );
+                    this->logport->closeObserver();
+                    this->loadWatches();
+                    break;
+
+                case SIGCHLD:
+                    this->reapChildren();
+                    break;
+
+                default:
+                    this->logport->getObserver().addLogEntry( "logport: " + logport::to_string<uint32_t>(signal_info.ssi_signo) + " received." );
+
+            };
+
+        }
+
+    }
+
+
+
+    void WatchSupervisor::handlePidFd( int pid_fd ){
+
+        map<int, SupervisedWatch*>::iterator it = this->watches_by_pid_fd.find( pid_fd );
+        if( it == this->watches_by_pid_fd.end() ){
+            return;
+        }
+
+        SupervisedWatch& supervised_watch = *it->second;
+
+        int status;
+        pid_t pid;
+        do{
+            pid = waitpid( supervised_watch.watch.pid, &status, WNOHANG );
+        }while( pid == -1 && errno == EINTR );
+
+        if( pid == supervised_watch.watch.pid ){
+            this->handleExit( supervised_watch, status );
+        }
+
+    }
+
+
+
+    void WatchSupervisor::reapChildren(){
+
+        for( size_t x = 0; x < this->watches.size(); x++ ){
+
+            SupervisedWatch& supervised_watch = *this->watches[x];
+
+            if( supervised_watch.pid_fd != -1 || supervised_watch.watch.pid <= 0 || supervised_watch.state == State::STOPPED || supervised_watch.state == State::WAITING ){
+                continue;
+            }
+
+            int status;
+            pid_t pid;
+            do{
+                pid = waitpid( supervised_watch.watch.pid, &status, WNOHANG );
+            }while( pid == -1 && errno == EINTR );
+
+            if( pid == supervised_watch.watch.pid ){
+                this->handleExit( supervised_watch, status );
+            }
+
+        }
+
+    }
+
+
+
+    void WatchSupervisor::handleExit( SupervisedWatch& supervised_watch, int status ){
+
+        Watch& watch = supervised_watch.watch;
+
+        if( WIFEXITED(status) ){
+            this->logport->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(watch.pid) + ") exited with status " + logport::to_string<int>(WEXITSTATUS(status)) );
+        }else if( WIFSIGNALED(status) ){
+            this->logport->getObserver().addLogEntry( "logport: PID (" + logport::to_string<pid_t>(watch.pid) + ") killed by signal " + logport::to_string<int>(WTERMSIG(status)) );
+        }
+
+        if( supervised_watch.pid_fd != -1 ){
+            this->epoll_watcher.remove( supervised_watch.pid_fd );
+            this->watches_by_pid_fd.erase( supervised_watch.pid_fd );
+            close( supervised_watch.pid_fd );
+            supervised_watch.pid_fd = -1;
+        }
+
+        watch.last_pid = watch.pid;
+        watch.pid = -1;
+        watch.savePid( this->logport->getDatabase() );
+
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        if( supervised_watch.state == State::STOPPING ){
+            //it was asked to exit; not a failure
+            supervised_watch.quick_exits = 0;
+        }else if( now - supervised_watch.start_time < std::chrono::milliseconds(WATCH_QUICK_EXIT_MS) ){
+            supervised_watch.quick_exits++;
+        }else{
+            supervised_watch.quick_exits = 0;
+        }
+
+        supervised_watch.state = State::STOPPED;
+
+        this->scheduleRestart( supervised_watch );
+
+    }
+
+
+
+    void WatchSupervisor::handleTimer(){
+
+        uint64_t expirations;
+        while( read(this->timer_fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR );
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        for( size_t x = 0; x < this->watches.size(); x++ ){
+
+            SupervisedWatch& supervised_watch = *this->watches[x];
+
+            if( supervised_watch.state == State::WAITING && supervised_watch.restart_time <= now ){
+
+                this->startWatch( supervised_watch );
+
+            }else if( supervised_watch.state == State::STOPPING && supervised_watch.kill_time <= now ){
+
+                //watch does not respond to SIGINT in certain conditions
+                const pid_t pid = supervised_watch.watch.pid;
+                supervised_watch.kill_time = TimePoint::max();
+
+                //verify the process name before killing SIGKILL
+                const string verified_process_name = proc_status_get_name( pid );
+
+                if( verified_process_name == "logport" ){
+                    this->logport->getObserver().addLogEntry( "logport: watch PID " + logport::to_string<pid_t>(pid) + " required a forceful exit." );
+                    if( kill(pid, SIGKILL) == -1 ){
+                        this->logport->getObserver().addLogEntry( "logport: failed to kill watch " + logport::to_string<pid_t>(pid) + " with SIGKILL." );
+                    }
+                }else{
+                    this->logport->getObserver().addLogEntry( "logport: same PID found, but different program name." );
+                }
+
+            }
+
+        }
+
+        if( this->logport->run && this->next_resource_check_time <= now ){
+            this->checkResources();
+            this->next_resource_check_time = now + std::chrono::milliseconds( WATCH_RESOURCE_CHECK_INTERVAL_MS );
+        }
+
+    }
+
+
+
+    void WatchSupervisor::checkResources(){
+
+        for( std::unique_ptr<SupervisedWatch>& supervised_watch : this->watches ){
+
+            if( supervised_watch->state != State::RUNNING ){
+                continue;
+            }
+
+            Watch& watch = supervised_watch->watch;
+
+            int watch_process_rss = proc_status_get_rss_usage_in_kb( watch.pid );
+            const string process_name = proc_status_get_name( watch.pid );
+
+            const double total_time_seconds = proc_stat_get_cpu_time_seconds( watch.pid );
+
+            //the watch replays its spool as it goes, so this is only reported
+            int64_t undelivered_spool_size = int64_t( Spool::getDiskUsage(Spool::getDirectoryFor(watch.undelivered_log_filepath)) );
+
+            this->logport->getObserver().addLogEntry( "logport: watch process_name(" + process_name + "), RSS(" + logport::to_string<int>(watch_process_rss) + "KB), PID(" + logport::to_string<pid_t>(watch.pid) + "), cpu_time(" + logport::to_string<double>(total_time_seconds) + "), undelivered_spool_size(" + logport::to_string<int64_t>(undelivered_spool_size) + ")" );
+
+            watch.last_undelivered_size = undelivered_spool_size;
+
+            //stopped gracefully and restarted as soon as it exits
+            if( watch_process_rss > WATCH_MAX_RSS_KB ){
+                this->logport->getObserver().addLogEntry( "logport: watch (pid: " + logport::to_string<pid_t>(watch.pid) + ", file: " + watch.watched_filepath + ") is being restarted because the RSS exceeded 250MB." );
+                this->stopWatch( *supervised_watch );
+            }else if( total_time_seconds > WATCH_MAX_CPU_TIME_SECONDS ){
+                this->logport->getObserver().addLogEntry( "logport: watch (pid: " + logport::to_string<pid_t>(watch.pid) + ", file: " + watch.watched_filepath + ") is being restarted because the CPU time exceeded 5 minutes." );
+                this->stopWatch( *supervised_watch );
+            }
+
+        }
+
+    }
+
+
+
+    void WatchSupervisor::armTimer(){
+
+        TimePoint deadline = TimePoint::max();
+
+        if( this->logport->run ){
+            deadline = this->next_resource_check_time;
+        }
+
+        for( const std::unique_ptr<SupervisedWatch>& supervised_watch : this->watches ){
+
+            if( supervised_watch->state == State::WAITING ){
+                deadline = std::min( deadline, supervised_watch->restart_time );
+            }else if( supervised_watch->state == State::STOPPING ){
+                deadline = std::min( deadline, supervised_watch->kill_time );
+            }
+
+        }
+
+        struct itimerspec timer_spec;
+        memset( &timer_spec, 0, sizeof(timer_spec) );
+
+        if( deadline != TimePoint::max() ){
+
+            //steady_clock is CLOCK_MONOTONIC; a zero it_value would disarm the timer instead of firing it
+            int64_t deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( deadline.time_since_epoch() ).count();
+            if( deadline_ns <= 0 ){
+                deadline_ns = 1;
+            }
+
+            timer_spec.it_value.tv_sec = time_t( deadline_ns / 1000000000 );
+            timer_spec.it_value.tv_nsec = long( deadline_ns % 1000000000 );
+
+        }
+
+        if( timerfd_settime(this->timer_fd, TFD_TIMER_ABSTIME, &timer_spec, NULL) == -1 ){
+            char error_string_buffer[1024];
+            snprintf( error_string_buffer, sizeof(error_string_buffer), "%d", errno );
+            throw std::runtime_error( "Failed to arm the supervisor's timerfd. errno: " + string(error_string_buffer) );
+        }
+
+    }
+
+
+
+    bool WatchSupervisor::hasRunningWatches() const{
+
+        for( const std::unique_ptr<SupervisedWatch>& supervised_watch : this->watches ){
+            if( supervised_watch->state == State::RUNNING || supervised_watch->state == State::STOPPING ){
+                return true;
+            }
+        }
+
+        return false;
+
+    }
+
+
+}